@@ -0,0 +1,600 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Z16Disasm.h"
+
+// ---------------------------------------------------------------------------
+// In-process Z16 assembler.
+// The inverse of Z16Simulator::disassemble(): it accepts every instruction
+// form the disassembler prints, plus labels and data directives, and writes
+// the machine code straight into a memory image (e.g. Z16Simulator::memory).
+//
+//   Instructions  add rd, rs2    jr rd    jalr rs2 (links in ra)    jalr rd, rs2
+//                 addi rd, imm   sltui rd, imm    slli rd, shamt
+//                 beq rs1, rs2, target   bz rs1, target
+//                 sb rs2, off(rs1)   lw rd, off(rs2)
+//                 j target   jal rd, target   lui rd, imm9   ecall service
+//                 Registers by ABI name (t0 ra sp s0 s1 t1 a0 a1) or x0..x7;
+//                 targets are labels or absolute addresses.
+//   Labels        name:   (any number per line, before the statement)
+//   Directives    .word value|label   .byte value   .space count
+//                 .asciiz "text"   (\n \t \r \0 \\ \" escapes)   .org address
+//   Numbers       decimal, -decimal, 0x hex, 'c'; a label stands for its address
+//   Comments      from '#' or ';' to the end of the line
+//
+// It also reads the listings the simulator writes (runFullDisassembly and
+// --disasm=cfg): a leading "0xAAAA:" sets the address, "0xAAAA: WWWW  text"
+// emits the raw word WWWW as listed (so every listed instruction, including
+// undefined words, round-trips exactly), and ".space N bytes" takes N in
+// hex, as the listing prints it.
+//
+// Assembly is two passes over pre-split statements with no per-line
+// allocation; one Z16Assembler can be reused for many programs. Errors throw
+// runtime_error("line N: ...").
+// ---------------------------------------------------------------------------
+class Z16Assembler {
+public:
+    static const size_t MEM_SIZE = 65536;
+
+    // Assemble 'source' into 'memory' (MEM_SIZE bytes). Bytes not written by
+    // the program are left alone. Returns the program size: one past the
+    // highest address written.
+    size_t assemble(std::string_view source, uint8_t *memory) {
+        statements.clear();
+        labels.clear();
+        parse(source);
+        size_t size = 0;
+        for (const Statement &s : statements) {
+            current = s.line;
+            emit(s, memory);
+            size = std::max(size, s.addr + s.size);
+        }
+        return size;
+    }
+
+    // Assemble into a simulator's memory (cleared first), set its program
+    // size and predecode it, ready to run from pc 0.
+    template <class Simulator>
+    size_t assemble(std::string_view source, Simulator &sim) {
+        sim.memory.fill(0);
+        sim.programSize = assemble(source, sim.memory.data());
+        sim.predecodeImage();
+        return sim.programSize;
+    }
+
+    // Assemble into a fresh image of exactly the program size.
+    std::vector<uint8_t> assemble(std::string_view source) {
+        std::vector<uint8_t> image(MEM_SIZE, 0);
+        image.resize(assemble(source, image.data()));
+        return image;
+    }
+
+    // Address ranges [begin, end) written by the last assembly, in address
+    // order and merged where they touch, each noting whether it holds
+    // instructions and/or data directives.
+    struct Extent {
+        size_t begin, end;
+        bool code, data;
+    };
+    std::vector<Extent> extents() const {
+        std::vector<const Statement *> order;
+        for (const Statement &s : statements)
+            if (s.size)
+                order.push_back(&s);
+        std::stable_sort(order.begin(), order.end(), [](const Statement *a, const Statement *b) { return a->addr < b->addr; });
+        std::vector<Extent> out;
+        for (const Statement *s : order) {
+            bool code = s->kind == INSTRUCTION || s->kind == RAW_WORD;
+            if (out.empty() || s->addr > out.back().end)
+                out.push_back({ s->addr, s->addr, false, false });
+            Extent &e = out.back();
+            e.end = std::max(e.end, s->addr + s->size);
+            e.code |= code;
+            e.data |= !code;
+        }
+        return out;
+    }
+
+    // Address of label 'name' in the last assembly (whose source must still
+    // be alive); false if it is not defined.
+    bool address(std::string_view name, uint16_t &addr) const {
+        auto it = labels.find(name);
+        if (it == labels.end())
+            return false;
+        addr = it->second;
+        return true;
+    }
+
+private:
+    enum Kind : uint8_t { INSTRUCTION, RAW_WORD, WORD, BYTE, SPACE, ASCIIZ, RAW_ASCIIZ };
+
+    struct Statement {
+        Kind kind;
+        uint8_t mnemonic;              // Z16Mnemonic, for INSTRUCTION.
+        uint8_t operandCount;
+        uint32_t line;
+        size_t addr;
+        size_t size;
+        std::string_view operands[3];  // Or the raw word / value / string.
+    };
+
+    std::vector<Statement> statements;
+    std::unordered_map<std::string_view, uint16_t> labels;
+    uint32_t current = 0;              // Line being processed, for errors.
+
+    [[noreturn]] void fail(const std::string &message) const {
+        throw std::runtime_error("line " + std::to_string(current) + ": " + message);
+    }
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+    static bool isIdentStart(char c) { return isalpha(static_cast<unsigned char>(c)) || c == '_' || c == '.'; }
+    static bool isIdent(char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.'; }
+
+    static std::string_view trim(std::string_view s) {
+        while (!s.empty() && isSpace(s.front()))
+            s.remove_prefix(1);
+        while (!s.empty() && isSpace(s.back()))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    static bool isHexWord(std::string_view s) {
+        if (s.size() != 4)
+            return false;
+        for (char c : s)
+            if (!isxdigit(static_cast<unsigned char>(c)))
+                return false;
+        return true;
+    }
+
+    // Strip a comment, leaving '#'/';' inside quotes alone.
+    static std::string_view stripComment(std::string_view line) {
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (c == '"' && (i == 0 || line[i - 1] != '\\'))
+                quoted = !quoted;
+            else if (!quoted && (c == '#' || c == ';'))
+                return line.substr(0, i);
+        }
+        return line;
+    }
+
+    // -----------------------------------------------------------------------
+    // Pass 1: split lines into statements, assign addresses, define labels.
+    // -----------------------------------------------------------------------
+    void parse(std::string_view source) {
+        size_t addr = 0;
+        current = 0;
+        while (!source.empty()) {
+            size_t nl = source.find('\n');
+            std::string_view line = source.substr(0, nl);
+            source.remove_prefix(nl == std::string_view::npos ? source.size() : nl + 1);
+            current++;
+
+            // A listed string is raw bytes (quotes, '#', newlines and all).
+            if (isListedString(line)) {
+                addr = number(line.substr(0, 6));
+                const char *body = line.data() + 17, *end = source.data() + source.size();
+                std::string_view text(body, end - body);
+                Statement s{};
+                s.kind = RAW_ASCIIZ;
+                s.line = current;
+                s.addr = addr;
+                s.operands[0] = text.substr(0, listedStringLength(text, addr));
+                s.size = s.operands[0].size() + 1;
+                current += static_cast<uint32_t>(std::count(s.operands[0].begin(), s.operands[0].end(), '\n'));
+                text.remove_prefix(std::min(text.size(), s.operands[0].size() + 2));   // Closing quote and newline.
+                source = text;
+                addr += s.size;
+                if (addr > MEM_SIZE)
+                    fail("program does not fit in memory");
+                statements.push_back(s);
+                continue;
+            }
+            line = trim(stripComment(line));
+
+            // Listing address: "0xAAAA:".
+            if (line.size() >= 7 && line[0] == '0' && line[1] == 'x' && line[6] == ':') {
+                addr = number(line.substr(0, 6));
+                line = trim(line.substr(7));
+            }
+            // Labels.
+            for (;;) {
+                size_t n = 0;
+                if (line.empty() || !isIdentStart(line[0]) || line[0] == '.')
+                    break;
+                while (n < line.size() && isIdent(line[n]))
+                    n++;
+                if (n == line.size() || line[n] != ':')
+                    break;
+                if (!labels.emplace(line.substr(0, n), static_cast<uint16_t>(addr)).second)
+                    fail("duplicate label '" + std::string(line.substr(0, n)) + "'");
+                line = trim(line.substr(n + 1));
+            }
+            if (line.empty())
+                continue;
+
+            Statement s{};
+            s.line = current;
+            s.addr = addr;
+            size_t split = 0;
+            while (split < line.size() && !isSpace(line[split]))
+                split++;
+            std::string_view head = line.substr(0, split);
+            std::string_view rest = trim(line.substr(split));
+
+            if (isHexWord(head) && !rest.empty()) {
+                // Listing line "WWWW  text": the raw word is authoritative.
+                s.kind = RAW_WORD;
+                s.operands[0] = head;
+                s.size = 2;
+            } else if (head == ".org") {
+                addr = number(rest);
+                continue;
+            } else if (head == ".word") {
+                s.kind = WORD;
+                s.operands[0] = rest;
+                s.size = 2;
+            } else if (head == ".byte") {
+                s.kind = BYTE;
+                s.operands[0] = rest;
+                s.size = 1;
+            } else if (head == ".space") {
+                // ".space N bytes" is the listing form, with N in hex.
+                s.kind = SPACE;
+                size_t end = 0;
+                while (end < rest.size() && !isSpace(rest[end]))
+                    end++;
+                std::string_view count = rest.substr(0, end);
+                if (trim(rest.substr(end)) == "bytes")
+                    s.size = hexNumber(count);
+                else if (trim(rest.substr(end)).empty())
+                    s.size = number(count);
+                else
+                    fail("bad .space");
+            } else if (head == ".asciiz") {
+                if (rest.size() < 2 || rest.front() != '"' || rest.back() != '"')
+                    fail(".asciiz needs a quoted string");
+                s.kind = ASCIIZ;
+                s.operands[0] = rest.substr(1, rest.size() - 2);
+                s.size = unescape(s.operands[0], nullptr) + 1;
+            } else {
+                s.kind = INSTRUCTION;
+                s.mnemonic = lookup(head);
+                s.size = 2;
+                splitOperands(rest, s);
+            }
+            addr += s.size;
+            if (addr > MEM_SIZE)
+                fail("program does not fit in memory");
+            statements.push_back(s);
+        }
+    }
+
+    uint8_t lookup(std::string_view name) const {
+        for (size_t m = 0; m < MN_UNKNOWN_R; m++)
+            if (Z16Disasm::mnemonics[m] == name)
+                return static_cast<uint8_t>(m);
+        fail("unknown instruction '" + std::string(name) + "'");
+    }
+
+    void splitOperands(std::string_view rest, Statement &s) const {
+        s.operandCount = 0;
+        while (!rest.empty()) {
+            if (s.operandCount == 3)
+                fail("too many operands");
+            size_t comma = rest.find(',');
+            s.operands[s.operandCount++] = trim(rest.substr(0, comma));
+            if (comma == std::string_view::npos)
+                break;
+            rest = rest.substr(comma + 1);
+        }
+    }
+
+    // "0xAAAA: .asciiz \"...", as runFullDisassembly() lists a string.
+    static bool isListedString(std::string_view line) {
+        return line.size() >= 17 && line[0] == '0' && line[1] == 'x' && isHexWord(line.substr(2, 4)) &&
+               line.substr(6, 11) == ": .asciiz \"";
+    }
+
+    // The listing writes string bytes unescaped, so a string may contain
+    // quotes and span lines. It ends at a '"' + newline after which the
+    // listing goes on at the address just past its terminator; failing that
+    // (the string is the last item listed), at the first '"' + newline after
+    // which no listing line follows. The disassembler lists strings shorter
+    // than MAX_LISTED_STRING bytes, which bounds the search for the former.
+    static const size_t MAX_LISTED_STRING = 256;
+
+    size_t listedStringLength(std::string_view text, size_t addr) const {
+        size_t last = std::string_view::npos;
+        for (size_t end = text.find('"'); end != std::string_view::npos; end = text.find('"', end + 1)) {
+            if (end >= MAX_LISTED_STRING && last != std::string_view::npos)
+                break;
+            size_t eol = end + 1;   // The quote must end the line ("\n" or "\r\n").
+            if (eol < text.size() && text[eol] == '\r')
+                eol++;
+            if (eol < text.size() && text[eol] != '\n')
+                continue;
+            long next = nextListedAddress(text.substr(std::min(text.size(), eol + 1)));
+            if (next >= 0 && static_cast<size_t>(next) == addr + end + 1)
+                return end;
+            if (next < 0 && last == std::string_view::npos)
+                last = end;
+        }
+        if (last == std::string_view::npos)
+            fail("unterminated string");
+        return last;
+    }
+
+    // Address of the next listing line, skipping blank, comment and label
+    // lines; -1 if there is none.
+    static long nextListedAddress(std::string_view text) {
+        while (!text.empty()) {
+            size_t nl = text.find('\n');
+            std::string_view line = trim(text.substr(0, nl));
+            text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+            if (line.empty() || line[0] == ';' || line[0] == '#' || (line.back() == ':' && isIdentStart(line[0])))
+                continue;
+            if (line.size() >= 7 && line[0] == '0' && line[1] == 'x' && isHexWord(line.substr(2, 4)) && line[6] == ':')
+                return std::stol(std::string(line.substr(2, 4)), nullptr, 16);
+            return -1;
+        }
+        return -1;
+    }
+
+    // Decode the escapes of an .asciiz body into 'out' (if given); returns its length.
+    size_t unescape(std::string_view text, uint8_t *out) const {
+        size_t n = 0;
+        for (size_t i = 0; i < text.size(); i++) {
+            char c = text[i];
+            if (c == '\\') {
+                if (++i == text.size())
+                    fail("bad escape in string");
+                switch (text[i]) {
+                    case 'n': c = '\n'; break;
+                    case 't': c = '\t'; break;
+                    case 'r': c = '\r'; break;
+                    case '0': c = '\0'; break;
+                    case '\\': c = '\\'; break;
+                    case '"': c = '"'; break;
+                    default: fail("bad escape in string");
+                }
+            }
+            if (out)
+                out[n] = static_cast<uint8_t>(c);
+            n++;
+        }
+        return n;
+    }
+
+    // -----------------------------------------------------------------------
+    // Operands.
+    // -----------------------------------------------------------------------
+    long hexNumber(std::string_view s) const {
+        if (s.empty())
+            fail("missing number");
+        long v = 0;
+        for (char c : s) {
+            if (!isxdigit(static_cast<unsigned char>(c)) || v > 0xFFFFF)
+                fail("bad number '" + std::string(s) + "'");
+            v = v * 16 + (isdigit(static_cast<unsigned char>(c)) ? c - '0' : (tolower(c) - 'a' + 10));
+        }
+        return v;
+    }
+
+    long number(std::string_view s) const {
+        s = trim(s);
+        if (s.size() == 3 && s.front() == '\'' && s.back() == '\'')
+            return static_cast<unsigned char>(s[1]);
+        bool negative = !s.empty() && s[0] == '-';
+        if (negative)
+            s.remove_prefix(1);
+        long v = 0;
+        if (s.size() > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+            v = hexNumber(s.substr(2));
+        } else {
+            if (s.empty())
+                fail("missing number");
+            for (char c : s) {
+                if (!isdigit(static_cast<unsigned char>(c)) || v > 0xFFFFF)
+                    fail("bad number '" + std::string(s) + "'");
+                v = v * 10 + (c - '0');
+            }
+        }
+        return negative ? -v : v;
+    }
+
+    long ranged(std::string_view s, long low, long high) const {
+        long v = address(s);
+        if (v < low || v > high)
+            fail("value " + std::to_string(v) + " out of range " + std::to_string(low) + ".." + std::to_string(high));
+        return v;
+    }
+
+    unsigned reg(std::string_view s) const {
+        s = trim(s);
+        for (unsigned r = 0; r < 8; r++)
+            if (Z16Disasm::regNames[r] == s)
+                return r;
+        if (s.size() == 2 && s[0] == 'x' && s[1] >= '0' && s[1] <= '7')
+            return s[1] - '0';
+        fail("bad register '" + std::string(s) + "'");
+    }
+
+    // A label or an absolute address.
+    long address(std::string_view s) const {
+        s = trim(s);
+        if (!s.empty() && isIdentStart(s[0])) {
+            auto it = labels.find(s);
+            if (it == labels.end())
+                fail("undefined label '" + std::string(s) + "'");
+            return it->second;
+        }
+        return number(s);
+    }
+
+    // Distance from 'from' to the target operand 's'. Addresses wrap at 64KB
+    // like the pc, so it is taken modulo 0x10000 as a signed 16-bit value:
+    // 'j 0xff00' at 0x0100 is a jump back by 0x200.
+    long displacement(std::string_view s, size_t from) const {
+        return static_cast<int16_t>(static_cast<uint16_t>(address(s) - static_cast<long>(from)));
+    }
+
+    // "off(reg)"
+    void memOperand(std::string_view s, unsigned &offset, unsigned &base) const {
+        size_t open = s.find('('), close = s.rfind(')');
+        if (open == std::string_view::npos || close != s.size() - 1)
+            fail("expected offset(register)");
+        offset = static_cast<unsigned>(ranged(s.substr(0, open), 0, 15));
+        base = reg(s.substr(open + 1, close - open - 1));
+    }
+
+    void expect(const Statement &s, unsigned count) const {
+        if (s.operandCount != count)
+            fail(std::string(Z16Disasm::mnemonics[s.mnemonic]) + " takes " + std::to_string(count) + " operand(s)");
+    }
+
+    // -----------------------------------------------------------------------
+    // Pass 2: encode.
+    // -----------------------------------------------------------------------
+    void emit(const Statement &s, uint8_t *memory) const {
+        uint8_t *p = memory + s.addr;
+        switch (s.kind) {
+            case RAW_WORD:
+            case WORD:
+            case INSTRUCTION: {
+                uint16_t w = s.kind == RAW_WORD ? static_cast<uint16_t>(hexNumber(s.operands[0]))
+                           : s.kind == WORD     ? static_cast<uint16_t>(wordValue(s.operands[0]))
+                                                : encode(s);
+                p[0] = w & 0xFF;
+                p[1] = w >> 8;
+                break;
+            }
+            case BYTE:
+                p[0] = static_cast<uint8_t>(ranged(s.operands[0], -128, 255));
+                break;
+            case SPACE:
+                memset(p, 0, s.size);
+                break;
+            case ASCIIZ:
+                p[unescape(s.operands[0], p)] = 0;
+                break;
+            case RAW_ASCIIZ:
+                memcpy(p, s.operands[0].data(), s.operands[0].size());
+                p[s.operands[0].size()] = 0;
+                break;
+        }
+    }
+
+    long wordValue(std::string_view s) const {
+        long v = address(s);
+        if (v < -32768 || v > 65535)
+            fail("value out of range for .word");
+        return v;
+    }
+
+    uint16_t encode(const Statement &s) const {
+        const std::string_view *op = s.operands;
+        unsigned m = s.mnemonic;
+        auto rType = [&](unsigned funct4, unsigned funct3, unsigned rd, unsigned rs2) {
+            return static_cast<uint16_t>(funct4 << 12 | rs2 << 9 | rd << 6 | funct3 << 3 | 0x0);
+        };
+        switch (m) {
+            case MN_ADD: case MN_SUB: case MN_SLT: case MN_SLTU: case MN_SLL: case MN_SRL:
+            case MN_SRA: case MN_OR: case MN_AND: case MN_XOR: case MN_MV: {
+                static const uint8_t funct[][2] = {   // funct4, funct3
+                    { 0b0000, 0b000 }, { 0b0001, 0b000 }, { 0b0000, 0b001 }, { 0b0000, 0b010 },
+                    { 0b0010, 0b011 }, { 0b0100, 0b011 }, { 0b1000, 0b011 }, { 0b0001, 0b100 },
+                    { 0b0000, 0b101 }, { 0b0000, 0b110 }, { 0b0000, 0b111 } };
+                expect(s, 2);
+                return rType(funct[m - MN_ADD][0], funct[m - MN_ADD][1], reg(op[0]), reg(op[1]));
+            }
+            case MN_JR:
+                expect(s, 1);
+                return rType(0b0100, 0b000, reg(op[0]), 0);
+            case MN_JALR:
+                // The disassembler prints only the target register; alone it links in ra.
+                if (s.operandCount == 1)
+                    return rType(0b1000, 0b000, 1, reg(op[0]));
+                expect(s, 2);
+                return rType(0b1000, 0b000, reg(op[0]), reg(op[1]));
+
+            case MN_ADDI: case MN_SLTI: case MN_SLTUI: case MN_ORI: case MN_ANDI: case MN_XORI: case MN_LI: {
+                static const uint8_t funct3[] = { 0b000, 0b001, 0b010, 0, 0, 0, 0b100, 0b101, 0b110, 0b111 };
+                expect(s, 2);
+                // 7-bit field: signed (-64..63) or raw (0..127).
+                unsigned imm = static_cast<unsigned>(ranged(op[1], -64, 127)) & 0x7F;
+                return static_cast<uint16_t>(imm << 9 | reg(op[0]) << 6 | funct3[m - MN_ADDI] << 3 | 0x1);
+            }
+            case MN_SLLI: case MN_SRLI: case MN_SRAI: {
+                static const uint8_t imm3[] = { 0b001, 0b010, 0b100 };
+                expect(s, 2);
+                unsigned shamt = static_cast<unsigned>(ranged(op[1], 0, 15));
+                return static_cast<uint16_t>((imm3[m - MN_SLLI] << 4 | shamt) << 9 | reg(op[0]) << 6 | 0b011 << 3 | 0x1);
+            }
+
+            case MN_BEQ: case MN_BNE: case MN_BLT: case MN_BGE: case MN_BLTU: case MN_BGEU:
+            case MN_BZ: case MN_BNZ: {
+                static const uint8_t funct3[] = { 0b000, 0b001, 0b010, 0b011, 0b100, 0b101, 0b110, 0b111 };
+                bool zero = m == MN_BZ || m == MN_BNZ;
+                expect(s, zero ? 2 : 3);
+                // beq & co. are relative to pc + 2, bz/bnz to pc itself.
+                long delta = displacement(op[zero ? 1 : 2], s.addr + (zero ? 0 : 2));
+                if (delta & 1)
+                    fail("branch target is odd");
+                long offset = delta / 2;
+                if (offset < -8 || offset > 7)
+                    fail("branch target out of range");
+                unsigned rs2 = zero ? 0 : reg(op[1]);
+                return static_cast<uint16_t>((offset & 0xF) << 12 | rs2 << 9 | reg(op[0]) << 6 | funct3[m - MN_BEQ] << 3 | 0x2);
+            }
+
+            case MN_SB: case MN_SW: {
+                expect(s, 2);
+                unsigned offset, base;
+                memOperand(op[1], offset, base);
+                return static_cast<uint16_t>(offset << 12 | reg(op[0]) << 9 | base << 6 | (m == MN_SW) << 3 | 0x3);
+            }
+            case MN_LB: case MN_LW: case MN_LBU: {
+                static const uint8_t funct3[] = { 0b000, 0b001, 0b100 };
+                expect(s, 2);
+                unsigned offset, base;
+                memOperand(op[1], offset, base);
+                return static_cast<uint16_t>(offset << 12 | base << 9 | reg(op[0]) << 6 | funct3[m - MN_LB] << 3 | 0x4);
+            }
+
+            case MN_J: case MN_JAL: {
+                bool link = m == MN_JAL;
+                expect(s, link ? 2 : 1);
+                long delta = displacement(op[link ? 1 : 0], s.addr);
+                if (delta & 1)
+                    fail("jump target is odd");
+                long imm = delta / 2;
+                if (imm < -256 || imm > 255)
+                    fail("jump target out of range");
+                unsigned imm9 = static_cast<unsigned>(imm) & 0x1FF;
+                unsigned rd = link ? reg(op[0]) : 0;
+                return static_cast<uint16_t>(link << 15 | (imm9 >> 3) << 9 | rd << 6 | (imm9 & 0x7) << 3 | 0x5);
+            }
+            case MN_LUI: case MN_AUIPC: {
+                expect(s, 2);
+                unsigned imm9 = static_cast<unsigned>(ranged(op[1], 0, 511));
+                return static_cast<uint16_t>((m == MN_AUIPC) << 15 | (imm9 >> 3) << 9 | reg(op[0]) << 6 | (imm9 & 0x7) << 3 | 0x6);
+            }
+            default: {   // MN_ECALL
+                expect(s, 1);
+                unsigned service = static_cast<unsigned>(ranged(op[0], 0, 1023));
+                return static_cast<uint16_t>(service << 6 | 0x7);
+            }
+        }
+    }
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include "Z16Simulator.h"
+#include "Z16Threaded.h"
+#include "Z16BlockEngine.h"
+#include "Z16ThreadPool.h"
+
+// ---------------------------------------------------------------------------
+// Batch driver.
+// Runs many independent programs in one process on a work-stealing thread
+// pool. Every worker owns one simulator (and block engine) that it resets and
+// reuses for each program it picks up, so the 64KB machine state and the
+// translation tables are allocated once per worker, not once per program.
+// Programs run untraced; what they print, how they ended, their final
+// registers and their memory listing are collected into one results file,
+// in input order.
+// ---------------------------------------------------------------------------
+struct Z16BatchOptions {
+    string engine = "switch";     // switch | threaded | block | jit
+    size_t jitThreshold = 32;
+    Z16Budget budget;
+    size_t jobs = 0;              // Worker threads; 0 = one per core.
+    Z16Misaligned misaligned = Z16Misaligned::Allow;
+};
+
+struct Z16BatchSummary {
+    size_t programs = 0;
+    size_t finished = 0;          // Ran off the end of the program or hit ecall 3.
+    size_t stopped = 0;           // Stopped by the watchdog.
+    size_t failed = 0;            // Could not be loaded, or faulted.
+    double seconds = 0;
+};
+
+class Z16Batch {
+public:
+    explicit Z16Batch(const Z16BatchOptions &options) : options(options) {}
+
+    // The programs named by 'path': every *.bin file in it (sorted by name)
+    // if it is a directory, otherwise one file name per line ('#' starts a
+    // comment; relative names are taken relative to the manifest).
+    static vector<string> collectInputs(const string &path) {
+        namespace fs = std::filesystem;
+        vector<string> files;
+        if (fs::is_directory(path)) {
+            for (const fs::directory_entry &e : fs::directory_iterator(path))
+                if (e.is_regular_file() && e.path().extension() == ".bin")
+                    files.push_back(e.path().string());
+            sort(files.begin(), files.end());
+            return files;
+        }
+        ifstream manifest(path);
+        if (!manifest)
+            throw runtime_error("Error opening batch manifest: " + path);
+        fs::path base = fs::path(path).parent_path();
+        string line;
+        while (getline(manifest, line)) {
+            line = line.substr(0, line.find('#'));
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == string::npos)
+                continue;
+            line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+            fs::path p(line);
+            files.push_back(p.is_absolute() ? line : (base / p).string());
+        }
+        return files;
+    }
+
+    // Run every program and write the aggregated results to 'results'.
+    Z16BatchSummary run(const vector<string> &files, ostream &results) {
+        auto startTime = chrono::steady_clock::now();
+        Z16ThreadPool pool(options.jobs);
+        workers.clear();
+        for (size_t i = 0; i < pool.size(); i++)
+            workers.push_back(make_unique<Worker>(options));
+
+        vector<Outcome> outcomes(files.size());
+        for (size_t i = 0; i < files.size(); i++)
+            pool.submit([this, &files, &outcomes, i](size_t worker) {
+                outcomes[i] = runOne(*workers[worker], files[i]);
+            });
+        pool.wait();
+
+        Z16BatchSummary summary;
+        summary.programs = files.size();
+        for (size_t i = 0; i < files.size(); i++) {
+            results << "=== " << files[i] << "\n" << outcomes[i].text << "\n";
+            summary.finished += outcomes[i].status == FINISHED;
+            summary.stopped += outcomes[i].status == STOPPED;
+            summary.failed += outcomes[i].status == FAILED;
+        }
+        summary.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        return summary;
+    }
+
+private:
+    enum Status { FINISHED, STOPPED, FAILED };
+
+    struct Outcome {
+        Status status = FAILED;
+        string text;
+    };
+
+    // Per-worker state, reused for every program the worker runs.
+    struct Worker {
+        Z16Simulator sim;
+        unique_ptr<Z16BlockEngine> blocks;
+        ostringstream console;
+
+        explicit Worker(const Z16BatchOptions &options) {
+            sim.console = &console;
+            if (options.engine == "block" || options.engine == "jit") {
+                blocks = make_unique<Z16BlockEngine>(sim);
+                if (options.engine == "jit")
+                    blocks->jitThreshold = options.jitThreshold;
+            }
+        }
+    };
+
+    Z16BatchOptions options;
+    vector<unique_ptr<Worker>> workers;
+
+    Outcome runOne(Worker &w, const string &file) {
+        Outcome outcome;
+        Z16Simulator &sim = w.sim;
+        sim.reset(false);
+        sim.misaligned = options.misaligned;
+        if (w.blocks)
+            w.blocks->flushAll();
+        w.console.str("");
+        w.console.clear();
+        w.console.copyfmt(ostringstream());   // Formatting state must not leak between programs.
+        ostringstream text;
+        try {
+            Z16Image(file).load(sim);
+            text << "Loaded " << sim.programSize << " bytes\n";
+
+            ostringstream discard;
+            Z16TraceWriter trace(discard, TraceMode::None);
+            Z16Watchdog watchdog(options.budget);
+            bool completed;
+            if (options.engine == "threaded")
+                completed = runThreaded<false>(sim, trace, watchdog);
+            else if (w.blocks)
+                completed = w.blocks->run<false>(trace, watchdog);
+            else
+                completed = sim.runExecution<false>(trace, watchdog);
+
+            text << w.console.str();
+            if (sim.trap) {
+                outcome.status = FAILED;
+                text << "Status: error: " << trapMessage(sim.trap.cause) << " at PC = 0x"
+                     << setw(4) << setfill('0') << hex << sim.trap.pc << "\n";
+            } else if (completed) {
+                outcome.status = FINISHED;
+                text << "Status: finished\n";
+            } else {
+                outcome.status = STOPPED;
+                text << "Status: " << stopMessage(watchdog.reason()) << " at PC = 0x"
+                     << setw(4) << setfill('0') << hex << sim.pc << "\n";
+            }
+            sim.printFinalState(text);
+            sim.showmem(text);
+        } catch (const exception &ex) {
+            text << w.console.str();
+            text << "Status: error: " << ex.what() << "\n";
+            outcome.status = FAILED;
+        }
+        outcome.text = text.str();
+        return outcome;
+    }
+};
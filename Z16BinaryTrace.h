@@ -0,0 +1,375 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <vector>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <bit>
+#include "Z16Decode.h"
+#include "Z16Watchdog.h"
+
+// ---------------------------------------------------------------------------
+// Binary execution trace.
+// One record per traced instruction, holding its PC, its instruction word and
+// what it changed (registers and the bytes of a store). Everything is encoded
+// relative to what the reader already knows, so a typical record is 2-4 bytes
+// against ~30 for the text line:
+//
+//   file    := "Z16T" version:u8 regs:8 x u16le record* end
+//   record  := header:u8 [pcDelta] [inst] [regDelta | regMask regDelta*] [memAddr memValue]
+//   end     := END_NORMAL | END_STOPPED reason:u8 pc
+//
+//   header bit 0  SEQ        pc is the previous record's pc + 2; else zigzag varint pc delta follows
+//   header bit 1  SAME_INST  inst equals the last inst recorded at this pc; else u16le inst follows
+//   header bit 2  ONE_REG    one register changed: index in bits 4..6, zigzag varint delta follows
+//   header bit 3  MEM        the instruction is a store: zigzag varint delta from the previous
+//                            store address, then a varint value (1 byte for sb, 2 for sw)
+//   header bit 7  MULTI_REG  several registers changed: u8 mask, then one delta per set bit
+//
+// Headers 0x10 and 0x20 (impossible for a record, which only sets bits 4..6
+// together with ONE_REG) are control records: END_NORMAL (0x10)
+// closes a run that finished, END_STOPPED (0x20) one stopped by the watchdog
+// and is followed by the StopReason and a varint pc. Register and memory deltas describe the state
+// when the next record was written, so in a sampled trace the register deltas
+// cover every instruction since the previous record.
+// ---------------------------------------------------------------------------
+namespace Z16Trace {
+    static const uint8_t VERSION = 2;
+
+    static const uint8_t SEQ       = 0x01;
+    static const uint8_t SAME_INST = 0x02;
+    static const uint8_t ONE_REG   = 0x04;
+    static const uint8_t MEM       = 0x08;
+    static const uint8_t MULTI_REG = 0x80;
+
+    static const uint8_t END_NORMAL  = 0x10;
+    static const uint8_t END_STOPPED = 0x20;
+
+    // Value of the "last inst at this pc" table for a pc not seen yet.
+    static const uint32_t NO_INST = 0x10000;
+
+    inline uint32_t zigzag(int32_t v) { return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31); }
+    inline int32_t unzigzag(uint32_t v) { return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1); }
+
+    inline uint8_t *putVarint(uint8_t *p, uint32_t v) {
+        while (v >= 0x80) {
+            *p++ = static_cast<uint8_t>(v) | 0x80;
+            v >>= 7;
+        }
+        *p++ = static_cast<uint8_t>(v);
+        return p;
+    }
+
+    // Store width in bytes of the instruction, or 0 if it is not a store.
+    inline int storeSize(uint16_t inst) {
+        uint8_t op = decodeInstruction(inst).op;
+        return op == OP_SB ? 1 : op == OP_SW ? 2 : 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Encoder. Records are built in one of two buffers; when it fills up it is
+// handed to a background thread that writes it out while the simulator keeps
+// filling the other one.
+// ---------------------------------------------------------------------------
+class Z16BinaryTraceWriter {
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+    static const size_t MAX_RECORD = 64;   // Bound on one record plus the end marker.
+
+    // 'regs' and 'memory' are the simulator state the deltas are taken from.
+    Z16BinaryTraceWriter(std::ostream &out, const uint16_t *regs, const uint8_t *memory)
+        : out(out), regs(regs), memory(memory), lastInst(65536, Z16Trace::NO_INST) {
+        for (std::vector<uint8_t> &b : buffers)
+            b.resize(BUFFER_SIZE);
+        memcpy(shadow.data(), regs, sizeof(uint16_t) * 8);
+        uint8_t *p = buffers[0].data();
+        memcpy(p, "Z16T", 4);
+        p[4] = Z16Trace::VERSION;
+        p += 5;
+        for (uint16_t r : shadow) {
+            *p++ = r & 0xFF;
+            *p++ = r >> 8;
+        }
+        used = p - buffers[0].data();
+        worker = std::thread([this] { writerLoop(); });
+    }
+
+    ~Z16BinaryTraceWriter() { close(); }
+
+    Z16BinaryTraceWriter(const Z16BinaryTraceWriter &) = delete;
+    Z16BinaryTraceWriter &operator=(const Z16BinaryTraceWriter &) = delete;
+
+    // Called before the instruction 'inst' at 'pc' executes.
+    void record(uint16_t pc, uint16_t inst) {
+        finishPending();
+        uint8_t *p = buffers[active].data() + used;
+        uint8_t &header = *p++;
+        header = 0;
+        if (pc == static_cast<uint16_t>(prevPc + 2)) {
+            header |= Z16Trace::SEQ;
+        } else {
+            p = Z16Trace::putVarint(p, Z16Trace::zigzag(static_cast<int16_t>(pc - prevPc)));
+        }
+        if (lastInst[pc] == inst) {
+            header |= Z16Trace::SAME_INST;
+        } else {
+            lastInst[pc] = inst;
+            *p++ = inst & 0xFF;
+            *p++ = inst >> 8;
+        }
+        used = p - buffers[active].data();
+        pendingHeader = &header - buffers[active].data();
+        prevPc = pc;
+        pendingInst = inst;
+        pendingRegs = shadow;
+        hasPending = true;
+    }
+
+    // The watchdog stopped the run with 'pc' next to execute.
+    void stopped(StopReason reason, uint16_t pc) {
+        finishPending();
+        uint8_t *p = buffers[active].data() + used;
+        *p++ = Z16Trace::END_STOPPED;
+        *p++ = static_cast<uint8_t>(reason);
+        p = Z16Trace::putVarint(p, pc);
+        used = p - buffers[active].data();
+        ended = true;
+    }
+
+    // Complete the last record, write the end marker and wait for the writer thread.
+    void close() {
+        if (closed)
+            return;
+        finishPending();
+        if (!ended)
+            buffers[active][used++] = Z16Trace::END_NORMAL;
+        handOff();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        cv.notify_all();
+        worker.join();
+        closed = true;
+    }
+
+    // Bytes encoded so far (including the header).
+    size_t size() const { return written + used; }
+
+private:
+    std::ostream &out;
+    const uint16_t *regs;
+    const uint8_t *memory;
+
+    std::array<std::vector<uint8_t>, 2> buffers;
+    int active = 0;
+    size_t used = 0;
+    size_t written = 0;
+
+    std::array<uint16_t, 8> shadow;        // Register values the reader has seen.
+    std::vector<uint32_t> lastInst;        // Last inst recorded at each pc.
+    uint16_t prevPc = 0xFFFE;              // So that a first record at pc 0 is SEQ.
+    uint16_t prevStore = 0;
+
+    // The last record still waits for its register and memory deltas, which
+    // are only known once the instruction has executed.
+    bool hasPending = false;
+    size_t pendingHeader = 0;
+    uint16_t pendingInst = 0;
+    std::array<uint16_t, 8> pendingRegs;   // Register values before it executed.
+    bool ended = false;
+    bool closed = false;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable cv;
+    const uint8_t *writeData = nullptr;    // Buffer owned by the writer thread, if any.
+    size_t writeSize = 0;
+    bool stopping = false;
+
+    void finishPending() {
+        if (hasPending) {
+            hasPending = false;
+            uint8_t *base = buffers[active].data();
+            uint8_t *p = base + used;
+            uint8_t header = 0;
+            uint8_t mask = 0;
+            for (int r = 0; r < 8; r++)
+                if (regs[r] != shadow[r])
+                    mask |= 1 << r;
+            if (mask && !(mask & (mask - 1))) {
+                int r = std::countr_zero(mask);
+                header |= Z16Trace::ONE_REG | r << 4;
+                p = Z16Trace::putVarint(p, Z16Trace::zigzag(static_cast<int16_t>(regs[r] - shadow[r])));
+                shadow[r] = regs[r];
+            } else if (mask) {
+                header |= Z16Trace::MULTI_REG;
+                *p++ = mask;
+                for (int r = 0; r < 8; r++) {
+                    if (mask & (1 << r)) {
+                        p = Z16Trace::putVarint(p, Z16Trace::zigzag(static_cast<int16_t>(regs[r] - shadow[r])));
+                        shadow[r] = regs[r];
+                    }
+                }
+            }
+            // Store address from the registers the store saw; S-type offsets are 0..15.
+            int width = Z16Trace::storeSize(pendingInst);
+            if (width) {
+                DecodedOp d = decodeInstruction(pendingInst);
+                uint16_t addr = pendingRegs[d.rd] + d.imm;
+                if (width == 1 || addr != 0xFFFF) {
+                    header |= Z16Trace::MEM;
+                    p = Z16Trace::putVarint(p, Z16Trace::zigzag(static_cast<int16_t>(addr - prevStore)));
+                    p = Z16Trace::putVarint(p, width == 1 ? memory[addr] : memory[addr] | memory[addr + 1] << 8);
+                    prevStore = addr;
+                }
+            }
+            base[pendingHeader] |= header;
+            used = p - base;
+        }
+        if (used + MAX_RECORD > BUFFER_SIZE)
+            handOff();
+    }
+
+    // Give the active buffer to the writer thread and continue in the other one.
+    void handOff() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return writeData == nullptr; });
+        writeData = buffers[active].data();
+        writeSize = used;
+        written += used;
+        active ^= 1;
+        used = 0;
+        cv.notify_all();
+    }
+
+    void writerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            cv.wait(lock, [this] { return writeData != nullptr || stopping; });
+            if (writeData) {
+                const uint8_t *data = writeData;
+                size_t size = writeSize;
+                lock.unlock();
+                out.write(reinterpret_cast<const char *>(data), size);
+                lock.lock();
+                writeData = nullptr;
+                cv.notify_all();
+            } else {
+                out.flush();
+                return;
+            }
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Decoder. Reads records back with absolute values filled in.
+// ---------------------------------------------------------------------------
+struct Z16TraceRecord {
+    enum Kind { INSTRUCTION, END_NORMAL, END_STOPPED } kind;
+    StopReason reason;               // Why the run stopped (END_STOPPED).
+    uint16_t pc;
+    uint16_t inst;
+    uint8_t regMask;                 // Registers changed since the previous record.
+    std::array<uint16_t, 8> regs;    // Register values after this record's deltas.
+    int memSize;                     // 0, or bytes stored (1 or 2).
+    uint16_t memAddr;
+    uint16_t memValue;
+};
+
+class Z16BinaryTraceReader {
+public:
+    explicit Z16BinaryTraceReader(std::istream &in) : in(in), lastInst(65536, Z16Trace::NO_INST) {}
+
+    // Read and check the file header; false if this is not a binary trace.
+    bool open() {
+        char magic[5];
+        if (!in.read(magic, 5) || memcmp(magic, "Z16T", 4) != 0 || magic[4] != Z16Trace::VERSION)
+            return false;
+        for (uint16_t &r : regs) {
+            int lo = in.get(), hi = in.get();
+            if (!in)
+                return false;
+            r = lo | hi << 8;
+        }
+        return true;
+    }
+
+    const std::array<uint16_t, 8> &initialRegs() const { return regs; }
+
+    // Decode the next record; false at end of file or on a truncated record.
+    bool next(Z16TraceRecord &rec) {
+        int header = in.get();
+        if (header == EOF)
+            return false;
+        if (header == Z16Trace::END_NORMAL || header == Z16Trace::END_STOPPED) {
+            rec.kind = header == Z16Trace::END_STOPPED ? Z16TraceRecord::END_STOPPED : Z16TraceRecord::END_NORMAL;
+            rec.reason = rec.kind == Z16TraceRecord::END_STOPPED ? static_cast<StopReason>(in.get()) : StopReason::None;
+            rec.pc = rec.kind == Z16TraceRecord::END_STOPPED ? varint() : pc;
+            rec.regMask = 0;
+            rec.regs = regs;
+            rec.memSize = 0;
+            return static_cast<bool>(in);
+        }
+        rec.kind = Z16TraceRecord::INSTRUCTION;
+        if (header & Z16Trace::SEQ)
+            pc += 2;
+        else
+            pc += Z16Trace::unzigzag(varint());
+        if (header & Z16Trace::SAME_INST) {
+            rec.inst = lastInst[pc];
+        } else {
+            int lo = in.get(), hi = in.get();
+            rec.inst = lo | hi << 8;
+            lastInst[pc] = rec.inst;
+        }
+        rec.pc = pc;
+        rec.regMask = 0;
+        if (header & Z16Trace::ONE_REG) {
+            int r = (header >> 4) & 0x7;
+            rec.regMask = 1 << r;
+            regs[r] += Z16Trace::unzigzag(varint());
+        } else if (header & Z16Trace::MULTI_REG) {
+            rec.regMask = in.get();
+            for (int r = 0; r < 8; r++)
+                if (rec.regMask & (1 << r))
+                    regs[r] += Z16Trace::unzigzag(varint());
+        }
+        rec.regs = regs;
+        rec.memSize = 0;
+        if (header & Z16Trace::MEM) {
+            store += Z16Trace::unzigzag(varint());
+            rec.memAddr = store;
+            rec.memValue = varint();
+            rec.memSize = Z16Trace::storeSize(rec.inst);
+        }
+        return static_cast<bool>(in);
+    }
+
+private:
+    std::istream &in;
+    std::array<uint16_t, 8> regs{};
+    std::vector<uint32_t> lastInst;
+    uint16_t pc = 0xFFFE;
+    uint16_t store = 0;
+
+    uint32_t varint() {
+        uint32_t v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            int b = in.get();
+            if (b == EOF)
+                return 0;
+            v |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                break;
+        }
+        return v;
+    }
+};
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <memory>
+#include <algorithm>
+#include "Z16Simulator.h"
+#include "Z16Threaded.h"   // Z16_COMPUTED_GOTO
+#include "Z16Jit.h"
+
+// ---------------------------------------------------------------------------
+// Basic-block translator.
+// A block is a straight run of instructions ending at the first B-type,
+// J-type, jr/jalr or ecall (or after MAX_BLOCK_OPS instructions). Each block
+// is translated once into micro-ops (predecoded ops, with auipc/lui folded into
+// constant loads) and then executed without the per-instruction checks of
+// runExecution: the programSize test and the watchdog check are done once per
+// block. A block's exits remember the block they lead to, so hot loops chain
+// from block to block without looking anything up.
+//
+// Stores are checked against a per-byte map of translated code; a store that
+// hits a translated range flushes every block covering it.
+//
+// With jitThreshold > 0 (and tracing off) the engine is tiered: a block that
+// has run more than jitThreshold times is compiled to x86-64 by Z16Jit and
+// from then on runs natively. Native code side-exits to the interpreter for
+// anything it does not handle itself.
+// ---------------------------------------------------------------------------
+struct Z16Block {
+    uint16_t start = 0;              // Address of the first instruction.
+    uint32_t end = 0;                // Address just past the last instruction.
+    bool hasTerminator = false;      // Last op is a branch, jump or ecall.
+    vector<DecodedOp> ops;           // Translated micro-ops.
+    Z16Block *takenLink = nullptr;   // Chained successor for a taken branch / direct jump.
+    Z16Block *fallLink = nullptr;    // Chained successor for the fall-through exit.
+    size_t execCount = 0;            // Interpreted executions (JIT tier only).
+    Z16JitFn jitCode = nullptr;      // Native code, once the block is hot.
+};
+
+class Z16BlockEngine {
+public:
+    // Longest block, in instructions.
+    static const size_t MAX_BLOCK_OPS = 64;
+
+    // Executions after which a block is compiled to native code (0 = never).
+    size_t jitThreshold = 0;
+
+    explicit Z16BlockEngine(Z16Simulator &sim)
+        : sim(sim), blockMap(Z16Simulator::MEM_SIZE, nullptr), codeBytes(Z16Simulator::MEM_SIZE, 0) {
+        jitContext.regs = sim.regs.data();
+        jitContext.memory = sim.memory.data();
+        jitContext.decodeCache = sim.decodeCache.data();
+        jitContext.codeBytes = codeBytes.data();
+        jitContext.dirtyPages = sim.dirtyPages.data();
+        static_assert(Z16Simulator::PAGE_SIZE == 256, "compiled stores mark pages with addr >> 8");
+    }
+
+    // -----------------------------------------------------
+    // Execution Loop: same contract (trace, watchdog, return value)
+    // as Z16Simulator::runExecution, but one iteration per block. The
+    // watchdog is consulted at every block boundary.
+    // -----------------------------------------------------
+    template <bool Trace>
+    bool run(Z16TraceWriter &trace, Z16Watchdog &watchdog) {
+        uint64_t executed = 0;
+        Z16Block *block = nullptr;          // Block at sim.pc, when already known.
+        Z16Block **pendingLink = nullptr;   // Exit to chain once the next block is known.
+        bool singleStep = false;            // Native code side-exited: interpret one instruction.
+        while (sim.pc < sim.programSize) {
+            if (executed >= watchdog.nextCheck && !watchdog.check(sim, sim.pc, executed)) {
+                trace.stopped(watchdog.reason(), sim.pc);
+                return false;
+            }
+            if (!block) {
+                block = lookup(sim.pc);
+                if (pendingLink)
+                    *pendingLink = block;
+            }
+            pendingLink = nullptr;
+
+            // Where nothing can be translated (or native code gave up on an
+            // instruction) interpret a single instruction.
+            if (singleStep || !block) {
+                DecodedOp d = sim.fetchDecoded(sim.pc);
+                if (Trace && trace.sample())
+                    trace.line(sim, sim.pc, d.inst);
+                uint16_t storeAddr = sim.regs[d.rd] + d.imm;
+                if (!sim.executeDecoded(d)) {
+                    if (!sim.enterTrap())
+                        break;
+                    block = nullptr;
+                    singleStep = false;
+                    continue;
+                }
+                executed++;
+                // A breakpoint whose condition did not hold ran the real instruction.
+                uint8_t op = d.op == OP_BREAKPOINT ? decodeInstruction(d.inst).op : d.op;
+                if (op == OP_SB || op == OP_SW)
+                    invalidate(storeAddr, op == OP_SW ? 2 : 1);
+                block = nullptr;
+                singleStep = false;
+                continue;
+            }
+
+            BlockExit exit;
+            if (!Trace && jitThreshold && !block->jitCode && ++block->execCount > jitThreshold)
+                compile(*block);
+            if (!Trace && block->jitCode)
+                exit = executeNative(*block, executed);
+            else
+                exit = executeBlock<Trace>(*block, trace, executed);
+            // Only the running block could still reference a flushed one.
+            retired.clear();
+            if (exit == EXIT_TERMINATE)
+                break;
+            if (exit == EXIT_TRAP) {
+                // The trapping instruction left sim.pc at itself.
+                if (!sim.enterTrap())
+                    break;
+                block = nullptr;
+                continue;
+            }
+            if (exit == EXIT_SIDE) {
+                singleStep = true;
+                block = nullptr;
+                continue;
+            }
+            if (exit == EXIT_FLUSHED || exit == EXIT_INDIRECT) {
+                block = nullptr;
+                continue;
+            }
+            Z16Block *&link = (exit == EXIT_TAKEN) ? block->takenLink : block->fallLink;
+            if (!link)
+                pendingLink = &link;
+            block = link;
+        }
+        return true;
+    }
+
+    // Flush every translated block overlapping [addr, addr + len).
+    // Returns true if 'current' was one of them.
+    bool invalidate(uint16_t addr, size_t len, const Z16Block *current = nullptr) {
+        bool hitCurrent = false;
+        if (addr + len > Z16Simulator::MEM_SIZE)   // A word at 0xFFFF wraps to 0x0000.
+            hitCurrent = invalidate(0, addr + len - Z16Simulator::MEM_SIZE, current);
+        size_t first = (addr >= 2 * MAX_BLOCK_OPS) ? addr - 2 * MAX_BLOCK_OPS : 0;
+        size_t last = min<size_t>(addr + len, Z16Simulator::MEM_SIZE);
+        for (size_t start = first; start < last; start++) {
+            Z16Block *b = blockMap[start];
+            if (!b || b->end <= addr)
+                continue;
+            hitCurrent |= (b == current);
+            retire(b);
+        }
+        // Every block covering the range is gone, so are its code bytes.
+        for (size_t a = addr; a < last; a++)
+            codeBytes[a] = 0;
+        return hitCurrent;
+    }
+
+    // Drop every translated block.
+    void flushAll() {
+        for (auto &b : blocks)
+            blockMap[b->start] = nullptr;
+        for (auto &b : blocks)
+            retired.push_back(std::move(b));
+        blocks.clear();
+        fill(codeBytes.begin(), codeBytes.end(), 0);
+    }
+
+    // Z16Simulator::restore, also dropping the blocks on every page it copies.
+    size_t restore(const Z16Snapshot &snap) {
+        return sim.restore(snap, [this](size_t page) {
+            invalidate(page * Z16Simulator::PAGE_SIZE, Z16Simulator::PAGE_SIZE);
+        });
+    }
+
+    size_t blockCount() const { return blocks.size(); }
+
+private:
+    enum BlockExit { EXIT_FALLTHROUGH, EXIT_TAKEN, EXIT_INDIRECT, EXIT_TERMINATE, EXIT_FLUSHED, EXIT_SIDE, EXIT_TRAP };
+
+    Z16Simulator &sim;
+    vector<Z16Block *> blockMap;             // Block starting at each address.
+    vector<uint8_t> codeBytes;               // Nonzero if a live block covers the byte.
+    vector<unique_ptr<Z16Block>> blocks;     // Live blocks.
+    vector<unique_ptr<Z16Block>> retired;    // Flushed blocks, freed once nothing runs them.
+    Z16Jit jit;
+    Z16JitContext jitContext;
+
+    static bool isTerminator(uint8_t op) {
+        return (op >= OP_BEQ && op <= OP_BGEU) || op == OP_J || op == OP_JAL ||
+               op == OP_JR || op == OP_JALR || op == OP_ECALL;
+    }
+
+    void traceLine(Z16TraceWriter &trace, uint16_t addr, const DecodedOp &d) {
+        if (trace.sample())
+            trace.line(sim, addr, d.inst);
+    }
+
+    // Find the block starting at 'addr', translating it on first use.
+    Z16Block *lookup(uint16_t addr) {
+        Z16Block *b = blockMap[addr];
+        return b ? b : translate(addr);
+    }
+
+    Z16Block *translate(uint16_t start) {
+        auto b = make_unique<Z16Block>();
+        b->start = start;
+        size_t addr = start;
+        // Stay inside the program and never read past the end of memory.
+        while (b->ops.size() < MAX_BLOCK_OPS && addr < sim.programSize && addr + 1 < Z16Simulator::MEM_SIZE) {
+            DecodedOp d = sim.fetchDecoded(addr);
+            // A breakpoint ends the block before it; at the start of one the
+            // single-instruction path runs into it and stops.
+            if (d.op == OP_BREAKPOINT)
+                break;
+            // Fold PC-relative and upper immediates into constant loads.
+            if (d.op == OP_AUIPC) {
+                d.op = OP_LI;
+                d.imm = static_cast<int16_t>(addr + (uint16_t)d.imm);
+            } else if (d.op == OP_LUI) {
+                d.op = OP_LI;
+            }
+            b->ops.push_back(d);
+            addr += 2;
+            if (isTerminator(d.op)) {
+                b->hasTerminator = true;
+                break;
+            }
+        }
+        if (b->ops.empty())
+            return nullptr;
+        b->end = addr;
+        for (size_t a = start; a < addr; a++)
+            codeBytes[a] = 1;
+        blockMap[start] = b.get();
+        blocks.push_back(std::move(b));
+        return blocks.back().get();
+    }
+
+    // Remove a block from the map and cut every chain link that leads to it.
+    void retire(Z16Block *b) {
+        blockMap[b->start] = nullptr;
+        for (auto &other : blocks) {
+            if (other->takenLink == b) other->takenLink = nullptr;
+            if (other->fallLink == b) other->fallLink = nullptr;
+        }
+        auto it = find_if(blocks.begin(), blocks.end(),
+                          [b](const unique_ptr<Z16Block> &p) { return p.get() == b; });
+        retired.push_back(std::move(*it));
+        blocks.erase(it);
+    }
+
+    // Compile a hot block; when the code buffer is full, drop all native code and retry.
+    void compile(Z16Block &b) {
+        b.jitCode = jit.compile(b.ops, b.start, b.hasTerminator);
+        if (!b.jitCode && jit.available()) {
+            jit.reset();
+            for (auto &other : blocks) {
+                other->jitCode = nullptr;
+                other->execCount = 0;
+            }
+            b.jitCode = jit.compile(b.ops, b.start, b.hasTerminator);
+        }
+    }
+
+    BlockExit executeNative(Z16Block &b, uint64_t &executed) {
+        uint32_t result = b.jitCode(&jitContext);
+        sim.pc = result & 0xFFFF;
+        executed += result >> 20;
+        switch ((result >> 16) & 0xF) {
+            case JIT_EXIT_TAKEN:    return EXIT_TAKEN;
+            case JIT_EXIT_INDIRECT: return EXIT_INDIRECT;
+            case JIT_EXIT_SIDE:     return EXIT_SIDE;
+            default:                return EXIT_FALLTHROUGH;
+        }
+    }
+
+    // Run one block. Leaves sim.pc at the next instruction and adds the number
+    // of executed instructions to 'executed'.
+    template <bool Trace>
+    BlockExit executeBlock(Z16Block &b, Z16TraceWriter &trace, uint64_t &executed) {
+        array<uint16_t, 8> &regs = sim.regs;
+        const DecodedOp *ops = b.ops.data();
+        size_t body = b.ops.size() - (b.hasTerminator ? 1 : 0);
+        uint16_t pc = b.start;
+
+        size_t i = 0;
+        const DecodedOp *d = ops;
+
+        // Body micro-ops are dispatched the same way as in runThreaded: each
+        // handler jumps straight to the next one.
+#if Z16_COMPUTED_GOTO
+        static void *const handlers[OP_COUNT] = {
+            &&B_OP_MEM_NOP,
+            &&B_OP_ADD, &&B_OP_SUB, &&B_OP_SLT, &&B_OP_SLTU, &&B_OP_SLL, &&B_OP_SRL, &&B_OP_SRA,
+            &&B_OP_OR, &&B_OP_AND, &&B_OP_XOR, &&B_OP_MV, &&B_OP_MEM_NOP, &&B_OP_MEM_NOP,
+            &&B_OP_ADDI, &&B_OP_SLTI, &&B_OP_SLTUI, &&B_OP_SLLI, &&B_OP_SRLI, &&B_OP_SRAI,
+            &&B_OP_ORI, &&B_OP_ANDI, &&B_OP_XORI, &&B_OP_LI,
+            &&B_OP_MEM_NOP, &&B_OP_MEM_NOP, &&B_OP_MEM_NOP, &&B_OP_MEM_NOP,
+            &&B_OP_MEM_NOP, &&B_OP_MEM_NOP, &&B_OP_MEM_NOP, &&B_OP_MEM_NOP,
+            &&B_OP_SB, &&B_OP_SW, &&B_OP_LB, &&B_OP_LW, &&B_OP_LBU,
+            &&B_OP_MEM_NOP, &&B_OP_MEM_NOP, &&B_OP_MEM_NOP, &&B_OP_MEM_NOP,
+            &&B_OP_MEM_NOP,
+            &&B_OP_MEM_NOP, &&B_OP_BAD_R, &&B_OP_BAD_SHIFT, &&B_OP_BAD_SYS,
+            &&B_OP_MEM_NOP,
+        };
+#define TARGET(name) B_##name:
+#define JUMP_TO_HANDLER() goto *handlers[d->op]
+#else
+#define TARGET(name) case name:
+#define JUMP_TO_HANDLER() goto dispatch_switch
+#endif
+#define BODY_DISPATCH()                         \
+        do {                                    \
+            if (i == body)                      \
+                goto body_done;                 \
+            d = &ops[i];                        \
+            if (Trace)                          \
+                traceLine(trace, pc, *d);       \
+            JUMP_TO_HANDLER();                  \
+        } while (0)
+#define BODY_NEXT() do { i++; pc += 2; BODY_DISPATCH(); } while (0)
+#define RD regs[d->rd]
+#define RS regs[d->rs]
+
+        BODY_DISPATCH();
+#if !Z16_COMPUTED_GOTO
+dispatch_switch:
+        switch (d->op) {
+#endif
+        TARGET(OP_ADD)   RD = RD + RS; BODY_NEXT();
+        TARGET(OP_SUB)   RD = RD - RS; BODY_NEXT();
+        TARGET(OP_SLT)   RD = (int16_t)RD < (int16_t)RS ? 1 : 0; BODY_NEXT();
+        TARGET(OP_SLTU)  RD = RD < RS ? 1 : 0; BODY_NEXT();
+        TARGET(OP_SLL)   RD = RD << (RS & 0xF); BODY_NEXT();
+        TARGET(OP_SRL)   RD = RD >> (RS & 0xF); BODY_NEXT();
+        TARGET(OP_SRA)   RD = static_cast<uint16_t>(static_cast<int16_t>(RD) >> (RS & 0xF)); BODY_NEXT();
+        TARGET(OP_OR)    RD = RD | RS; BODY_NEXT();
+        TARGET(OP_AND)   RD = RD & RS; BODY_NEXT();
+        TARGET(OP_XOR)   RD = RD ^ RS; BODY_NEXT();
+        TARGET(OP_MV)    RD = RS; BODY_NEXT();
+        TARGET(OP_ADDI)  RD = RD + d->imm; BODY_NEXT();
+        TARGET(OP_SLTI)  RD = ((int16_t)RD < d->imm) ? 1 : 0; BODY_NEXT();
+        TARGET(OP_SLTUI) RD = (RD < (uint16_t)d->imm) ? 1 : 0; BODY_NEXT();
+        TARGET(OP_SLLI)  RD = RD << d->imm; BODY_NEXT();
+        TARGET(OP_SRLI)  RD = RD >> d->imm; BODY_NEXT();
+        TARGET(OP_SRAI)  RD = static_cast<uint16_t>(static_cast<int16_t>(RD) >> d->imm); BODY_NEXT();
+        TARGET(OP_ORI)   RD = RD | d->imm; BODY_NEXT();
+        TARGET(OP_ANDI)  RD = RD & d->imm; BODY_NEXT();
+        TARGET(OP_XORI)  RD = RD ^ d->imm; BODY_NEXT();
+        TARGET(OP_LI)    RD = d->imm; BODY_NEXT();
+        TARGET(OP_LB)    RD = static_cast<int8_t>(sim.readByte(RS + d->imm)); BODY_NEXT();
+        TARGET(OP_LW)
+            sim.pc = pc;
+            if (!sim.loadWord<0>(RS + d->imm, RD, nullptr))
+                goto trapped;
+            BODY_NEXT();
+        TARGET(OP_LBU)   RD = sim.readByte(RS + d->imm); BODY_NEXT();
+        TARGET(OP_SB) {
+            uint16_t addr = RD + d->imm;
+            sim.writeByte(addr, RS & 0xFF);
+            if (codeBytes[addr] && invalidate(addr, 1, &b))
+                goto flushed;
+            BODY_NEXT();
+        }
+        TARGET(OP_SW) {
+            uint16_t addr = RD + d->imm;
+            sim.pc = pc;
+            if (!sim.storeWord<0>(addr, RS, nullptr))
+                goto trapped;
+            if ((codeBytes[addr] || codeBytes[static_cast<uint16_t>(addr + 1)]) && invalidate(addr, 2, &b))
+                goto flushed;
+            BODY_NEXT();
+        }
+        TARGET(OP_BAD_R)
+        TARGET(OP_BAD_SHIFT)
+        TARGET(OP_BAD_SYS)
+            sim.pc = pc;
+            if (!sim.illegalOp(*d))
+                goto trapped;
+            BODY_NEXT();
+#if !Z16_COMPUTED_GOTO
+        default:  // Terminators and breakpoints never appear in the body.
+#endif
+        TARGET(OP_MEM_NOP) BODY_NEXT();
+#if !Z16_COMPUTED_GOTO
+        }
+#endif
+#undef TARGET
+#undef JUMP_TO_HANDLER
+#undef BODY_DISPATCH
+#undef BODY_NEXT
+#undef RD
+#undef RS
+
+trapped:
+        // An instruction trapped (sim.pc is at it) and did not execute.
+        executed += i;
+        return EXIT_TRAP;
+
+flushed:
+        // A store hit this block: the rest of it may be stale, so leave now.
+        sim.pc = pc + 2;
+        executed += i + 1;
+        return EXIT_FLUSHED;
+
+body_done:
+        executed += b.ops.size();
+
+        if (!b.hasTerminator) {
+            sim.pc = pc;
+            return EXIT_FALLTHROUGH;
+        }
+
+        const DecodedOp &term = ops[body];
+        uint16_t &rd = regs[term.rd];
+        uint16_t rs = regs[term.rs];
+        if (Trace)
+            traceLine(trace, pc, term);
+        bool taken = false;
+        switch (term.op) {
+            case OP_BEQ:  taken = rd == rs; break;
+            case OP_BNE:  taken = rd != rs; break;
+            case OP_BZ:   taken = rd == 0; break;
+            case OP_BNZ:  taken = rd != 0; break;
+            case OP_BLT:  taken = (int16_t)rd < (int16_t)rs; break;
+            case OP_BGE:  taken = (int16_t)rd >= (int16_t)rs; break;
+            case OP_BLTU: taken = rd < rs; break;
+            case OP_BGEU: taken = rd >= rs; break;
+            case OP_J:
+                sim.pc = pc + term.imm;
+                return EXIT_TAKEN;
+            case OP_JAL:
+                rd = pc + 2;
+                sim.pc = pc + term.imm;
+                return EXIT_TAKEN;
+            case OP_JR:
+                sim.pc = rd;
+                return EXIT_INDIRECT;
+            case OP_JALR:
+                rd = pc + 2;
+                sim.pc = regs[term.rs];
+                return EXIT_INDIRECT;
+            case OP_ECALL:
+                sim.pc = pc;
+                if (!sim.systemCall(term.imm))
+                    return EXIT_TERMINATE;
+                if (sim.pc != pc)           // ecall 18 returned from a trap.
+                    return EXIT_INDIRECT;
+                sim.pc = pc + 2;
+                return EXIT_FALLTHROUGH;
+        }
+        sim.pc = taken ? pc + term.imm : pc + 2;
+        return taken ? EXIT_TAKEN : EXIT_FALLTHROUGH;
+    }
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Cache model.
+// A set-associative cache over the 16-bit address space, configured by total
+// size, associativity, line size, replacement policy (LRU, FIFO, random) and
+// write policy (write-back with write-allocate, or write-through without
+// it). It only keeps tags: the data always lives in Z16Simulator::memory, so
+// the model counts hits, misses, evictions and write-backs and never changes
+// what a program computes. The execution loop feeds the I-cache every fetch
+// and the D-cache every load and store (see Z16Plugins in Z16Simulator.h).
+//
+// Tags are line numbers packed into one array (set-major, 'ways' entries per
+// set), with a parallel array of LRU/FIFO stamps and a dirty bit per line.
+// The line touched last is remembered: a further access to it, the common
+// case for sequential fetches and neighbouring data, is a hit that needs no
+// lookup.
+//
+// Every access is also counted against the PC that made it, so the report
+// can list the instructions that miss most.
+// ---------------------------------------------------------------------------
+enum class Z16Replacement { Lru, Fifo, Random };
+
+struct Z16CacheConfig {
+    size_t size = 1024;                 // Bytes.
+    unsigned ways = 2;
+    unsigned lineSize = 16;             // Bytes, a power of two.
+    Z16Replacement replacement = Z16Replacement::Lru;
+    bool writeBack = true;              // false: write-through, no write-allocate.
+};
+
+// Parse "SIZE:WAYS:LINE[:lru|fifo|random[:wb|wt]]"; false if malformed or the
+// geometry is not a power-of-two number of sets.
+inline bool parseCacheConfig(const std::string &text, Z16CacheConfig &config) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    for (;;) {
+        size_t colon = text.find(':', start);
+        fields.push_back(text.substr(start, colon - start));
+        if (colon == std::string::npos)
+            break;
+        start = colon + 1;
+    }
+    if (fields.size() < 3 || fields.size() > 5)
+        return false;
+    config.size = strtoul(fields[0].c_str(), nullptr, 0);
+    config.ways = strtoul(fields[1].c_str(), nullptr, 0);
+    config.lineSize = strtoul(fields[2].c_str(), nullptr, 0);
+    if (fields.size() > 3) {
+        if (fields[3] == "lru")
+            config.replacement = Z16Replacement::Lru;
+        else if (fields[3] == "fifo")
+            config.replacement = Z16Replacement::Fifo;
+        else if (fields[3] == "random")
+            config.replacement = Z16Replacement::Random;
+        else
+            return false;
+    }
+    if (fields.size() > 4) {
+        if (fields[4] != "wb" && fields[4] != "wt")
+            return false;
+        config.writeBack = fields[4] == "wb";
+    }
+    auto power = [](size_t n) { return n && !(n & (n - 1)); };
+    return power(config.lineSize) && config.lineSize >= 2 && config.ways &&
+           config.size % (size_t(config.ways) * config.lineSize) == 0 &&
+           power(config.size / (size_t(config.ways) * config.lineSize)) && config.size <= 65536;
+}
+
+class Z16Cache {
+public:
+    static constexpr size_t MEM_SIZE = 65536;
+    static constexpr size_t TOP_COUNT = 10;        // PCs listed in the report.
+
+    uint64_t misses = 0, evictions = 0, writeBacks = 0, memoryWrites = 0;
+    std::vector<uint64_t> pcAccesses, pcMisses, pcEvictions;   // Indexed by the PC making the access.
+
+    explicit Z16Cache(Z16CacheConfig config = {})
+        : pcAccesses(MEM_SIZE), pcMisses(MEM_SIZE), pcEvictions(MEM_SIZE), cfg(config) {
+        lineBits = 0;
+        while ((1u << lineBits) < cfg.lineSize)
+            lineBits++;
+        sets = cfg.size / (size_t(cfg.ways) * cfg.lineSize);
+        tags.assign(sets * cfg.ways, INVALID);
+        stamps.assign(sets * cfg.ways, 0);
+        dirty.assign(sets * cfg.ways, 0);
+    }
+
+    const Z16CacheConfig &config() const { return cfg; }
+
+    // Access 'bytes' bytes at 'addr' on behalf of the instruction at 'pc'.
+    // A read within the line touched last is settled here; everything else
+    // goes through the lookup.
+    void read(uint16_t pc, uint16_t addr, unsigned bytes) {
+        uint32_t first = uint32_t(addr) >> lineBits;
+        uint32_t last = uint32_t(static_cast<uint16_t>(addr + bytes - 1)) >> lineBits;
+        if (first == lastLine && last == lastLine)
+            pcAccesses[pc]++;
+        else
+            access(pc, addr, bytes, false);
+    }
+
+    void write(uint16_t pc, uint16_t addr, unsigned bytes) { access(pc, addr, bytes, true); }
+
+    uint64_t accesses() const {
+        uint64_t n = 0;
+        for (uint64_t a : pcAccesses)
+            n += a;
+        return n;
+    }
+
+    void writeReport(const char *name, std::string &out) const {
+        static const char *const policies[] = { "LRU", "FIFO", "random" };
+        char line[160];
+        uint64_t accesses = this->accesses();
+        snprintf(line, sizeof line, "%s: %zu bytes, %u-way, %u-byte lines, %s, %s\n", name, cfg.size, cfg.ways,
+                 cfg.lineSize, policies[static_cast<int>(cfg.replacement)], cfg.writeBack ? "write-back" : "write-through");
+        out += line;
+        snprintf(line, sizeof line,
+                 "  Accesses     %12llu\n"
+                 "  Hits         %12llu (%.2f%%)\n"
+                 "  Misses       %12llu (%.2f%%)\n"
+                 "  Evictions    %12llu\n",
+                 (unsigned long long)accesses, (unsigned long long)(accesses - misses), rate(accesses - misses, accesses),
+                 (unsigned long long)misses, rate(misses, accesses), (unsigned long long)evictions);
+        out += line;
+        if (cfg.writeBack)
+            snprintf(line, sizeof line, "  Write-backs  %12llu\n", (unsigned long long)writeBacks);
+        else
+            snprintf(line, sizeof line, "  Memory writes%12llu\n", (unsigned long long)memoryWrites);
+        out += line;
+
+        std::vector<size_t> order;
+        for (size_t pc = 0; pc < MEM_SIZE; pc++)
+            if (pcMisses[pc])
+                order.push_back(pc);
+        size_t n = std::min(order.size(), TOP_COUNT);
+        std::partial_sort(order.begin(), order.begin() + n, order.end(), [&](size_t a, size_t b) {
+            return pcMisses[a] != pcMisses[b] ? pcMisses[a] > pcMisses[b] : a < b;
+        });
+        if (n)
+            out += "  Most misses by PC (accesses, misses, miss rate, evictions):\n";
+        for (size_t i = 0; i < n; i++) {
+            size_t pc = order[i];
+            snprintf(line, sizeof line, "    0x%04zx %12llu %12llu %6.2f%% %12llu\n", pc, (unsigned long long)pcAccesses[pc],
+                     (unsigned long long)pcMisses[pc], rate(pcMisses[pc], pcAccesses[pc]), (unsigned long long)pcEvictions[pc]);
+            out += line;
+        }
+    }
+
+    double hitRate() const {
+        uint64_t n = accesses();
+        return rate(n - misses, n);
+    }
+
+private:
+    static constexpr uint32_t INVALID = ~0u;
+
+    Z16CacheConfig cfg;
+    unsigned lineBits;
+    size_t sets;
+    std::vector<uint32_t> tags;         // Line number held by each way; INVALID if empty.
+    std::vector<uint64_t> stamps;       // Last use (LRU) or fill (FIFO) time.
+    std::vector<uint8_t> dirty;
+    uint64_t clock = 0;
+    uint32_t lastLine = INVALID;        // Line of the previous access (always resident)...
+    size_t lastWay = 0;                 // ...and the way holding it.
+    uint32_t random = 0x9E3779B9u;
+
+    static double rate(uint64_t n, uint64_t of) { return of ? 100.0 * n / of : 0.0; }
+
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    void access(uint16_t pc, uint16_t addr, unsigned bytes, bool isWrite) {
+        uint32_t first = addr >> lineBits;
+        uint32_t last = static_cast<uint16_t>(addr + bytes - 1) >> lineBits;
+        touch(pc, first, isWrite);
+        if (last != first)                 // An unaligned word spanning two lines.
+            touch(pc, last, isWrite);
+    }
+
+    void touch(uint16_t pc, uint32_t line, bool isWrite) {
+        pcAccesses[pc]++;
+        if (!cfg.writeBack && isWrite)
+            memoryWrites++;
+        if (line == lastLine) {
+            // Still the most recently used line: a hit, already in LRU order.
+            if (isWrite && cfg.writeBack)
+                dirty[lastWay] = 1;
+            return;
+        }
+        clock++;
+        size_t base = (line & (sets - 1)) * cfg.ways;
+        for (size_t w = base; w < base + cfg.ways; w++) {
+            if (tags[w] == line) {
+                if (cfg.replacement == Z16Replacement::Lru)
+                    stamps[w] = clock;
+                if (isWrite && cfg.writeBack)
+                    dirty[w] = 1;
+                remember(line, w);
+                return;
+            }
+        }
+        misses++;
+        pcMisses[pc]++;
+        if (isWrite && !cfg.writeBack) {
+            // No write-allocate: the write goes around the cache.
+            return;
+        }
+        size_t victim = chooseVictim(base);
+        if (tags[victim] != INVALID) {
+            evictions++;
+            pcEvictions[pc]++;
+            if (dirty[victim])
+                writeBacks++;
+        }
+        tags[victim] = line;
+        stamps[victim] = clock;
+        dirty[victim] = isWrite && cfg.writeBack;
+        remember(line, victim);
+    }
+
+    void remember(uint32_t line, size_t way) {
+        lastLine = line;
+        lastWay = way;
+    }
+
+    size_t chooseVictim(size_t base) {
+        for (size_t w = base; w < base + cfg.ways; w++)
+            if (tags[w] == INVALID)
+                return w;
+        if (cfg.replacement == Z16Replacement::Random) {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            return base + random % cfg.ways;
+        }
+        // LRU and FIFO both evict the oldest stamp (last use or fill time).
+        size_t victim = base;
+        for (size_t w = base + 1; w < base + cfg.ways; w++)
+            if (stamps[w] < stamps[victim])
+                victim = w;
+        return victim;
+    }
+};
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Z16Disasm.h"
+#include "Z16ThreadPool.h"
+
+// ---------------------------------------------------------------------------
+// Control-flow disassembler.
+// Instead of sweeping the image linearly, follows control flow from the entry
+// point the way the machine would run it. It follows both ways of every
+// branch, j and jal targets, and the return points after jal/jalr. A path
+// ends at jr (a return or an indirect jump), at ecall 3 and at the end of
+// the program; undefined words do not end it, since the machine only warns
+// and goes on. Everything reached is code; the rest is listed with the
+// linear sweep's data rules, under a comment saying it was not reached.
+//
+// The result is a CFG: basic blocks (split at every branch target, return
+// point and control transfer) with their successors, and functions (the
+// entry point and every jal target). The listing labels every function
+// entry (func_XXXX) and block (L_XXXX) and uses those labels in place of the
+// raw hex targets of branches and jumps.
+//
+// Discovering the code is one cheap pass; the listing is then formatted
+// region by region (a run of code, or a gap of data) on a thread pool, and
+// the regions are stitched together in address order.
+// ---------------------------------------------------------------------------
+struct Z16CfgBlock {
+    uint16_t start = 0;                  // Address of the first instruction.
+    uint32_t end = 0;                    // Address just past the last instruction.
+    std::vector<uint16_t> successors;    // Blocks control can continue at (not through jr).
+};
+
+class Z16Cfg {
+public:
+    Z16Cfg(const uint8_t *memory, size_t programSize, uint16_t entry = 0)
+        : mem(memory), size(programSize), flags(programSize + 1, 0) {
+        discover(entry);
+        buildBlocks();
+    }
+
+    const std::vector<Z16CfgBlock> &blocks() const { return blockList; }
+
+    // Function entry points, in address order.
+    const std::vector<uint16_t> &functions() const { return functionList; }
+
+    // True if an instruction listed as code starts at 'addr'.
+    bool isCode(size_t addr) const { return addr < size && (flags[addr] & VISIBLE); }
+
+    // Append the labelled listing to 'out', formatting regions on 'jobs'
+    // threads (0 = one per core).
+    void write(std::string &out, size_t jobs = 0) const {
+        std::vector<Region> regions = splitRegions();
+        std::vector<std::string> text(regions.size());
+        if (jobs == 1 || regions.size() < 2) {
+            for (size_t i = 0; i < regions.size(); i++)
+                format(regions[i], text[i]);
+        } else {
+            Z16ThreadPool pool(jobs);
+            // A few regions per task, so tiny regions do not cost a task each.
+            size_t perTask = std::max<size_t>(1, regions.size() / (pool.size() * 8));
+            for (size_t first = 0; first < regions.size(); first += perTask)
+                pool.submit([&, first](size_t) {
+                    for (size_t i = first; i < std::min(first + perTask, regions.size()); i++)
+                        format(regions[i], text[i]);
+                });
+            pool.wait();
+        }
+        for (const std::string &t : text)
+            out += t;
+    }
+
+private:
+    enum : uint8_t {
+        START = 1,        // An instruction was decoded here.
+        LEADER = 2,       // A basic block starts here.
+        FUNCTION = 4,     // A function starts here.
+        ENDS_BLOCK = 8,   // The instruction here ends its block.
+        VISIBLE = 16,     // Listed as an instruction (not hidden by an overlapping one).
+    };
+
+    struct Region {
+        size_t start, end;
+        bool code;
+    };
+
+    const uint8_t *mem;
+    size_t size;
+    std::vector<uint8_t> flags;
+    std::vector<Z16CfgBlock> blockList;
+    std::vector<uint16_t> functionList;
+
+    uint16_t word(size_t addr) const { return mem[addr] | mem[addr + 1] << 8; }
+
+    // Direct target of a branch, j or jal at 'addr' (see Z16Disasm::formatInstruction).
+    uint16_t target(size_t addr) const {
+        uint16_t inst = word(addr);
+        uint8_t layout = Z16Disasm::table[inst].layout;
+        if (layout == LAYOUT_BRANCH || layout == LAYOUT_BRANCH_ZERO) {
+            int off4 = (inst >> 12) & 0xF;
+            int offset = (off4 & 0x8) ? off4 - 16 : off4;
+            return addr + offset * 2 + (layout == LAYOUT_BRANCH ? 2 : 0);
+        }
+        int imm9 = ((inst >> 9) & 0x3F) << 3 | ((inst >> 3) & 0x7);
+        if (imm9 & 0x100)
+            imm9 -= 0x200;
+        return addr + imm9 * 2;
+    }
+
+    bool hasDirectTarget(uint8_t layout) const {
+        return layout == LAYOUT_BRANCH || layout == LAYOUT_BRANCH_ZERO || layout == LAYOUT_JUMP || layout == LAYOUT_JAL;
+    }
+
+    // Successors of the block-ending instruction at 'addr' (inside the program).
+    void successorsOf(size_t addr, std::vector<uint16_t> &out) const {
+        uint16_t inst = word(addr);
+        Z16DisasmEntry e = Z16Disasm::table[inst];
+        auto add = [&](size_t a) {
+            if (a < size)
+                out.push_back(static_cast<uint16_t>(a));
+        };
+        switch (e.layout) {
+            case LAYOUT_BRANCH:
+            case LAYOUT_BRANCH_ZERO:
+                add(target(addr));
+                add(addr + 2);
+                break;
+            case LAYOUT_JUMP:
+                add(target(addr));
+                break;
+            case LAYOUT_JAL:
+                add(target(addr));
+                add(addr + 2);
+                break;
+            case LAYOUT_RS2:       // jalr: the callee is unknown, the return point is not.
+                add(addr + 2);
+                break;
+            case LAYOUT_RD:        // jr
+                break;
+            case LAYOUT_SYS:       // ecall 3 ends the program; other services fall through.
+                if (((inst >> 6) & 0x3FF) != 3)
+                    add(addr + 2);
+                break;
+            default:               // Block split by a leader: falls through.
+                add(addr + 2);
+                break;
+        }
+    }
+
+    void discover(uint16_t entry) {
+        std::vector<size_t> work;
+        auto reach = [&](size_t a, uint8_t kind) {
+            if (a >= size)
+                return;
+            flags[a] |= kind;
+            work.push_back(a);
+        };
+        reach(entry, LEADER | FUNCTION);
+        while (!work.empty()) {
+            size_t a = work.back();
+            work.pop_back();
+            for (;;) {
+                if (a + 1 >= size || (flags[a] & START))
+                    break;
+                uint16_t inst = word(a);
+                Z16DisasmEntry e = Z16Disasm::table[inst];
+                flags[a] |= START;
+                bool ends = true;
+                switch (e.layout) {
+                    case LAYOUT_BRANCH:
+                    case LAYOUT_BRANCH_ZERO:
+                        reach(target(a), LEADER);
+                        reach(a + 2, LEADER);
+                        break;
+                    case LAYOUT_JUMP:
+                        reach(target(a), LEADER);
+                        break;
+                    case LAYOUT_JAL:
+                        reach(target(a), LEADER | FUNCTION);
+                        reach(a + 2, LEADER);
+                        break;
+                    case LAYOUT_RS2:   // jalr
+                        reach(a + 2, LEADER);
+                        break;
+                    case LAYOUT_RD:    // jr
+                        break;
+                    case LAYOUT_SYS:
+                        ends = ((inst >> 6) & 0x3FF) == 3;
+                        break;
+                    default:
+                        ends = false;
+                        break;
+                }
+                if (ends) {
+                    flags[a] |= ENDS_BLOCK;
+                    break;
+                }
+                a += 2;
+            }
+        }
+    }
+
+    void buildBlocks() {
+        // An instruction is listed unless an instruction listed before it
+        // overlaps it (code reached at both even and odd alignments).
+        for (size_t a = 0; a < size;) {
+            if (flags[a] & START) {
+                flags[a] |= VISIBLE;
+                a += 2;
+            } else {
+                a++;
+            }
+        }
+        Z16CfgBlock *current = nullptr;
+        for (size_t a = 0; a < size; a++) {
+            if (!(flags[a] & VISIBLE))
+                continue;
+            if (flags[a] & FUNCTION)
+                functionList.push_back(static_cast<uint16_t>(a));
+            if (!current || (flags[a] & LEADER) || current->end != a) {
+                if (current && current->end == a && current->successors.empty())
+                    successorsOf(a - 2, current->successors);   // Split by a leader: falls through.
+                blockList.emplace_back();
+                current = &blockList.back();
+                current->start = static_cast<uint16_t>(a);
+            }
+            current->end = static_cast<uint32_t>(a + 2);
+            if (flags[a] & ENDS_BLOCK) {
+                successorsOf(a, current->successors);
+                current = nullptr;
+            }
+        }
+    }
+
+    std::vector<Region> splitRegions() const {
+        std::vector<Region> regions;
+        for (size_t a = 0; a < size;) {
+            bool code = flags[a] & VISIBLE;
+            size_t b = a;
+            if (code) {
+                while (b < size && (flags[b] & VISIBLE))
+                    b += 2;
+            } else {
+                while (b < size && !(flags[b] & VISIBLE))
+                    b++;
+            }
+            regions.push_back({ a, std::min(b, size), code });
+            a = b;
+        }
+        return regions;
+    }
+
+    char *putLabel(char *p, uint16_t addr) const {
+        p = Z16Disasm::put(p, (flags[addr] & FUNCTION) ? "func_" : "L_");
+        return Z16Disasm::putHex4(p, addr);
+    }
+
+    bool hasLabel(uint16_t addr) const {
+        return addr < size && (flags[addr] & VISIBLE) && (flags[addr] & (LEADER | FUNCTION));
+    }
+
+    void format(const Region &r, std::string &out) const {
+        if (!r.code) {
+            char line[64];
+            char *p = Z16Disasm::put(line, "; 0x");
+            p = Z16Disasm::putHex4(p, static_cast<uint16_t>(r.start));
+            p = Z16Disasm::put(p, "-0x");
+            p = Z16Disasm::putHex4(p, static_cast<uint16_t>(r.end - 1));
+            p = Z16Disasm::put(p, ": not reached\n");
+            out.append(line, p);
+            Z16Disasm::sweep(mem, r.start, r.end, out);
+            return;
+        }
+        char line[96];
+        for (size_t a = r.start; a < r.end; a += 2) {
+            uint16_t addr = static_cast<uint16_t>(a);
+            char *p = line;
+            if (flags[a] & FUNCTION) {
+                *p++ = '\n';
+                p = putLabel(p, addr);
+                p = Z16Disasm::put(p, ":\n");
+            } else if (flags[a] & LEADER) {
+                p = putLabel(p, addr);
+                p = Z16Disasm::put(p, ":\n");
+            }
+            uint16_t inst = word(a);
+            p = Z16Disasm::putAddress(p, a);
+            p = Z16Disasm::putHex4(p, inst);
+            p = Z16Disasm::put(p, "  ");
+            p = Z16Disasm::formatInstruction(p, addr, inst);
+            // The raw target is always the trailing "0xTTTT"; use its label.
+            if (hasDirectTarget(Z16Disasm::table[inst].layout) && hasLabel(target(a)))
+                p = putLabel(p - 6, target(a));
+            *p++ = '\n';
+            out.append(line, p);
+        }
+    }
+};
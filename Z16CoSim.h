@@ -0,0 +1,375 @@
+#pragma once
+
+#include <memory>
+#include <sstream>
+#include "Z16Simulator.h"
+#include "Z16Threaded.h"
+#include "Z16BlockEngine.h"
+
+// ---------------------------------------------------------------------------
+// Differential co-simulation.
+// Z16CoSim runs a program on the reference interpreter (executeInstruction,
+// which fetches and decodes every word as it always has) and, in lock-step,
+// on one of the fast engines (switch, threaded, block or jit) in a simulator
+// of its own, and reports the first point where the two disagree.
+//
+// The engine runs in slices that end at its first check point (Z16Watchdog.h):
+// the next backward control transfer, trap entry or trap return for the
+// switch and threaded engines, the next block boundary for the block and jit
+// engines. The watchdog says how
+// many instructions the slice executed; the reference then executes as many
+// and the two machines are compared: pc, registers, trap registers, an
+// unhandled trap, whether each is still running, and every memory page either
+// of them has written since the previous comparison (DIRTY_BIT).
+//
+// With everyInstruction the reference also takes a snapshot at each check
+// point where the two agree. When a slice diverges, both machines are put
+// back to that snapshot and the slice is replayed one instruction at a time
+// on the reference and on the engine itself, comparing after every
+// instruction. The engine is single-stepped the way a debugger does it
+// without hardware help: a breakpoint (Z16Simulator::setBreakpoint) where
+// the reference went next stops it after one instruction, and if it goes
+// anywhere else its next check point does. A difference there is reported
+// at the instruction that made it. The block and jit engines run one-
+// instruction blocks when stepped this way; if the replay agrees all the
+// way, the fault is in how the engine ran the slice as a whole (for them,
+// a longer block's translation), and the slice is reported as a whole.
+//
+// A report lists each differing field, then the last instructions the
+// reference executed. runThreaded counts an instruction when it dispatches
+// it and the other engines when it completes, so only the threaded engine
+// counts one that traps; the reference counts the same way as the engine.
+// The block engine can stop at the entry of a guest trap handler; the
+// reference then takes the same trap before the comparison.
+// The reference writes to its own console; the engine's is silenced. The
+// whole run is bounded by 'budget', checked at the check points.
+//
+//   Z16Simulator ref;
+//   ref.programSize = Z16Assembler().assemble(source, ref.memory.data());
+//   ref.invalidateDecodeCache();
+//   Z16CoSim cosim(ref, options);
+//   Z16CoSimResult result = cosim.run();   // result.diverged, result.report
+// ---------------------------------------------------------------------------
+struct Z16CoSimOptions {
+    string engine = "block";      // switch | threaded | block | jit
+    size_t jitThreshold = 32;
+    bool everyInstruction = false;
+    size_t context = 16;          // Reference instructions listed in a report.
+    Z16Budget budget;
+};
+
+struct Z16CoSimResult {
+    bool diverged = false;
+    StopReason stop = StopReason::None;   // The budget ended the run first.
+    uint64_t instructions = 0;            // Executed by the reference.
+    uint64_t comparisons = 0;
+    string report;                        // What differed, if anything.
+};
+
+class Z16CoSim {
+public:
+    // Bit of Z16Simulator::dirtyPages owned by the co-simulator, in both machines.
+    static const uint8_t DIRTY_BIT = 4;
+
+    // Most instructions the reference may run after the engine has ended.
+    static const uint64_t TAIL_LIMIT = Z16Simulator::MEM_SIZE;
+
+    Z16CoSim(Z16Simulator &reference, const Z16CoSimOptions &options)
+        : reference(reference), options(options), silent(nullptr), trace(silent, TraceMode::None),
+          engineSim(make_unique<Z16Simulator>()) {
+        if (options.engine != "switch" && options.engine != "threaded" && options.engine != "block" &&
+            options.engine != "jit")
+            throw runtime_error("Unknown engine: " + options.engine);
+        engineSim->console = &silent;
+        if (options.engine == "block" || options.engine == "jit") {
+            blocks = make_unique<Z16BlockEngine>(*engineSim);
+            if (options.engine == "jit")
+                blocks->jitThreshold = options.jitThreshold;
+        }
+        countTraps = options.engine == "threaded";
+    }
+
+    // The engine's machine, e.g. to inspect it after a divergence.
+    Z16Simulator &engineState() { return *engineSim; }
+
+    // Run from the reference's current state until both machines end, they
+    // diverge or the budget runs out.
+    Z16CoSimResult run() {
+        Z16CoSimResult result;
+        engineSim->restore(reference.snapshot());
+        engineSim->misaligned = reference.misaligned;
+        if (blocks)
+            blocks->flushAll();
+        for (size_t p = 0; p < reference.dirtyPages.size(); p++) {
+            reference.dirtyPages[p] &= ~DIRTY_BIT;
+            engineSim->dirtyPages[p] &= ~DIRTY_BIT;
+        }
+        history.assign(options.context, { 0, 0 });
+        recorded = 0;
+
+        Z16Watchdog watchdog(options.budget);
+        Z16Snapshot agreed;                   // everyInstruction: the last check point that matched...
+        uint64_t agreedAt = 0;                // ...and the reference's instruction count there.
+        if (options.everyInstruction)
+            agreed = reference.snapshot();
+        for (;;) {
+            Z16Budget slice;
+            slice.maxInstructions = 1;
+            slice.detectLivelock = false;
+            Z16Watchdog sliceWatchdog(slice);
+            bool engineRunning = !runEngine(sliceWatchdog);
+            uint64_t count = engineRunning ? sliceWatchdog.lastCheck : TAIL_LIMIT;
+            bool referenceRunning = advance(count, result.instructions);
+            if (engineRunning && referenceRunning && enteredTrap())
+                referenceRunning = stepReference() != STEP_ENDED;
+            result.comparisons++;
+
+            string difference = compare(*engineSim, engineRunning, referenceRunning);
+            if (!difference.empty()) {
+                result.diverged = true;
+                result.report = report(difference, result, count, agreed, agreedAt);
+                return result;
+            }
+            if (!engineRunning)
+                return result;
+            if (options.everyInstruction) {
+                agreed = reference.snapshot();
+                agreedAt = result.instructions;
+            }
+            if (result.instructions >= watchdog.nextCheck &&
+                !watchdog.check(reference, reference.pc, result.instructions)) {
+                result.stop = watchdog.reason();
+                return result;
+            }
+        }
+    }
+
+private:
+    enum Step { STEP_DONE, STEP_TRAPPED, STEP_ENDED };
+
+    Z16Simulator &reference;
+    Z16CoSimOptions options;
+    ostream silent;
+    Z16TraceWriter trace;
+    unique_ptr<Z16Simulator> engineSim;
+    unique_ptr<Z16BlockEngine> blocks;         // Block and jit engines only.
+    bool countTraps = false;
+
+    // The last options.context reference instructions: (pc, instruction).
+    vector<pair<uint16_t, uint16_t>> history;
+    uint64_t recorded = 0;
+
+    // Run the engine until its first check point; false if it stopped there.
+    bool runEngine(Z16Watchdog &watchdog) {
+        if (blocks)
+            return blocks->run<false>(trace, watchdog);
+        if (options.engine == "threaded")
+            return runThreaded<false>(*engineSim, trace, watchdog);
+        return engineSim->runExecution<false>(trace, watchdog);
+    }
+
+    // True if the engine has just entered a guest trap handler for the
+    // instruction the reference is about to run.
+    bool enteredTrap() const {
+        const Z16Simulator &e = *engineSim;
+        return e.pc != reference.pc && (e.trapRegs[TRAP_STATUS] & TRAP_STATUS_IN_TRAP) &&
+               e.pc == e.trapRegs[TRAP_VECTOR] && e.trapRegs[TRAP_EPC] == reference.pc;
+    }
+
+    // One instruction on the reference interpreter.
+    Step stepReference() {
+        if (reference.pc >= reference.programSize)
+            return STEP_ENDED;
+        uint16_t inst = reference.readWord(reference.pc);
+        if (!history.empty())
+            history[recorded++ % history.size()] = { reference.pc, inst };
+        if (reference.executeInstruction(inst))
+            return STEP_DONE;
+        return reference.trap && reference.enterTrap() ? STEP_TRAPPED : STEP_ENDED;
+    }
+
+    // Run the engine up to where the reference is now, one instruction if
+    // they agree: a breakpoint there stops it, unless that is where the
+    // engine already is (a jump to itself), when its next check point does.
+    // False if the engine ended.
+    bool stepEngine(bool referenceRunning) {
+        Z16Simulator &engine = *engineSim;
+        uint16_t next = reference.pc;
+        bool armed = referenceRunning && next != engine.pc && next < engine.programSize;
+        if (armed)
+            setStop(next, true);
+        Z16Budget step;
+        step.maxInstructions = 1;
+        step.detectLivelock = false;
+        Z16Watchdog watchdog(step);
+        bool running = !runEngine(watchdog);
+        if (engine.trap.cause == Z16TrapCause::Breakpoint) {
+            engine.trap = Z16Trap();
+            running = true;
+        }
+        if (armed)
+            setStop(next, false);
+        return running;
+    }
+
+    void setStop(uint16_t addr, bool set) {
+        set ? engineSim->setBreakpoint(addr) : engineSim->clearBreakpoint(addr);
+        if (blocks)
+            blocks->invalidate(addr, 2);
+    }
+
+    // Run the reference for 'count' instructions as the engine counts them,
+    // adding the executed ones to 'executed'. False if it ended first.
+    bool advance(uint64_t count, uint64_t &executed) {
+        for (uint64_t n = 0; n < count;) {
+            Step step = stepReference();
+            if (step == STEP_ENDED)
+                return false;
+            executed += step == STEP_DONE;
+            n += step == STEP_DONE || countTraps;
+        }
+        return true;
+    }
+
+    // Everything that differs between the reference and 'other', one line
+    // each, or "". Clears DIRTY_BIT in both.
+    string compare(Z16Simulator &other, bool otherRunning, bool referenceRunning) {
+        static const size_t MAX_BYTES = 8;     // Differing memory bytes listed.
+        if (otherRunning == referenceRunning && agrees(other))
+            return string();
+        ostringstream out;
+        out << hex << setfill('0');
+        const char *name = options.engine.c_str();
+        if (otherRunning != referenceRunning)
+            out << "  state: reference " << (referenceRunning ? "running" : "ended") << ", " << name << " "
+                << (otherRunning ? "running" : "ended") << "\n";
+        if (other.pc != reference.pc)
+            out << "  pc: reference 0x" << setw(4) << reference.pc << ", " << name << " 0x" << setw(4) << other.pc
+                << "\n";
+        for (size_t r = 0; r < reference.regs.size(); r++)
+            if (other.regs[r] != reference.regs[r])
+                out << "  " << Z16Disasm::regNames[r] << ": reference 0x" << setw(4) << reference.regs[r] << ", "
+                    << name << " 0x" << setw(4) << other.regs[r] << "\n";
+        for (size_t r = 0; r < TRAP_REG_COUNT; r++)
+            if (other.trapRegs[r] != reference.trapRegs[r])
+                out << "  trap register " << r << ": reference 0x" << setw(4) << reference.trapRegs[r] << ", "
+                    << name << " 0x" << setw(4) << other.trapRegs[r] << "\n";
+        if (other.trap.cause != reference.trap.cause || other.trap.pc != reference.trap.pc ||
+            other.trap.addr != reference.trap.addr)
+            out << "  trap: reference " << trapText(reference.trap) << ", " << name << " " << trapText(other.trap)
+                << "\n";
+        size_t listed = 0;
+        for (size_t p = 0; p < reference.dirtyPages.size(); p++) {
+            if (!((reference.dirtyPages[p] | other.dirtyPages[p]) & DIRTY_BIT))
+                continue;
+            reference.dirtyPages[p] &= ~DIRTY_BIT;
+            other.dirtyPages[p] &= ~DIRTY_BIT;
+            size_t base = p * Z16Simulator::PAGE_SIZE;
+            if (memcmp(&reference.memory[base], &other.memory[base], Z16Simulator::PAGE_SIZE) == 0)
+                continue;
+            for (size_t a = base; a < base + Z16Simulator::PAGE_SIZE && listed < MAX_BYTES; a++) {
+                if (reference.memory[a] != other.memory[a]) {
+                    out << "  memory 0x" << setw(4) << a << ": reference 0x" << setw(2) << int(reference.memory[a])
+                        << ", " << name << " 0x" << setw(2) << int(other.memory[a]) << "\n";
+                    listed++;
+                }
+            }
+        }
+        return out.str();
+    }
+
+    // compare()'s fast path, taken at almost every check point: true if the
+    // machines agree. Clears DIRTY_BIT of the pages it found equal.
+    bool agrees(Z16Simulator &other) {
+        if (other.pc != reference.pc || other.regs != reference.regs || other.trapRegs != reference.trapRegs ||
+            other.trap.cause != reference.trap.cause || other.trap.pc != reference.trap.pc ||
+            other.trap.addr != reference.trap.addr)
+            return false;
+        for (size_t p = 0; p < reference.dirtyPages.size(); p++) {
+            if (!((reference.dirtyPages[p] | other.dirtyPages[p]) & DIRTY_BIT))
+                continue;
+            size_t base = p * Z16Simulator::PAGE_SIZE;
+            if (memcmp(&reference.memory[base], &other.memory[base], Z16Simulator::PAGE_SIZE) != 0)
+                return false;
+            reference.dirtyPages[p] &= ~DIRTY_BIT;
+            other.dirtyPages[p] &= ~DIRTY_BIT;
+        }
+        return true;
+    }
+
+    static string trapText(const Z16Trap &trap) {
+        if (!trap)
+            return "none";
+        ostringstream out;
+        out << trapMessage(trap.cause) << " at 0x" << hex << setfill('0') << setw(4) << trap.pc << " (0x" << setw(4)
+            << trap.addr << ")";
+        return out.str();
+    }
+
+    // Replay the diverging slice from 'agreed' on the reference and the
+    // engine, one instruction at a time; the difference after the first
+    // instruction where they disagree, or "".
+    string replay(const Z16Snapshot &agreed, uint64_t count, uint64_t &executed) {
+        engineSim->restore(agreed);
+        if (blocks)
+            blocks->flushAll();
+        ostream *console = reference.console;
+        reference.console = &silent;           // Its output was already written once.
+        reference.restore(agreed);
+        for (size_t p = 0; p < reference.dirtyPages.size(); p++) {
+            reference.dirtyPages[p] &= ~DIRTY_BIT;
+            engineSim->dirtyPages[p] &= ~DIRTY_BIT;
+        }
+        recorded = 0;
+        string difference;
+        for (uint64_t n = 0; n < count && difference.empty();) {
+            Step step = stepReference();
+            bool referenceRunning = step != STEP_ENDED;
+            bool engineRunning = stepEngine(referenceRunning);
+            difference = compare(*engineSim, engineRunning, referenceRunning);
+            if (!referenceRunning)
+                break;
+            executed += step == STEP_DONE;
+            n += step == STEP_DONE || countTraps;
+        }
+        reference.console = console;
+        return difference;
+    }
+
+    // The report for a slice of 'count' instructions that ended in
+    // 'difference'; with everyInstruction, first replay it from 'agreed',
+    // taken after 'agreedAt' reference instructions.
+    string report(const string &difference, Z16CoSimResult &result, uint64_t count, const Z16Snapshot &agreed,
+                  uint64_t agreedAt) {
+        ostringstream out;
+        const char *name = options.engine.c_str();
+        string found = difference;
+        bool located = false;
+        if (options.everyInstruction) {
+            uint64_t executed = 0;
+            string replayed = replay(agreed, count, executed);
+            if (!replayed.empty()) {
+                found = replayed;
+                located = true;
+                result.instructions = agreedAt + executed;
+            }
+        }
+        out << "Co-simulation divergence between the reference interpreter and the " << name << " engine";
+        if (located)
+            out << " at the last instruction listed (replayed one instruction at a time)";
+        else if (options.everyInstruction)
+            out << " (stepped one instruction at a time the " << name
+                << " engine agrees with the reference over this slice, so it differs only when running it whole)";
+        out << ", after " << dec << result.instructions << " reference instructions and " << result.comparisons
+            << " comparisons:\n" << found;
+        size_t shown = min<uint64_t>(recorded, history.size());
+        out << "Last " << shown << " reference instructions:\n";
+        char text[Z16Disasm::MAX_TEXT];
+        for (uint64_t i = recorded - shown; i < recorded; i++) {
+            auto [pc, inst] = history[i % history.size()];
+            out << "0x" << hex << setfill('0') << setw(4) << pc << ": " << setw(4) << inst << "  "
+                << string(text, Z16Disasm::formatInstruction(text, pc, inst)) << "\n";
+        }
+        return out.str();
+    }
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Guest edge coverage.
+// Z16Coverage is the execution loop's COVERAGE plug-in (Z16Plugins in
+// Z16Simulator.h): every branch (taken or not), jump, call and return adds
+// one to a counter in a bitmap of MAP_SIZE 8-bit counters. As in AFL, each
+// target address hashes to a location, and the counter is that of the edge
+// from the previous transfer's target: cur ^ (prev >> 1), so A->B and B->A
+// differ and a tight loop (A->A) does not land on 0. The previous target
+// stands for the instruction that transferred, which ends the straight-line
+// run it starts. Counters wrap; collisions are accepted.
+//
+// The bitmap is the object's own unless one is passed in, so a fuzzer
+// (Z16Fuzz.h) or an external driver with a shared-memory map can read it
+// directly. One bitmap must not be written by two running simulators.
+//
+// The counters an execution touched are also listed in 'touched', so
+// clearing the map and reading what one run hit cost O(edges hit), not
+// O(MAP_SIZE); a counter that wraps is listed again. clear() also forgets
+// the previous location, so call it before each execution.
+// ---------------------------------------------------------------------------
+class Z16Coverage {
+public:
+    static const size_t MAP_SIZE = 1 << 16;
+
+    uint8_t *map;
+    std::vector<uint32_t> touched;   // Indices that went from 0 to 1 since clear().
+
+    Z16Coverage() : owned(MAP_SIZE) { map = owned.data(); }
+
+    // Count into 'shared' (MAP_SIZE bytes, zeroed) instead.
+    explicit Z16Coverage(uint8_t *shared) : map(shared) {}
+
+    Z16Coverage(const Z16Coverage &) = delete;
+    Z16Coverage &operator=(const Z16Coverage &) = delete;
+
+    void clear() {
+        for (uint32_t i : touched)
+            map[i] = 0;
+        touched.clear();
+        prev = 0;
+    }
+
+    // A control transfer to 'to'.
+    void edge(uint16_t to) {
+        uint32_t cur = location(to);
+        uint32_t i = cur ^ (prev >> 1);
+        prev = cur;
+        if (!map[i]++)
+            touched.push_back(i);
+    }
+
+    static uint32_t location(uint16_t addr) {
+        return (static_cast<uint32_t>(addr) * 0x9E3779B1u >> 16) & (MAP_SIZE - 1);
+    }
+
+private:
+    std::vector<uint8_t> owned;
+    uint32_t prev = 0;                // location() of the last target.
+};
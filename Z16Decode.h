@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstdint>       // For fixed-width integer types (uint16_t, uint8_t)
+
+// ---------------------------------------------------------------------------
+// Predecoded instruction form.
+// Every field the executor needs (handler id, register indices and the
+// sign-extended immediate) is extracted once, so the hot loop only has to
+// dispatch on 'op' instead of re-decoding the raw 16-bit word.
+// ---------------------------------------------------------------------------
+enum Z16Op : uint8_t {
+    OP_UNDECODED = 0,   // Cache slot is empty or was invalidated by a store.
+
+    // R-type
+    OP_ADD, OP_SUB, OP_SLT, OP_SLTU, OP_SLL, OP_SRL, OP_SRA,
+    OP_OR, OP_AND, OP_XOR, OP_MV, OP_JR, OP_JALR,
+
+    // I-type
+    OP_ADDI, OP_SLTI, OP_SLTUI, OP_SLLI, OP_SRLI, OP_SRAI,
+    OP_ORI, OP_ANDI, OP_XORI, OP_LI,
+
+    // B-type
+    OP_BEQ, OP_BNE, OP_BZ, OP_BNZ, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+
+    // S-type / L-type
+    OP_SB, OP_SW, OP_LB, OP_LW, OP_LBU,
+
+    // J-type / U-type
+    OP_J, OP_JAL, OP_LUI, OP_AUIPC,
+
+    // SYS-type
+    OP_ECALL,
+
+    // Encodings the executor does not implement.
+    OP_MEM_NOP,          // S/L-type with an unused funct3: silently skipped.
+    OP_BAD_R,            // "Unknown R-type instruction" warning.
+    OP_BAD_SHIFT,        // "Unimplemented I-type shift instruction" warning.
+    OP_BAD_SYS,          // "Unknown SYS-type instruction" warning.
+
+    // Not an encoding: a debugger breakpoint patched into the decode cache
+    // (Z16Simulator::setBreakpoint).
+    OP_BREAKPOINT,
+
+    OP_COUNT
+};
+
+struct DecodedOp {
+    uint8_t  op;    // Z16Op handler id.
+    uint8_t  rd;    // rd / rs1 field (bits 8:6).
+    uint8_t  rs;    // rs2 field (bits 11:9).
+    uint8_t  pad;
+    int16_t  imm;   // Immediate, memory offset, shift amount, ecall service,
+                    // or PC-relative delta for branches and jumps.
+    uint16_t inst;  // Raw instruction word (kept for tracing).
+};
+
+// Decode a raw instruction word into its predecoded form.
+// Mirrors the field extraction done by Z16Simulator::executeInstruction.
+inline DecodedOp decodeInstruction(uint16_t inst) {
+    DecodedOp d{};
+    d.inst = inst;
+    d.rd = (inst >> 6) & 0x7;
+    d.rs = (inst >> 9) & 0x7;
+    uint8_t funct3 = (inst >> 3) & 0x7;
+
+    switch (inst & 0x7) {
+        case 0x0: { // R-type
+            uint8_t funct4 = (inst >> 12) & 0xF;
+            d.op = OP_BAD_R;
+            if (funct4 == 0b0000 && funct3 == 0b000)      d.op = OP_ADD;
+            else if (funct4 == 0b0001 && funct3 == 0b000) d.op = OP_SUB;
+            else if (funct4 == 0b0000 && funct3 == 0b001) d.op = OP_SLT;
+            else if (funct4 == 0b0000 && funct3 == 0b010) d.op = OP_SLTU;
+            else if (funct4 == 0b0010 && funct3 == 0b011) d.op = OP_SLL;
+            else if (funct4 == 0b0100 && funct3 == 0b011) d.op = OP_SRL;
+            else if (funct4 == 0b1000 && funct3 == 0b011) d.op = OP_SRA;
+            else if (funct4 == 0b0001 && funct3 == 0b100) d.op = OP_OR;
+            else if (funct4 == 0b0000 && funct3 == 0b101) d.op = OP_AND;
+            else if (funct4 == 0b0000 && funct3 == 0b110) d.op = OP_XOR;
+            else if (funct4 == 0b0000 && funct3 == 0b111) d.op = OP_MV;
+            else if (funct4 == 0b0100 && funct3 == 0b000) d.op = OP_JR;
+            else if (funct4 == 0b1000 && funct3 == 0b000) d.op = OP_JALR;
+            break;
+        }
+        case 0x1: { // I-type
+            uint8_t imm7 = (inst >> 9) & 0x7F;
+            uint8_t imm3 = (inst >> 13) & 0x7;
+            d.imm = (imm7 & 0x40) ? (imm7 | 0xFF80) : imm7;
+            static const uint8_t iOps[8] = { OP_ADDI, OP_SLTI, OP_SLTUI, 0,
+                                             OP_ORI, OP_ANDI, OP_XORI, OP_LI };
+            if (funct3 != 0b011) {
+                d.op = iOps[funct3];
+            } else {
+                d.imm = imm7 & 0xF;  // Shift amount.
+                if (imm3 == 0b001)      d.op = OP_SLLI;
+                else if (imm3 == 0b010) d.op = OP_SRLI;
+                else if (imm3 == 0b100) d.op = OP_SRAI;
+                else                    d.op = OP_BAD_SHIFT;
+            }
+            break;
+        }
+        case 0x2: { // B-type: imm is the taken-branch delta from the branch PC.
+            int8_t raw_offset = (inst >> 12) & 0xF;
+            if (raw_offset & 0x8)
+                raw_offset |= 0xF0;
+            static const uint8_t bOps[8] = { OP_BEQ, OP_BNE, OP_BZ, OP_BNZ,
+                                             OP_BLT, OP_BGE, OP_BLTU, OP_BGEU };
+            d.op = bOps[funct3];
+            // BZ/BNZ branch to pc + offset*2; the two-register forms add 2.
+            d.imm = raw_offset * 2 + ((funct3 == 0b010 || funct3 == 0b011) ? 0 : 2);
+            break;
+        }
+        case 0x3: { // S-type: rd holds the base register, rs the value.
+            d.imm = (inst >> 12) & 0xF;
+            if (funct3 == 0b000)      d.op = OP_SB;
+            else if (funct3 == 0b001) d.op = OP_SW;
+            else                      d.op = OP_MEM_NOP;
+            break;
+        }
+        case 0x4: { // L-type: rd is the destination, rs the base register.
+            d.imm = (inst >> 12) & 0xF;
+            if (funct3 == 0b000)      d.op = OP_LB;
+            else if (funct3 == 0b001) d.op = OP_LW;
+            else if (funct3 == 0b100) d.op = OP_LBU;
+            else                      d.op = OP_MEM_NOP;
+            break;
+        }
+        case 0x5: { // J-type: imm is the jump delta from the jump PC.
+            int16_t rawImm = funct3 | (((inst >> 9) & 0x3F) << 3);
+            if (rawImm & (1 << 8))
+                rawImm |= 0xFE00;
+            d.imm = rawImm * 2;
+            d.op = ((inst >> 15) & 0x1) ? OP_JAL : OP_J;
+            break;
+        }
+        case 0x6: { // U-type: imm is the already shifted upper immediate.
+            uint16_t imm_val = (((inst >> 9) & 0x3F) << 3) | funct3;
+            d.imm = static_cast<int16_t>(imm_val << 7);
+            d.op = ((inst >> 15) & 0x1) ? OP_AUIPC : OP_LUI;
+            break;
+        }
+        case 0x7: { // SYS-type: imm is the service number.
+            d.imm = (inst >> 6) & 0x3FF;
+            d.op = (funct3 == 0b000) ? OP_ECALL : OP_BAD_SYS;
+            break;
+        }
+    }
+    return d;
+}
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Memory-mapped I/O.
+// A Z16Bus maps devices into the 64KB address space in whole 256-byte pages.
+// Each page of the space has one slot in a dispatch table holding the
+// device that claims it (or null for RAM), so resolving an access costs one
+// table load whatever the number of devices. Loads and stores to a claimed
+// page go to the device, a byte at a time (a word is its low byte, then its
+// high byte); instruction fetches always read RAM.
+//
+// The execution loop runs with the bus as the Z16Plugins::DEVICES plug-in,
+// so runs without devices have no device check at all. Before each
+// instruction it sets the bus clock, 'now', to the number of instructions
+// executed so far: the machine is modelled as one instruction per cycle,
+// and the timer counts those cycles.
+//
+// Device n, in mapping order, drives interrupt line n (the first 16 devices;
+// see Z16Trap.h for how the guest takes interrupts). A line is a level: the
+// timer asserts it while its STATUS bit 0 is set, the disk from the end of a
+// command until STATUS is read. The console has no line.
+//
+// Devices (register offsets are relative to the device's base address):
+//
+//   console  0x00 DATA    write: transmit a byte; read: next input byte (0 at end)
+//            0x01 STATUS  bit 0: input available, bit 1: ready to transmit (always)
+//            0x02 FLUSH   write: flush the output buffer now
+//            Output collects in a buffer that is written out in FLUSH_SIZE
+//            chunks, and before any ecall writes to the same stream.
+//
+//   timer    0x00 COUNT   u32, cycles since the timer was reset; reading
+//                         byte 0 latches all four bytes
+//            0x04 COMPARE u32
+//            0x08 STATUS  read: bit 0 set once COUNT >= COMPARE (COMPARE != 0),
+//                         which is also the interrupt; write: reset COUNT to 0
+//
+//   disk     0x00 SECTOR  u16, sector for the next command
+//            0x02 COMMAND write 1: read the sector into the buffer,
+//                         2: write the buffer to the sector
+//            0x03 STATUS  0 after a successful command, 1 after a failed one;
+//                         reading it acknowledges the interrupt
+//            0x04 SECTORS u16, sectors in the backing file (read-only)
+//            second page: the 256-byte sector buffer
+//            Sectors are SECTOR_SIZE bytes of a host file; writing past the
+//            end of the file extends it. SECTORS tops out at 0xFFFF, so
+//            sectors 0-0xFFFE are usable; a write to 0xFFFF fails.
+// ---------------------------------------------------------------------------
+class Z16Device {
+public:
+    static const size_t PAGE_SIZE = 256;
+
+    uint16_t base = 0;                 // Set when mapped.
+
+    virtual ~Z16Device() {}
+    virtual const char *name() const = 0;
+    virtual size_t pages() const { return 1; }
+    // One byte at 'offset' from the base; 'now' is the bus clock.
+    virtual uint8_t read(uint16_t offset, uint64_t now) = 0;
+    virtual void write(uint16_t offset, uint8_t value, uint64_t now) = 0;
+    // Write out anything buffered.
+    virtual void flush() {}
+    // Level of the device's interrupt line at bus time 'now'.
+    virtual bool interrupt(uint64_t) const { return false; }
+};
+
+class Z16Bus {
+public:
+    static const size_t PAGE_SIZE = Z16Device::PAGE_SIZE;
+    static const size_t PAGE_COUNT = 65536 / PAGE_SIZE;
+
+    uint64_t now = 0;                  // Instructions executed so far in the run.
+
+    // Claim pages from 'base' (page-aligned) for 'device'.
+    void map(std::unique_ptr<Z16Device> device, uint16_t base) {
+        if (base % PAGE_SIZE)
+            throw std::runtime_error(std::string(device->name()) + " must be mapped at a multiple of 0x100");
+        size_t first = base / PAGE_SIZE;
+        if (first + device->pages() > PAGE_COUNT)
+            throw std::runtime_error(std::string(device->name()) + " does not fit below 0x10000");
+        for (size_t p = first; p < first + device->pages(); p++)
+            if (table[p])
+                throw std::runtime_error(std::string(device->name()) + " overlaps " + table[p]->name());
+        device->base = base;
+        for (size_t p = first; p < first + device->pages(); p++)
+            table[p] = device.get();
+        devices.push_back(std::move(device));
+    }
+
+    bool empty() const { return devices.empty(); }
+
+    // Interrupt lines asserted now: bit n for device n.
+    uint16_t pending() const {
+        uint16_t lines = 0;
+        for (size_t i = 0; i < devices.size() && i < 16; i++)
+            if (devices[i]->interrupt(now))
+                lines |= 1 << i;
+        return lines;
+    }
+
+    // Device claiming 'addr', or null for RAM.
+    Z16Device *device(uint16_t addr) const { return table[addr / PAGE_SIZE]; }
+
+    // True if any of the 'bytes' bytes from 'addr' belongs to a device.
+    bool claims(uint16_t addr, unsigned bytes) const {
+        return table[addr / PAGE_SIZE] || table[static_cast<uint16_t>(addr + bytes - 1) / PAGE_SIZE];
+    }
+
+    uint8_t read(uint16_t addr) {
+        Z16Device *d = device(addr);
+        return d->read(addr - d->base, now);
+    }
+
+    void write(uint16_t addr, uint8_t value) {
+        Z16Device *d = device(addr);
+        d->write(addr - d->base, value, now);
+    }
+
+    void flush() {
+        for (auto &d : devices)
+            d->flush();
+    }
+
+private:
+    std::array<Z16Device *, PAGE_COUNT> table{};
+    std::vector<std::unique_ptr<Z16Device>> devices;
+};
+
+class Z16ConsoleDevice : public Z16Device {
+public:
+    static const size_t FLUSH_SIZE = 64 * 1024;
+
+    // Output goes to 'out'; input, if any, comes from 'in'.
+    explicit Z16ConsoleDevice(std::ostream &out, std::istream *in = nullptr) : out(out), in(in) {
+        buffer.reserve(FLUSH_SIZE);
+    }
+    ~Z16ConsoleDevice() override { flush(); }
+
+    const char *name() const override { return "console"; }
+
+    uint8_t read(uint16_t offset, uint64_t) override {
+        if (offset == 0) {
+            int c = in ? in->get() : EOF;
+            return c == EOF ? 0 : static_cast<uint8_t>(c);
+        }
+        if (offset == 1)
+            return (in && in->peek() != EOF ? 1 : 0) | 2;
+        return 0;
+    }
+
+    void write(uint16_t offset, uint8_t value, uint64_t) override {
+        if (offset == 0) {
+            buffer.push_back(static_cast<char>(value));
+            if (buffer.size() >= FLUSH_SIZE)
+                flush();
+        } else if (offset == 2) {
+            flush();
+        }
+    }
+
+    void flush() override {
+        if (!buffer.empty()) {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+
+private:
+    std::ostream &out;
+    std::istream *in;
+    std::string buffer;
+};
+
+class Z16TimerDevice : public Z16Device {
+public:
+    const char *name() const override { return "timer"; }
+
+    uint8_t read(uint16_t offset, uint64_t now) override {
+        if (offset == 0)
+            latched = count(now);
+        if (offset < 4)
+            return static_cast<uint8_t>(latched >> (8 * offset));
+        if (offset < 8)
+            return static_cast<uint8_t>(compare >> (8 * (offset - 4)));
+        if (offset == 8)
+            return interrupt(now);
+        return 0;
+    }
+
+    bool interrupt(uint64_t now) const override { return compare && count(now) >= compare; }
+
+    void write(uint16_t offset, uint8_t value, uint64_t now) override {
+        if (offset >= 4 && offset < 8) {
+            unsigned shift = 8 * (offset - 4);
+            compare = (compare & ~(0xFFu << shift)) | uint32_t(value) << shift;
+        } else if (offset == 8) {
+            start = now;
+        }
+    }
+
+private:
+    uint64_t start = 0;                // Bus time of the last reset.
+    uint32_t latched = 0;
+    uint32_t compare = 0;
+
+    uint32_t count(uint64_t now) const { return static_cast<uint32_t>(now - start); }
+};
+
+class Z16BlockDevice : public Z16Device {
+public:
+    static const size_t SECTOR_SIZE = 256;
+
+    explicit Z16BlockDevice(const std::string &path) : path(path) {
+        file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file) {
+            // Create it empty.
+            std::ofstream(path, std::ios::binary);
+            file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        }
+        if (!file)
+            throw std::runtime_error("Error opening disk file: " + path);
+        file.seekg(0, std::ios::end);
+        size_t bytes = static_cast<size_t>(file.tellg());
+        sectors = static_cast<uint16_t>(std::min<size_t>((bytes + SECTOR_SIZE - 1) / SECTOR_SIZE, 0xFFFF));
+    }
+
+    const char *name() const override { return "disk"; }
+    size_t pages() const override { return 2; }
+
+    uint8_t read(uint16_t offset, uint64_t) override {
+        if (offset >= PAGE_SIZE)
+            return buffer[offset - PAGE_SIZE];
+        switch (offset) {
+            case 0: return static_cast<uint8_t>(sector);
+            case 1: return static_cast<uint8_t>(sector >> 8);
+            case 3: done = false; return status;
+            case 4: return static_cast<uint8_t>(sectors);
+            case 5: return static_cast<uint8_t>(sectors >> 8);
+            default: return 0;
+        }
+    }
+
+    void write(uint16_t offset, uint8_t value, uint64_t) override {
+        if (offset >= PAGE_SIZE)
+            buffer[offset - PAGE_SIZE] = value;
+        else if (offset == 0)
+            sector = (sector & 0xFF00) | value;
+        else if (offset == 1)
+            sector = static_cast<uint16_t>((sector & 0x00FF) | value << 8);
+        else if (offset == 2)
+            command(value);
+    }
+
+    void flush() override { file.flush(); }
+
+    bool interrupt(uint64_t) const override { return done; }
+
+private:
+    std::string path;
+    std::fstream file;
+    std::array<uint8_t, SECTOR_SIZE> buffer{};
+    uint16_t sector = 0;
+    uint16_t sectors = 0;
+    uint8_t status = 0;
+    bool done = false;                 // Interrupt: a command finished, STATUS not read yet.
+
+    void command(uint8_t value) {
+        file.clear();
+        status = 1;
+        done = true;
+        if (value == 1 && sector < sectors) {
+            // The last sector of a file that is not a whole number of them reads as zero-padded.
+            buffer.fill(0);
+            file.seekg(std::streamoff(sector) * SECTOR_SIZE);
+            file.read(reinterpret_cast<char *>(buffer.data()), SECTOR_SIZE);
+            file.clear();
+            status = 0;
+        } else if (value == 2 && sector < 0xFFFF) {
+            if (sector > sectors) {
+                // Fill the gap up to the sector with zeros.
+                static const std::array<char, SECTOR_SIZE> zero{};
+                file.seekp(std::streamoff(sectors) * SECTOR_SIZE);
+                for (uint16_t s = sectors; s < sector; s++)
+                    file.write(zero.data(), SECTOR_SIZE);
+            }
+            file.seekp(std::streamoff(sector) * SECTOR_SIZE);
+            file.write(reinterpret_cast<const char *>(buffer.data()), SECTOR_SIZE);
+            if (file) {
+                sectors = std::max(sectors, static_cast<uint16_t>(sector + 1));
+                status = 0;
+            }
+        }
+    }
+};
+
+// Parse "console@ADDR", "timer@ADDR" or "disk:FILE@ADDR" and map the device
+// on 'bus'. The console writes to 'console' and reads from 'input'. False if
+// the text is malformed; mapping errors throw.
+inline bool mapDevice(const std::string &text, Z16Bus &bus, std::ostream &console, std::istream *input) {
+    size_t at = text.rfind('@');
+    if (at == std::string::npos || at + 1 >= text.size())
+        return false;
+    char *end;
+    unsigned long base = strtoul(text.c_str() + at + 1, &end, 0);
+    if (*end || base > 0xFFFF)
+        return false;
+    std::string kind = text.substr(0, at);
+    std::unique_ptr<Z16Device> device;
+    if (kind == "console")
+        device = std::make_unique<Z16ConsoleDevice>(console, input);
+    else if (kind == "timer")
+        device = std::make_unique<Z16TimerDevice>();
+    else if (kind.rfind("disk:", 0) == 0 && kind.size() > 5)
+        device = std::make_unique<Z16BlockDevice>(kind.substr(5));
+    else
+        return false;
+    bus.map(std::move(device), static_cast<uint16_t>(base));
+    return true;
+}
@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Table-driven disassembler.
+// Every one of the 65536 instruction words maps to a mnemonic and an operand
+// layout through a table built at compile time, so formatting an instruction
+// is one table lookup plus a few field extractions written straight into the
+// caller's buffer (no stringstream, no allocation). Words the ISA does not
+// define get LAYOUT_INVALID, whose "mnemonic" is the "Unknown ... instruction"
+// text disassemble() has always printed for them; that is what the linear
+// disassembly uses to tell code from data.
+//
+// The text is exactly that of the original Z16Simulator::disassemble,
+// including its quirks (sltui prints its immediate as a raw character, S/L
+// offsets are unsigned, bz/bnz targets are pc + offset * 2).
+// ---------------------------------------------------------------------------
+enum Z16Mnemonic : uint8_t {
+    MN_ADD, MN_SUB, MN_SLT, MN_SLTU, MN_SLL, MN_SRL, MN_SRA,
+    MN_OR, MN_AND, MN_XOR, MN_MV, MN_JR, MN_JALR,
+    MN_ADDI, MN_SLTI, MN_SLTUI, MN_SLLI, MN_SRLI, MN_SRAI,
+    MN_ORI, MN_ANDI, MN_XORI, MN_LI,
+    MN_BEQ, MN_BNE, MN_BZ, MN_BNZ, MN_BLT, MN_BGE, MN_BLTU, MN_BGEU,
+    MN_SB, MN_SW, MN_LB, MN_LW, MN_LBU,
+    MN_J, MN_JAL, MN_LUI, MN_AUIPC,
+    MN_ECALL,
+    MN_UNKNOWN_R, MN_UNKNOWN_I, MN_UNKNOWN_S, MN_UNKNOWN_L, MN_UNKNOWN_SYS,
+    MN_COUNT
+};
+
+enum Z16Layout : uint8_t {
+    LAYOUT_INVALID,     // Not an instruction: the mnemonic is the whole text.
+    LAYOUT_RR,          // add rd, rs2
+    LAYOUT_RD,          // jr rd
+    LAYOUT_RS2,         // jalr rs2
+    LAYOUT_IMM,         // addi rd, simm7
+    LAYOUT_IMM_CHAR,    // sltui rd, <imm7 as a character>
+    LAYOUT_SHIFT,       // slli rd, imm4
+    LAYOUT_BRANCH,      // beq rs1, rs2, 0xTTTT   (target pc + 2 + offset * 2)
+    LAYOUT_BRANCH_ZERO, // bz rs1, 0xTTTT         (target pc + offset * 2)
+    LAYOUT_STORE,       // sb rs2, off(rs1)
+    LAYOUT_LOAD,        // lb rd, off(rs2)
+    LAYOUT_JUMP,        // j 0xTTTT
+    LAYOUT_JAL,         // jal rd, 0xTTTT
+    LAYOUT_UPPER,       // lui rd, imm9
+    LAYOUT_SYS          // ecall service
+};
+
+struct Z16DisasmEntry {
+    uint8_t mnemonic;   // Z16Mnemonic
+    uint8_t layout;     // Z16Layout
+
+    constexpr bool valid() const { return layout != LAYOUT_INVALID; }
+};
+
+namespace Z16Disasm {
+
+// Longest text formatInstruction() produces.
+static const size_t MAX_TEXT = 32;
+
+inline constexpr std::array<std::string_view, MN_COUNT> mnemonics = {
+    "add", "sub", "slt", "sltu", "sll", "srl", "sra",
+    "or", "and", "xor", "mv", "jr", "jalr",
+    "addi", "slti", "sltui", "slli", "srli", "srai",
+    "ori", "andi", "xori", "li",
+    "beq", "bne", "bz", "bnz", "blt", "bge", "bltu", "bgeu",
+    "sb", "sw", "lb", "lw", "lbu",
+    "j", "jal", "lui", "auipc",
+    "ecall",
+    "Unknown R-type instruction", "Unknown I-type instruction", "Unknown S-type instruction",
+    "Unknown L-type instruction", "Unknown SYS-type instruction",
+};
+
+inline constexpr std::array<std::string_view, 8> regNames = { "t0", "ra", "sp", "s0", "s1", "t1", "a0", "a1" };
+
+// The mnemonic and layout depend only on the opcode, funct3 (bits 5:0) and
+// bits 15:12 (funct4, the shift type, the J/U f bit), so the table is filled
+// from 1024 classified keys.
+constexpr unsigned keyOf(uint16_t inst) { return (inst & 0x3F) | (inst >> 12) << 6; }
+
+constexpr Z16DisasmEntry classify(unsigned key) {
+    unsigned opcode = key & 0x7, funct3 = (key >> 3) & 0x7, funct4 = key >> 6;
+    switch (opcode) {
+        case 0x0: {   // R-type
+            if (funct4 == 0b0000 && funct3 == 0b000) return { MN_ADD, LAYOUT_RR };
+            if (funct4 == 0b0001 && funct3 == 0b000) return { MN_SUB, LAYOUT_RR };
+            if (funct4 == 0b0000 && funct3 == 0b001) return { MN_SLT, LAYOUT_RR };
+            if (funct4 == 0b0000 && funct3 == 0b010) return { MN_SLTU, LAYOUT_RR };
+            if (funct4 == 0b0010 && funct3 == 0b011) return { MN_SLL, LAYOUT_RR };
+            if (funct4 == 0b0100 && funct3 == 0b011) return { MN_SRL, LAYOUT_RR };
+            if (funct4 == 0b1000 && funct3 == 0b011) return { MN_SRA, LAYOUT_RR };
+            if (funct4 == 0b0001 && funct3 == 0b100) return { MN_OR, LAYOUT_RR };
+            if (funct4 == 0b0000 && funct3 == 0b101) return { MN_AND, LAYOUT_RR };
+            if (funct4 == 0b0000 && funct3 == 0b110) return { MN_XOR, LAYOUT_RR };
+            if (funct4 == 0b0000 && funct3 == 0b111) return { MN_MV, LAYOUT_RR };
+            if (funct4 == 0b0100 && funct3 == 0b000) return { MN_JR, LAYOUT_RD };
+            if (funct4 == 0b1000 && funct3 == 0b000) return { MN_JALR, LAYOUT_RS2 };
+            return { MN_UNKNOWN_R, LAYOUT_INVALID };
+        }
+        case 0x1: {   // I-type
+            unsigned imm3 = funct4 >> 1;   // Bits 15:13.
+            switch (funct3) {
+                case 0b000: return { MN_ADDI, LAYOUT_IMM };
+                case 0b001: return { MN_SLTI, LAYOUT_IMM };
+                case 0b010: return { MN_SLTUI, LAYOUT_IMM_CHAR };
+                case 0b011:
+                    if (imm3 == 0b001) return { MN_SLLI, LAYOUT_SHIFT };
+                    if (imm3 == 0b010) return { MN_SRLI, LAYOUT_SHIFT };
+                    if (imm3 == 0b100) return { MN_SRAI, LAYOUT_SHIFT };
+                    return { MN_UNKNOWN_I, LAYOUT_INVALID };
+                case 0b100: return { MN_ORI, LAYOUT_IMM };
+                case 0b101: return { MN_ANDI, LAYOUT_IMM };
+                case 0b110: return { MN_XORI, LAYOUT_IMM };
+                default:    return { MN_LI, LAYOUT_IMM };
+            }
+        }
+        case 0x2:     // B-type
+            if (funct3 == 0b010) return { MN_BZ, LAYOUT_BRANCH_ZERO };
+            if (funct3 == 0b011) return { MN_BNZ, LAYOUT_BRANCH_ZERO };
+            return { static_cast<uint8_t>(funct3 < 2 ? MN_BEQ + funct3 : MN_BLT + funct3 - 4), LAYOUT_BRANCH };
+        case 0x3:     // S-type
+            if (funct3 == 0b000) return { MN_SB, LAYOUT_STORE };
+            if (funct3 == 0b001) return { MN_SW, LAYOUT_STORE };
+            return { MN_UNKNOWN_S, LAYOUT_INVALID };
+        case 0x4:     // L-type
+            if (funct3 == 0b000) return { MN_LB, LAYOUT_LOAD };
+            if (funct3 == 0b001) return { MN_LW, LAYOUT_LOAD };
+            if (funct3 == 0b100) return { MN_LBU, LAYOUT_LOAD };
+            return { MN_UNKNOWN_L, LAYOUT_INVALID };
+        case 0x5:     // J-type
+            return (funct4 & 0x8) ? Z16DisasmEntry{ MN_JAL, LAYOUT_JAL } : Z16DisasmEntry{ MN_J, LAYOUT_JUMP };
+        case 0x6:     // U-type
+            return { static_cast<uint8_t>((funct4 & 0x8) ? MN_AUIPC : MN_LUI), LAYOUT_UPPER };
+        default:      // SYS-type
+            if (funct3 == 0b000) return { MN_ECALL, LAYOUT_SYS };
+            return { MN_UNKNOWN_SYS, LAYOUT_INVALID };
+    }
+}
+
+constexpr std::array<Z16DisasmEntry, 65536> buildTable() {
+    std::array<Z16DisasmEntry, 1024> byKey{};
+    for (unsigned k = 0; k < 1024; k++)
+        byKey[k] = classify(k);
+    std::array<Z16DisasmEntry, 65536> table{};
+    for (unsigned inst = 0; inst < 65536; inst++)
+        table[inst] = byKey[keyOf(static_cast<uint16_t>(inst))];
+    return table;
+}
+
+inline constexpr std::array<Z16DisasmEntry, 65536> table = buildTable();
+
+inline char *put(char *p, std::string_view s) {
+    memcpy(p, s.data(), s.size());
+    return p + s.size();
+}
+
+inline char *putReg(char *p, unsigned r) {
+    return put(p, regNames[r & 0x7]);
+}
+
+inline char *putDec(char *p, int v) {
+    if (v < 0) {
+        *p++ = '-';
+        v = -v;
+    }
+    char digits[8];
+    int n = 0;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (n)
+        *p++ = digits[--n];
+    return p;
+}
+
+// Four hex digits, lowercase ("%04x").
+inline char *putHex4(char *p, uint16_t v) {
+    static const char digits[] = "0123456789abcdef";
+    p[0] = digits[(v >> 12) & 0xF];
+    p[1] = digits[(v >> 8) & 0xF];
+    p[2] = digits[(v >> 4) & 0xF];
+    p[3] = digits[v & 0xF];
+    return p + 4;
+}
+
+// Two hex digits, lowercase ("%02x").
+inline char *putHex2(char *p, uint8_t v) {
+    static const char digits[] = "0123456789abcdef";
+    p[0] = digits[v >> 4];
+    p[1] = digits[v & 0xF];
+    return p + 2;
+}
+
+// Lowercase hex with no padding ("%x").
+inline char *putHex(char *p, unsigned v) {
+    static const char digits[] = "0123456789abcdef";
+    char buf[8];
+    int n = 0;
+    do {
+        buf[n++] = digits[v & 0xF];
+        v >>= 4;
+    } while (v);
+    while (n)
+        *p++ = buf[--n];
+    return p;
+}
+
+// Format the instruction 'inst' at 'addr' into 'p' (at least MAX_TEXT bytes,
+// not terminated); returns the end of the text.
+inline char *formatInstruction(char *p, uint16_t addr, uint16_t inst) {
+    Z16DisasmEntry e = table[inst];
+    p = put(p, mnemonics[e.mnemonic]);
+    if (!e.valid())
+        return p;
+    *p++ = ' ';
+    unsigned rd = (inst >> 6) & 0x7;     // rd / rs1
+    unsigned rs2 = (inst >> 9) & 0x7;
+    unsigned imm7 = (inst >> 9) & 0x7F;
+    unsigned off4 = (inst >> 12) & 0xF;
+    switch (e.layout) {
+        case LAYOUT_RR:
+            p = putReg(p, rd);
+            p = put(p, ", ");
+            return putReg(p, rs2);
+        case LAYOUT_RD:
+            return putReg(p, rd);
+        case LAYOUT_RS2:
+            return putReg(p, rs2);
+        case LAYOUT_IMM:
+            p = putReg(p, rd);
+            p = put(p, ", ");
+            return putDec(p, (imm7 & 0x40) ? static_cast<int>(imm7) - 0x80 : static_cast<int>(imm7));
+        case LAYOUT_IMM_CHAR:
+            p = putReg(p, rd);
+            p = put(p, ", ");
+            *p++ = static_cast<char>(imm7);
+            return p;
+        case LAYOUT_SHIFT:
+            p = putReg(p, rd);
+            p = put(p, ", ");
+            return putDec(p, imm7 & 0xF);
+        case LAYOUT_BRANCH:
+        case LAYOUT_BRANCH_ZERO: {
+            int offset = (off4 & 0x8) ? static_cast<int>(off4) - 16 : static_cast<int>(off4);
+            uint16_t target = addr + offset * 2 + (e.layout == LAYOUT_BRANCH ? 2 : 0);
+            p = putReg(p, rd);
+            if (e.layout == LAYOUT_BRANCH) {
+                p = put(p, ", ");
+                p = putReg(p, rs2);
+            }
+            p = put(p, ", 0x");
+            return putHex4(p, target);
+        }
+        case LAYOUT_STORE:
+        case LAYOUT_LOAD:
+            p = putReg(p, e.layout == LAYOUT_STORE ? rs2 : rd);
+            *p++ = ',';
+            *p++ = ' ';
+            p = putDec(p, off4);
+            *p++ = '(';
+            p = putReg(p, e.layout == LAYOUT_STORE ? rd : rs2);
+            *p++ = ')';
+            return p;
+        case LAYOUT_JUMP:
+        case LAYOUT_JAL: {
+            int imm9 = ((inst >> 9) & 0x3F) << 3 | ((inst >> 3) & 0x7);
+            if (imm9 & 0x100)
+                imm9 -= 0x200;
+            uint16_t target = addr + imm9 * 2;
+            if (e.layout == LAYOUT_JAL) {
+                p = putReg(p, rd);
+                p = put(p, ", ");
+            }
+            p = put(p, "0x");
+            return putHex4(p, target);
+        }
+        case LAYOUT_UPPER:
+            p = putReg(p, rd);
+            p = put(p, ", ");
+            return putDec(p, ((inst >> 9) & 0x3F) << 3 | ((inst >> 3) & 0x7));
+        default:   // LAYOUT_SYS
+            return putDec(p, (inst >> 6) & 0x3FF);
+    }
+}
+
+// "0xAAAA: "
+inline char *putAddress(char *p, size_t addr) {
+    *p++ = '0';
+    *p++ = 'x';
+    p = putHex4(p, static_cast<uint16_t>(addr));
+    *p++ = ':';
+    *p++ = ' ';
+    return p;
+}
+
+// Linear sweep over mem[from, to), appending one line per item to 'out':
+// NUL-terminated ASCII strings (.asciiz), runs of four or more zero words
+// (.space), other zero words and undefined instruction words (.word),
+// instructions, and a trailing odd byte (.byte). String and zero runs are
+// found in one backward pass over the range rather than by probing forward
+// from every address.
+inline void sweep(const uint8_t *mem, size_t from, size_t to, std::string &out) {
+    const size_t MIN_STR_LEN = 4;      // Minimum length for string detection.
+    const size_t MAX_PROBE = 256;      // A string must end within this many bytes.
+    const size_t THRESHOLD = 4;        // If 4 or more consecutive zero words, group them.
+
+    // Length of the run of printable/whitespace bytes (capped at MAX_PROBE)
+    // and of zero bytes starting at every address.
+    size_t n = to - from;
+    std::vector<uint16_t> textRun(n + 1, 0);
+    std::vector<uint32_t> zeroRun(n + 1, 0);
+    for (size_t i = n; i-- > 0;) {
+        uint8_t b = mem[from + i];
+        if (isprint(b) || isspace(b))
+            textRun[i] = static_cast<uint16_t>(std::min<size_t>(textRun[i + 1] + 1, MAX_PROBE));
+        zeroRun[i] = b == 0 ? zeroRun[i + 1] + 1 : 0;
+    }
+
+    char line[64];
+    size_t addr = from;
+    while (addr < to) {
+        // --- Step 1: Detect an ASCII string ---
+        size_t len = textRun[addr - from];
+        if (len >= MIN_STR_LEN && len < MAX_PROBE && addr + len < to && mem[addr + len] == 0) {
+            char *p = put(putAddress(line, addr), ".asciiz \"");
+            out.append(line, p);
+            out.append(reinterpret_cast<const char *>(mem + addr), len);
+            out.append("\"\n");
+            // Skip over the entire string and the null terminator.
+            addr += len + 1;
+            continue;
+        }
+
+        if (addr + 1 < to) {
+            // --- Step 2: Group contiguous zero words ---
+            size_t zeroCount = zeroRun[addr - from] / 2;
+            if (zeroCount >= THRESHOLD) {
+                char *p = put(putAddress(line, addr), ".space ");
+                p = putHex(p, zeroCount * 2);   // Printed in hex, as the stream-based version did.
+                p = put(p, " bytes\n");
+                out.append(line, p);
+                addr += zeroCount * 2;
+                continue;
+            }
+            if (zeroCount) {
+                // For small gaps, output each zero word individually.
+                for (size_t i = 0; i < zeroCount; i++, addr += 2) {
+                    char *p = put(putAddress(line, addr), ".word 0x0000\n");
+                    out.append(line, p);
+                }
+                continue;
+            }
+
+            // --- Step 3: Disassemble an instruction; undefined words are data ---
+            uint16_t word = mem[addr] | (mem[addr + 1] << 8);
+            char *p = putAddress(line, addr);
+            if (!table[word].valid()) {
+                p = put(p, ".word 0x");
+                p = putHex4(p, word);
+            } else {
+                p = putHex4(p, word);
+                p = put(p, "  ");
+                p = formatInstruction(p, static_cast<uint16_t>(addr), word);
+            }
+            *p++ = '\n';
+            out.append(line, p);
+            addr += 2;
+            continue;
+        }
+
+        // --- Step 4: Handle any leftover single byte ---
+        char *p = put(putAddress(line, addr), ".byte 0x");
+        p = putHex2(p, mem[addr]);
+        *p++ = '\n';
+        out.append(line, p);
+        addr++;
+    }
+}
+
+} // namespace Z16Disasm
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <memory>
+#include <unordered_set>
+#include "Z16Simulator.h"
+#include "Z16Coverage.h"
+#include "Z16CoSim.h"
+
+// ---------------------------------------------------------------------------
+// Coverage-guided fuzzing.
+// Z16Fuzzer executes inputs (raw program images, loaded at address 0 and run
+// from pc 0 like a binary) in-process, on one pooled simulator:
+//
+//   - reset: the simulator is restored to a blank snapshot taken once, which
+//     copies back only the pages the previous input wrote, and the input is
+//     copied in with Z16Simulator::loadBytes; nothing is O(memory) per run;
+//   - run: the predecoded interpreter with the COVERAGE plug-in, which counts
+//     guest control-flow edges into the Z16Coverage bitmap, under an
+//     instruction budget, with the console silenced;
+//   - with 'differential' set, the input is also co-simulated (Z16CoSim.h)
+//     on that engine against the reference interpreter, which fuzzes the
+//     decoder and the engines rather than the guest.
+//
+// step() is one fuzzing iteration: pick a corpus entry, mutate it, execute
+// it, and keep it if its edges, bucketed by hit count as in AFL (1, 2, 3,
+// 4-7, 8-15, 16-31, 32-127, 128+), reached a bucket no input reached before.
+// The corpus holds at most maxCorpus entries; past that a new one replaces
+// a random one, so a long run keeps exploring in bounded memory.
+// An unhandled trap at a (cause, pc) not seen before is reported as a crash,
+// a co-simulation divergence as a divergence.
+//
+// The mutator is built from the decode tables (Z16Disasm::table): it knows
+// the valid encodings of every mnemonic and which bits of each opcode are
+// operands, so most mutations keep a word a valid instruction:
+//
+//   - replace a word with a random instruction (uniform over mnemonics), or
+//     with an ecall of an implemented service;
+//   - re-randomize a word's operands, or flip one operand bit;
+//   - change a word's function (another mnemonic of its opcode), keeping
+//     its operand bits;
+//   - insert, delete or copy words; overwrite a random byte; splice with
+//     another corpus entry.
+//
+// Each iteration stacks 1 to MAX_STACK of them. On small programs with the
+// default budget one core runs well over 100k executions per second; the
+// bitmap is cleared and read through Z16Coverage::touched, so its size does
+// not add to that.
+// ---------------------------------------------------------------------------
+struct Z16FuzzOptions {
+    uint64_t maxInstructions = 1024;   // Per execution.
+    size_t maxLength = 256;            // Bytes per input (at most 64KB).
+    Z16Misaligned misaligned = Z16Misaligned::Allow;
+    uint64_t seed = 1;
+    string differential;               // Engine to co-simulate with; empty: none.
+    size_t maxCorpus = 4096;           // Entries kept in memory.
+};
+
+enum class Z16FuzzEnd { Finished, Trapped, Budget };
+
+struct Z16FuzzResult {
+    Z16FuzzEnd end = Z16FuzzEnd::Finished;
+    Z16Trap trap;                      // The unhandled trap, if end is Trapped.
+    bool diverged = false;
+    string report;                     // The co-simulation report, if diverged.
+};
+
+struct Z16FuzzStats {
+    uint64_t executions = 0;
+    uint64_t crashes = 0;              // New (cause, pc) unhandled traps.
+    uint64_t divergences = 0;
+    size_t edges = 0;                  // Bitmap entries ever hit.
+};
+
+class Z16Fuzzer {
+public:
+    static const size_t MAX_STACK = 4;     // Mutations per iteration.
+
+    // Bitmap of the last execution.
+    Z16Coverage coverage;
+
+    explicit Z16Fuzzer(const Z16FuzzOptions &options)
+        : options(options), silent(nullptr), trace(silent, TraceMode::None), virgin(Z16Coverage::MAP_SIZE, 0xFF),
+          random(options.seed ? options.seed : 1) {
+        this->options.maxLength = max<size_t>(2, min(options.maxLength, Z16Simulator::MEM_SIZE));
+        this->options.maxCorpus = max<size_t>(1, options.maxCorpus);
+        budget.maxInstructions = options.maxInstructions;
+        budget.detectLivelock = false;
+        sim.console = &silent;
+        sim.misaligned = options.misaligned;
+        blank = sim.snapshot();
+        plugins.coverage = &coverage;
+        if (!options.differential.empty()) {
+            reference.console = &silent;
+            reference.misaligned = options.misaligned;
+            Z16CoSimOptions cosimOptions;
+            cosimOptions.engine = options.differential;
+            cosimOptions.budget = budget;
+            cosim = make_unique<Z16CoSim>(reference, cosimOptions);
+        }
+        for (unsigned inst = 0; inst < 65536; inst++) {
+            const Z16DisasmEntry &e = Z16Disasm::table[inst];
+            if (e.valid()) {
+                byMnemonic[e.mnemonic].push_back(static_cast<uint16_t>(inst));
+                byOpcode[inst & 0x7].push_back(static_cast<uint16_t>(inst));
+            }
+        }
+        for (size_t m = 0; m < MN_COUNT; m++)
+            if (!byMnemonic[m].empty())
+                mnemonics.push_back(static_cast<uint8_t>(m));
+    }
+
+    // Run one input and leave its edges in 'coverage'.
+    Z16FuzzResult execute(const uint8_t *data, size_t size) {
+        size = min(size, Z16Simulator::MEM_SIZE);
+        Z16FuzzResult result;
+        sim.restore(blank);
+        sim.loadBytes(0, data, size);
+        sim.programSize = size;
+        coverage.clear();
+        Z16Watchdog watchdog(budget);
+        if (!sim.executionLoop<false, Z16Plugins::COVERAGE>(trace, watchdog, &plugins))
+            result.end = Z16FuzzEnd::Budget;
+        else if (sim.trap)
+            result.end = Z16FuzzEnd::Trapped;
+        result.trap = sim.trap;
+        stats.executions++;
+        if (cosim) {
+            reference.restore(blank);
+            reference.loadBytes(0, data, size);
+            reference.programSize = size;
+            Z16CoSimResult diff = cosim->run();
+            result.diverged = diff.diverged;
+            result.report = std::move(diff.report);
+        }
+        return result;
+    }
+
+    // Execute 'input' and add it to the corpus if it found new coverage (or,
+    // with 'always', regardless). True if it was added.
+    bool addSeed(vector<uint8_t> input, bool always = true) {
+        if (input.size() > options.maxLength)
+            input.resize(options.maxLength);
+        Z16FuzzResult result = execute(input.data(), input.size());
+        judge(result);
+        if (!mergeCoverage() && !always)
+            return false;
+        keep(std::move(input));
+        return true;
+    }
+
+    // What one step() found.
+    struct Event {
+        bool newCoverage = false;      // The input was added to the corpus.
+        bool crash = false;
+        bool divergence = false;
+    };
+
+    // One fuzzing iteration. The input it ran is lastInput(), its outcome
+    // lastResult().
+    Event step() {
+        if (entries.empty())
+            addSeed(randomProgram());
+        current = entries[next() % entries.size()];
+        size_t count = 1 + next() % MAX_STACK;
+        for (size_t i = 0; i < count; i++)
+            mutate(current);
+        last = execute(current.data(), current.size());
+        Event event = judge(last);
+        if (mergeCoverage()) {
+            keep(current);
+            event.newCoverage = true;
+        }
+        return event;
+    }
+
+    // Apply one random mutation to 'input'.
+    void mutate(vector<uint8_t> &input) {
+        if (input.size() < 2) {
+            putWord(input, 0, randomInstruction());
+            return;
+        }
+        size_t words = input.size() / 2;
+        size_t at = (next() % words) * 2;
+        uint16_t word = getWord(input, at);
+        const Z16DisasmEntry &e = Z16Disasm::table[word];
+        switch (next() % 10) {
+            case 0:
+                putWord(input, at, randomInstruction());
+                break;
+            case 1: {
+                static const uint16_t services[] = { 1, 3, 5, 16, 17, 18 };
+                putWord(input, at, static_cast<uint16_t>(services[next() % 6] << 6 | 0x7));
+                break;
+            }
+            case 2:
+                // Same mnemonic, new operands.
+                putWord(input, at, e.valid() ? pick(byMnemonic[e.mnemonic]) : randomInstruction());
+                break;
+            case 3:
+                putWord(input, at, word ^ oneOperandBit(word));
+                break;
+            case 4: {
+                // Another function of the same opcode, same operands.
+                uint16_t mask = OPERAND_MASK[word & 0x7];
+                putWord(input, at, static_cast<uint16_t>((word & mask) | (pick(byOpcode[word & 0x7]) & ~mask)));
+                break;
+            }
+            case 5:
+                if (input.size() + 2 <= options.maxLength) {
+                    uint16_t inst = randomInstruction();
+                    input.insert(input.begin() + at, { static_cast<uint8_t>(inst), static_cast<uint8_t>(inst >> 8) });
+                }
+                break;
+            case 6:
+                if (words > 1)
+                    input.erase(input.begin() + at, input.begin() + at + 2);
+                break;
+            case 7: {
+                // Copy a run of words over another place.
+                size_t from = (next() % words) * 2;
+                size_t length = min<size_t>(2 * (1 + next() % 8), min(input.size() - from, input.size() - at));
+                memmove(&input[at], &input[from], length & ~size_t(1));
+                break;
+            }
+            case 8:
+                input[next() % input.size()] = static_cast<uint8_t>(next());
+                break;
+            default: {
+                // Splice: this input's head, another's tail.
+                if (entries.size() < 2)
+                    break;
+                const vector<uint8_t> &other = entries[next() % entries.size()];
+                if (other.size() <= at)
+                    break;
+                input.resize(at);
+                input.insert(input.end(), other.begin() + at, other.end());
+                if (input.size() > options.maxLength)
+                    input.resize(options.maxLength);
+                break;
+            }
+        }
+    }
+
+    const vector<vector<uint8_t>> &corpus() const { return entries; }
+    const vector<uint8_t> &lastInput() const { return current; }
+    const Z16FuzzResult &lastResult() const { return last; }
+    const Z16FuzzStats &statistics() const { return stats; }
+    const Z16FuzzOptions &settings() const { return options; }
+
+    // The differential engine's machine; null without 'differential'. Its
+    // breakpoints outlive executions (z16fuzz --check plants a fault there).
+    Z16Simulator *engineUnderTest() { return cosim ? &cosim->engineState() : nullptr; }
+
+private:
+    // Operand bits of each opcode (bits 2:0): everything but the opcode and
+    // the function fields.
+    static constexpr uint16_t OPERAND_MASK[8] = {
+        0x0FC0,   // R: rs2, rd
+        0xFFC0,   // I: imm7 (or shift type and amount), rd
+        0xFFC0,   // B: offset, rs2, rs1
+        0xFFC0,   // S: offset, rs2, rs1
+        0xFFC0,   // L: offset, rs2, rd
+        0x7FF8,   // J: imm, rd
+        0x7FF8,   // U: imm, rd
+        0xFFC0,   // SYS: service
+    };
+
+    Z16FuzzOptions options;
+    Z16Budget budget;
+    ostream silent;
+    Z16TraceWriter trace;
+    Z16Simulator sim;
+    Z16Snapshot blank;                        // Memory all zero, registers reset.
+    Z16Plugins plugins;
+    Z16Simulator reference;                   // Differential runs only.
+    unique_ptr<Z16CoSim> cosim;
+
+    vector<uint8_t> virgin;                   // Buckets no input has reached yet, per entry.
+    vector<vector<uint8_t>> entries;
+    vector<uint8_t> current;
+    Z16FuzzResult last;
+    unordered_set<uint32_t> trapsSeen;        // cause << 16 | pc
+    Z16FuzzStats stats;
+
+    vector<uint16_t> byMnemonic[MN_COUNT];    // Valid encodings.
+    vector<uint16_t> byOpcode[8];
+    vector<uint8_t> mnemonics;                // Those with any.
+    uint64_t random;
+
+    uint64_t next() {
+        random ^= random << 13;
+        random ^= random >> 7;
+        random ^= random << 17;
+        return random;
+    }
+
+    uint16_t pick(const vector<uint16_t> &words) { return words[next() % words.size()]; }
+
+    uint16_t randomInstruction() { return pick(byMnemonic[mnemonics[next() % mnemonics.size()]]); }
+
+    uint16_t oneOperandBit(uint16_t word) {
+        uint16_t mask = OPERAND_MASK[word & 0x7];
+        unsigned bits = __builtin_popcount(mask), n = next() % bits;
+        for (unsigned b = 0; b < 16; b++)
+            if ((mask >> b & 1) && n-- == 0)
+                return static_cast<uint16_t>(1u << b);
+        return 0;
+    }
+
+    static uint16_t getWord(const vector<uint8_t> &input, size_t at) {
+        return input[at] | (at + 1 < input.size() ? input[at + 1] << 8 : 0);
+    }
+
+    static void putWord(vector<uint8_t> &input, size_t at, uint16_t word) {
+        if (input.size() < at + 2)
+            input.resize(at + 2);
+        input[at] = word & 0xFF;
+        input[at + 1] = word >> 8;
+    }
+
+    vector<uint8_t> randomProgram() {
+        vector<uint8_t> program;
+        for (size_t i = 0; i < 8 && program.size() + 2 <= options.maxLength; i++)
+            putWord(program, program.size(), randomInstruction());
+        return program;
+    }
+
+    void keep(vector<uint8_t> input) {
+        if (entries.size() < options.maxCorpus)
+            entries.push_back(std::move(input));
+        else
+            entries[next() % entries.size()] = std::move(input);
+    }
+
+    // Crash and divergence bookkeeping for 'result'.
+    Event judge(const Z16FuzzResult &result) {
+        Event event;
+        if (result.end == Z16FuzzEnd::Trapped &&
+            trapsSeen.insert(static_cast<uint32_t>(result.trap.cause) << 16 | result.trap.pc).second) {
+            event.crash = true;
+            stats.crashes++;
+        }
+        if (result.diverged) {
+            event.divergence = true;
+            stats.divergences++;
+        }
+        return event;
+    }
+
+    // Fold the last execution's bitmap into 'virgin'; true if it reached a
+    // new hit-count bucket anywhere.
+    bool mergeCoverage() {
+        static const auto buckets = [] {
+            array<uint8_t, 256> b{};
+            for (unsigned n = 1; n < 256; n++)
+                b[n] = n == 1 ? 1 : n == 2 ? 2 : n == 3 ? 4 : n < 8 ? 8 : n < 16 ? 16 : n < 32 ? 32 : n < 128 ? 64 : 128;
+            return b;
+        }();
+        bool found = false;
+        for (uint32_t i : coverage.touched) {
+            uint8_t bucket = buckets[coverage.map[i]];
+            if (virgin[i] & bucket) {
+                stats.edges += virgin[i] == 0xFF;
+                virgin[i] &= ~bucket;
+                found = true;
+            }
+        }
+        return found;
+    }
+};
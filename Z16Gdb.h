@@ -0,0 +1,528 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Z16Simulator.h"
+#include "Z16Threaded.h"
+#include "Z16BlockEngine.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define Z16_GDB_AVAILABLE 1
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#else
+#define Z16_GDB_AVAILABLE 0
+#endif
+
+// ---------------------------------------------------------------------------
+// GDB remote serial protocol stub.
+// Z16GdbServer lets a debugger that speaks RSP drive the simulator over a
+// Unix socket or a pair of pipes (e.g. "target remote | rvsim --gdb=- ...").
+// It serves one connection at a time and understands:
+//
+//   ?  g G p P        stop reason; all registers; one register (read/write)
+//   m M               memory read/write
+//   c s               continue, single step (optionally from an address)
+//   Z0/z0, Z1/z1      breakpoints (software and "hardware" are the same thing)
+//   Z2-Z4 / z2-z4     write, read and access watchpoints
+//   qSupported, qAttached, QStartNoAckMode, H, k, D, and Ctrl-C while running
+//
+// Registers are numbered t0, ra, sp, s0, s1, t1, a0, a1 (0-7) then pc (8),
+// each 16 bits, sent little-endian as 4 hex digits.
+//
+// Continuing runs the selected engine (switch, threaded, block or jit) at full
+// speed. A breakpoint is an OP_BREAKPOINT in the decode cache
+// (Z16Simulator::setBreakpoint), and the block engine ends its blocks before
+// one, so no engine consults a breakpoint list per instruction. The engine
+// runs in slices of SLICE instructions, between which the connection is
+// polled for Ctrl-C. Write watchpoints are the predecoded interpreter's
+// WATCH plug-in (Z16Stops.h), so while one is set continuing runs that loop
+// at nearly full speed, stopping after the store. While a read or access
+// watchpoint is set, continuing single-steps instead, checking each load and
+// store against the watched ranges.
+//
+// Stop replies: T05 (with swbreak: or watch:/rwatch:/awatch:) for breakpoints,
+// watchpoints and steps, T02 for Ctrl-C, T0b/T07/T04 (SIGSEGV, SIGBUS, SIGILL)
+// for a trap the guest does not handle, and W00 once the program has ended.
+//
+// Only built where Unix sockets and poll() exist (Z16_GDB_AVAILABLE).
+// ---------------------------------------------------------------------------
+#if Z16_GDB_AVAILABLE
+class Z16GdbServer {
+public:
+    static const uint64_t SLICE = 1 << 22;     // Instructions between Ctrl-C polls.
+
+    Z16GdbServer(Z16Simulator &sim, const string &engine = "switch", size_t jitThreshold = 32)
+        : sim(sim), engine(engine), silent(nullptr), trace(silent, TraceMode::None) {
+        if (engine == "block" || engine == "jit") {
+            blocks = make_unique<Z16BlockEngine>(sim);
+            if (engine == "jit")
+                blocks->jitThreshold = jitThreshold;
+        }
+    }
+
+    ~Z16GdbServer() {
+        clearAll();
+    }
+
+    // Listen on a Unix socket at 'path' and serve the first debugger that
+    // connects, until it detaches or kills the program. A socket left at
+    // 'path' by an earlier run is replaced; anything else there is an error.
+    void serveSocket(const string &path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof address.sun_path)
+            throw runtime_error("Socket path too long: " + path);
+        memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0)
+            throw runtime_error("Error creating socket: " + path);
+        struct stat existing;
+        if (lstat(path.c_str(), &existing) == 0) {
+            if (!S_ISSOCK(existing.st_mode)) {
+                close(listener);
+                throw runtime_error("Not a socket, not replacing it: " + path);
+            }
+            unlink(path.c_str());
+        }
+        if (bind(listener, reinterpret_cast<sockaddr *>(&address), sizeof address) < 0 || listen(listener, 1) < 0) {
+            close(listener);
+            throw runtime_error("Error listening on socket: " + path);
+        }
+        int connection = accept(listener, nullptr, nullptr);
+        close(listener);
+        unlink(path.c_str());
+        if (connection < 0)
+            throw runtime_error("Error accepting a debugger on socket: " + path);
+        serve(connection, connection);
+        close(connection);
+    }
+
+    // Serve over already open descriptors: packets arrive on 'in', replies
+    // go to 'out'.
+    void serve(int in, int out) {
+        inFd = in;
+        outFd = out;
+        string packet;
+        while (readPacket(packet) && handle(packet)) {}
+    }
+
+private:
+    enum WatchKind { WATCH_WRITE = 2, WATCH_READ = 3, WATCH_ACCESS = 4 };
+    struct Watchpoint {
+        WatchKind kind;
+        uint16_t addr;
+        uint16_t length;
+    };
+
+    Z16Simulator &sim;
+    string engine;
+    unique_ptr<Z16BlockEngine> blocks;         // Block and jit engines only.
+    vector<Watchpoint> watchpoints;
+    Z16Watchpoints writes;                     // The WATCH_WRITE ones, for the plug-in.
+    ostream silent;                            // Engines run untraced.
+    Z16TraceWriter trace;
+    string lastStop = "S05";
+    int inFd = -1, outFd = -1;
+    bool ack = true;
+    string input;                              // Bytes read but not used yet...
+    size_t inputPos = 0;                       // ...from here.
+
+    static const char *hexDigits() { return "0123456789abcdef"; }
+
+    static void putHex(string &out, uint8_t byte) {
+        out += hexDigits()[byte >> 4];
+        out += hexDigits()[byte & 0xF];
+    }
+
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // Parse hex digits from 'at'; stops at the first non-digit.
+    static unsigned long parseHex(const string &s, size_t &at) {
+        unsigned long value = 0;
+        while (at < s.size() && hexValue(s[at]) >= 0)
+            value = value << 4 | hexValue(s[at++]);
+        return value;
+    }
+
+    // Register 'n' (0-7 regs, 8 pc).
+    uint16_t &reg(unsigned n) { return n < 8 ? sim.regs[n] : sim.pc; }
+
+    // -----------------------------------------------------
+    // Packets.
+    // -----------------------------------------------------
+    // Next input byte, or -1 at end of input.
+    int getByte() {
+        if (inputPos == input.size()) {
+            char buffer[4096];
+            ssize_t n = read(inFd, buffer, sizeof buffer);
+            if (n <= 0)
+                return -1;
+            input.assign(buffer, n);
+            inputPos = 0;
+        }
+        return static_cast<uint8_t>(input[inputPos++]);
+    }
+
+    void send(const string &bytes) {
+        size_t done = 0;
+        while (done < bytes.size()) {
+            ssize_t n = write(outFd, bytes.data() + done, bytes.size() - done);
+            if (n <= 0)
+                return;
+            done += n;
+        }
+    }
+
+    bool readPacket(string &packet) {
+        int c;
+        do {
+            c = getByte();
+            if (c == 3) {                      // Ctrl-C while stopped: report where we are.
+                packet = "?";
+                return true;
+            }
+        } while (c != '$' && c >= 0);
+        packet.clear();
+        while ((c = getByte()) != '#' && c >= 0)
+            packet += static_cast<char>(c);
+        int high = getByte(), low = getByte();
+        if (c < 0 || low < 0)
+            return false;
+        uint8_t sum = 0;
+        for (char ch : packet)
+            sum += static_cast<uint8_t>(ch);
+        bool valid = hexValue(high) * 16 + hexValue(low) == sum;
+        if (ack)
+            send(valid ? "+" : "-");
+        if (!valid)
+            return readPacket(packet);
+        // Binary data is escaped as '}' followed by the byte XOR 0x20.
+        string unescaped;
+        for (size_t i = 0; i < packet.size(); i++)
+            unescaped += packet[i] == '}' && i + 1 < packet.size() ? static_cast<char>(packet[++i] ^ 0x20) : packet[i];
+        packet.swap(unescaped);
+        return true;
+    }
+
+    void reply(const string &data) {
+        string out = "$";
+        for (char c : data) {
+            if (c == '$' || c == '#' || c == '}' || c == '*') {
+                out += '}';
+                c ^= 0x20;
+            }
+            out += c;
+        }
+        uint8_t sum = 0;
+        for (size_t i = 1; i < out.size(); i++)
+            sum += static_cast<uint8_t>(out[i]);
+        out += '#';
+        putHex(out, sum);
+        send(out);
+        // The acknowledgement is read (and skipped) with the next packet.
+    }
+
+    // True if the debugger sent Ctrl-C; polls without blocking.
+    bool interrupted() {
+        for (;;) {
+            while (inputPos < input.size())
+                if (input[inputPos++] == 3)
+                    return true;
+            pollfd p{ inFd, POLLIN, 0 };
+            if (poll(&p, 1, 0) <= 0 || !(p.revents & POLLIN))
+                return false;
+            if (getByte() == 3)
+                return true;
+        }
+    }
+
+    // Handle one packet; false to end the session.
+    bool handle(const string &packet) {
+        string out;
+        size_t at = 1;
+        char command = packet.empty() ? 0 : packet[0];
+        switch (command) {
+            case '?':
+                out = lastStop;
+                break;
+            case 'g':
+                for (unsigned r = 0; r < 9; r++) {
+                    putHex(out, reg(r) & 0xFF);
+                    putHex(out, reg(r) >> 8);
+                }
+                break;
+            case 'G':
+                for (unsigned r = 0; r < 9 && at + 4 <= packet.size(); r++, at += 4)
+                    reg(r) = static_cast<uint16_t>(hexByte(packet, at) | hexByte(packet, at + 2) << 8);
+                out = "OK";
+                break;
+            case 'p': {
+                unsigned r = parseHex(packet, at);
+                if (r > 8) {
+                    out = "E01";
+                    break;
+                }
+                putHex(out, reg(r) & 0xFF);
+                putHex(out, reg(r) >> 8);
+                break;
+            }
+            case 'P': {
+                unsigned r = parseHex(packet, at);
+                if (r > 8 || at + 5 > packet.size() || packet[at] != '=') {
+                    out = "E01";
+                    break;
+                }
+                reg(r) = static_cast<uint16_t>(hexByte(packet, at + 1) | hexByte(packet, at + 3) << 8);
+                out = "OK";
+                break;
+            }
+            case 'm': {
+                uint16_t addr = parseHex(packet, at);
+                at++;
+                size_t length = parseHex(packet, at);
+                for (size_t i = 0; i < length && i < Z16Simulator::MEM_SIZE; i++)
+                    putHex(out, sim.readByte(addr + i));
+                break;
+            }
+            case 'M': {
+                uint16_t addr = parseHex(packet, at);
+                at++;
+                size_t length = parseHex(packet, at);
+                at++;
+                for (size_t i = 0; i < length && at + 2 <= packet.size(); i++, at += 2)
+                    writeMemory(addr + i, hexByte(packet, at));
+                out = "OK";
+                break;
+            }
+            case 'c':
+            case 's':
+                if (at < packet.size())
+                    sim.pc = parseHex(packet, at);
+                out = lastStop = resume(command == 's');
+                break;
+            case 'Z':
+            case 'z': {
+                unsigned type = parseHex(packet, at);
+                at++;
+                uint16_t addr = parseHex(packet, at);
+                at++;
+                uint16_t length = parseHex(packet, at);
+                out = point(command == 'Z', type, addr, length ? length : 1) ? "OK" : "";
+                break;
+            }
+            case 'q':
+                if (packet.rfind("qSupported", 0) == 0)
+                    out = "PacketSize=4000;swbreak+;hwbreak+;QStartNoAckMode+";
+                else if (packet == "qAttached")
+                    out = "1";
+                else if (packet == "qC")
+                    out = "QC1";
+                else if (packet == "qfThreadInfo")
+                    out = "m1";
+                else if (packet == "qsThreadInfo")
+                    out = "l";
+                break;
+            case 'Q':
+                if (packet == "QStartNoAckMode") {
+                    reply("OK");
+                    ack = false;
+                    return true;
+                }
+                break;
+            case 'H':
+            case 'T':
+                out = "OK";
+                break;
+            case 'D':
+                // Detach: the program runs on to its end on its own.
+                reply("OK");
+                clearAll();
+                runFree();
+                return false;
+            case 'k':
+                return false;
+        }
+        reply(out);
+        return true;
+    }
+
+    static uint8_t hexByte(const string &s, size_t at) {
+        return static_cast<uint8_t>(hexValue(s[at]) << 4 | hexValue(s[at + 1]));
+    }
+
+    void writeMemory(uint16_t addr, uint8_t value) {
+        sim.writeByte(addr, value);
+        if (blocks)
+            blocks->invalidate(addr, 1);
+    }
+
+    // -----------------------------------------------------
+    // Breakpoints and watchpoints.
+    // -----------------------------------------------------
+    bool point(bool set, unsigned type, uint16_t addr, uint16_t length) {
+        if (type <= 1) {
+            set ? sim.setBreakpoint(addr) : sim.clearBreakpoint(addr);
+            if (blocks)
+                blocks->invalidate(addr, 2);
+            return true;
+        }
+        if (type > WATCH_ACCESS)
+            return false;
+        WatchKind kind = static_cast<WatchKind>(type);
+        auto same = [&](const Watchpoint &w) { return w.kind == kind && w.addr == addr && w.length == length; };
+        if (set)
+            watchpoints.push_back({ kind, addr, length });
+        else
+            watchpoints.erase(remove_if(watchpoints.begin(), watchpoints.end(), same), watchpoints.end());
+        if (kind == WATCH_WRITE)
+            set ? writes.add(addr, length) : writes.remove(addr, length);
+        return true;
+    }
+
+    void clearAll() {
+        while (!sim.breakpoints.empty())
+            point(false, 0, sim.breakpoints.back().addr, 1);
+        watchpoints.clear();
+        writes.clear();
+    }
+
+    // True if a read or access watchpoint is set: those need single steps.
+    bool stepping() const {
+        return any_of(watchpoints.begin(), watchpoints.end(), [](const Watchpoint &w) { return w.kind != WATCH_WRITE; });
+    }
+
+    // Stop reply if the access 'd' is about to make hits a watchpoint, else "".
+    string watchHit(const DecodedOp &d) const {
+        bool store = d.op == OP_SB || d.op == OP_SW;
+        bool load = d.op == OP_LB || d.op == OP_LBU || d.op == OP_LW;
+        if (!store && !load)
+            return "";
+        uint16_t addr = (store ? sim.regs[d.rd] : sim.regs[d.rs]) + d.imm;
+        unsigned bytes = d.op == OP_SW || d.op == OP_LW ? 2 : 1;
+        for (const Watchpoint &w : watchpoints) {
+            if (w.kind == (store ? WATCH_READ : WATCH_WRITE))
+                continue;
+            for (unsigned i = 0; i < bytes; i++) {
+                uint16_t a = addr + i;
+                if (static_cast<uint16_t>(a - w.addr) < w.length) {
+                    static const char *const names[] = { "watch", "rwatch", "awatch" };
+                    char text[32];
+                    snprintf(text, sizeof text, "T05%s:%x;", names[w.kind - WATCH_WRITE], a);
+                    return text;
+                }
+            }
+        }
+        return "";
+    }
+
+    // -----------------------------------------------------
+    // Execution.
+    // -----------------------------------------------------
+
+    // Step or continue; returns the stop reply.
+    string resume(bool step) {
+        // Leave the current instruction first: a breakpoint on it was
+        // reported when the run stopped there.
+        string stop = stepOne();
+        if (!stop.empty())
+            return stop;
+        if (step)
+            return "T05";
+        for (;;) {
+            if (!stepping()) {
+                Z16Budget slice;
+                slice.maxInstructions = SLICE;
+                slice.detectLivelock = false;
+                Z16Watchdog watchdog(slice);
+                if (runEngine(watchdog))
+                    return ended();
+            } else {
+                for (uint64_t n = 0; n < SLICE; n++) {
+                    if (sim.isBreakpoint(sim.pc))
+                        return "T05swbreak:;";
+                    if (!(stop = stepOne()).empty())
+                        return stop;
+                }
+            }
+            if (interrupted())
+                return "T02";
+        }
+    }
+
+    // Execute the instruction at pc (the real one, even under a breakpoint).
+    // Returns a stop reply if the step ended the run, trapped or hit a
+    // watchpoint, else "".
+    string stepOne() {
+        if (sim.pc >= sim.programSize)
+            return "W00";
+        DecodedOp d = decodeInstruction(sim.readWord(sim.pc));
+        string watch = watchpoints.empty() ? string() : watchHit(d);
+        uint16_t storeAddr = sim.regs[d.rd] + d.imm;
+        if (!sim.executeDecoded(d)) {
+            if (!sim.trap)
+                return "W00";                      // ecall 3, or ran off the end.
+            if (!sim.enterTrap())
+                return ended();
+            return "";
+        }
+        if (blocks && (d.op == OP_SB || d.op == OP_SW))
+            blocks->invalidate(storeAddr, d.op == OP_SW ? 2 : 1);
+        return watch;
+    }
+
+    // Run the engine until it stops; false if the watchdog's slice ran out.
+    bool runEngine(Z16Watchdog &watchdog) {
+        if (!writes.empty()) {
+            Z16Plugins plugins;
+            plugins.watch = &writes;
+            bool finished = sim.runExecution<false>(trace, watchdog, plugins);
+            // Stores in that run did not go through the block engine.
+            if (blocks)
+                blocks->flushAll();
+            return finished;
+        }
+        if (blocks)
+            return blocks->run<false>(trace, watchdog);
+        if (engine == "threaded")
+            return runThreaded<false>(sim, trace, watchdog);
+        return sim.runExecution<false>(trace, watchdog);
+    }
+
+    // The engine stopped by itself: a breakpoint, a watchpoint, a trap or
+    // the end.
+    string ended() {
+        if (!sim.trap)
+            return "W00";
+        Z16Trap stop = sim.trap;
+        sim.trap = Z16Trap();
+        char text[32];
+        switch (stop.cause) {
+            case Z16TrapCause::Breakpoint:         return "T05swbreak:;";
+            case Z16TrapCause::Watchpoint:
+                snprintf(text, sizeof text, "T05watch:%x;", stop.addr);
+                return text;
+            case Z16TrapCause::MisalignedLoad:
+            case Z16TrapCause::MisalignedStore:    return "T07";
+            case Z16TrapCause::IllegalInstruction: return "T04";
+            default:                               return "T0b";
+        }
+    }
+
+    // After a detach: run to the end with nothing armed.
+    void runFree() {
+        Z16Watchdog watchdog;
+        runEngine(watchdog);
+    }
+};
+#endif
@@ -0,0 +1,706 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include "Z16Simulator.h"
+#include "Z16Batch.h"
+
+// ---------------------------------------------------------------------------
+// Lock-step many-harts engine.
+// Runs LANES copies of one program at once, each with its own registers,
+// program counter and 64KB memory. Registers are stored structure-of-arrays
+// (regs[reg][lane]), so one instruction is executed for all lanes at once:
+// with GCC and Clang the register and pc updates are written with vector
+// extensions (one LANES x 16-bit vector per register, SSE/AVX2/NEON code);
+// other compilers get the equivalent lane loops.
+//
+// Lanes at the same pc form a group and execute together; lanes outside the
+// group are masked off (every update blends the new value in under a
+// 0x0000/0xFFFF lane mask). Each step runs the group at the lowest pc, so
+// when a branch diverges the lanes that fell behind catch up and the groups
+// re-converge as soon as the pcs meet again, e.g. at the join point after an
+// if/else or at the exit of a loop some lanes left earlier.
+//
+// Code is decoded once for all lanes. A halfword of the program image that
+// a lane writes (or writeLane fills) is flagged as possibly differing; the
+// next fetch from it compares the running lanes and, if they agree again,
+// clears the flag and decodes it once more. Only while they disagree do the
+// lanes at that pc fetch and run separately, so per-lane data inside the
+// image costs nothing until it is executed.
+//
+// Instruction semantics are those of Z16Simulator::executeInstruction with
+// the default (allow) misaligned policy, including its quirks. Differences,
+// all per lane: faults stop that lane with status FAULTED (the trap cause in
+// 'fault'), ecall and warning output is collected in the lane's console
+// string, and the budgets stop a lane with status STOPPED. There are no
+// devices and no livelock detection. Lanes have no trap registers: ecall
+// 16-18 stop the lane with status UNSUPPORTED. As ecall 17 is the only way
+// to install a trap handler, every other trap ends its lane just as an
+// unhandled trap ends a Z16Simulator run.
+// ---------------------------------------------------------------------------
+template <size_t LANES = 16>
+class Z16Harts {
+public:
+    static constexpr size_t MEM_SIZE = 65536;
+
+    enum LaneStatus : uint8_t { RUNNING, FINISHED, STOPPED, FAULTED, UNSUPPORTED };
+
+    alignas(64) uint16_t regs[8][LANES];
+    alignas(64) uint16_t pc[LANES];
+    size_t programSize = 0;
+    array<LaneStatus, LANES> status;
+    array<uint64_t, LANES> executed;   // Instructions retired per lane.
+    array<string, LANES> console;      // ecall output and warnings per lane.
+    array<Z16Trap, LANES> fault;       // Why a FAULTED lane stopped.
+    array<StopReason, LANES> stopped;  // Why a STOPPED lane stopped.
+
+    // Budgets per lane (0 = unlimited). Checked every BUDGET_INTERVAL steps,
+    // so lanes may run slightly past them.
+    uint64_t maxInstructions = 0;
+    double maxSeconds = 0;
+    static const uint64_t BUDGET_INTERVAL = 256;
+
+    Z16Harts() : memoryBlock(LANES * MEM_SIZE), decodeCache(MEM_SIZE / 2), splitCode(MEM_SIZE / 2) {
+        reset();
+    }
+
+    // Registers, pcs, memory and consoles back to the power-on state.
+    void reset() {
+        for (size_t r = 0; r < 8; r++)
+            for (size_t l = 0; l < LANES; l++)
+                regs[r][l] = 0;
+        for (size_t l = 0; l < LANES; l++) {
+            regs[2][l] = MEM_SIZE - 2;   // sp, as in Z16Simulator.
+            pc[l] = 0;
+            status[l] = RUNNING;
+            executed[l] = 0;
+            console[l].clear();
+            fault[l] = Z16Trap();
+            hexOutput[l] = false;
+        }
+        fill(memoryBlock.begin(), memoryBlock.end(), 0);
+        programSize = 0;
+        shareAllCode();
+    }
+
+    // Load the same program image into every lane.
+    void loadProgram(const uint8_t *image, size_t size) {
+        size = min(size, MEM_SIZE);
+        for (size_t l = 0; l < LANES; l++)
+            memcpy(mem(l), image, size);
+        programSize = size;
+        shareAllCode();
+    }
+
+    // Load a program (raw binary or segmented image) into every lane; every
+    // lane starts at its entry point.
+    void loadImage(const Z16Image &image) {
+        image.loadInto(mem(0));
+        for (size_t l = 1; l < LANES; l++)
+            memcpy(mem(l), mem(0), MEM_SIZE);
+        programSize = image.programSize();
+        for (size_t l = 0; l < LANES; l++)
+            pc[l] = image.entry;
+        shareAllCode();
+    }
+
+    // Write per-lane input data. Writing into the program image makes the
+    // lanes' code differ there, which is supported but slower if executed.
+    void writeLane(size_t lane, uint16_t addr, const uint8_t *data, size_t len) {
+        len = min(len, MEM_SIZE - addr);
+        memcpy(mem(lane) + addr, data, len);
+        for (size_t a = addr; a < addr + len && a < programSize; a += 2)
+            codeWritten(static_cast<uint16_t>(a));
+        if (len && addr + len - 1 < programSize)
+            codeWritten(static_cast<uint16_t>(addr + len - 1));
+    }
+
+    const uint8_t *laneMemory(size_t lane) const { return memoryBlock.data() + lane * MEM_SIZE; }
+
+    // Run until every lane has finished, faulted or been stopped.
+    void run() {
+        auto startTime = chrono::steady_clock::now();
+        uint64_t sinceCheck = 0;
+        alignas(64) uint16_t mask[LANES];
+        bool all;
+        while (selectGroup(mask, all)) {
+            if (all)
+                sinceCheck += runConverged(mask);
+            else
+                sinceCheck += step(mask);
+            if ((maxInstructions || maxSeconds > 0) && sinceCheck >= BUDGET_INTERVAL) {
+                sinceCheck = 0;
+                bool late = maxSeconds > 0 &&
+                            chrono::duration<double>(chrono::steady_clock::now() - startTime).count() >= maxSeconds;
+                for (size_t l = 0; l < LANES; l++) {
+                    if (status[l] != RUNNING)
+                        continue;
+                    if (maxInstructions && executed[l] >= maxInstructions) {
+                        status[l] = STOPPED;
+                        stopped[l] = StopReason::InstructionBudget;
+                    } else if (late) {
+                        status[l] = STOPPED;
+                        stopped[l] = StopReason::TimeBudget;
+                    }
+                }
+            }
+        }
+    }
+
+    // Total lane instructions retired.
+    uint64_t laneInstructions() const {
+        uint64_t total = 0;
+        for (uint64_t e : executed)
+            total += e;
+        return total;
+    }
+
+private:
+    vector<uint8_t> memoryBlock;         // LANES x 64KB, lane-major.
+    vector<DecodedOp> decodeCache;       // Shared by all lanes, one per halfword.
+    vector<uint8_t> splitCode;           // 1: the running lanes may differ in this halfword.
+    array<bool, LANES> hexOutput;        // Console base: warnings switch to hex, ecall 1 to decimal.
+
+#if defined(__GNUC__)
+    // One register (or the pcs, or a lane mask) across all lanes.
+    static_assert((LANES & (LANES - 1)) == 0, "LANES must be a power of two");
+    typedef uint16_t Vec __attribute__((vector_size(LANES * sizeof(uint16_t))));
+    typedef int16_t SVec __attribute__((vector_size(LANES * sizeof(uint16_t))));
+#else
+    typedef uint16_t Vec;
+    typedef int16_t SVec;
+#endif
+
+    uint8_t *mem(size_t lane) { return memoryBlock.data() + lane * MEM_SIZE; }
+
+    // Little-endian words of a lane's memory (never at 0xFFFF).
+    static uint16_t loadWord(const uint8_t *p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        uint16_t value;
+        memcpy(&value, p, 2);
+        return value;
+#else
+        return p[0] | p[1] << 8;
+#endif
+    }
+
+    static void storeWord(uint8_t *p, uint16_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(p, &value, 2);
+#else
+        p[0] = value & 0xFF;
+        p[1] = value >> 8;
+#endif
+    }
+
+    static uint16_t blend(uint16_t mask, uint16_t value, uint16_t old) {
+        return (value & mask) | (old & ~mask);
+    }
+
+    // Every lane holds the same image: nothing is flagged, nothing decoded.
+    void shareAllCode() {
+        for (DecodedOp &d : decodeCache)
+            d.op = OP_UNDECODED;
+        fill(splitCode.begin(), splitCode.end(), 0);
+    }
+
+    // A lane wrote the byte at 'addr'.
+    void codeWritten(uint16_t addr) {
+        if (addr >= programSize)
+            return;
+        splitCode[addr >> 1] = 1;
+        decodeCache[addr >> 1].op = OP_UNDECODED;
+    }
+
+    // The shared decoding of the (even) 'at', or nullptr while the running
+    // lanes hold different words there. A flagged halfword on which they
+    // agree again is unflagged and decoded from the running lanes' copy.
+    const DecodedOp *sharedDecode(uint16_t at) {
+        DecodedOp &c = decodeCache[at >> 1];
+        if (splitCode[at >> 1]) {
+            int leader = -1;
+            uint16_t word = 0;
+            for (size_t l = 0; l < LANES; l++) {
+                if (status[l] != RUNNING)
+                    continue;
+                uint16_t w = mem(l)[at] | mem(l)[at + 1] << 8;
+                if (leader < 0) {
+                    leader = static_cast<int>(l);
+                    word = w;
+                } else if (w != word) {
+                    return nullptr;
+                }
+            }
+            splitCode[at >> 1] = 0;
+            c = decodeInstruction(word);
+        } else if (c.op == OP_UNDECODED) {
+            // Never written since the image was loaded: every lane has it.
+            c = decodeInstruction(mem(0)[at] | mem(0)[at + 1] << 8);
+        }
+        return &c;
+    }
+
+    // Mask of the running lanes at the lowest pc; false when none is running.
+    // 'all' is set when every running lane is in the group.
+    bool selectGroup(uint16_t *mask, bool &all) {
+        alignas(64) uint16_t alive[LANES];
+        uint32_t lowest = 0x10000;
+        for (size_t l = 0; l < LANES; l++) {
+            if (status[l] == RUNNING && pc[l] >= programSize)
+                status[l] = FINISHED;
+            alive[l] = status[l] == RUNNING ? 0xFFFF : 0;
+            uint32_t key = alive[l] ? pc[l] : 0x10000;
+            lowest = key < lowest ? key : lowest;
+        }
+        if (lowest == 0x10000)
+            return false;
+        uint16_t outside = 0;
+        for (size_t l = 0; l < LANES; l++) {
+            mask[l] = alive[l] & (pc[l] == lowest ? 0xFFFF : 0);
+            outside |= alive[l] & ~mask[l];
+        }
+        all = !outside;
+        return true;
+    }
+
+    void stopLane(size_t lane, LaneStatus why, uint16_t at, uint16_t *m) {
+        status[lane] = why;
+        pc[lane] = at;
+        m[lane] = 0;
+    }
+
+    // Stop 'lane' with the trap Z16Simulator would raise (and, with no trap
+    // handler, end its run with).
+    void faultLane(size_t lane, Z16TrapCause cause, uint16_t at, uint16_t addr, uint16_t *m) {
+        fault[lane].cause = cause;
+        fault[lane].pc = at;
+        fault[lane].addr = addr;
+        stopLane(lane, FAULTED, at, m);
+    }
+
+    void warn(size_t lane, const char *text, const uint16_t *at) {
+        console[lane] += text;
+        if (at) {
+            static const char digits[] = "0123456789abcdef";
+            char buf[8];
+            int n = 0;
+            uint16_t v = *at;
+            do { buf[n++] = digits[v & 0xF]; v >>= 4; } while (v);
+            while (n) console[lane] += buf[--n];
+            hexOutput[lane] = true;
+        }
+        console[lane] += '\n';
+    }
+
+    // Z16Simulator::systemCall for one lane: the same output for the
+    // console services, UNSUPPORTED for the trap-register services (16-18),
+    // FINISHED for ecall 3, otherwise RUNNING.
+    LaneStatus systemCall(size_t lane, uint16_t service) {
+        string &out = console[lane];
+        if (service == 1) {
+            out += "Print integer: " + to_string(static_cast<int16_t>(regs[6][lane])) + "\n";
+            hexOutput[lane] = false;
+        } else if (service == 3) {
+            out += "ecall 3\necall terminate simulation\n";
+            return FINISHED;
+        } else if (service == 5) {
+            const uint8_t *m = mem(lane);
+            out += "Print string: ";
+            uint16_t addr = regs[6][lane];
+            for (size_t n = 0; n < MEM_SIZE && m[addr]; n++, addr++)
+                out += static_cast<char>(m[addr]);
+            out += "\n";
+        } else if (service >= 16 && service <= 18) {
+            return UNSUPPORTED;
+        } else {
+            char buf[8];
+            snprintf(buf, sizeof(buf), hexOutput[lane] ? "%x" : "%u", service);
+            out += string("ecall ") + buf + "\n";
+        }
+        return RUNNING;
+    }
+
+    // Decoded instruction for the group in 'mask'. Where the lanes' code
+    // differs, lanes whose word at this pc differs from the first lane's are
+    // dropped from the mask; they run in a later step.
+    bool fetch(uint16_t *mask, uint16_t at, DecodedOp &d) {
+        if (at == 0xFFFF) {      // The word would run past the end of memory.
+            for (size_t l = 0; l < LANES; l++)
+                if (mask[l])
+                    faultLane(l, Z16TrapCause::LoadFault, at, at, mask);
+            return false;
+        }
+        if (!(at & 1))
+            if (const DecodedOp *c = sharedDecode(at)) {
+                d = *c;
+                return true;
+            }
+        int leader = -1;
+        uint16_t word = 0;
+        for (size_t l = 0; l < LANES; l++) {
+            if (!mask[l])
+                continue;
+            uint16_t w = mem(l)[at] | mem(l)[at + 1] << 8;
+            if (leader < 0) {
+                leader = static_cast<int>(l);
+                word = w;
+            } else if (w != word) {
+                mask[l] = 0;
+            }
+        }
+        d = decodeInstruction(word);
+        return true;
+    }
+
+    // One step of the group in 'm' (not converged): executes the instruction
+    // at the group's pc and moves the group's pcs on. Returns the number of
+    // lane-steps taken (0 or 1).
+    uint64_t step(uint16_t *m) {
+        const uint16_t at = [&] { for (size_t l = 0; l < LANES; l++) if (m[l]) return pc[l]; return uint16_t(0); }();
+        DecodedOp d;
+        if (!fetch(m, at, d))
+            return 0;
+        for (size_t l = 0; l < LANES; l++)
+            executed[l] += m[l] & 1;
+        if (!(execute(d, at, m) & JUMPED))
+            for (size_t l = 0; l < LANES; l++)
+                pc[l] = blend(m[l], at + 2, pc[l]);
+        return 1;
+    }
+
+    // Every running lane is in 'm' at the same pc: run with one scalar pc
+    // and the shared decode cache, without per-lane pc updates, until the
+    // lanes diverge, one of them stops, the pc reaches code the lanes do
+    // not share, or BUDGET_INTERVAL steps have run. Returns the steps taken.
+    uint64_t runConverged(uint16_t *m) {
+        alignas(64) uint16_t group[LANES];
+        memcpy(group, m, sizeof(group));
+        uint16_t P = 0;
+        for (size_t l = 0; l < LANES; l++)
+            if (m[l]) {
+                P = pc[l];
+                break;
+            }
+        uint64_t n = 0;
+        bool pcsWritten = false;
+        while (n < BUDGET_INTERVAL && P < programSize && !(P & 1)) {
+            const DecodedOp *c = sharedDecode(P);
+            if (!c)
+                break;
+            const DecodedOp d = *c;   // A store may invalidate the cached copy.
+            n++;
+            int flow = execute(d, P, m);
+            if (flow & LANE_STOPPED) {
+                pcsWritten = flow & JUMPED;
+                if (!pcsWritten)
+                    P += 2;
+                break;
+            }
+            if (!(flow & JUMPED)) {
+                P += 2;
+                continue;
+            }
+            // Still converged if every lane took the same way.
+            for (size_t l = 0; l < LANES; l++)
+                if (m[l]) {
+                    P = pc[l];
+                    break;
+                }
+            uint16_t differ = 0;
+            for (size_t l = 0; l < LANES; l++)
+                differ |= (pc[l] ^ P) & m[l];
+            if (differ) {
+                pcsWritten = true;
+                break;
+            }
+        }
+        if (!pcsWritten)
+            for (size_t l = 0; l < LANES; l++)
+                pc[l] = blend(m[l], P, pc[l]);
+        for (size_t l = 0; l < LANES; l++)
+            executed[l] += group[l] ? n : 0;
+        if (!n)   // Odd pc, 0xFFFF or differing code: take the general path.
+            return step(m);
+        return n;
+    }
+
+    enum Flow { JUMPED = 1, LANE_STOPPED = 2 };
+
+    // Execute 'd' at 'at' for the lanes in 'm'. Lanes that fault or terminate
+    // are removed from 'm' (with pc left at 'at'). Returns JUMPED if the
+    // instruction wrote the group's pcs (otherwise they fall through to
+    // at + 2), with LANE_STOPPED added if a lane left the group.
+    int execute(const DecodedOp &d, uint16_t at, uint16_t *m) {
+        uint16_t *Rp = regs[d.rd];
+        const uint16_t *Sp = regs[d.rs];
+        const uint16_t imm = static_cast<uint16_t>(d.imm);
+        const int16_t simm = d.imm;
+        const uint16_t next = at + 2;
+        int flow = 0;
+
+        // LANES_DO(expr) writes expr to rd, LANES_PC(expr) to the pcs, in
+        // every lane of the group; R and S are the lane values (Vec) of rd and
+        // rs. TRUTH turns a comparison into a 0x0000/0xFFFF mask.
+#if defined(__GNUC__)
+        Vec M;
+        memcpy(&M, m, sizeof(M));
+#define LANES_DO(expr) do { Vec R, S; memcpy(&R, Rp, sizeof(R)); memcpy(&S, Sp, sizeof(S)); (void)S; \
+                            R = ((expr) & M) | (R & ~M); memcpy(Rp, &R, sizeof(R)); } while (0)
+#define LANES_PC(expr) do { Vec R, S, P; memcpy(&R, Rp, sizeof(R)); memcpy(&S, Sp, sizeof(S));       \
+                            memcpy(&P, pc, sizeof(P)); (void)R; (void)S;                              \
+                            P = ((expr) & M) | (P & ~M); memcpy(pc, &P, sizeof(P)); } while (0)
+#define TRUTH(c) ((Vec)(c))
+#else
+#define LANES_DO(expr) for (size_t l = 0; l < LANES; l++) {                     \
+                           const Vec R = Rp[l], S = Sp[l]; (void)S;              \
+                           Rp[l] = blend(m[l], (expr), R); }
+#define LANES_PC(expr) for (size_t l = 0; l < LANES; l++) {                     \
+                           const Vec R = Rp[l], S = Sp[l]; (void)R; (void)S;     \
+                           pc[l] = blend(m[l], (expr), pc[l]); }
+#define TRUTH(c) ((Vec)-(c))
+#endif
+#define SGN(v) ((SVec)(v))
+#define BIT(c) (TRUTH(c) & 1)
+#define SRA(v, n) ((Vec)(SGN(v) >> (n)))
+#define BRANCH(cond)                                                                  \
+        LANES_PC((TRUTH(cond) & static_cast<uint16_t>(at + imm)) | (~TRUTH(cond) & next)); \
+        return JUMPED
+
+        switch (d.op) {
+            case OP_ADD:   LANES_DO(R + S); break;
+            case OP_SUB:   LANES_DO(R - S); break;
+            case OP_SLT:   LANES_DO(BIT(SGN(R) < SGN(S))); break;
+            case OP_SLTU:  LANES_DO(BIT(R < S)); break;
+            case OP_SLL:   LANES_DO(R << (S & 0xF)); break;
+            case OP_SRL:   LANES_DO(R >> (S & 0xF)); break;
+            case OP_SRA:   LANES_DO(SRA(R, SGN(S & 0xF))); break;
+            case OP_OR:    LANES_DO(R | S); break;
+            case OP_AND:   LANES_DO(R & S); break;
+            case OP_XOR:   LANES_DO(R ^ S); break;
+            case OP_MV:    LANES_DO(S); break;
+            case OP_JR:
+                LANES_PC(R);
+                return JUMPED;
+            case OP_JALR:
+                // rd is written first, so 'jalr x, x' jumps to pc + 2.
+                LANES_DO(next);
+                LANES_PC(S);
+                return JUMPED;
+
+            case OP_ADDI:  LANES_DO(R + imm); break;
+            case OP_SLTI:  LANES_DO(BIT(SGN(R) < simm)); break;
+            case OP_SLTUI: LANES_DO(BIT(R < imm)); break;
+            case OP_SLLI:  LANES_DO(R << imm); break;
+            case OP_SRLI:  LANES_DO(R >> imm); break;
+            case OP_SRAI:  LANES_DO(SRA(R, simm)); break;
+            case OP_ORI:   LANES_DO(R | imm); break;
+            case OP_ANDI:  LANES_DO(R & imm); break;
+            case OP_XORI:  LANES_DO(R ^ imm); break;
+            case OP_LI:    LANES_DO(imm); break;
+            case OP_LUI:   LANES_DO(imm); break;
+            case OP_AUIPC: LANES_DO(static_cast<uint16_t>(at + imm)); break;
+
+            case OP_BEQ:   BRANCH(R == S);
+            case OP_BNE:   BRANCH(R != S);
+            case OP_BZ:    BRANCH(R == 0);
+            case OP_BNZ:   BRANCH(R != 0);
+            case OP_BLT:   BRANCH(SGN(R) < SGN(S));
+            case OP_BGE:   BRANCH(SGN(R) >= SGN(S));
+            case OP_BLTU:  BRANCH(R < S);
+            case OP_BGEU:  BRANCH(R >= S);
+            case OP_J:
+                LANES_PC(static_cast<uint16_t>(at + imm));
+                return JUMPED;
+            case OP_JAL:
+                LANES_DO(next);
+                LANES_PC(static_cast<uint16_t>(at + imm));
+                return JUMPED;
+
+            // Memory addresses differ per lane: these are per-lane gathers/scatters.
+            case OP_SB:
+                for (size_t l = 0; l < LANES; l++) {
+                    if (!m[l])
+                        continue;
+                    uint16_t addr = Rp[l] + imm;
+                    mem(l)[addr] = Sp[l] & 0xFF;
+                    codeWritten(addr);
+                }
+                break;
+            case OP_SW:
+                for (size_t l = 0; l < LANES; l++) {
+                    if (!m[l])
+                        continue;
+                    uint16_t addr = Rp[l] + imm;
+                    if (addr == 0xFFFF) {
+                        faultLane(l, Z16TrapCause::StoreFault, at, addr, m);
+                        flow = LANE_STOPPED;
+                        continue;
+                    }
+                    storeWord(mem(l) + addr, Sp[l]);
+                    codeWritten(addr);
+                    codeWritten(addr + 1);
+                }
+                break;
+            case OP_LB:
+                for (size_t l = 0; l < LANES; l++)
+                    if (m[l])
+                        Rp[l] = static_cast<int8_t>(mem(l)[static_cast<uint16_t>(Sp[l] + imm)]);
+                break;
+            case OP_LBU:
+                for (size_t l = 0; l < LANES; l++)
+                    if (m[l])
+                        Rp[l] = mem(l)[static_cast<uint16_t>(Sp[l] + imm)];
+                break;
+            case OP_LW:
+                for (size_t l = 0; l < LANES; l++) {
+                    if (!m[l])
+                        continue;
+                    uint16_t addr = Sp[l] + imm;
+                    if (addr == 0xFFFF) {
+                        faultLane(l, Z16TrapCause::LoadFault, at, addr, m);
+                        flow = LANE_STOPPED;
+                        continue;
+                    }
+                    Rp[l] = loadWord(mem(l) + addr);
+                }
+                break;
+            case OP_MEM_NOP:
+                break;
+
+            case OP_ECALL:
+                for (size_t l = 0; l < LANES; l++) {
+                    if (!m[l])
+                        continue;
+                    LaneStatus why = systemCall(l, d.imm);
+                    if (why != RUNNING) {
+                        stopLane(l, why, at, m);   // ecall 3 leaves pc on the ecall.
+                        flow = LANE_STOPPED;
+                    }
+                }
+                break;
+            case OP_BAD_R:
+                for (size_t l = 0; l < LANES; l++)
+                    if (m[l])
+                        warn(l, "Unknown R-type instruction at PC = 0x", &at);
+                break;
+            case OP_BAD_SHIFT:
+                for (size_t l = 0; l < LANES; l++)
+                    if (m[l])
+                        warn(l, "Unimplemented I-type shift instruction at PC = 0x", &at);
+                break;
+            case OP_BAD_SYS:
+                for (size_t l = 0; l < LANES; l++)
+                    if (m[l])
+                        warn(l, "Unknown SYS-type instruction", nullptr);
+                break;
+        }
+#undef LANES_DO
+#undef LANES_PC
+#undef TRUTH
+#undef SGN
+#undef BIT
+#undef SRA
+#undef BRANCH
+        return flow;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Many-inputs driver (rvsim --harts).
+// Runs one program once per input image: each input file is written at the
+// same address of a lane's memory, LANES inputs per Z16Harts run. Results
+// are written in input order, in the format of Z16Batch's results file.
+// ---------------------------------------------------------------------------
+template <size_t LANES = 16>
+class Z16HartsBatch {
+public:
+    Z16HartsBatch(const string &program, uint16_t inputAddress, const Z16Budget &budget)
+        : image(program), inputAddress(inputAddress) {
+        harts.maxInstructions = budget.maxInstructions;
+        harts.maxSeconds = budget.maxSeconds;
+    }
+
+    Z16BatchSummary run(const vector<string> &inputs, ostream &results) {
+        auto startTime = chrono::steady_clock::now();
+        Z16BatchSummary summary;
+        summary.programs = inputs.size();
+        for (size_t first = 0; first < inputs.size(); first += LANES) {
+            size_t count = min(LANES, inputs.size() - first);
+            harts.reset();
+            harts.loadImage(image);
+            vector<string> errors(count);
+            for (size_t l = 0; l < LANES; l++) {
+                if (l >= count) {
+                    harts.status[l] = Z16Harts<LANES>::FINISHED;   // Unused lanes sit out.
+                    continue;
+                }
+                ifstream in(inputs[first + l], ios::binary);
+                if (!in) {
+                    errors[l] = "Error opening input file: " + inputs[first + l];
+                    harts.status[l] = Z16Harts<LANES>::FAULTED;
+                    continue;
+                }
+                vector<uint8_t> data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+                harts.writeLane(l, inputAddress, data.data(), data.size());
+            }
+            harts.run();
+            for (size_t l = 0; l < count; l++) {
+                results << "=== " << inputs[first + l] << "\n";
+                if (!errors[l].empty()) {
+                    results << "Status: error: " << errors[l] << "\n\n";
+                    summary.failed++;
+                    continue;
+                }
+                writeLane(l, results, summary);
+            }
+        }
+        summary.seconds = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+        return summary;
+    }
+
+private:
+    Z16Image image;
+    uint16_t inputAddress;
+    Z16Harts<LANES> harts;
+
+    void writeLane(size_t l, ostream &out, Z16BatchSummary &summary) {
+        ostringstream text;
+        text << harts.console[l];
+        text << hex << setfill('0');
+        switch (harts.status[l]) {
+            case Z16Harts<LANES>::FAULTED:
+                summary.failed++;
+                text << "Status: error: " << trapMessage(harts.fault[l].cause) << " at PC = 0x" << setw(4)
+                     << harts.fault[l].pc << "\n";
+                break;
+            case Z16Harts<LANES>::UNSUPPORTED:
+                summary.failed++;
+                text << "Status: error: trap-register ecall (16-18) not supported with --harts at PC = 0x"
+                     << setw(4) << harts.pc[l] << "\n";
+                break;
+            case Z16Harts<LANES>::STOPPED:
+                summary.stopped++;
+                text << "Status: " << stopMessage(harts.stopped[l]) << " at PC = 0x" << setw(4) << harts.pc[l] << "\n";
+                break;
+            default:
+                summary.finished++;
+                text << "Status: finished\n";
+                break;
+        }
+        text << "\nFinal register state:\n";
+        for (size_t r = 0; r < 8; r++)
+            text << Z16Disasm::regNames[r] << " = 0x" << setw(4) << harts.regs[r][l] << "\n";
+        text << "\nUsed Memory Listing (only non-zero cells):\n";
+        const uint8_t *memory = harts.laneMemory(l);
+        bool foundAny = false;
+        for (size_t addr = 0; addr < Z16Harts<LANES>::MEM_SIZE; addr++) {
+            if (memory[addr]) {
+                text << "Addr 0x" << setw(4) << addr << " : 0x" << setw(2) << int(memory[addr]) << "\n";
+                foundAny = true;
+            }
+        }
+        if (!foundAny)
+            text << "No used memory addresses found.\n";
+        out << text.str() << "\n";
+    }
+};
@@ -0,0 +1,437 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "Z16Decode.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define Z16_JIT_AVAILABLE 1
+#include <sys/mman.h>
+#else
+#define Z16_JIT_AVAILABLE 0
+#endif
+
+// ---------------------------------------------------------------------------
+// Native x86-64 backend for hot basic blocks (see Z16BlockEngine).
+//
+// A compiled block is a function taking a Z16JitContext. The eight guest
+// registers live in host registers for the whole block and the 64KB guest
+// memory is addressed through a base register (rsi):
+//
+//   guest  t0  ra  sp   s0   s1   t1   a0  a1
+//   host   ebx ebp r12d r13d r14d r15d r8d r9d
+//
+//   rdi = context, rsi = memory, r10 = decode cache, r11 = code-byte map,
+//   rax/rcx/rdx = scratch.
+//
+// Host registers always hold the zero-extended 16-bit guest value. Loads and
+// stores are done natively; anything that needs the interpreter (an ecall, a
+// store that hits translated code, a word access at an odd address, or an unknown
+// encoding that prints a warning) leaves the block *before* that instruction
+// with a side exit, and the interpreter executes it.
+//
+// The return value packs the exit: bits 0-15 next guest PC, bits 16-19 the
+// exit kind, bits 20-31 the number of guest instructions executed.
+// ---------------------------------------------------------------------------
+struct Z16JitContext {
+    uint16_t *regs;              // Z16Simulator::regs
+    uint8_t *memory;             // Z16Simulator::memory
+    DecodedOp *decodeCache;      // Z16Simulator::decodeCache (invalidated by stores)
+    const uint8_t *codeBytes;    // Z16BlockEngine code map (stores there side-exit)
+    uint8_t *dirtyPages;         // Z16Simulator::dirtyPages (set by stores)
+};
+
+typedef uint32_t (*Z16JitFn)(Z16JitContext *ctx);
+
+static_assert(sizeof(DecodedOp) == 8 && offsetof(DecodedOp, op) == 0,
+              "compiled stores clear decodeCache[addr >> 1].op with [r10 + index*8]");
+
+enum Z16JitExit : uint32_t {
+    JIT_EXIT_FALLTHROUGH = 0,
+    JIT_EXIT_TAKEN = 1,
+    JIT_EXIT_INDIRECT = 2,
+    JIT_EXIT_SIDE = 3,           // Interpreter must execute the instruction at the PC.
+};
+
+inline uint32_t jitExitCode(Z16JitExit kind, uint16_t pc, size_t executed) {
+    return pc | (kind << 16) | (static_cast<uint32_t>(executed) << 20);
+}
+
+class Z16Jit {
+public:
+    // Size of the executable code buffer; it is recycled when full.
+    static const size_t CODE_BUFFER_SIZE = 4 << 20;
+
+    Z16Jit() {
+#if Z16_JIT_AVAILABLE
+        void *p = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED)
+            buffer = static_cast<uint8_t *>(p);
+#endif
+    }
+
+    ~Z16Jit() {
+#if Z16_JIT_AVAILABLE
+        if (buffer)
+            munmap(buffer, CODE_BUFFER_SIZE);
+#endif
+    }
+
+    Z16Jit(const Z16Jit &) = delete;
+    Z16Jit &operator=(const Z16Jit &) = delete;
+
+    bool available() const { return buffer != nullptr; }
+
+    // Forget all compiled code. Every previously returned Z16JitFn becomes invalid.
+    void reset() { used = 0; }
+
+    // Compile a translated block. Returns nullptr if the buffer is full
+    // (call reset() and retry) or the JIT is unavailable on this host.
+    Z16JitFn compile(const std::vector<DecodedOp> &ops, uint16_t start, bool hasTerminator) {
+        if (!buffer)
+            return nullptr;
+        code.clear();
+        sideExits.clear();
+        epilogueJumps.clear();
+
+        emitPrologue();
+        size_t body = ops.size() - (hasTerminator ? 1 : 0);
+        uint16_t pc = start;
+        bool exited = false;
+        for (size_t i = 0; i < body && !exited; i++, pc += 2)
+            exited = !emitBodyOp(ops[i], pc, i);  // Unconditional side exit ends the block.
+        if (!exited) {
+            if (hasTerminator)
+                emitTerminator(ops[body], pc, body);
+            else
+                emitExit(jitExitCode(JIT_EXIT_FALLTHROUGH, pc, body));
+        }
+
+        // Side-exit stubs, then the shared epilogue.
+        for (const SideExit &s : sideExits) {
+            patchRel32(s.jumpAt, code.size());
+            emitExit(s.code);
+        }
+        size_t epilogue = code.size();
+        emitEpilogue();
+        for (size_t at : epilogueJumps)
+            patchRel32(at, epilogue);
+
+#if Z16_JIT_AVAILABLE
+        size_t aligned = (code.size() + 15) & ~size_t(15);
+        if (used + aligned > CODE_BUFFER_SIZE)
+            return nullptr;
+        mprotect(buffer, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE);
+        memcpy(buffer + used, code.data(), code.size());
+        mprotect(buffer, CODE_BUFFER_SIZE, PROT_READ | PROT_EXEC);
+        Z16JitFn fn = reinterpret_cast<Z16JitFn>(buffer + used);
+        used += aligned;
+        return fn;
+#else
+        return nullptr;
+#endif
+    }
+
+private:
+    // Host register numbers.
+    enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+           R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15 };
+    static constexpr int guestReg[8] = { RBX, RBP, R12, R13, R14, R15, R8, R9 };
+    static constexpr int calleeSaved[6] = { RBX, RBP, R12, R13, R14, R15 };
+
+    struct SideExit {
+        size_t jumpAt;   // Offset of the rel32 to patch.
+        uint32_t code;   // Exit code returned by the stub.
+    };
+
+    uint8_t *buffer = nullptr;
+    size_t used = 0;
+    std::vector<uint8_t> code;
+    std::vector<SideExit> sideExits;
+    std::vector<size_t> epilogueJumps;
+
+    // ---- Raw encoding helpers -------------------------------------------
+    void byte(uint8_t b) { code.push_back(b); }
+    void imm32(uint32_t v) { for (int i = 0; i < 4; i++) byte((v >> (8 * i)) & 0xFF); }
+
+    void rex(bool w, int reg, int index, int base) {
+        uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+        if (r != 0x40)
+            byte(r);
+    }
+
+    // Register-register form: opcode /r with ModRM.reg = reg, ModRM.rm = rm.
+    // p66 selects the 16-bit operand size (the prefix must precede REX).
+    void opRR(std::initializer_list<uint8_t> opcode, int reg, int rm, bool w = false, bool p66 = false) {
+        if (p66) byte(0x66);
+        rex(w, reg, 0, rm);
+        for (uint8_t b : opcode) byte(b);
+        byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+    }
+
+    // Memory form [base + index*scale + disp8]; index < 0 means no index.
+    // base is never rsp/rbp/r12/r13, so no special ModRM cases are needed.
+    void opRM(std::initializer_list<uint8_t> opcode, int reg, int base, int index, int scale,
+              int8_t disp, bool w = false, bool p66 = false) {
+        if (p66) byte(0x66);
+        rex(w, reg, index < 0 ? 0 : index, base);
+        for (uint8_t b : opcode) byte(b);
+        uint8_t mod = disp ? 0x40 : 0x00;
+        if (index < 0) {
+            byte(mod | ((reg & 7) << 3) | (base & 7));
+        } else {
+            uint8_t ss = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+            byte(mod | ((reg & 7) << 3) | 0x04);
+            byte((ss << 6) | ((index & 7) << 3) | (base & 7));
+        }
+        if (disp)
+            byte(static_cast<uint8_t>(disp));
+    }
+
+    // ALU op with imm32: 81 /ext.
+    void aluImm(int ext, int reg, uint32_t imm) {
+        rex(false, 0, 0, reg);
+        byte(0x81);
+        byte(0xC0 | (ext << 3) | (reg & 7));
+        imm32(imm);
+    }
+
+    void movImm(int reg, uint32_t imm) {
+        rex(false, 0, 0, reg);
+        byte(0xB8 + (reg & 7));
+        imm32(imm);
+    }
+
+    void shiftImm(int ext, int reg, uint8_t amount) {
+        rex(false, 0, 0, reg);
+        byte(0xC1);
+        byte(0xC0 | (ext << 3) | (reg & 7));
+        byte(amount);
+    }
+
+    void shiftCl(int ext, int reg) {
+        rex(false, 0, 0, reg);
+        byte(0xD3);
+        byte(0xC0 | (ext << 3) | (reg & 7));
+    }
+
+    void zext16(int reg) { opRR({0x0F, 0xB7}, reg, reg); }   // movzx r32, r16
+    void sext16(int reg) { opRR({0x0F, 0xBF}, reg, reg); }   // movsx r32, r16
+
+    // setcc al; movzx reg, al
+    void setcc(uint8_t cc, int reg) {
+        byte(0x0F); byte(0x90 | cc); byte(0xC0);
+        opRR({0x0F, 0xB6}, reg, RAX);
+    }
+
+    size_t jcc32(uint8_t cc) {
+        byte(0x0F); byte(0x80 | cc);
+        size_t at = code.size();
+        imm32(0);
+        return at;
+    }
+
+    size_t jmp32() {
+        byte(0xE9);
+        size_t at = code.size();
+        imm32(0);
+        return at;
+    }
+
+    void patchRel32(size_t at, size_t target) {
+        uint32_t rel = static_cast<uint32_t>(target - (at + 4));
+        memcpy(&code[at], &rel, 4);
+    }
+
+    // x86 condition codes.
+    enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD };
+
+    // ---- Block structure --------------------------------------------------
+    void emitPrologue() {
+        for (int r : calleeSaved) {
+            rex(false, 0, 0, r);
+            byte(0x50 + (r & 7));                               // push r
+        }
+        opRM({0x8B}, RSI, RDI, -1, 1, offsetof(Z16JitContext, memory), true);
+        opRM({0x8B}, R10, RDI, -1, 1, offsetof(Z16JitContext, decodeCache), true);
+        opRM({0x8B}, R11, RDI, -1, 1, offsetof(Z16JitContext, codeBytes), true);
+        opRM({0x8B}, RAX, RDI, -1, 1, offsetof(Z16JitContext, regs), true);
+        for (int i = 0; i < 8; i++)
+            opRM({0x0F, 0xB7}, guestReg[i], RAX, -1, 1, 2 * i);  // movzx r32, word [rax+2i]
+    }
+
+    void emitEpilogue() {
+        opRM({0x8B}, RCX, RDI, -1, 1, offsetof(Z16JitContext, regs), true);
+        for (int i = 0; i < 8; i++)
+            opRM({0x89}, guestReg[i], RCX, -1, 1, 2 * i, false, true);  // mov word [rcx+2i], r16
+        for (int k = 5; k >= 0; k--) {
+            rex(false, 0, 0, calleeSaved[k]);
+            byte(0x58 + (calleeSaved[k] & 7));              // pop r
+        }
+        byte(0xC3);                                         // ret
+    }
+
+    // mov eax, exitCode; jmp epilogue
+    void emitExit(uint32_t exitCode) {
+        movImm(RAX, exitCode);
+        epilogueJumps.push_back(jmp32());
+    }
+
+    void sideExitIf(uint8_t cc, uint16_t pc, size_t executed) {
+        sideExits.push_back({ jcc32(cc), jitExitCode(JIT_EXIT_SIDE, pc, executed) });
+    }
+
+    // eax = (guest reg + imm) & 0xFFFF
+    void effectiveAddress(int reg, int16_t imm) {
+        opRR({0x89}, reg, RAX);                             // mov eax, reg
+        aluImm(0, RAX, static_cast<uint32_t>(static_cast<int32_t>(imm)));
+        zext16(RAX);
+    }
+
+    // test al, 1: ZF clear if the address in eax is odd.
+    void testLowBit() {
+        byte(0xA8);
+        byte(1);
+    }
+
+    // Returns false if the op always leaves the block.
+    bool emitBodyOp(const DecodedOp &d, uint16_t pc, size_t index) {
+        int rd = guestReg[d.rd];
+        int rs = guestReg[d.rs];
+        uint32_t imm = static_cast<uint32_t>(static_cast<int32_t>(d.imm));
+        switch (d.op) {
+            case OP_ADD: opRR({0x01}, rs, rd); zext16(rd); break;
+            case OP_SUB: opRR({0x29}, rs, rd); zext16(rd); break;
+            case OP_SLT:
+                opRR({0x39}, rs, rd, false, true);          // cmp rd16, rs16
+                setcc(CC_L, rd);
+                break;
+            case OP_SLTU: opRR({0x39}, rs, rd); setcc(CC_B, rd); break;
+            case OP_SLL:
+            case OP_SRL:
+            case OP_SRA:
+                opRR({0x89}, rs, RCX);                      // mov ecx, rs
+                aluImm(4, RCX, 0xF);                        // and ecx, 15
+                if (d.op == OP_SRA) sext16(rd);
+                shiftCl(d.op == OP_SLL ? 4 : d.op == OP_SRL ? 5 : 7, rd);
+                zext16(rd);
+                break;
+            case OP_OR:  opRR({0x09}, rs, rd); break;
+            case OP_AND: opRR({0x21}, rs, rd); break;
+            case OP_XOR: opRR({0x31}, rs, rd); break;
+            case OP_MV:  opRR({0x89}, rs, rd); break;
+
+            case OP_ADDI: aluImm(0, rd, imm); zext16(rd); break;
+            case OP_SLTI:
+                opRR({0x0F, 0xBF}, RDX, rd);                // movsx edx, rd16
+                aluImm(7, RDX, imm);                        // cmp edx, imm
+                setcc(CC_L, rd);
+                break;
+            case OP_SLTUI: aluImm(7, rd, imm & 0xFFFF); setcc(CC_B, rd); break;
+            case OP_SLLI: shiftImm(4, rd, d.imm); zext16(rd); break;
+            case OP_SRLI: shiftImm(5, rd, d.imm); break;
+            case OP_SRAI: sext16(rd); shiftImm(7, rd, d.imm); zext16(rd); break;
+            case OP_ORI:  aluImm(1, rd, imm); zext16(rd); break;
+            case OP_ANDI: aluImm(4, rd, imm); zext16(rd); break;
+            case OP_XORI: aluImm(6, rd, imm); zext16(rd); break;
+            case OP_LI:
+            case OP_LUI:  movImm(rd, imm & 0xFFFF); break;
+            case OP_AUIPC: movImm(rd, static_cast<uint16_t>(pc + d.imm)); break;
+
+            case OP_LB:
+                effectiveAddress(rs, d.imm);
+                opRM({0x0F, 0xBE}, rd, RSI, RAX, 1, 0);     // movsx rd, byte [rsi+rax]
+                zext16(rd);
+                break;
+            case OP_LBU:
+                effectiveAddress(rs, d.imm);
+                opRM({0x0F, 0xB6}, rd, RSI, RAX, 1, 0);     // movzx rd, byte [rsi+rax]
+                break;
+            case OP_LW:
+                effectiveAddress(rs, d.imm);
+                testLowBit();                               // Misaligned: the interpreter applies the policy.
+                sideExitIf(CC_NE, pc, index);
+                opRM({0x0F, 0xB7}, rd, RSI, RAX, 1, 0);     // movzx rd, word [rsi+rax]
+                break;
+            case OP_SB:
+            case OP_SW: {
+                bool word = d.op == OP_SW;
+                effectiveAddress(rd, d.imm);
+                if (word) {
+                    testLowBit();
+                    sideExitIf(CC_NE, pc, index);
+                }
+                // Stores into translated code are left to the interpreter.
+                opRM({0x80}, 7, R11, RAX, 1, 0); byte(0);   // cmp byte [r11+rax], 0
+                sideExitIf(CC_NE, pc, index);
+                if (word) {
+                    opRM({0x80}, 7, R11, RAX, 1, 1); byte(0);
+                    sideExitIf(CC_NE, pc, index);
+                    opRM({0x89}, rs, RSI, RAX, 1, 0, false, true);  // mov word [rsi+rax], rs16
+                } else {
+                    opRR({0x89}, rs, RCX);                          // mov ecx, rs
+                    opRM({0x88}, RCX, RSI, RAX, 1, 0);              // mov byte [rsi+rax], cl
+                }
+                // decodeCache[addr >> 1].op = OP_UNDECODED. Words are aligned
+                // here, so both bytes share one halfword and one page.
+                opRR({0x89}, RAX, RCX);
+                shiftImm(5, RCX, 1);
+                opRM({0xC6}, 0, R10, RCX, 8, 0); byte(OP_UNDECODED);
+                // dirtyPages[addr >> 8] = 0xFF, i.e. DIRTY_ALL.
+                opRM({0x8B}, RDX, RDI, -1, 1, offsetof(Z16JitContext, dirtyPages), true);
+                opRR({0x89}, RAX, RCX);
+                shiftImm(5, RCX, 8);
+                opRM({0xC6}, 0, RDX, RCX, 1, 0); byte(0xFF);
+                break;
+            }
+            case OP_MEM_NOP: break;
+
+            default:  // Warnings and anything unexpected run in the interpreter.
+                emitExit(jitExitCode(JIT_EXIT_SIDE, pc, index));
+                return false;
+        }
+        return true;
+    }
+
+    void emitTerminator(const DecodedOp &d, uint16_t pc, size_t index) {
+        int rd = guestReg[d.rd];
+        int rs = guestReg[d.rs];
+        uint16_t target = pc + d.imm;
+        uint8_t cc;
+        switch (d.op) {
+            case OP_BEQ:  opRR({0x39}, rs, rd); cc = CC_E; break;
+            case OP_BNE:  opRR({0x39}, rs, rd); cc = CC_NE; break;
+            case OP_BZ:   opRR({0x85}, rd, rd); cc = CC_E; break;
+            case OP_BNZ:  opRR({0x85}, rd, rd); cc = CC_NE; break;
+            case OP_BLT:  opRR({0x39}, rs, rd, false, true); cc = CC_L; break;
+            case OP_BGE:  opRR({0x39}, rs, rd, false, true); cc = CC_GE; break;
+            case OP_BLTU: opRR({0x39}, rs, rd); cc = CC_B; break;
+            case OP_BGEU: opRR({0x39}, rs, rd); cc = CC_AE; break;
+            case OP_J:
+                emitExit(jitExitCode(JIT_EXIT_TAKEN, target, index + 1));
+                return;
+            case OP_JAL:
+                movImm(rd, static_cast<uint16_t>(pc + 2));
+                emitExit(jitExitCode(JIT_EXIT_TAKEN, target, index + 1));
+                return;
+            case OP_JR:
+            case OP_JALR:
+                if (d.op == OP_JALR)
+                    movImm(rd, static_cast<uint16_t>(pc + 2));  // Written before rs is read.
+                opRR({0x89}, d.op == OP_JR ? rd : rs, RAX);
+                aluImm(1, RAX, jitExitCode(JIT_EXIT_INDIRECT, 0, index + 1));
+                epilogueJumps.push_back(jmp32());
+                return;
+            default:  // ecall: the interpreter performs the service.
+                emitExit(jitExitCode(JIT_EXIT_SIDE, pc, index));
+                return;
+        }
+        size_t takenJump = jcc32(cc);
+        emitExit(jitExitCode(JIT_EXIT_FALLTHROUGH, pc + 2, index + 1));
+        patchRel32(takenJump, code.size());
+        emitExit(jitExitCode(JIT_EXIT_TAKEN, target, index + 1));
+    }
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define Z16_MMAP_AVAILABLE 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define Z16_MMAP_AVAILABLE 0
+#endif
+
+// ---------------------------------------------------------------------------
+// Program loader.
+// A program file is mapped read-only and copy-on-write (MAP_PRIVATE) rather
+// than read through a stream, so its bytes go from the page cache straight
+// into guest memory in one copy; where mmap is unavailable (or fails, e.g.
+// on a pipe) the file is read into a buffer instead.
+//
+// Two formats are accepted:
+//
+//   - a raw binary (the .bin files z16asm writes): one segment loaded at
+//     address 0 and entered at pc 0;
+//   - a segmented image:
+//
+//       "Z16I" version:u8 segmentCount:u8 entry:u16
+//       segmentCount * { flags:u8 reserved:u8 address:u16 fileSize:u32 memSize:u32 }
+//       the segments' file bytes, in table order
+//
+//     with every integer little-endian. A segment occupies
+//     [address, address + memSize) of the 64KB space; its first fileSize
+//     bytes come from the file and the rest are zero (.bss style). Flags mark
+//     code and data segments. Segments may not overlap.
+//
+// Loading writes every byte of guest memory exactly once: segment bytes are
+// copied and everything around them is zero-filled, so the simulator need not
+// clear memory first (Z16Simulator::reset(false)). The program size is one
+// past the end of the highest segment.
+// ---------------------------------------------------------------------------
+class Z16MappedFile {
+public:
+    explicit Z16MappedFile(const std::string &path) {
+#if Z16_MMAP_AVAILABLE
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Error opening binary file: " + path);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            length = static_cast<size_t>(st.st_size);
+            if (length == 0) {
+                ::close(fd);
+                return;
+            }
+            void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::close(fd);
+                mapped = static_cast<const uint8_t *>(p);
+                return;
+            }
+        }
+        ::close(fd);
+#endif
+        std::ifstream in(path, std::ios::binary);
+        if (!in)
+            throw std::runtime_error("Error opening binary file: " + path);
+        buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        length = buffer.size();
+    }
+
+    ~Z16MappedFile() {
+#if Z16_MMAP_AVAILABLE
+        if (mapped)
+            munmap(const_cast<uint8_t *>(mapped), length);
+#endif
+    }
+
+    Z16MappedFile(const Z16MappedFile &) = delete;
+    Z16MappedFile &operator=(const Z16MappedFile &) = delete;
+
+    const uint8_t *data() const { return mapped ? mapped : reinterpret_cast<const uint8_t *>(buffer.data()); }
+    size_t size() const { return length; }
+
+private:
+    const uint8_t *mapped = nullptr;
+    size_t length = 0;
+    std::vector<char> buffer;          // Fallback when the file is not mapped.
+};
+
+struct Z16Segment {
+    static const uint8_t CODE = 1;
+    static const uint8_t DATA = 2;
+
+    uint16_t address = 0;
+    uint32_t fileSize = 0;
+    uint32_t memSize = 0;
+    uint8_t flags = CODE | DATA;
+    const uint8_t *bytes = nullptr;    // fileSize bytes, inside the image's file.
+};
+
+class Z16Image {
+public:
+    static const size_t MEM_SIZE = 65536;
+    static const uint8_t VERSION = 1;
+    static const size_t HEADER_SIZE = 8;
+    static const size_t ENTRY_SIZE = 12;
+
+    std::vector<Z16Segment> segments;  // In address order.
+    uint16_t entry = 0;
+    bool segmented = false;            // false: a raw binary.
+
+    explicit Z16Image(const std::string &path) : file(path) {
+        const uint8_t *p = file.data();
+        size_t n = file.size();
+        if (isImage(p, n))
+            parse(p, n);
+        else if (n > MEM_SIZE)
+            throw std::runtime_error("Binary file " + path + " is larger than the 64KB address space");
+        else if (n)
+            segments.push_back({ 0, static_cast<uint32_t>(n), static_cast<uint32_t>(n), Z16Segment::CODE | Z16Segment::DATA, p });
+    }
+
+    static bool isImage(const uint8_t *p, size_t n) { return n >= 4 && memcmp(p, "Z16I", 4) == 0; }
+
+    // One past the highest byte any segment occupies.
+    size_t programSize() const {
+        return segments.empty() ? 0 : size_t(segments.back().address) + segments.back().memSize;
+    }
+
+    // Fill all MEM_SIZE bytes of 'memory': segment bytes where they load,
+    // zero everywhere else.
+    void loadInto(uint8_t *memory) const {
+        size_t at = 0;
+        for (const Z16Segment &s : segments) {
+            memset(memory + at, 0, s.address - at);
+            if (s.fileSize)
+                memcpy(memory + s.address, s.bytes, s.fileSize);
+            memset(memory + s.address + s.fileSize, 0, s.memSize - s.fileSize);
+            at = size_t(s.address) + s.memSize;
+        }
+        memset(memory + at, 0, MEM_SIZE - at);
+    }
+
+    // Load into a simulator: memory, program size, pc = entry, predecoded.
+    template <class Simulator>
+    void load(Simulator &sim) const {
+        loadInto(sim.memory.data());
+        sim.programSize = programSize();
+        sim.pc = entry;
+        sim.predecodeImage();
+    }
+
+    // Write a segmented image of the given segments (any order) to 'out'.
+    static void write(std::ostream &out, std::vector<Z16Segment> segs, uint16_t entry) {
+        if (segs.size() > 255)
+            throw std::runtime_error("Too many segments for a Z16 image");
+        std::vector<uint8_t> header{ 'Z', '1', '6', 'I', VERSION, static_cast<uint8_t>(segs.size()),
+                                     static_cast<uint8_t>(entry), static_cast<uint8_t>(entry >> 8) };
+        for (const Z16Segment &s : segs) {
+            header.push_back(s.flags);
+            header.push_back(0);
+            put(header, s.address, 2);
+            put(header, s.fileSize, 4);
+            put(header, s.memSize, 4);
+        }
+        out.write(reinterpret_cast<const char *>(header.data()), header.size());
+        for (const Z16Segment &s : segs)
+            out.write(reinterpret_cast<const char *>(s.bytes), s.fileSize);
+    }
+
+private:
+    Z16MappedFile file;
+
+    static uint32_t get(const uint8_t *p, int bytes) {
+        uint32_t v = 0;
+        for (int i = bytes; i-- > 0;)
+            v = v << 8 | p[i];
+        return v;
+    }
+
+    static void put(std::vector<uint8_t> &out, uint32_t v, int bytes) {
+        for (int i = 0; i < bytes; i++)
+            out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+
+    void parse(const uint8_t *p, size_t n) {
+        if (n < HEADER_SIZE || p[4] != VERSION)
+            throw std::runtime_error("Unsupported or truncated Z16 image header");
+        size_t count = p[5];
+        entry = static_cast<uint16_t>(get(p + 6, 2));
+        segmented = true;
+        size_t data = HEADER_SIZE + count * ENTRY_SIZE;
+        if (n < data)
+            throw std::runtime_error("Truncated Z16 image segment table");
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t *e = p + HEADER_SIZE + i * ENTRY_SIZE;
+            Z16Segment s;
+            s.flags = e[0];
+            s.address = static_cast<uint16_t>(get(e + 2, 2));
+            s.fileSize = get(e + 4, 4);
+            s.memSize = get(e + 8, 4);
+            if (s.fileSize > s.memSize || size_t(s.address) + s.memSize > MEM_SIZE)
+                throw std::runtime_error("Z16 image segment " + std::to_string(i) + " does not fit in memory");
+            if (n - data < s.fileSize)
+                throw std::runtime_error("Truncated Z16 image segment " + std::to_string(i));
+            s.bytes = p + data;
+            data += s.fileSize;
+            if (s.memSize)
+                segments.push_back(s);
+        }
+        std::sort(segments.begin(), segments.end(),
+                  [](const Z16Segment &a, const Z16Segment &b) { return a.address < b.address; });
+        for (size_t i = 1; i < segments.size(); i++)
+            if (size_t(segments[i - 1].address) + segments[i - 1].memSize > segments[i].address)
+                throw std::runtime_error("Z16 image segments overlap");
+    }
+};
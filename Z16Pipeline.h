@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Z16Decode.h"
+
+// ---------------------------------------------------------------------------
+// Pipeline timing model.
+// Estimates the cycles a classic 5-stage pipeline (IF ID EX MEM WB) would
+// take to run the instructions the simulator executes. The execution loop
+// calls retire() after each instruction with its decoded fields; the model
+// only does the bookkeeping, never the execution.
+//
+//   - Data hazards: every register records the cycle from which a consumer
+//     can enter EX. With forwarding an ALU result is ready for the next
+//     instruction and a load's one cycle later (the load-use stall); without
+//     it a consumer waits until the producer's WB.
+//   - Branches (B-type) are predicted in IF and resolved in EX: a
+//     misprediction costs 'mispredictPenalty' cycles, a correctly predicted
+//     taken branch the 'takenPenalty' bubble of computing the target in ID.
+//   - j and jal also cost 'takenPenalty'; jr and jalr are resolved in EX and
+//     always cost 'mispredictPenalty' (there is no target predictor).
+//
+// Predictors: not-taken and backward-taken/forward-not-taken (static),
+// bimodal (2-bit counters indexed by PC) and gshare (2-bit counters indexed
+// by PC xor global history), with 2^tableBits counters.
+// ---------------------------------------------------------------------------
+enum class Z16Predictor { NotTaken, Btfn, Bimodal, Gshare };
+
+struct Z16PipelineConfig {
+    Z16Predictor predictor = Z16Predictor::Bimodal;
+    unsigned tableBits = 10;            // Counters in the bimodal/gshare table: 2^tableBits.
+    unsigned mispredictPenalty = 2;     // Branch resolved in EX: IF and ID are flushed.
+    unsigned takenPenalty = 1;          // Taken branch or jump: target known in ID.
+    bool forwarding = true;
+};
+
+// Parse a predictor name (not-taken, btfn, bimodal, gshare); false if unknown.
+inline bool parsePredictor(const std::string &name, Z16Predictor &predictor) {
+    static const char *const names[] = { "not-taken", "btfn", "bimodal", "gshare" };
+    for (int i = 0; i < 4; i++) {
+        if (name == names[i]) {
+            predictor = static_cast<Z16Predictor>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+class Z16Pipeline {
+public:
+    static constexpr unsigned MAX_TABLE_BITS = 20;
+
+    uint64_t instructions = 0;
+    uint64_t loadUseStalls = 0;         // With forwarding: consumer right after a load.
+    uint64_t dataStalls = 0;            // Without forwarding: waiting for WB.
+    uint64_t mispredictStalls = 0;
+    uint64_t takenStalls = 0;           // Correctly predicted taken branches, j and jal.
+    uint64_t indirectStalls = 0;        // jr and jalr.
+    uint64_t branches = 0;
+    uint64_t branchesTaken = 0;
+    uint64_t predictedCorrectly = 0;
+
+    explicit Z16Pipeline(Z16PipelineConfig config = {}) : cfg(config) {
+        cfg.tableBits = std::min(cfg.tableBits, MAX_TABLE_BITS);
+        reset();
+    }
+
+    const Z16PipelineConfig &config() const { return cfg; }
+
+    void reset() {
+        instructions = loadUseStalls = dataStalls = mispredictStalls = takenStalls = indirectStalls = 0;
+        branches = branchesTaken = predictedCorrectly = 0;
+        counters.assign(size_t(1) << cfg.tableBits, 1);   // Weakly not taken.
+        history = 0;
+        ready.fill(0);
+        // The first instruction enters EX in cycle 2 (IF in 0, ID in 1).
+        nextEx = 2;
+        lastEx = 0;
+    }
+
+    // The instruction 'd' at 'pc' has executed; 'regs' are the registers after it.
+    void retire(const uint16_t *regs, uint16_t pc, DecodedOp d) {
+        const Usage &u = usage(d.op);
+        // Enter EX once the sources are ready.
+        uint64_t ex = nextEx;
+        uint64_t wait = 0;
+        if (u.readsRd)
+            wait = std::max(wait, ready[d.rd]);
+        if (u.readsRs)
+            wait = std::max(wait, ready[d.rs]);
+        if (u.readsFixed >= 0)
+            wait = std::max(wait, ready[u.readsFixed]);
+        if (wait > ex) {
+            uint64_t stall = wait - ex;
+            (cfg.forwarding ? loadUseStalls : dataStalls) += stall;
+            ex = wait;
+        }
+        if (u.writesRd)
+            ready[d.rd] = ex + (cfg.forwarding ? (u.load ? 2 : 1) : 3);
+        instructions++;
+        lastEx = ex;
+        nextEx = ex + 1;
+
+        switch (u.control) {
+            case BRANCH: {
+                // Branches write no registers, so the outcome can be recomputed.
+                bool taken = branchTaken(regs, d);
+                bool predicted = predict(pc, d);
+                train(pc, taken);
+                branches++;
+                branchesTaken += taken;
+                if (predicted == taken) {
+                    predictedCorrectly++;
+                    if (taken)
+                        bubble(takenStalls, cfg.takenPenalty);
+                } else {
+                    bubble(mispredictStalls, cfg.mispredictPenalty);
+                }
+                break;
+            }
+            case DIRECT:
+                bubble(takenStalls, cfg.takenPenalty);
+                break;
+            case INDIRECT:
+                bubble(indirectStalls, cfg.mispredictPenalty);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Cycles until the last instruction retired leaves WB.
+    uint64_t cycles() const { return instructions ? lastEx + 3 : 0; }
+
+    double cpi() const { return instructions ? double(cycles()) / instructions : 0.0; }
+
+    void write(std::string &out) const {
+        static const char *const names[] = { "not-taken", "btfn", "bimodal", "gshare" };
+        char line[160];
+        uint64_t total = cycles();
+        auto share = [&](uint64_t n) { return total ? 100.0 * n / total : 0.0; };
+        snprintf(line, sizeof line, "Pipeline timing model (5-stage, %s, %s predictor",
+                 cfg.forwarding ? "forwarding" : "no forwarding", names[static_cast<int>(cfg.predictor)]);
+        out += line;
+        if (cfg.predictor == Z16Predictor::Bimodal || cfg.predictor == Z16Predictor::Gshare) {
+            snprintf(line, sizeof line, ", %zu counters", counters.size());
+            out += line;
+        }
+        out += "):\n";
+        snprintf(line, sizeof line,
+                 "  Instructions        %12llu\n"
+                 "  Cycles              %12llu\n"
+                 "  CPI                 %12.3f\n"
+                 "  Stall cycles:\n",
+                 (unsigned long long)instructions, (unsigned long long)total, cpi());
+        out += line;
+        const std::pair<const char *, uint64_t> stalls[] = {
+            { "load-use", loadUseStalls }, { "data hazards", dataStalls },
+            { "mispredictions", mispredictStalls }, { "taken branches/jumps", takenStalls },
+            { "jr/jalr", indirectStalls },
+        };
+        for (const auto &s : stalls) {
+            snprintf(line, sizeof line, "    %-20s%12llu %6.2f%%\n", s.first, (unsigned long long)s.second, share(s.second));
+            out += line;
+        }
+        snprintf(line, sizeof line, "  Pipeline fill/drain %12llu\n", (unsigned long long)(instructions ? 4 : 0));
+        out += line;
+        snprintf(line, sizeof line, "  Branches            %12llu (%.2f%% taken)\n"
+                                    "  Predicted correctly %12llu (%.2f%%)\n",
+                 (unsigned long long)branches, branches ? 100.0 * branchesTaken / branches : 0.0,
+                 (unsigned long long)predictedCorrectly, branches ? 100.0 * predictedCorrectly / branches : 0.0);
+        out += line;
+    }
+
+private:
+    enum Control : uint8_t { NONE, BRANCH, DIRECT, INDIRECT };
+
+    struct Usage {
+        bool readsRd, readsRs, writesRd, load;
+        Control control;
+        int8_t readsFixed = -1;         // A register read whatever the fields say (-1: none).
+    };
+
+    // Register and control usage of every handler.
+    static constexpr std::array<Usage, OP_COUNT> buildUsage() {
+        std::array<Usage, OP_COUNT> t{};
+        for (int op = OP_ADD; op <= OP_XOR; op++)
+            t[op] = { true, true, true, false, NONE };
+        t[OP_MV] = { false, true, true, false, NONE };
+        t[OP_JR] = { true, false, false, false, INDIRECT };
+        t[OP_JALR] = { false, true, true, false, INDIRECT };
+        for (int op = OP_ADDI; op <= OP_XORI; op++)
+            t[op] = { true, false, true, false, NONE };
+        t[OP_LI] = { false, false, true, false, NONE };
+        for (int op = OP_BEQ; op <= OP_BGEU; op++)
+            t[op] = { true, op != OP_BZ && op != OP_BNZ, false, false, BRANCH };
+        t[OP_SB] = t[OP_SW] = { true, true, false, false, NONE };
+        t[OP_LB] = t[OP_LW] = t[OP_LBU] = { false, true, true, true, NONE };
+        t[OP_J] = { false, false, false, false, DIRECT };
+        t[OP_JAL] = { false, false, true, false, DIRECT };
+        t[OP_LUI] = t[OP_AUIPC] = { false, false, true, false, NONE };
+        t[OP_ECALL] = { false, false, false, false, NONE, 6 };   // The service's argument, a0.
+        return t;
+    }
+    static const Usage &usage(uint8_t op) {
+        static constexpr std::array<Usage, OP_COUNT> table = buildUsage();
+        return table[op];
+    }
+
+    Z16PipelineConfig cfg;
+    std::vector<uint8_t> counters;      // 2-bit saturating counters.
+    uint32_t history = 0;               // Global branch history (gshare).
+    std::array<uint64_t, 8> ready{};    // Cycle from which each register can be used in EX.
+    uint64_t nextEx = 2;                // Earliest EX cycle of the next instruction.
+    uint64_t lastEx = 0;
+
+    void bubble(uint64_t &counter, unsigned cycles) {
+        counter += cycles;
+        nextEx += cycles;
+    }
+
+    static bool branchTaken(const uint16_t *regs, DecodedOp d) {
+        uint16_t a = regs[d.rd], b = regs[d.rs];
+        switch (d.op) {
+            case OP_BEQ:  return a == b;
+            case OP_BNE:  return a != b;
+            case OP_BZ:   return a == 0;
+            case OP_BNZ:  return a != 0;
+            case OP_BLT:  return (int16_t)a < (int16_t)b;
+            case OP_BGE:  return (int16_t)a >= (int16_t)b;
+            case OP_BLTU: return a < b;
+            default:      return a >= b;   // OP_BGEU
+        }
+    }
+
+    size_t index(uint16_t pc) const {
+        size_t mask = counters.size() - 1;
+        size_t i = pc >> 1;
+        return (cfg.predictor == Z16Predictor::Gshare ? i ^ history : i) & mask;
+    }
+
+    bool predict(uint16_t pc, DecodedOp d) const {
+        switch (cfg.predictor) {
+            case Z16Predictor::NotTaken: return false;
+            case Z16Predictor::Btfn:     return d.imm <= 0;   // Target at or before the branch.
+            default:                     return counters[index(pc)] >= 2;
+        }
+    }
+
+    void train(uint16_t pc, bool taken) {
+        uint8_t &c = counters[index(pc)];
+        if (taken && c < 3)
+            c++;
+        else if (!taken && c > 0)
+            c--;
+        history = ((history << 1) | taken) & ((1u << cfg.tableBits) - 1);
+    }
+};
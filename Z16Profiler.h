@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Z16Decode.h"
+#include "Z16Disasm.h"
+
+// ---------------------------------------------------------------------------
+// Execution profiler.
+// The executor reports each straight-line run of instructions as the jump,
+// taken branch or ecall that ends it transfers control, along with calls,
+// returns and load/store addresses, from the cases that handle them; the
+// execution loop only reports where runs start and stop. Profiling adds no
+// dispatch of its own and nothing to an instruction that falls through to
+// the next. While the program runs, it only bumps flat per-address
+// counters: where runs start and end, and where loads and stores of each
+// width land. finish() derives from them:
+//
+//   - an execution count per PC, from which the report derives the
+//     instruction count per opcode class (R, I, B, S, L, J, U, SYS) using
+//     the word at each PC when it is written;
+//   - taken / not-taken counts per branch (B-type): a run that ends in a
+//     transfer at a branch took it, and every other completed execution
+//     did not;
+//   - load and store counts per memory address (S-type and L-type).
+//
+// It also keeps instruction counts per call stack. jal and jalr push a
+// frame for the callee, and a jr to the return address of one of the top
+// few frames pops back to it; past MAX_DEPTH, calls are only counted. Each
+// distinct stack is a node in a tree of (caller stack, callee) pairs; a node
+// is charged the instructions run since the last call or return.
+//
+// Branches are told apart by the words in memory at finish(), like the
+// class histogram.
+// ---------------------------------------------------------------------------
+class Z16Profiler {
+public:
+    static constexpr size_t MEM_SIZE = 65536;
+    static constexpr size_t MAX_DEPTH = 1024;      // Deeper calls are charged to the frame at this depth.
+    static constexpr size_t RETURN_SEARCH = 8;     // Frames a jr looks through for its return address.
+    static constexpr size_t TOP_COUNT = 10;        // Entries in the hot-spot tables.
+
+    // Filled in by finish().
+    std::vector<uint64_t> executions;          // Per PC.
+    std::vector<uint64_t> taken, notTaken;     // Per branch PC.
+    std::vector<uint64_t> loads, stores;       // Per byte address.
+    uint64_t total = 0;
+
+    Z16Profiler()
+        : executions(MEM_SIZE), taken(MEM_SIZE), notTaken(MEM_SIZE), loads(MEM_SIZE), stores(MEM_SIZE),
+          runStarts(MEM_SIZE), runEnds(MEM_SIZE), runStops(MEM_SIZE), runFaults(MEM_SIZE), byteLoads(MEM_SIZE),
+          wordLoads(MEM_SIZE), byteStores(MEM_SIZE), wordStores(MEM_SIZE) {
+        start(0);
+    }
+
+    // Forget all counts and start the call stack at 'entry'.
+    void start(uint16_t entry) {
+        for (std::vector<uint64_t> *counts : { &executions, &taken, &notTaken, &loads, &stores, &runStarts, &runEnds,
+                                               &runStops, &runFaults, &byteLoads, &wordLoads, &byteStores, &wordStores })
+            std::fill(counts->begin(), counts->end(), 0);
+        total = 0;
+        nodes.assign(1, { 0, entry, 0 });
+        nodeCounts.assign(1, 0);
+        children.clear();
+        frames.clear();
+        frames.reserve(MAX_DEPTH);
+        untracked = 0;
+        node = 0;
+        charged = 0;
+        runStart = entry;
+    }
+
+    // Execution continues at 'pc', after start() or a trap.
+    void startRun(uint16_t pc) { runStart = pc; }
+
+    // The run that began at the last startRun() or endRun() ended with the
+    // instruction at 'last', which transferred control to 'next'.
+    void endRun(uint16_t last, uint16_t next) {
+        runStarts[runStart]++;
+        runEnds[last]++;
+        total += static_cast<uint16_t>(last - runStart) / 2 + 1;
+        runStart = next;
+    }
+
+    // The run stopped after the instruction at 'last' without a transfer:
+    // it trapped, hit a breakpoint or watchpoint, or was the last one of the
+    // program; 'completed' unless it trapped or hit a breakpoint. Nothing to
+    // do if a transfer already ended the run there.
+    void stopRun(uint16_t last, bool completed) {
+        if (runStart > last)
+            return;
+        runStarts[runStart]++;
+        (completed ? runStops : runFaults)[last]++;
+        total += static_cast<uint16_t>(last - runStart) / 2 + 1;
+        runStart = last + 2;
+    }
+
+    // Execution left the program at 'pc': if it fell through to there, the
+    // run stopped before it.
+    void stopBefore(uint16_t pc) {
+        if (runStart < pc)
+            stopRun(pc - 2, true);
+    }
+
+    void load(uint16_t addr, unsigned bytes) { (bytes == 2 ? wordLoads : byteLoads)[addr]++; }
+
+    void store(uint16_t addr, unsigned bytes) { (bytes == 2 ? wordStores : byteStores)[addr]++; }
+
+    // Derive the per-PC, per-branch and per-byte counts from the raw
+    // counters, classifying branches by the words now in 'mem'; call once
+    // the run is over.
+    void finish(const uint8_t *mem) {
+        for (size_t pc = 0; pc < MEM_SIZE; pc++) {
+            // The runs still going after pc - 2, and those starting here.
+            uint64_t through = pc >= 2 ? executions[pc - 2] - runEnds[pc - 2] - runStops[pc - 2] - runFaults[pc - 2] : 0;
+            executions[pc] = through + runStarts[pc];
+            bool isBranch = (mem[pc] & 0x7) == 0x2;   // B-type.
+            taken[pc] = isBranch ? runEnds[pc] : 0;
+            notTaken[pc] = isBranch ? executions[pc] - runEnds[pc] - runFaults[pc] : 0;
+            size_t before = static_cast<uint16_t>(pc - 1);
+            loads[pc] = byteLoads[pc] + wordLoads[pc] + wordLoads[before];
+            stores[pc] = byteStores[pc] + wordStores[pc] + wordStores[before];
+        }
+    }
+
+    // jal/jalr at 'pc' calls 'target', after endRun(). Past MAX_DEPTH frames
+    // only the depth is counted, so a call that never returns costs no memory.
+    void call(uint16_t pc, uint16_t target) {
+        if (frames.size() == MAX_DEPTH) {
+            untracked++;
+            return;
+        }
+        charge();
+        // Most call sites call the same function every time: try the callee
+        // this stack called last before the map.
+        uint32_t child = nodes[node].lastChild;
+        if (!child || nodes[child].function != target)
+            child = findChild(target);
+        node = child;
+        frames.push_back({ node, static_cast<uint16_t>(pc + 2) });
+    }
+
+    // A jr to 'target', after endRun(): a return if it matches a recent
+    // return address.
+    void jump(uint16_t target) {
+        for (size_t i = 0; i < std::min(frames.size(), RETURN_SEARCH); i++) {
+            if (frames[frames.size() - 1 - i].returnAddr == target) {
+                if (untracked) {
+                    // The untracked frames return first. Recursion returns
+                    // to the same address as the top frame, so a return
+                    // there pops one of them; one further down means they
+                    // are all gone.
+                    if (i == 0) {
+                        untracked--;
+                        return;
+                    }
+                    untracked = 0;
+                }
+                charge();
+                frames.resize(frames.size() - 1 - i);
+                node = frames.empty() ? 0 : frames.back().node;
+                return;
+            }
+        }
+    }
+
+    // Annotated listing: each line of the linear disassembly of mem[0, size)
+    // prefixed with the instructions executed in its bytes and their share of
+    // the total, and followed by branch outcomes or memory accesses.
+    void writeListing(const uint8_t *mem, size_t size, std::string &out) const {
+        std::string listing;
+        Z16Disasm::sweep(mem, 0, size, listing);
+        char prefix[64];
+        size_t pos = 0;
+        while (pos < listing.size()) {
+            size_t end = listing.find('\n', pos);
+            size_t next = end + 1;
+            // A listed string may contain newlines; its line runs to the next
+            // address line.
+            while (next < listing.size() && !isListingLine(listing, next)) {
+                end = listing.find('\n', next);
+                next = end + 1;
+            }
+            size_t from = lineAddress(listing, pos);
+            size_t to = next < listing.size() ? lineAddress(listing, next) : size;
+            uint64_t count = 0, in = 0, outCount = 0, t = 0, nt = 0;
+            for (size_t a = from; a < to; a++) {
+                count += executions[a];
+                in += loads[a];
+                outCount += stores[a];
+                t += taken[a];
+                nt += notTaken[a];
+            }
+            if (count)
+                snprintf(prefix, sizeof prefix, "%12llu %6.2f%%  ", (unsigned long long)count, percent(count));
+            else
+                snprintf(prefix, sizeof prefix, "%12s %7s  ", "", "");
+            out += prefix;
+            out.append(listing, pos, end - pos);
+            if (t + nt) {
+                snprintf(prefix, sizeof prefix, "    ; taken %llu, not taken %llu", (unsigned long long)t, (unsigned long long)nt);
+                out += prefix;
+            }
+            if (in + outCount) {
+                snprintf(prefix, sizeof prefix, "    ; loads %llu, stores %llu", (unsigned long long)in, (unsigned long long)outCount);
+                out += prefix;
+            }
+            out += '\n';
+            pos = next;
+        }
+    }
+
+    // Instructions executed per opcode class, classified by the words now in 'mem'.
+    std::array<uint64_t, 8> classCounts(const uint8_t *mem) const {
+        std::array<uint64_t, 8> counts{};
+        for (size_t pc = 0; pc < MEM_SIZE; pc++)
+            if (executions[pc])
+                counts[mem[pc] & 0x7] += executions[pc];
+        return counts;
+    }
+
+    // Summary: class histogram, hottest PCs, branches and memory addresses,
+    // and a per-page memory heatmap.
+    void writeSummary(const uint8_t *mem, std::string &out) const {
+        static const char *const classNames[8] = { "R", "I", "B", "S", "L", "J", "U", "SYS" };
+        std::array<uint64_t, 8> classes = classCounts(mem);
+        char line[128];
+        snprintf(line, sizeof line, "Instructions executed: %llu\n\nBy class:\n", (unsigned long long)total);
+        out += line;
+        for (int c = 0; c < 8; c++) {
+            snprintf(line, sizeof line, "  %-4s %12llu %6.2f%%\n", classNames[c], (unsigned long long)classes[c], percent(classes[c]));
+            out += line;
+        }
+
+        out += "\nHottest instructions:\n";
+        for (size_t a : top(executions)) {
+            snprintf(line, sizeof line, "  0x%04zx %12llu %6.2f%%\n", a, (unsigned long long)executions[a], percent(executions[a]));
+            out += line;
+        }
+
+        std::vector<uint64_t> branchCounts(MEM_SIZE);
+        for (size_t a = 0; a < MEM_SIZE; a++)
+            branchCounts[a] = taken[a] + notTaken[a];
+        out += "\nHottest branches (taken / not taken):\n";
+        for (size_t a : top(branchCounts)) {
+            snprintf(line, sizeof line, "  0x%04zx %12llu %12llu  %6.2f%% taken\n", a, (unsigned long long)taken[a],
+                     (unsigned long long)notTaken[a], 100.0 * taken[a] / branchCounts[a]);
+            out += line;
+        }
+
+        std::vector<uint64_t> accesses(MEM_SIZE);
+        for (size_t a = 0; a < MEM_SIZE; a++)
+            accesses[a] = loads[a] + stores[a];
+        out += "\nHottest memory bytes (loads / stores):\n";
+        for (size_t a : top(accesses)) {
+            snprintf(line, sizeof line, "  0x%04zx %12llu %12llu\n", a, (unsigned long long)loads[a], (unsigned long long)stores[a]);
+            out += line;
+        }
+
+        out += "\nMemory heatmap per 256-byte page (loads / stores):\n";
+        for (size_t page = 0; page < MEM_SIZE; page += 256) {
+            uint64_t in = 0, outCount = 0;
+            for (size_t a = page; a < page + 256; a++) {
+                in += loads[a];
+                outCount += stores[a];
+            }
+            if (in + outCount) {
+                snprintf(line, sizeof line, "  0x%04zx-0x%04zx %12llu %12llu\n", page, page + 255, (unsigned long long)in,
+                         (unsigned long long)outCount);
+                out += line;
+            }
+        }
+    }
+
+    // Call stacks in the folded format flame-graph tools read: one line per
+    // stack, "func_0000;func_0040;func_0100 <instructions>".
+    void writeFoldedStacks(std::string &out) const {
+        char text[32];
+        std::vector<uint32_t> chain;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            uint64_t instructions = nodeCounts[n] + (n == node ? total - charged : 0);
+            if (!instructions)
+                continue;
+            chain.clear();
+            for (uint32_t m = static_cast<uint32_t>(n); m != 0; m = nodes[m].parent)
+                chain.push_back(m);
+            chain.push_back(0);
+            for (size_t i = chain.size(); i-- > 0;) {
+                snprintf(text, sizeof text, "func_%04x%c", nodes[chain[i]].function, i ? ';' : ' ');
+                out += text;
+            }
+            snprintf(text, sizeof text, "%llu\n", (unsigned long long)instructions);
+            out += text;
+        }
+    }
+
+private:
+    struct Node {
+        uint32_t parent;
+        uint16_t function;
+        uint32_t lastChild;   // Node of the last call from this stack, 0 if none.
+    };
+    struct Frame {
+        uint32_t node;        // Stack node of the callee.
+        uint16_t returnAddr;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<uint64_t> nodeCounts;
+    std::unordered_map<uint64_t, uint32_t> children;   // (parent << 16 | function) -> node.
+    std::vector<Frame> frames;
+    size_t untracked = 0;      // Calls past MAX_DEPTH not yet returned from.
+    uint32_t node = 0;
+    uint64_t charged = 0;      // Instructions executed when the stack last changed.
+    // Raw counters. Runs are counted where they start and where they end:
+    // in a transfer, a stop after a completed instruction, or a fault. Word
+    // accesses are counted once, at their first byte.
+    std::vector<uint64_t> runStarts, runEnds, runStops, runFaults;
+    std::vector<uint64_t> byteLoads, wordLoads, byteStores, wordStores;
+    uint16_t runStart = 0;
+
+    // The node for a call to 'target' from the current stack, added if new.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    uint32_t findChild(uint16_t target) {
+        auto [it, added] = children.try_emplace(uint64_t(node) << 16 | target, static_cast<uint32_t>(nodes.size()));
+        if (added) {
+            nodes.push_back({ node, target, 0 });
+            nodeCounts.push_back(0);
+        }
+        nodes[node].lastChild = it->second;
+        return it->second;
+    }
+
+    // Charge the instructions up to the call or return just counted to the
+    // current node.
+    void charge() {
+        nodeCounts[node] += total - charged;
+        charged = total;
+    }
+
+    double percent(uint64_t count) const { return total ? 100.0 * count / total : 0.0; }
+
+    // Addresses of the TOP_COUNT largest non-zero counts, largest first.
+    static std::vector<size_t> top(const std::vector<uint64_t> &counts) {
+        std::vector<size_t> order;
+        for (size_t a = 0; a < counts.size(); a++)
+            if (counts[a])
+                order.push_back(a);
+        size_t n = std::min(order.size(), TOP_COUNT);
+        std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                          [&](size_t x, size_t y) { return counts[x] != counts[y] ? counts[x] > counts[y] : x < y; });
+        order.resize(n);
+        return order;
+    }
+
+    // Listing lines start with "0xAAAA: ".
+    static bool isListingLine(const std::string &listing, size_t pos) {
+        return pos + 8 <= listing.size() && listing[pos] == '0' && listing[pos + 1] == 'x' && listing[pos + 6] == ':';
+    }
+
+    static size_t lineAddress(const std::string &listing, size_t pos) {
+        return std::stoul(listing.substr(pos + 2, 4), nullptr, 16);
+    }
+};
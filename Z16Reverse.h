@@ -0,0 +1,424 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <sstream>
+#include "Z16Simulator.h"
+
+// ---------------------------------------------------------------------------
+// Reverse execution.
+// Z16TimeTravel records a run on the predecoded interpreter so that it can
+// afterwards be stepped backwards, continued backwards to a breakpoint, moved
+// to any instruction count, or asked when an address last changed, without
+// re-running from the start.
+//
+// Two things are kept while recording:
+//
+//   - checkpoints: every 'interval' instructions a Z16Snapshot of the
+//     registers, pc, trap registers and memory. Snapshots share every page
+//     that has not been written since the previous one, so a checkpoint
+//     costs only the pages written in its interval. It also remembers which
+//     pages those were. When there are more than MAX_CHECKPOINTS, every
+//     other one is dropped and the interval doubles, so long runs keep a
+//     bounded number of them;
+//
+//   - an undo log for the instructions since the latest checkpoint: per
+//     instruction its pc, the old value of the one register it can write
+//     (rd, or a0 for ecall), and the address and old bytes of a store. It is
+//     cleared at every checkpoint, so it never holds more than one interval.
+//
+// Stepping back within the log pops entries. Going further back restores the
+// checkpoint before the target and replays forward to it, rebuilding the log
+// on the way; a replay never covers more than one interval. "When did this
+// address last change" searches the log and then, newest first, only the
+// intervals whose checkpoint says the address's page was written.
+//
+// Times count steps from the start of the recording: an executed
+// instruction, or a trap taken by a guest handler (which changes pc and the
+// trap registers without executing anything). Replays run with the console
+// silenced, since the output they would repeat has already been written.
+// Device state cannot be rewound, so recording runs without devices.
+// ---------------------------------------------------------------------------
+struct Z16UndoEntry {
+    uint16_t pc;                // pc before the step.
+    uint16_t oldReg;            // Old value of regs[reg].
+    uint16_t addr;              // Store address...
+    uint16_t oldMem;            // ...and the two bytes there before it (low byte first).
+    uint8_t reg;
+    uint8_t stored;             // Bytes stored: 0, 1 or 2.
+};
+
+// A change found by Z16TimeTravel::lastChange().
+struct Z16Change {
+    uint64_t time = 0;          // Step that made it.
+    uint16_t pc = 0;            // Instruction that made it.
+    uint8_t before = 0, after = 0;
+};
+
+class Z16TimeTravel {
+public:
+    static const size_t MAX_CHECKPOINTS = 1024;
+    static const size_t PAGE_COUNT = Z16Simulator::MEM_SIZE / Z16Simulator::PAGE_SIZE;
+
+    explicit Z16TimeTravel(Z16Simulator &sim, uint64_t interval = 1 << 16)
+        : sim(sim), interval(interval ? interval : 1), silent(nullptr) {}
+
+    uint64_t now() const { return time; }
+    uint64_t end() const { return recorded; }          // Last step recorded.
+    size_t checkpointCount() const { return checkpoints.size(); }
+    uint64_t checkpointInterval() const { return interval; }
+
+    // -----------------------------------------------------
+    // Record: run forward from the current step, with the same contract
+    // (trace, watchdog, return value) as Z16Simulator::runExecution. Started
+    // at an earlier step than end(), it discards the recorded future.
+    // -----------------------------------------------------
+    template <bool Trace>
+    bool run(Z16TraceWriter &trace, Z16Watchdog &watchdog) {
+        if (checkpoints.empty()) {
+            checkpoint();
+            startLog();
+        }
+        while (checkpoints.back().time > time)
+            checkpoints.pop_back();
+        recorded = time;
+        uint64_t executed = 0;
+        while (sim.pc < sim.programSize) {
+            if (Trace && trace.sample())
+                trace.line(sim, sim.pc, sim.fetchDecoded(sim.pc).inst);
+            uint16_t from = sim.pc;
+            bool running = step();
+            recorded = time;
+            if (!running)
+                break;
+            executed++;
+            if (sim.pc <= from && executed >= watchdog.nextCheck && !watchdog.check(sim, sim.pc, executed)) {
+                trace.stopped(watchdog.reason(), sim.pc);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // -----------------------------------------------------
+    // Queries. Each one leaves the machine in the state it had after the
+    // step it reports (or the step it moved to).
+    // -----------------------------------------------------
+
+    // Move to step 'target' (clamped to the recorded range).
+    void seek(uint64_t target) {
+        target = min(target, recorded);
+        if (target < logStart)
+            restoreCheckpoint(target);
+        while (time > target)
+            undo();
+        replayTo(target);
+    }
+
+    // Step back 'n' steps; false if the start was reached first.
+    bool stepBack(uint64_t n = 1) {
+        bool enough = n <= time;
+        seek(enough ? time - n : 0);
+        return enough;
+    }
+
+    // Step back until 'stop(sim)' holds (e.g. pc at a breakpoint), checking
+    // every earlier step, newest first. False if it never does: the machine
+    // is then at step 0.
+    template <class Stop>
+    bool continueBack(Stop stop) {
+        while (time > 0) {
+            if (time == logStart)
+                rebuildLog();
+            undo();
+            if (stop(sim))
+                return true;
+        }
+        return false;
+    }
+
+    // Find the last step before now that changed the byte at 'addr'. The
+    // machine stays where it is. False if it never changed.
+    bool lastChange(uint16_t addr, Z16Change &change) {
+        uint64_t origin = time;
+        uint8_t value = sim.readByte(addr);      // The value after the step searched.
+        bool found = searchLog(addr, value, change);
+        size_t page = addr / Z16Simulator::PAGE_SIZE;
+        // Older intervals, newest first, skipping those that never wrote the page.
+        size_t k = checkpointAt(logStart);
+        while (!found && k > 0) {
+            if (checkpoints[k].written[page]) {
+                restoreCheckpoint(checkpoints[k - 1].time);
+                replayTo(checkpoints[k].time);
+                found = searchLog(addr, value, change);
+            }
+            k--;
+        }
+        seek(origin);
+        return found;
+    }
+
+private:
+    struct Checkpoint {
+        uint64_t time;
+        Z16Snapshot snap;
+        bitset<PAGE_COUNT> written;             // Pages written since the previous checkpoint.
+    };
+    struct SavedTrapRegs {
+        uint64_t time;                          // Step that changed them.
+        array<uint16_t, TRAP_REG_COUNT> regs;
+    };
+
+    Z16Simulator &sim;
+    uint64_t interval;
+    uint64_t time = 0;
+    uint64_t recorded = 0;
+    uint64_t logStart = 0;                      // Step of the first log entry.
+    uint64_t nextCheckpoint = 0;                // Step at which the log next restarts.
+    vector<Checkpoint> checkpoints;             // Ascending times, multiples of 'interval'.
+    vector<Z16UndoEntry> log;
+    vector<SavedTrapRegs> savedTrapRegs;        // Steps in the log that changed the trap registers.
+    ostream silent;                             // Console while replaying.
+
+    // Execute one step, logging how to undo it. False when the run ends.
+    bool step() {
+        if (time == nextCheckpoint)
+            atCheckpoint();
+        DecodedOp d = sim.fetchDecoded(sim.pc);
+        Z16UndoEntry &e = log.emplace_back();
+        e.pc = sim.pc;
+        e.reg = d.op == OP_ECALL ? 6 : d.rd;    // ecall 16 writes a0.
+        e.oldReg = sim.regs[e.reg];
+        e.stored = d.op == OP_SB ? 1 : d.op == OP_SW ? 2 : 0;
+        if (e.stored) {
+            e.addr = sim.regs[d.rd] + d.imm;
+            e.oldMem = sim.readByte(e.addr) | sim.readByte(e.addr + 1) << 8;
+        }
+        if (d.op == OP_ECALL)
+            savedTrapRegs.push_back({ time, sim.trapRegs });
+        time++;
+        return sim.executeDecoded(d) || stepEnded();
+    }
+
+    // The step just logged returned false: it either ended the run (ecall 3,
+    // or ran off the end) or trapped without effect, in which case the step
+    // is the guest taking the trap, if it does.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    bool stepEnded() {
+        if (!sim.trap)
+            return false;
+        savedTrapRegs.push_back({ time - 1, sim.trapRegs });
+        if (sim.enterTrap())
+            return true;
+        savedTrapRegs.pop_back();
+        log.pop_back();
+        time--;
+        return false;
+    }
+
+    void undo() {
+        Z16UndoEntry e = log.back();
+        log.pop_back();
+        time--;
+        while (!savedTrapRegs.empty() && savedTrapRegs.back().time == time) {
+            sim.trapRegs = savedTrapRegs.back().regs;
+            savedTrapRegs.pop_back();
+        }
+        if (e.stored) {
+            sim.writeByte(e.addr, e.oldMem & 0xFF);
+            if (e.stored == 2)
+                sim.writeByte(e.addr + 1, e.oldMem >> 8);
+        }
+        sim.regs[e.reg] = e.oldReg;
+        sim.pc = e.pc;
+        sim.trap = Z16Trap();
+    }
+
+    // Reached a multiple of the interval: take a checkpoint there (or, when
+    // replaying, find the one already taken) and start a new log.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    void atCheckpoint() {
+        if (checkpoints.empty() || checkpoints.back().time < time)
+            checkpoint();
+        startLog();
+    }
+
+    void startLog() {
+        log.clear();
+        savedTrapRegs.clear();
+        logStart = time;
+        nextCheckpoint = (time / interval + 1) * interval;
+    }
+
+    void checkpoint() {
+        Checkpoint c;
+        c.time = time;
+        for (size_t p = 0; p < PAGE_COUNT; p++)
+            c.written[p] = (sim.dirtyPages[p] & Z16Snapshot::DIRTY_BIT) != 0;
+        c.snap = sim.snapshot();
+        checkpoints.push_back(move(c));
+        if (checkpoints.size() > MAX_CHECKPOINTS)
+            thin();
+    }
+
+    // Keep the checkpoints at multiples of twice the interval. A dropped
+    // checkpoint's written pages carry over to the next one kept.
+    void thin() {
+        interval *= 2;
+        size_t kept = 0;
+        bitset<PAGE_COUNT> carried;
+        for (size_t i = 0; i < checkpoints.size(); i++) {
+            carried |= checkpoints[i].written;
+            if (checkpoints[i].time % interval == 0 || i + 1 == checkpoints.size()) {
+                checkpoints[i].written = carried;
+                carried.reset();
+                if (kept != i)
+                    checkpoints[kept] = move(checkpoints[i]);
+                kept++;
+            }
+        }
+        checkpoints.resize(kept);
+    }
+
+    // Index of the latest checkpoint at or before 't'.
+    size_t checkpointAt(uint64_t t) const {
+        size_t k = checkpoints.size() - 1;
+        while (k > 0 && checkpoints[k].time > t)
+            k--;
+        return k;
+    }
+
+    // Go back to the latest checkpoint at or before 't' with an empty log.
+    void restoreCheckpoint(uint64_t t) {
+        const Checkpoint &c = checkpoints[checkpointAt(t)];
+        sim.restore(c.snap);
+        sim.trap = Z16Trap();
+        time = c.time;
+        startLog();
+    }
+
+    // The log is empty: rebuild it back to the previous checkpoint.
+    void rebuildLog() {
+        uint64_t target = time;
+        restoreCheckpoint(target - 1);
+        replayTo(target);
+    }
+
+    // Run forward (silently, logging) to step 'target' <= recorded.
+    void replayTo(uint64_t target) {
+        if (time >= target)
+            return;
+        ostream *console = sim.console;
+        sim.console = &silent;
+        while (time < target && sim.pc < sim.programSize && step()) {}
+        sim.console = console;
+    }
+
+    // Search the log, newest first, for a store that changed 'addr' from
+    // what it held before to 'value'. On the way back 'value' becomes the
+    // byte's value at the start of the log.
+    bool searchLog(uint16_t addr, uint8_t &value, Z16Change &change) const {
+        for (size_t i = log.size(); i-- > 0;) {
+            const Z16UndoEntry &e = log[i];
+            uint8_t old;
+            if (e.stored && e.addr == addr)
+                old = e.oldMem & 0xFF;
+            else if (e.stored == 2 && static_cast<uint16_t>(e.addr + 1) == addr)
+                old = e.oldMem >> 8;
+            else
+                continue;
+            if (old != value) {
+                change.time = logStart + i;
+                change.pc = e.pc;
+                change.before = old;
+                change.after = value;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Run time-travel commands from 'in', one per line, reporting to 'out':
+//
+//   back [N]              step back N steps (default 1)
+//   forward [N]           step forward N recorded steps (default 1)
+//   goto T                move to step T
+//   rcontinue PC[,PC...]  step back to the last time pc was one of these
+//   last-change ADDR      when the byte at ADDR last changed
+//   where                 current step and pc
+//   regs                  registers
+//
+// Numbers take any C prefix (0x...). Blank lines and '#' comments are skipped.
+inline void runTimeTravelCommands(Z16TimeTravel &travel, Z16Simulator &sim, istream &in, ostream &out) {
+    auto where = [&] {
+        out << "step " << dec << travel.now() << " of " << travel.end() << ", pc = 0x" << hex << setw(4)
+            << setfill('0') << sim.pc << dec << setfill(' ') << "\n";
+    };
+    string line;
+    while (getline(in, line)) {
+        istringstream words(line);
+        string command, argument;
+        words >> command >> argument;
+        if (command.empty() || command[0] == '#')
+            continue;
+        char *end;
+        uint64_t n = argument.empty() ? 1 : strtoull(argument.c_str(), &end, 0);
+        bool valid = argument.empty() || !*end;
+        out << "> " << line << "\n";
+        if (command == "back" && valid) {
+            if (!travel.stepBack(n))
+                out << "reached the start of the recording\n";
+            where();
+        } else if (command == "forward" && valid) {
+            travel.seek(travel.now() + n);
+            where();
+        } else if (command == "goto" && valid && !argument.empty()) {
+            travel.seek(n);
+            where();
+        } else if (command == "rcontinue" && !argument.empty()) {
+            vector<uint16_t> breakpoints;
+            for (size_t at = 0; at != string::npos && valid;) {
+                size_t comma = argument.find(',', at);
+                string pc = argument.substr(at, comma == string::npos ? string::npos : comma - at);
+                breakpoints.push_back(static_cast<uint16_t>(strtoul(pc.c_str(), &end, 0)));
+                valid = !pc.empty() && !*end;
+                at = comma == string::npos ? comma : comma + 1;
+            }
+            if (!valid) {
+                out << "usage: rcontinue PC[,PC...]\n";
+                continue;
+            }
+            bool hit = travel.continueBack([&](const Z16Simulator &s) {
+                return find(breakpoints.begin(), breakpoints.end(), s.pc) != breakpoints.end();
+            });
+            if (!hit)
+                out << "no breakpoint hit; reached the start of the recording\n";
+            where();
+        } else if (command == "last-change" && valid && !argument.empty()) {
+            Z16Change change;
+            uint16_t addr = static_cast<uint16_t>(n);
+            out << hex << setfill('0');
+            if (travel.lastChange(addr, change))
+                out << "0x" << setw(4) << addr << " changed 0x" << setw(2) << int(change.before) << " -> 0x" << setw(2)
+                    << int(change.after) << " at step " << dec << change.time << " (pc = 0x" << hex << setw(4)
+                    << change.pc << ")\n";
+            else
+                out << "0x" << setw(4) << addr << " has not changed since the start of the recording\n";
+            out << dec << setfill(' ');
+        } else if (command == "where") {
+            where();
+        } else if (command == "regs") {
+            out << hex << setfill('0');
+            for (size_t r = 0; r < sim.regs.size(); r++)
+                out << sim.regNames[r] << " = 0x" << setw(4) << sim.regs[r] << (r % 4 == 3 ? "\n" : "  ");
+            out << dec << setfill(' ');
+        } else {
+            out << "unknown or malformed command\n";
+        }
+    }
+}
@@ -0,0 +1,1216 @@
+#pragma once
+
+#include <iostream>      
+#include <fstream>       
+#include <sstream>       // For stringstream (used in disassembly)
+#include <cstdint>       // For fixed-width integer types (uint16_t, uint8_t)
+#include <cstring>       
+#include <array>         
+#include <stdexcept>     
+#include <cstdlib>       
+#include <iomanip>       
+#include <vector>
+#include <algorithm>
+#include "Z16Decode.h"   // Predecoded instruction form (DecodedOp)
+#include "Z16Disasm.h"   // Table-driven disassembler
+#include "Z16TraceWriter.h"
+#include "Z16Watchdog.h"
+#include "Z16Snapshot.h"
+#include "Z16Profiler.h"
+#include "Z16Pipeline.h"
+#include "Z16Cache.h"
+#include "Z16Loader.h"
+#include "Z16Devices.h"
+#include "Z16Trap.h"
+#include "Z16Stops.h"
+#include "Z16Coverage.h"
+using namespace std;
+
+// Define total memory size as 64KB.
+static const size_t MEM_SIZE = 65536;
+
+// Optional observers of the execution loop (see runExecution), and the
+// memory-mapped devices. Each one that is present is compiled into its own
+// instantiation of the loop.
+struct Z16Plugins {
+    Z16Profiler *profiler = nullptr;   // Z16Profiler.h
+    Z16Pipeline *pipeline = nullptr;   // Z16Pipeline.h
+    Z16Cache *icache = nullptr;        // Z16Cache.h, fed by instruction fetches...
+    Z16Cache *dcache = nullptr;        // ...and by loads and stores.
+    Z16Bus *bus = nullptr;             // Z16Devices.h, if it has any devices.
+    Z16Watchpoints *watch = nullptr;   // Z16Stops.h, if it has any watchpoints.
+    Z16Coverage *coverage = nullptr;   // Z16Coverage.h
+
+    static constexpr unsigned PROFILE = 1, TIMING = 2, ICACHE = 4, DCACHE = 8, DEVICES = 16, WATCH = 32, ALL = 63;
+
+    // Not part of ALL, so runExecution(plugins) neither reports nor selects
+    // it: the fuzzer (Z16Fuzz.h) runs executionLoop<false, COVERAGE> itself,
+    // and the other observers are compiled without a coverage variant.
+    static constexpr unsigned COVERAGE = 64;
+
+    unsigned present() const {
+        return (profiler ? PROFILE : 0) | (pipeline ? TIMING : 0) | (icache ? ICACHE : 0) | (dcache ? DCACHE : 0) |
+               (bus && !bus->empty() ? DEVICES : 0) | (watch && !watch->empty() ? WATCH : 0);
+    }
+};
+
+class Z16Simulator {
+public:
+    // 64KB memory (overridden within the class)
+    static constexpr size_t MEM_SIZE = 65536;
+
+    // Granularity of the dirty-page map.
+    static const size_t PAGE_SIZE = Z16Watchdog::PAGE_SIZE;
+    
+    // Array of 8 registers (16-bit each). The registers are indexed 0 to 7.
+    array<uint16_t, 8> regs;
+    
+    // Program counter (16-bit) holds the current address in memory.
+    uint16_t pc;
+    
+    // Memory array representing the entire 64KB.
+    array<uint8_t, MEM_SIZE> memory;
+    
+    // Total number of bytes loaded into memory (program size).
+    size_t programSize;
+    
+    // Register ABI names for display (used for disassembly and debugging).
+    const array<string, 8> regNames = { "t0", "ra", "sp", "s0", "s1", "t1", "a0", "a1" };
+
+    // One byte per PAGE_SIZE bytes of memory; every store sets all its bits
+    // (DIRTY_ALL). Each consumer owns one bit and clears only that one: the
+    // watchdog's livelock detector (Z16Watchdog::DIRTY_BIT), snapshots
+    // (Z16Snapshot::DIRTY_BIT) and the co-simulator (Z16CoSim::DIRTY_BIT).
+    array<uint8_t, MEM_SIZE / PAGE_SIZE> dirtyPages;
+    static constexpr uint8_t DIRTY_ALL = 0xFF;
+
+    // Set when an instruction traps (Z16Trap.h) and no guest handler takes it.
+    Z16Trap trap;
+
+    // Guest trap registers, indexed by Z16TrapReg.
+    array<uint16_t, TRAP_REG_COUNT> trapRegs{};
+
+    // What loads and stores do with a word at an odd address.
+    Z16Misaligned misaligned = Z16Misaligned::Allow;
+
+    // Pages of the last snapshot taken or restored. Memory matches them except
+    // where a page's Z16Snapshot::DIRTY_BIT is set; null before the first one.
+    Z16Snapshot::PageTable basePages;
+
+    // Decode cache: one predecoded record per halfword of memory.
+    // Slots start out (and are reset to) OP_UNDECODED and are filled lazily on fetch.
+    vector<DecodedOp> decodeCache;
+
+    // Debugger breakpoints. Each one is an OP_BREAKPOINT in the decode cache,
+    // put back whenever its slot is refilled, so engines find them by
+    // dispatching on the op as usual and only look this list up when they
+    // reach one (for its condition, Z16Stops.h).
+    struct Breakpoint {
+        uint16_t addr;
+        Z16Condition condition;        // Empty: always stop.
+    };
+    vector<Breakpoint> breakpoints;
+
+    // Where ecall output and execution warnings are written.
+    ostream *console;
+
+    // Constructor initializes registers, program counter, and memory.
+    // Note: sp (reg index 2) is initialized to point near the end of memory.
+    Z16Simulator() : pc(0), programSize(0), decodeCache(MEM_SIZE / 2), console(&cout) {
+        regs.fill(0);            // Set all registers to 0.
+        regs[2] = MEM_SIZE - 2;  // Initialize sp register to top of memory (minus 2).
+        memory.fill(0);          // Clear all memory bytes.
+        dirtyPages.fill(DIRTY_ALL);
+    }
+
+    // Return to the freshly constructed state (console excepted), so one
+    // simulator object can run many programs. A caller about to overwrite all
+    // of memory anyway (Z16Image::loadInto) can skip clearing it.
+    void reset(bool clearMemory = true) {
+        pc = 0;
+        programSize = 0;
+        regs.fill(0);
+        regs[2] = MEM_SIZE - 2;
+        if (clearMemory)
+            memory.fill(0);
+        trap = Z16Trap();
+        trapRegs.fill(0);
+        invalidateDecodeCache();
+    }
+
+
+    // -----------------------------------------------------------------------
+    // Memory access. Addresses are 16-bit and wrap, so these cannot fail: a
+    // word at 0xFFFF has its high byte at 0x0000. Aligned words are single
+    // native 16-bit accesses on little-endian hosts. Loads and stores made by
+    // instructions go through loadWord/storeWord and friends below, which
+    // apply the misaligned-access policy and raise traps (Z16Trap.h).
+    // -----------------------------------------------------------------------
+
+    // Read a byte from memory at the given address.
+    uint8_t readByte(uint16_t addr) const {
+        return memory[addr];
+    }
+
+void showmem(ostream &out) {
+    out << "\nUsed Memory Listing (only non-zero cells):\n";
+    bool foundAny = false;
+    // Go through the entire memory.
+    for (size_t addr = 0; addr < MEM_SIZE; ++addr) {
+        // Only output memory locations that have a nonzero value.
+        if (memory[addr] != 0) {
+            out << "Addr 0x" << setw(4) << setfill('0') << hex << addr
+                << " : 0x" << setw(2) << setfill('0') << hex << (int)memory[addr] << "\n";
+            foundAny = true;
+        }
+    }
+    // In case no memory cells were used.
+    if (!foundAny) {
+        out << "No used memory addresses found.\n";
+    }
+}
+
+
+    // Read a 16-bit word from memory (using little-endian order).
+    uint16_t readWord(uint16_t addr) const {
+        if (addr == MEM_SIZE - 1)
+            return memory[addr] | (memory[0] << 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        uint16_t value;
+        memcpy(&value, &memory[addr], 2);
+        return value;
+#else
+        // Combine two bytes: low byte at addr, high byte at addr+1.
+        return memory[addr] | (memory[addr + 1] << 8);
+#endif
+    }
+
+    // Write a byte to memory at the given address.
+    void writeByte(uint16_t addr, uint8_t value) {
+        memory[addr] = value;
+        decodeCache[addr >> 1].op = OP_UNDECODED;  // Self-modifying code support.
+        dirtyPages[addr / PAGE_SIZE] = DIRTY_ALL;
+    }
+
+    // Write a 16-bit word to memory in little-endian order.
+    void writeWord(uint16_t addr, uint16_t value) {
+        if (addr & 1) {
+            // Two halfwords and possibly two pages (or, at 0xFFFF, both ends of memory).
+            writeByte(addr, value & 0xFF);
+            writeByte(addr + 1, value >> 8);
+            return;
+        }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(&memory[addr], &value, 2);
+#else
+        memory[addr] = value & 0xFF;             // Lower 8 bits.
+        memory[addr + 1] = (value >> 8) & 0xFF;    // Upper 8 bits.
+#endif
+        decodeCache[addr >> 1].op = OP_UNDECODED;
+        dirtyPages[addr / PAGE_SIZE] = DIRTY_ALL;
+    }
+
+    // Copy 'size' bytes to 'addr' (not wrapping past the end of memory),
+    // dropping the predecoded records and marking dirty only the pages they
+    // cover, so loading a small image costs O(size), not O(memory).
+    void loadBytes(uint16_t addr, const uint8_t *bytes, size_t size) {
+        size = min(size, MEM_SIZE - addr);
+        if (!size)
+            return;
+        memcpy(&memory[addr], bytes, size);
+        for (size_t i = addr >> 1; i <= (addr + size - 1) >> 1; i++)
+            decodeCache[i].op = OP_UNDECODED;
+        for (size_t p = addr / PAGE_SIZE; p <= (addr + size - 1) / PAGE_SIZE; p++)
+            dirtyPages[p] = DIRTY_ALL;
+    }
+
+    // Drop every predecoded record and mark every page dirty (needed after
+    // writing 'memory' directly).
+    void invalidateDecodeCache() {
+        for (DecodedOp &d : decodeCache)
+            d.op = OP_UNDECODED;
+        dirtyPages.fill(DIRTY_ALL);
+    }
+
+    // -----------------------------------------------------------------------
+    // Snapshots (see Z16Snapshot.h).
+    // -----------------------------------------------------------------------
+
+    // Capture the machine state. Pages not written since the last snapshot
+    // or restore are shared with it rather than copied.
+    Z16Snapshot snapshot() {
+        for (size_t p = 0; p < basePages.size(); p++) {
+            if (!basePages[p] || (dirtyPages[p] & Z16Snapshot::DIRTY_BIT)) {
+                basePages[p] = Z16Snapshot::makePage(memory.data() + p * PAGE_SIZE);
+                dirtyPages[p] &= ~Z16Snapshot::DIRTY_BIT;
+            }
+        }
+        Z16Snapshot snap;
+        snap.regs = regs;
+        snap.pc = pc;
+        snap.trapRegs = trapRegs;
+        snap.programSize = programSize;
+        snap.pages = basePages;
+        return snap;
+    }
+
+    // Return to the state captured in 'snap', copying only the pages that
+    // differ from it. 'onPageCopied(page)' is called for each copied page
+    // (the block engine uses it to drop stale translations). Returns the
+    // number of pages copied.
+    template <class OnPageCopied>
+    size_t restore(const Z16Snapshot &snap, OnPageCopied onPageCopied) {
+        static_assert(Z16Snapshot::PAGE_SIZE == PAGE_SIZE, "snapshot pages are dirty-map pages");
+        size_t copied = 0;
+        for (size_t p = 0; p < basePages.size(); p++) {
+            if (basePages[p] == snap.pages[p] && !(dirtyPages[p] & Z16Snapshot::DIRTY_BIT))
+                continue;
+            memcpy(memory.data() + p * PAGE_SIZE, snap.pages[p]->data(), PAGE_SIZE);
+            for (size_t i = p * PAGE_SIZE / 2; i < (p + 1) * PAGE_SIZE / 2; i++)
+                decodeCache[i].op = OP_UNDECODED;
+            basePages[p] = snap.pages[p];
+            dirtyPages[p] = DIRTY_ALL & ~Z16Snapshot::DIRTY_BIT;
+            onPageCopied(p);
+            copied++;
+        }
+        regs = snap.regs;
+        pc = snap.pc;
+        trapRegs = snap.trapRegs;
+        programSize = snap.programSize;
+        trap = Z16Trap();
+        return copied;
+    }
+
+    size_t restore(const Z16Snapshot &snap) {
+        return restore(snap, [](size_t) {});
+    }
+
+    // Predecode the loaded program image so the first pass through it is fast too.
+    void predecodeImage() {
+        invalidateDecodeCache();
+        for (size_t addr = 0; addr + 1 < programSize; addr += 2)
+            decodeCache[addr >> 1] = decodeInstruction(readWord(addr));
+    }
+
+    // Fetch the predecoded record for 'addr', decoding it on a cache miss.
+    // Odd addresses are never cached and are decoded on every fetch. Both
+    // cases share one test so a hit is straight-line code.
+    DecodedOp fetchDecoded(uint16_t addr) {
+        DecodedOp d = decodeCache[addr >> 1];
+        if ((addr & 1) | (d.op == OP_UNDECODED))
+            return decodeMiss(addr);
+        return d;
+    }
+
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    DecodedOp decodeMiss(uint16_t addr) {
+        if (addr & 1)
+            return decodeAt(addr);
+        return decodeCache[addr >> 1] = decodeAt(addr);
+    }
+
+    // Decode the instruction at 'addr' for the cache: OP_BREAKPOINT if a
+    // breakpoint is set there. Out of line: it only runs on cache misses.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    DecodedOp decodeAt(uint16_t addr) const {
+        DecodedOp d = decodeInstruction(readWord(addr));
+        if (!breakpoints.empty() && isBreakpoint(addr))
+            d.op = OP_BREAKPOINT;
+        return d;
+    }
+
+    bool isBreakpoint(uint16_t addr) const {
+        return findBreakpoint(addr) != breakpoints.end();
+    }
+
+    vector<Breakpoint>::const_iterator findBreakpoint(uint16_t addr) const {
+        return find_if(breakpoints.begin(), breakpoints.end(), [=](const Breakpoint &b) { return b.addr == addr; });
+    }
+
+    // Set or clear a breakpoint: an instruction fetched from 'addr' stops
+    // the run with a Breakpoint trap instead of executing, if 'condition'
+    // holds then; otherwise it executes as usual. Setting one again replaces
+    // its condition. The block engine must also drop its translations of
+    // 'addr' (Z16BlockEngine::invalidate).
+    void setBreakpoint(uint16_t addr, Z16Condition condition = Z16Condition()) {
+        auto b = findBreakpoint(addr);
+        if (b == breakpoints.end())
+            breakpoints.push_back({ addr, std::move(condition) });
+        else
+            breakpoints[b - breakpoints.begin()].condition = std::move(condition);
+        if (!(addr & 1))
+            decodeCache[addr >> 1] = decodeAt(addr);
+    }
+
+    void clearBreakpoint(uint16_t addr) {
+        breakpoints.erase(remove_if(breakpoints.begin(), breakpoints.end(),
+                                    [=](const Breakpoint &b) { return b.addr == addr; }),
+                          breakpoints.end());
+        if (!(addr & 1))
+            decodeCache[addr >> 1] = decodeAt(addr);
+    }
+
+
+    // -----------------------------------------------------------------------
+    // Disassemble a 16-bit instruction into a human-readable assembly string.
+    // 'addr' is the current address (used for branch targets). The text comes
+    // from the table-driven formatter in Z16Disasm.h.
+    // -----------------------------------------------------------------------
+    string disassemble(uint16_t addr, uint16_t inst) {
+        char text[Z16Disasm::MAX_TEXT];
+        return string(text, Z16Disasm::formatInstruction(text, addr, inst));
+    }
+
+    // -----------------------------------------------------
+    // Execution Loop: Simulate running the loaded program.
+    // -----------------------------------------------------
+    bool runExecution(ostream &out) {
+        Z16TraceWriter trace(out);
+        Z16Watchdog watchdog;
+        return runExecution<true>(trace, watchdog);
+    }
+
+    // Same loop with a configurable trace and budget. Trace = false is the
+    // untraced instantiation used for TraceMode::None; it has no
+    // per-instruction trace code. The watchdog is consulted at backward
+    // control transfers and on entering and returning from a trap handler
+    // only. Returns false if the watchdog stopped the run.
+    template <bool Trace>
+    bool runExecution(Z16TraceWriter &trace, Z16Watchdog &watchdog) {
+        return executionLoop<Trace, 0>(trace, watchdog, nullptr);
+    }
+
+    // Same again with the observers in 'plugins'. Each combination of
+    // observers is its own instantiation of the loop, chosen once per run, so
+    // a run without one pays nothing for it.
+    template <bool Trace>
+    bool runExecution(Z16TraceWriter &trace, Z16Watchdog &watchdog, const Z16Plugins &plugins) {
+        return selectLoop<Trace>(plugins.present(), trace, watchdog, plugins);
+    }
+
+    template <bool Trace, unsigned Plugins = 0>
+    bool selectLoop(unsigned present, Z16TraceWriter &trace, Z16Watchdog &watchdog, const Z16Plugins &plugins) {
+        if constexpr (Plugins < Z16Plugins::ALL) {
+            if (present != Plugins)
+                return selectLoop<Trace, Plugins + 1>(present, trace, watchdog, plugins);
+        }
+        return executionLoop<Trace, Plugins>(trace, watchdog, &plugins);
+    }
+
+    template <bool Trace, unsigned Plugins>
+    bool executionLoop(Z16TraceWriter &trace, Z16Watchdog &watchdog, const Z16Plugins *plugins) {
+        uint64_t executed = 0;
+        // The inner loop ends when an instruction returns false; if that was
+        // a trap the guest handles, carry on in its handler. Entering a
+        // handler and returning from one (ecall 18) are watchdog check points
+        // like a backward transfer: a handler that returns to an instruction
+        // that faults again loops without making one.
+        for (;;) {
+            if (Plugins & Z16Plugins::PROFILE)
+                plugins->profiler->startRun(pc);
+            while (pc < programSize) {
+                DecodedOp op = fetchDecoded(pc);
+                if (Trace && trace.sample())
+                    trace.line(*this, pc, op.inst);
+                if (Plugins & Z16Plugins::DEVICES)
+                    plugins->bus->now = executed;
+                if (Plugins & Z16Plugins::ICACHE)
+                    plugins->icache->read(pc, pc, 2);
+                // Execute the instruction. If execution should terminate, break.
+                uint16_t from = pc;
+                bool running = executeDecoded<Plugins>(op, plugins);
+                if (Plugins & Z16Plugins::TIMING)
+                    plugins->pipeline->retire(regs.data(), from, op);
+                bool watched = (Plugins & Z16Plugins::WATCH) && plugins->watch->pending && watchStop(*plugins->watch, from);
+                if (watched || !running) {
+                    if (Plugins & Z16Plugins::PROFILE)
+                        plugins->profiler->stopRun(from, pc == from + 2);
+                    break;
+                }
+                executed++;
+                if (pc <= from || (op.op == OP_ECALL && pc != from + 2)) {
+                    // The profiler hears about straight-line runs as they end:
+                    // here for ecalls, and from executeDecoded for the jumps
+                    // and branches, so falling through costs it nothing.
+                    if ((Plugins & Z16Plugins::PROFILE) && op.op == OP_ECALL)
+                        plugins->profiler->endRun(from, pc);
+                    if (executed >= watchdog.nextCheck && !watchdog.check(*this, pc, executed)) {
+                        trace.stopped(watchdog.reason(), pc);
+                        return false;
+                    }
+                    // Device interrupt lines are sampled where the blocks of a loop meet.
+                    if ((Plugins & Z16Plugins::DEVICES) && (trapRegs[TRAP_STATUS] & TRAP_STATUS_IE) &&
+                        pollInterrupts(*plugins->bus) && (Plugins & Z16Plugins::PROFILE))
+                        plugins->profiler->startRun(pc);
+                }
+            }
+            if (Plugins & Z16Plugins::PROFILE)
+                plugins->profiler->stopBefore(pc);
+            if (!enterTrap())
+                return true;
+            if (executed >= watchdog.nextCheck && !watchdog.check(*this, pc, executed)) {
+                trace.stopped(watchdog.reason(), pc);
+                return false;
+            }
+        }
+    }
+
+    // ----------------------------------------------
+    // Print Final Register State to the Output Stream.
+    // ----------------------------------------------
+    void printFinalState(ostream &out) {
+        out << "\nFinal register state:" << endl;
+        for (size_t i = 0; i < regs.size(); i++) {
+            out << regNames[i] << " = " << "0x" << setw(4) << setfill('0')
+                << hex << regs[i] << endl;
+        }
+    }
+
+    // -----------------------------------------------------
+    // Execute a Single Instruction.
+    // Returns false if simulation should terminate (including on a trap,
+    // which is left in 'trap').
+    // -----------------------------------------------------
+    bool executeInstruction(uint16_t inst) {
+        // Extract opcode (lowest 3 bits).
+        uint8_t opcode = inst & 0x7;
+        bool pcUpdated = false;
+
+        // Special-case: If instruction is a specific jump (J-type) instruction with value 0x818D.
+        if (1){
+            // Switch based on opcode.
+            switch(opcode) {
+                case 0x0: { // R-type instructions.
+                    uint8_t funct4 = (inst >> 12) & 0xF;
+                    uint8_t rs2 = (inst >> 9) & 0x7;
+                    uint8_t rd_rs1 = (inst >> 6) & 0x7;
+                    uint8_t funct3 = (inst >> 3) & 0x7;
+                    if (funct4 == 0b0000 && funct3 == 0b000)
+                        regs[rd_rs1] = regs[rd_rs1] + regs[rs2];
+                    else if (funct4 == 0b0001 && funct3 == 0b000)
+                        regs[rd_rs1] = regs[rd_rs1] - regs[rs2];
+                    else if (funct4 == 0b0000 && funct3 == 0b001)
+                        regs[rd_rs1] = (int16_t)regs[rd_rs1] < (int16_t)regs[rs2] ? 1 : 0;
+                    else if (funct4 == 0b0000 && funct3 == 0b010)
+                        regs[rd_rs1] = regs[rd_rs1] < regs[rs2] ? 1 : 0;
+                    else if (funct4 == 0b0010 && funct3 == 0b011)
+                        regs[rd_rs1] = regs[rd_rs1] << (regs[rs2] & 0xF);
+                    else if (funct4 == 0b0100 && funct3 == 0b011)
+                        regs[rd_rs1] = regs[rd_rs1] >> (regs[rs2] & 0xF);
+                    else if (funct4 == 0b1000 && funct3 == 0b011)
+                        regs[rd_rs1] = static_cast<uint16_t>(static_cast<int16_t>(regs[rd_rs1]) >> (regs[rs2] & 0xF));
+                    else if (funct4 == 0b0001 && funct3 == 0b100)
+                        regs[rd_rs1] = regs[rd_rs1] | regs[rs2];
+                    else if (funct4 == 0b0000 && funct3 == 0b101)
+                        regs[rd_rs1] = regs[rd_rs1] & regs[rs2];
+                    else if (funct4 == 0b0000 && funct3 == 0b110)
+                        regs[rd_rs1] = regs[rd_rs1] ^ regs[rs2];
+                    else if (funct4 == 0b0000 && funct3 == 0b111)
+                        regs[rd_rs1] = regs[rs2];
+                    else if (funct4 == 0b0100 && funct3 == 0b000) {
+                        // JR: Jump register.
+                        pc = regs[rd_rs1];
+                        pcUpdated = true;
+                    } else if (funct4 == 0b1000 && funct3 == 0b000) {
+                        // JALR: Save return address and jump.
+                        regs[rd_rs1] = pc + 2;
+                        pc = regs[rs2];
+                        pcUpdated = true;
+                    } else {
+                        if (!illegalInstruction(inst))
+                            return false;
+                        *console << "Unknown R-type instruction at PC = 0x" << hex << pc << endl;
+                    }
+                    break;
+                }
+                case 0x1: { // I-type instructions.
+                    // Extract fields for I-type instruction.
+                    uint8_t imm7    = (inst >> 9) & 0x7F;   // Immediate (bits 15:9)
+                    uint8_t rd_rs1  = (inst >> 6) & 0x7;      // Register operand
+                    uint8_t funct3  = (inst >> 3) & 0x7;      // Function code
+                    uint8_t imm3    = (inst >> 13) & 0x7;     // For shift instructions (overlap)
+                    // Sign-extend immediate for non-shift operations.
+                    int16_t simm = (imm7 & 0x40) ? (imm7 | 0xFF80) : imm7;
+
+                    switch (funct3) {
+                        case 0b000: {
+                            // ADDI: Add immediate.
+                            regs[rd_rs1] = regs[rd_rs1] + simm;
+                            break;
+                        }
+                        case 0b001: {
+                            // SLTI: Set if less than (signed).
+                            regs[rd_rs1] = ((int16_t) regs[rd_rs1] < simm) ? 1 : 0;
+                            break;
+                        }
+                        case 0b010: {
+                            // SLTUI: Set if less than (unsigned).
+                            regs[rd_rs1] = ((uint16_t) regs[rd_rs1] < (uint16_t) simm) ? 1 : 0;
+                            break;
+                        }
+                        case 0b011: {
+                            // Shift instructions: SLLI, SRLI, SRAI.
+                            uint8_t shamt = imm7 & 0xF;  // Shift amount is in lower 4 bits.
+                            switch (imm3) {
+                                case 0b001: // SLLI: Shift left logical.
+                                    regs[rd_rs1] = regs[rd_rs1] << shamt;
+                                    break;
+                                case 0b010: // SRLI: Shift right logical.
+                                    regs[rd_rs1] = regs[rd_rs1] >> shamt;
+                                    break;
+                                case 0b100: // SRAI: Shift right arithmetic.
+                                    regs[rd_rs1] = static_cast<uint16_t>(
+                                        static_cast<int16_t>(regs[rd_rs1]) >> shamt
+                                    );
+                                    break;
+                                default:
+                                    if (!illegalInstruction(inst))
+                                        return false;
+                                    *console << "Unimplemented I-type shift instruction at PC = 0x"
+                                         << hex << pc << endl;
+                                    break;
+                            }
+                            break;
+                        }
+                        case 0b100: {
+                            // ORI: Bitwise OR with immediate.
+                            regs[rd_rs1] = regs[rd_rs1] | simm;
+                            break;
+                        }
+                        case 0b101: {
+                            // ANDI: Bitwise AND with immediate.
+                            regs[rd_rs1] = regs[rd_rs1] & simm;
+                            break;
+                        }
+                        case 0b110: {
+                            // XORI: Bitwise XOR with immediate.
+                            regs[rd_rs1] = regs[rd_rs1] ^ simm;
+                            break;
+                        }
+                        case 0b111: {
+                            // LI: Load immediate.
+                            regs[rd_rs1] = simm;
+                            break;
+                        }
+                        default:
+                            *console << "Unimplemented I-type instruction at PC = 0x"
+                                 << hex << pc << endl;
+                            break;
+                    }
+                    break;
+                }
+                case 0x2: { // B-type (branch) instructions.
+                    int8_t raw_offset = (inst >> 12) & 0xF;
+                    if (raw_offset & 0x8)
+                        raw_offset |= 0xF0;  // Sign extend offset.
+                    uint8_t rs2 = (inst >> 9) & 0x7;
+                    uint8_t rs1 = (inst >> 6) & 0x7;
+                    uint8_t funct3 = (inst >> 3) & 0x7;
+                    uint16_t target = pc + (raw_offset * 2);
+                    switch(funct3) {
+                        case 0b000: // BEQ
+                            if (regs[rs1] == regs[rs2]) {
+                                pc = target + 2;
+                                return true;
+                            }
+                            break;
+                        case 0b001: // BNE
+                            if (regs[rs1] != regs[rs2]) {
+                                pc = target + 2;
+                                return true;
+                            }
+                            break;
+                        case 0b010: // BZ (branch if register rs1 equals 0)
+                            if (regs[rs1] == 0) {
+                                pc = target;
+                                return true;
+                            }
+                            break;
+                        case 0b011: // BNZ (branch if register rs1 is nonzero)
+                            if (regs[rs1] != 0) {
+                                pc = target;
+                                return true;
+                            }
+                            break;
+                        case 0b100: // BLT (branch if less than, signed)
+                            if ((int16_t)regs[rs1] < (int16_t)regs[rs2]) {
+                                pc = target + 2;
+                                return true;
+                            }
+                            break;
+                        case 0b101: // BGE (branch if greater than or equal, signed)
+                            if ((int16_t)regs[rs1] >= (int16_t)regs[rs2]) {
+                                pc = target + 2;
+                                return true;
+                            }
+                            break;
+                        case 0b110: // BLTU (branch if less than, unsigned)
+                            if (regs[rs1] < regs[rs2]) {
+                                pc = target + 2;
+                                return true;
+                            }
+                            break;
+                        case 0b111: // BGEU (branch if greater than or equal, unsigned)
+                            if (regs[rs1] >= regs[rs2]) {
+                                pc = target + 2;
+                                return true;
+                            }
+                            break;
+                        default:
+                            *console << "Unimplemented B-type instruction at PC = 0x" << hex << pc << endl;
+                            break;
+                    }
+                    break;
+                }
+                case 0x3: { // S-type (store) instructions.
+                    int8_t offset = (inst >> 12) & 0xF;
+                    uint8_t rs1 = (inst >> 6) & 0x7;   // Base register for store.
+                    uint8_t rs2 = (inst >> 9) & 0x7;   // Register holding value to store.
+                    uint8_t funct3 = (inst >> 3) & 0x7;
+                    uint16_t addr = regs[rs1] + offset;
+                    if (funct3 == 0b000)
+                        writeByte(addr, regs[rs2] & 0xFF);
+                    else if (funct3 == 0b001 && !storeWord<0>(addr, regs[rs2], nullptr))
+                        return false;
+                    break;
+                }
+                case 0x4: { // L-type (load) instructions.
+                    int8_t offset = (inst >> 12) & 0xF;
+                    uint8_t rs2 = (inst >> 9) & 0x7;   // Base register.
+                    uint8_t rd = (inst >> 6) & 0x7;      // Destination register.
+                    uint8_t funct3 = (inst >> 3) & 0x7;
+                    uint16_t addr = regs[rs2] + offset;
+                    if (funct3 == 0b000)
+                        regs[rd] = static_cast<int8_t>(readByte(addr));
+                    else if (funct3 == 0b001 && !loadWord<0>(addr, regs[rd], nullptr))
+                        return false;
+                    else if (funct3 == 0b100)
+                        regs[rd] = readByte(addr);
+                    break;
+                }
+                case 0x5: { // J-type (jump) instructions.
+                    uint8_t f = (inst >> 15) & 0x1;  // Flag to differentiate jump types.
+                    uint8_t imm6 = (inst >> 9) & 0x3F;
+                    uint8_t rd = (inst >> 6) & 0x7;
+                    uint8_t imm3 = (inst >> 3) & 0x7;
+                    // Combine immediate fields into 9-bit immediate.
+                    int16_t rawImm = imm3 | (imm6 << 3);
+                    // Sign-extend the immediate.
+                    if (rawImm & (1 << 8))
+                        rawImm |= 0xFE00;
+                    uint16_t target = pc + (rawImm * 2);
+                    if (f == 0b0) {
+                        pc = target;
+                        pcUpdated = true;
+                    }
+                    else if (f == 0b1) {
+                        regs[rd] = pc + 2;  // Save return address in register.
+                        pc = target;
+                        pcUpdated = true;
+                    }
+                    break;
+                }
+                case 0x6: { // U-type (lui/auipc) instructions.
+                    uint8_t f         = (inst >> 15) & 0x1;
+                    uint8_t imm_upper = (inst >> 9)  & 0x3F;
+                    uint8_t rd        = (inst >> 6)  & 0x7;
+                    uint8_t imm_lower = (inst >> 3)  & 0x7;
+                    uint16_t imm_val  = (imm_upper << 3) | imm_lower;
+                    if (f == 0) {
+                        // LUI: Load upper immediate (shift left by 7 bits).
+                        regs[rd] = imm_val << 7;
+                    } else {
+                        // AUIPC: Add upper immediate to PC.
+                        regs[rd] = pc + (imm_val << 7);
+                    }
+                    break;
+                }
+                case 0x7: { // SYS-type instructions.
+                    uint16_t service = (inst >> 6) & 0x3FF;
+                    uint8_t funct3 = (inst >> 3) & 0x7;
+                    if (funct3 == 0b000) {
+                        uint16_t at = pc;
+                        if (!systemCall(service))
+                            return false;
+                        pcUpdated = pc != at;       // ecall 18 returns from a trap.
+                    } else {
+                        if (!illegalInstruction(inst))
+                            return false;
+                        *console << "Unknown SYS-type instruction" << endl;
+                    }
+                    break;
+                }
+                default:
+                    if (!illegalInstruction(inst))
+                        return false;
+                    *console << "Unknown instruction opcode 0x" << hex << static_cast<int>(opcode)
+                         << " at PC = 0x" << pc << endl;
+                    break;
+            }
+        }
+        // If the instruction did not change the PC explicitly, increment by 2 (instruction size).
+        if (!pcUpdated)
+            pc += 2;
+        // Terminate simulation if PC is beyond program size.
+        if (pc >= programSize)
+            return false;
+        return true;
+    }
+
+    // -----------------------------------------------------
+    // Handle an ecall service request.
+    // Returns false if the service terminates the simulation.
+    // -----------------------------------------------------
+    bool systemCall(uint16_t service) {
+        if (service == 1) {
+            // ecall service 1: Print integer (assumes a0 is at index 6).
+            *console << "Print integer: " << dec << static_cast<int16_t>(regs[6]) << endl;
+        } else if (service == 3) {
+            // ecall service 3: Terminate simulation.
+            *console << "ecall 3" << endl;
+            *console << "ecall terminate simulation" << endl;
+            return false;
+        } else if (service == 5) {
+            // ecall service 5: Print null-terminated string.
+            // Assumes address of string in register a0.
+            // Stops after MEM_SIZE bytes: memory with no NUL must not hang the host.
+            uint16_t addr = regs[6];
+            string output;
+            while (output.size() < MEM_SIZE) {
+                char c = static_cast<char>(readByte(addr));
+                if (c == '\0') break;
+                output.push_back(c);
+                addr++;
+            }
+            *console << "Print string: " << output << endl;
+        } else if (service == 16) {
+            // ecall service 16: a0 = trap register a1 (Z16Trap.h).
+            regs[6] = regs[7] < TRAP_REG_COUNT ? trapRegs[regs[7]] : 0;
+        } else if (service == 17) {
+            // ecall service 17: trap register a1 = a0. PENDING is read-only.
+            if (regs[7] < TRAP_REG_COUNT && regs[7] != TRAP_PENDING)
+                trapRegs[regs[7]] = regs[6];
+        } else if (service == 18) {
+            // ecall service 18: return from a trap handler to EPC.
+            uint16_t &status = trapRegs[TRAP_STATUS];
+            status = (status & TRAP_STATUS_PIE) ? TRAP_STATUS_IE : 0;
+            pc = trapRegs[TRAP_EPC];
+        } else {
+            *console << "ecall " << service << endl;
+        }
+        return true;
+    }
+
+    // -----------------------------------------------------
+    // Execute a single predecoded instruction.
+    // Same semantics (and return value) as executeInstruction, but all
+    // fields were extracted up front by decodeInstruction. 'Plugins' says
+    // which of the observers in 'plugins' are told about branch outcomes,
+    // memory accesses, calls and returns.
+    // Always inlined: as a call per instruction (which GCC chooses once the
+    // trap paths are in) the decoded path is no faster than the reference.
+    // The cold cases (ecall, illegal encodings, breakpoints, misaligned
+    // accesses) are out-of-line calls. 'at' keeps pc in a register across
+    // the register-file store, which may alias it.
+    // -----------------------------------------------------
+    template <unsigned Plugins = 0>
+#if defined(__GNUC__)
+    __attribute__((always_inline)) inline
+#endif
+    bool executeDecoded(DecodedOp d, const Z16Plugins *plugins = nullptr) {
+        uint16_t &rd = regs[d.rd];
+        uint16_t rs = regs[d.rs];
+        const uint16_t at = pc;
+        switch (d.op) {
+            case OP_ADD:   rd = rd + rs; break;
+            case OP_SUB:   rd = rd - rs; break;
+            case OP_SLT:   rd = (int16_t)rd < (int16_t)rs ? 1 : 0; break;
+            case OP_SLTU:  rd = rd < rs ? 1 : 0; break;
+            case OP_SLL:   rd = rd << (rs & 0xF); break;
+            case OP_SRL:   rd = rd >> (rs & 0xF); break;
+            case OP_SRA:   rd = static_cast<uint16_t>(static_cast<int16_t>(rd) >> (rs & 0xF)); break;
+            case OP_OR:    rd = rd | rs; break;
+            case OP_AND:   rd = rd & rs; break;
+            case OP_XOR:   rd = rd ^ rs; break;
+            case OP_MV:    rd = rs; break;
+            case OP_JR:
+                if (Plugins & Z16Plugins::PROFILE) {
+                    plugins->profiler->endRun(pc, rd);
+                    plugins->profiler->jump(rd);
+                }
+                if (Plugins & Z16Plugins::COVERAGE)
+                    plugins->coverage->edge(rd);
+                pc = rd;
+                return pc < programSize;
+            case OP_JALR:
+                // rd is written first, so 'jalr x, x' jumps to pc + 2.
+                rd = pc + 2;
+                if (Plugins & Z16Plugins::PROFILE) {
+                    plugins->profiler->endRun(pc, regs[d.rs]);
+                    plugins->profiler->call(pc, regs[d.rs]);
+                }
+                if (Plugins & Z16Plugins::COVERAGE)
+                    plugins->coverage->edge(regs[d.rs]);
+                pc = regs[d.rs];
+                return pc < programSize;
+
+            case OP_ADDI:  rd = rd + d.imm; break;
+            case OP_SLTI:  rd = ((int16_t)rd < d.imm) ? 1 : 0; break;
+            case OP_SLTUI: rd = (rd < (uint16_t)d.imm) ? 1 : 0; break;
+            case OP_SLLI:  rd = rd << d.imm; break;
+            case OP_SRLI:  rd = rd >> d.imm; break;
+            case OP_SRAI:  rd = static_cast<uint16_t>(static_cast<int16_t>(rd) >> d.imm); break;
+            case OP_ORI:   rd = rd | d.imm; break;
+            case OP_ANDI:  rd = rd & d.imm; break;
+            case OP_XORI:  rd = rd ^ d.imm; break;
+            case OP_LI:    rd = d.imm; break;
+
+            // Taken branches return without the programSize check, exactly
+            // like executeInstruction; runExecution's loop condition covers it.
+            case OP_BEQ:   return branch<Plugins>(rd == rs, d, plugins);
+            case OP_BNE:   return branch<Plugins>(rd != rs, d, plugins);
+            case OP_BZ:    return branch<Plugins>(rd == 0, d, plugins);
+            case OP_BNZ:   return branch<Plugins>(rd != 0, d, plugins);
+            case OP_BLT:   return branch<Plugins>((int16_t)rd < (int16_t)rs, d, plugins);
+            case OP_BGE:   return branch<Plugins>((int16_t)rd >= (int16_t)rs, d, plugins);
+            case OP_BLTU:  return branch<Plugins>(rd < rs, d, plugins);
+            case OP_BGEU:  return branch<Plugins>(rd >= rs, d, plugins);
+
+            case OP_SB:
+                noteStore<Plugins>(rd + d.imm, 1, plugins);
+                storeByte<Plugins>(rd + d.imm, rs & 0xFF, plugins);
+                break;
+            case OP_SW:
+                noteStore<Plugins>(rd + d.imm, 2, plugins);
+                if (!storeWord<Plugins>(rd + d.imm, rs, plugins))
+                    return false;
+                break;
+            case OP_LB:
+                noteLoad<Plugins>(rs + d.imm, 1, plugins);
+                rd = static_cast<int8_t>(loadByte<Plugins>(rs + d.imm, plugins));
+                break;
+            case OP_LW:
+                noteLoad<Plugins>(rs + d.imm, 2, plugins);
+                if (!loadWord<Plugins>(rs + d.imm, rd, plugins))
+                    return false;
+                break;
+            case OP_LBU:
+                noteLoad<Plugins>(rs + d.imm, 1, plugins);
+                rd = loadByte<Plugins>(rs + d.imm, plugins);
+                break;
+            case OP_MEM_NOP: break;
+
+            case OP_J:
+                if (Plugins & Z16Plugins::PROFILE)
+                    plugins->profiler->endRun(pc, pc + d.imm);
+                if (Plugins & Z16Plugins::COVERAGE)
+                    plugins->coverage->edge(pc + d.imm);
+                pc += d.imm;
+                return pc < programSize;
+            case OP_JAL:
+                if (Plugins & Z16Plugins::PROFILE) {
+                    plugins->profiler->endRun(pc, pc + d.imm);
+                    plugins->profiler->call(pc, pc + d.imm);
+                }
+                if (Plugins & Z16Plugins::COVERAGE)
+                    plugins->coverage->edge(pc + d.imm);
+                rd = pc + 2;
+                pc += d.imm;
+                return pc < programSize;
+            case OP_LUI:   rd = (uint16_t)d.imm; break;
+            case OP_AUIPC: rd = pc + (uint16_t)d.imm; break;
+
+            case OP_ECALL: {
+                // Buffered console output comes before whatever the ecall prints.
+                if (Plugins & Z16Plugins::DEVICES)
+                    plugins->bus->flush();
+                if (!systemCall(d.imm))
+                    return false;
+                if (pc != at)                       // ecall 18 returned from a trap.
+                    return pc < programSize;
+                break;
+            }
+            case OP_BAD_R:
+            case OP_BAD_SHIFT:
+            case OP_BAD_SYS:
+                if (!illegalOp(d))
+                    return false;
+                break;
+            case OP_BREAKPOINT:
+                return breakpointAt<Plugins>(plugins);
+#if defined(__GNUC__)
+            default:
+                // fetchDecoded never returns OP_UNDECODED; no range check.
+                __builtin_unreachable();
+#endif
+        }
+        pc = at + 2;
+        return pc < programSize;
+    }
+
+    // An OP_BREAKPOINT at pc: stop with a Breakpoint trap if it has no
+    // condition or its condition holds, else execute the instruction under
+    // it. Out of line: it is never hot.
+    template <unsigned Plugins = 0>
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    bool breakpointAt(const Z16Plugins *plugins = nullptr) {
+        auto b = findBreakpoint(pc);
+        if (b == breakpoints.end() || b->condition.holds(regs.data(), pc, memory.data()))
+            return raise(Z16TrapCause::Breakpoint, pc);
+        return executeDecoded<Plugins>(decodeInstruction(readWord(pc)), plugins);
+    }
+
+    // The WATCH plug-in saw a store to a watched page by the instruction at
+    // 'from', which has now completed (or trapped). Raise a Watchpoint stop
+    // if it wrote a watched byte whose range's condition holds: the store is
+    // done and pc is past it, and 'trap' names the store and the byte.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    bool watchStop(Z16Watchpoints &watch, uint16_t from) {
+        if (trap) {
+            // A trapping store wrote nothing.
+            watch.pending = false;
+            return false;
+        }
+        if (!watch.confirm(regs.data(), pc, memory.data()))
+            return false;
+        trap.cause = Z16TrapCause::Watchpoint;
+        trap.pc = from;
+        trap.addr = watch.hitAddr;
+        return true;
+    }
+
+    // B-type tail of executeDecoded.
+    template <unsigned Plugins>
+    bool branch(bool taken, DecodedOp d, const Z16Plugins *plugins) {
+        if (Plugins & Z16Plugins::COVERAGE)
+            plugins->coverage->edge(taken ? pc + d.imm : pc + 2);
+        if (taken) {
+            if (Plugins & Z16Plugins::PROFILE)
+                plugins->profiler->endRun(pc, pc + d.imm);
+            pc += d.imm;
+            return true;
+        }
+        pc += 2;
+        return pc < programSize;
+    }
+
+    // Loads and stores made by instructions. Byte accesses cannot fail. A
+    // word access at an odd address goes through misalignedAccess(), which
+    // applies the 'misaligned' policy; if it raises a trap the access returns
+    // false and has no effect. With the DEVICES plug-in, an access touching a
+    // page claimed by a device goes to the bus (deviceLoad / deviceStore);
+    // everything else is RAM.
+    template <unsigned Plugins>
+    uint8_t loadByte(uint16_t addr, const Z16Plugins *plugins) {
+        if ((Plugins & Z16Plugins::DEVICES) && plugins->bus->device(addr))
+            return deviceLoad(*plugins->bus, addr, 1);
+        return readByte(addr);
+    }
+
+    template <unsigned Plugins>
+    bool loadWord(uint16_t addr, uint16_t &value, const Z16Plugins *plugins) {
+        if ((addr & 1) && !misalignedAccess(addr, false))
+            return false;
+        if ((Plugins & Z16Plugins::DEVICES) && plugins->bus->claims(addr, 2))
+            value = deviceLoad(*plugins->bus, addr, 2);
+        else
+            value = readWord(addr);
+        return true;
+    }
+
+    template <unsigned Plugins>
+    void storeByte(uint16_t addr, uint8_t value, const Z16Plugins *plugins) {
+        if ((Plugins & Z16Plugins::DEVICES) && plugins->bus->device(addr))
+            deviceStore(*plugins->bus, addr, value, 1);
+        else
+            writeByte(addr, value);
+    }
+
+    template <unsigned Plugins>
+    bool storeWord(uint16_t addr, uint16_t value, const Z16Plugins *plugins) {
+        if ((addr & 1) && !misalignedAccess(addr, true))
+            return false;
+        if ((Plugins & Z16Plugins::DEVICES) && plugins->bus->claims(addr, 2))
+            deviceStore(*plugins->bus, addr, value, 2);
+        else
+            writeWord(addr, value);
+        return true;
+    }
+
+    // A word access at odd 'addr': false (with 'trap' set) if the policy
+    // does not let it go ahead.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    bool misalignedAccess(uint16_t addr, bool store) {
+        switch (misaligned) {
+            case Z16Misaligned::Trap:
+                return raise(store ? Z16TrapCause::MisalignedStore : Z16TrapCause::MisalignedLoad, addr);
+            case Z16Misaligned::Allow:
+                // The word would run past the end of memory.
+                if (addr == MEM_SIZE - 1)
+                    return raise(store ? Z16TrapCause::StoreFault : Z16TrapCause::LoadFault, addr);
+                return true;
+            default:
+                return true;
+        }
+    }
+
+    // Record a trap at the current instruction. Always false, for returning.
+    bool raise(Z16TrapCause cause, uint16_t addr) {
+        trap.cause = cause;
+        trap.pc = pc;
+        trap.addr = addr;
+        return false;
+    }
+
+    // An instruction the decoder rejected. With a trap handler installed it
+    // raises an illegal-instruction trap (false); without one the caller
+    // reports it and skips it (true).
+    bool illegalInstruction(uint16_t inst) {
+        return !trapRegs[TRAP_VECTOR] || raise(Z16TrapCause::IllegalInstruction, inst);
+    }
+
+    // The same for a predecoded OP_BAD_* at pc, printing the warning the
+    // engines have always printed. Out of line: it is never hot.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    bool illegalOp(DecodedOp d) {
+        if (!illegalInstruction(d.inst))
+            return false;
+        if (d.op == OP_BAD_R)
+            *console << "Unknown R-type instruction at PC = 0x" << hex << pc << endl;
+        else if (d.op == OP_BAD_SHIFT)
+            *console << "Unimplemented I-type shift instruction at PC = 0x" << hex << pc << endl;
+        else
+            *console << "Unknown SYS-type instruction" << endl;
+        return true;
+    }
+
+    // Hand the pending 'trap' to the guest handler and clear it; the engines
+    // call this when an instruction returns false. False if there is no trap,
+    // no handler, the handler itself trapped (a double fault) or the trap is
+    // a debugger stop (a breakpoint or watchpoint): the run then ends with
+    // 'trap' left as it is.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    bool enterTrap() {
+        if (!trap || trap.cause >= Z16TrapCause::Breakpoint || !trapRegs[TRAP_VECTOR] ||
+            (trapRegs[TRAP_STATUS] & TRAP_STATUS_IN_TRAP))
+            return false;
+        enterHandler(static_cast<uint16_t>(trap.cause), trap.pc, trap.addr);
+        trap = Z16Trap();
+        return true;
+    }
+
+    // Sample the bus's interrupt lines into PENDING and take an enabled one
+    // (the lowest line first) if interrupts are on. pc is the next
+    // instruction, where the handler will return to.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    bool pollInterrupts(const Z16Bus &bus) {
+        trapRegs[TRAP_PENDING] = bus.pending();
+        uint16_t lines = trapRegs[TRAP_PENDING] & trapRegs[TRAP_ENABLE];
+        if (!lines || !(trapRegs[TRAP_STATUS] & TRAP_STATUS_IE) || !trapRegs[TRAP_VECTOR])
+            return false;
+        unsigned line = 0;
+        while (!(lines & (1u << line)))
+            line++;
+        enterHandler(TRAP_CAUSE_INTERRUPT | line, pc, 0);
+        return true;
+    }
+
+    void enterHandler(uint16_t cause, uint16_t epc, uint16_t tval) {
+        uint16_t &status = trapRegs[TRAP_STATUS];
+        status = ((status & TRAP_STATUS_IE) ? TRAP_STATUS_PIE : 0) | TRAP_STATUS_IN_TRAP;
+        trapRegs[TRAP_CAUSE] = cause;
+        trapRegs[TRAP_EPC] = epc;
+        trapRegs[TRAP_TVAL] = tval;
+        pc = trapRegs[TRAP_VECTOR];
+    }
+
+    // An access of 'bytes' bytes that touches a device, done a byte at a time
+    // (low byte first) with RAM bytes, if any, read or written as usual. Kept
+    // out of line so the RAM path stays small.
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    uint16_t deviceLoad(Z16Bus &bus, uint16_t addr, unsigned bytes) {
+        uint16_t value = 0;
+        for (unsigned i = 0; i < bytes; i++) {
+            uint16_t a = addr + i;
+            value |= (bus.device(a) ? bus.read(a) : readByte(a)) << (8 * i);
+        }
+        return value;
+    }
+
+#if defined(__GNUC__)
+    __attribute__((noinline))
+#endif
+    void deviceStore(Z16Bus &bus, uint16_t addr, uint16_t value, unsigned bytes) {
+        for (unsigned i = 0; i < bytes; i++) {
+            uint16_t a = addr + i;
+            uint8_t b = static_cast<uint8_t>(value >> (8 * i));
+            if (bus.device(a))
+                bus.write(a, b);
+            else
+                writeByte(a, b);
+        }
+    }
+
+    // Memory accesses of executeDecoded, for the observers that want them.
+    template <unsigned Plugins>
+    void noteLoad(uint16_t addr, unsigned bytes, const Z16Plugins *plugins) {
+        if (Plugins & Z16Plugins::PROFILE)
+            plugins->profiler->load(addr, bytes);
+        if (Plugins & Z16Plugins::DCACHE)
+            plugins->dcache->read(pc, addr, bytes);
+    }
+
+    template <unsigned Plugins>
+    void noteStore(uint16_t addr, unsigned bytes, const Z16Plugins *plugins) {
+        if (Plugins & Z16Plugins::PROFILE)
+            plugins->profiler->store(addr, bytes);
+        if (Plugins & Z16Plugins::DCACHE)
+            plugins->dcache->write(pc, addr, bytes);
+        if (Plugins & Z16Plugins::WATCH)
+            plugins->watch->store(addr, bytes);
+    }
+
+    // ---------------------------------------------------
+    // Print final register state to standard output.
+    // ---------------------------------------------------
+    // (This function is used in non-redirected mode.)
+    void printFinalState() {
+        cout << "\nFinal register state:" << endl;
+        for (size_t i = 0; i < regs.size(); i++) {
+            cout << regNames[i] << " = " << "0x" << setw(4) << setfill('0') << hex << regs[i] << endl;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Linear Disassembly: Walk through memory and output disassembly.
+    // Writes output to the provided output stream.
+    // ------------------------------------------------------------------------
+    // Linear sweep over the program image (see Z16Disasm::sweep).
+    void runFullDisassembly(ostream &out) {
+        string listing;
+        Z16Disasm::sweep(memory.data(), 0, programSize, listing);
+        out.write(listing.data(), listing.size());
+        // The line-by-line version left 'out' in hex with '0' fill; keep that
+        // for whatever the caller writes next.
+        if (programSize)
+            out << hex << setfill('0');
+    }
+};
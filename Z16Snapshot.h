@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include "Z16Trap.h"
+
+// ---------------------------------------------------------------------------
+// Machine snapshots.
+// A snapshot holds the registers, pc, trap registers, program size and
+// memory of a Z16Simulator (Z16Simulator::snapshot() / restore()). Memory is
+// kept as a table of immutable 256-byte pages shared through reference counts:
+//
+//   - a simulator remembers the page table it was last snapshotted from or
+//     restored to, and which pages it has written since (its dirty flags);
+//   - snapshot() shares every page that is still clean and copies only the
+//     dirty ones, so many children forked from one snapshot each cost only
+//     the pages they wrote;
+//   - restore() copies back only the pages that differ from the snapshot,
+//     i.e. the ones written since the last snapshot/restore, which makes
+//     replaying from the same snapshot over and over cheap.
+//
+// All-zero pages share one page. On disk a snapshot is
+//
+//   "Z16S" version:u8 pc:u16 regs:8*u16 programSize:u32
+//   trapRegs:TRAP_REG_COUNT*u16 (version 2; zero when loading version 1)
+//   page bitmap (one bit per page, set for non-zero pages, 32 bytes)
+//   the non-zero pages, 256 bytes each, in address order
+//
+// with every integer little-endian.
+// ---------------------------------------------------------------------------
+class Z16Snapshot {
+public:
+    static const size_t PAGE_SIZE = 256;
+    static const size_t PAGE_COUNT = 65536 / PAGE_SIZE;
+    static const uint8_t VERSION = 2;
+
+    // Bit of Z16Simulator::dirtyPages owned by the snapshot machinery.
+    static const uint8_t DIRTY_BIT = 2;
+
+    typedef std::array<uint8_t, PAGE_SIZE> Page;
+    typedef std::array<std::shared_ptr<const Page>, PAGE_COUNT> PageTable;
+
+    std::array<uint16_t, 8> regs{};
+    uint16_t pc = 0;
+    std::array<uint16_t, TRAP_REG_COUNT> trapRegs{};
+    size_t programSize = 0;
+    PageTable pages;                 // Never null in a complete snapshot.
+
+    // The one shared all-zero page.
+    static const std::shared_ptr<const Page> &zeroPage() {
+        static const std::shared_ptr<const Page> zero = std::make_shared<const Page>(Page{});
+        return zero;
+    }
+
+    // A shared page holding 'bytes' (the zero page if they are all zero).
+    static std::shared_ptr<const Page> makePage(const uint8_t *bytes) {
+        static const Page zero{};
+        if (memcmp(bytes, zero.data(), PAGE_SIZE) == 0)
+            return zeroPage();
+        auto page = std::make_shared<Page>();
+        memcpy(page->data(), bytes, PAGE_SIZE);
+        return page;
+    }
+
+    // Pages not shared with 'other' (e.g. what a child wrote since its parent).
+    size_t pagesDifferentFrom(const Z16Snapshot &other) const {
+        size_t n = 0;
+        for (size_t p = 0; p < PAGE_COUNT; p++)
+            n += pages[p] != other.pages[p];
+        return n;
+    }
+
+    void save(std::ostream &out) const {
+        uint8_t header[4 + 1 + 2 + 16 + 4];
+        memcpy(header, "Z16S", 4);
+        header[4] = VERSION;
+        put16(header + 5, pc);
+        for (size_t r = 0; r < 8; r++)
+            put16(header + 7 + 2 * r, regs[r]);
+        uint32_t size = static_cast<uint32_t>(programSize);
+        for (size_t i = 0; i < 4; i++)
+            header[23 + i] = size >> (8 * i);
+        uint8_t bitmap[PAGE_COUNT / 8] = {};
+        for (size_t p = 0; p < PAGE_COUNT; p++)
+            if (pages[p] != zeroPage())
+                bitmap[p / 8] |= 1 << (p % 8);
+        uint8_t traps[2 * TRAP_REG_COUNT];
+        for (size_t r = 0; r < TRAP_REG_COUNT; r++)
+            put16(traps + 2 * r, trapRegs[r]);
+        out.write(reinterpret_cast<const char *>(header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(traps), sizeof(traps));
+        out.write(reinterpret_cast<const char *>(bitmap), sizeof(bitmap));
+        for (size_t p = 0; p < PAGE_COUNT; p++)
+            if (pages[p] != zeroPage())
+                out.write(reinterpret_cast<const char *>(pages[p]->data()), PAGE_SIZE);
+        if (!out)
+            throw std::runtime_error("Error writing snapshot");
+    }
+
+    static Z16Snapshot load(std::istream &in) {
+        uint8_t header[4 + 1 + 2 + 16 + 4];
+        uint8_t bitmap[PAGE_COUNT / 8];
+        if (!in.read(reinterpret_cast<char *>(header), sizeof(header)) || memcmp(header, "Z16S", 4) != 0)
+            throw std::runtime_error("Not a Z16 snapshot");
+        if (header[4] != 1 && header[4] != VERSION)
+            throw std::runtime_error("Unsupported Z16 snapshot version");
+        Z16Snapshot snap;
+        if (header[4] >= 2) {
+            uint8_t traps[2 * TRAP_REG_COUNT];
+            if (!in.read(reinterpret_cast<char *>(traps), sizeof(traps)))
+                throw std::runtime_error("Snapshot is truncated");
+            for (size_t r = 0; r < TRAP_REG_COUNT; r++)
+                snap.trapRegs[r] = get16(traps + 2 * r);
+        }
+        if (!in.read(reinterpret_cast<char *>(bitmap), sizeof(bitmap)))
+            throw std::runtime_error("Snapshot is truncated");
+        snap.pc = get16(header + 5);
+        for (size_t r = 0; r < 8; r++)
+            snap.regs[r] = get16(header + 7 + 2 * r);
+        snap.programSize = header[23] | header[24] << 8 | header[25] << 16 | static_cast<uint32_t>(header[26]) << 24;
+        if (snap.programSize > PAGE_COUNT * PAGE_SIZE)
+            throw std::runtime_error("Snapshot has an invalid program size");
+        Page bytes;
+        for (size_t p = 0; p < PAGE_COUNT; p++) {
+            if (!(bitmap[p / 8] & (1 << (p % 8)))) {
+                snap.pages[p] = zeroPage();
+                continue;
+            }
+            if (!in.read(reinterpret_cast<char *>(bytes.data()), PAGE_SIZE))
+                throw std::runtime_error("Snapshot is truncated");
+            snap.pages[p] = makePage(bytes.data());
+        }
+        return snap;
+    }
+
+    // True if 'in' starts with the snapshot magic (the stream is rewound).
+    static bool isSnapshot(std::istream &in) {
+        char magic[4] = {};
+        in.read(magic, 4);
+        bool match = in.gcount() == 4 && memcmp(magic, "Z16S", 4) == 0;
+        in.clear();
+        in.seekg(0);
+        return match;
+    }
+
+private:
+    static void put16(uint8_t *p, uint16_t v) {
+        p[0] = v & 0xFF;
+        p[1] = v >> 8;
+    }
+
+    static uint16_t get16(const uint8_t *p) { return p[0] | p[1] << 8; }
+};
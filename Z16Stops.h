@@ -0,0 +1,412 @@
+#pragma once
+
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Z16Disasm.h"   // Register names
+
+// ---------------------------------------------------------------------------
+// Stop conditions: conditional breakpoints and watchpoints.
+//
+// A Z16Condition is a small expression over the machine state, compiled once
+// into postfix code and evaluated only where a breakpoint or watchpoint has
+// already been reached, never per instruction. It is C's integer expression
+// syntax on 32-bit signed values:
+//
+//   operands   decimal or 0x hex numbers; t0 ra sp s0 s1 t1 a0 a1 and pc
+//              (16 bits, zero-extended); byte[e] and word[e], memory at the
+//              16-bit address e (words little-endian); s16(e), the low 16
+//              bits of e sign-extended
+//   operators  by falling precedence: unary - ~ !; * / %; + -; << >>;
+//              < <= > >=; == !=; &; ^; |; &&; ||
+//
+// so "a0 == 5", "s16(t1) < 0 && pc != 0x20" and "word[sp + 2] == 0xBEEF" are
+// conditions. A nonzero value is true; division by zero gives 0. Malformed
+// text throws std::runtime_error with the position of the error.
+//
+// Z16Watchpoints is the execution loop's WATCH plug-in (Z16Plugins in
+// Z16Simulator.h). It keeps one write-protect count per 256-byte page, so a
+// store is checked against the watched ranges only when it lands on a page
+// that has one; a hit is confirmed (and its condition, if any, evaluated)
+// after the storing instruction completes. Runs without watchpoints use a
+// loop instantiation without the plug-in and pay nothing for it.
+// ---------------------------------------------------------------------------
+class Z16Condition {
+public:
+    static const size_t MAX_DEPTH = 32;      // Evaluation stack slots.
+
+    // The empty condition, which always holds.
+    Z16Condition() {}
+
+    explicit Z16Condition(const std::string &text) : source(text) {
+        Parser parser{ text, 0, code, 0 };
+        parser.expression();
+        parser.skipSpace();
+        if (parser.at != text.size())
+            parser.fail("unexpected text");
+    }
+
+    bool empty() const { return code.empty(); }
+    const std::string &text() const { return source; }
+
+    // Value of the expression for the given state.
+    int32_t eval(const uint16_t *regs, uint16_t pc, const uint8_t *memory) const {
+        int64_t stack[MAX_DEPTH];
+        size_t sp = 0;
+        for (const Op &op : code) {
+            int64_t value;
+            if (op.code <= PC) {
+                value = op.code == PUSH ? op.value : op.code == REG ? regs[op.value] : pc;
+                sp++;
+            } else if (op.code < MUL) {
+                int64_t a = stack[sp - 1];
+                uint16_t addr = static_cast<uint16_t>(a);
+                switch (op.code) {
+                    case BYTE: value = memory[addr]; break;
+                    case WORD: value = memory[addr] | memory[static_cast<uint16_t>(addr + 1)] << 8; break;
+                    case S16:  value = static_cast<int16_t>(a); break;
+                    case NEG:  value = -a; break;
+                    case NOT:  value = ~a; break;
+                    default:   value = !a; break;
+                }
+            } else {
+                int64_t b = stack[--sp], a = stack[sp - 1];
+                switch (op.code) {
+                    case MUL:  value = a * b; break;
+                    case DIV:  value = b ? a / b : 0; break;
+                    case MOD:  value = b ? a % b : 0; break;
+                    case ADD:  value = a + b; break;
+                    case SUB:  value = a - b; break;
+                    case SHL:  value = static_cast<int64_t>(static_cast<uint64_t>(a) << (b & 31)); break;
+                    case SHR:  value = a >> (b & 31); break;
+                    case LT:   value = a < b; break;
+                    case LE:   value = a <= b; break;
+                    case GT:   value = a > b; break;
+                    case GE:   value = a >= b; break;
+                    case EQ:   value = a == b; break;
+                    case NE:   value = a != b; break;
+                    case AND:  value = a & b; break;
+                    case XOR:  value = a ^ b; break;
+                    case OR:   value = a | b; break;
+                    case LAND: value = a && b; break;
+                    default:   value = a || b; break;
+                }
+            }
+            stack[sp - 1] = static_cast<int32_t>(static_cast<uint32_t>(value));
+        }
+        return static_cast<int32_t>(stack[0]);
+    }
+
+    // True if the condition is empty or evaluates nonzero.
+    bool holds(const uint16_t *regs, uint16_t pc, const uint8_t *memory) const {
+        return code.empty() || eval(regs, pc, memory) != 0;
+    }
+
+private:
+    enum Code : uint8_t {
+        PUSH, REG, PC, BYTE, WORD, S16, NEG, NOT, LNOT,
+        MUL, DIV, MOD, ADD, SUB, SHL, SHR, LT, LE, GT, GE, EQ, NE, AND, XOR, OR, LAND, LOR
+    };
+    struct Op {
+        Code code;
+        int32_t value;
+    };
+
+    std::string source;
+    std::vector<Op> code;
+
+    // Recursive descent, one function per precedence level, emitting code
+    // as it goes. 'depth' tracks the stack the code needs.
+    struct Parser {
+        const std::string &text;
+        size_t at;
+        std::vector<Op> &code;
+        size_t depth;
+
+        [[noreturn]] void fail(const char *what) const {
+            throw std::runtime_error(std::string("Bad condition \"") + text + "\": " + what + " at column " +
+                                     std::to_string(at + 1));
+        }
+
+        void skipSpace() {
+            while (at < text.size() && isspace(static_cast<unsigned char>(text[at])))
+                at++;
+        }
+
+        // Consume 'token' if it comes next (and, for "<" and the like, is not
+        // the start of a longer operator).
+        bool accept(const char *token) {
+            skipSpace();
+            size_t n = std::char_traits<char>::length(token);
+            if (text.compare(at, n, token) != 0)
+                return false;
+            char next = at + n < text.size() ? text[at + n] : 0;
+            if (n == 1 && (token[0] == '<' || token[0] == '>') && (next == token[0] || next == '='))
+                return false;
+            if (n == 1 && (token[0] == '&' || token[0] == '|') && next == token[0])
+                return false;
+            if (n == 1 && (token[0] == '!' || token[0] == '=') && next == '=')
+                return false;
+            at += n;
+            return true;
+        }
+
+        void expect(const char *token) {
+            if (!accept(token))
+                fail((std::string("expected '") + token + "'").c_str());
+        }
+
+        void emit(Code c, int32_t value = 0) {
+            if (c <= PC && ++depth > MAX_DEPTH)
+                fail("expression too deep");
+            if (c >= MUL)
+                depth--;
+            code.push_back({ c, value });
+        }
+
+        // One precedence level of left-associative binary operators.
+        template <class Next>
+        void binary(Next next, std::initializer_list<std::pair<const char *, Code>> ops) {
+            next();
+            for (;;) {
+                bool matched = false;
+                for (const auto &op : ops) {
+                    if (accept(op.first)) {
+                        next();
+                        emit(op.second);
+                        matched = true;
+                        break;
+                    }
+                }
+                if (!matched)
+                    return;
+            }
+        }
+
+        void expression() {
+            binary([&] { logicalAnd(); }, { { "||", LOR } });
+        }
+        void logicalAnd() {
+            binary([&] { bitOr(); }, { { "&&", LAND } });
+        }
+        void bitOr() {
+            binary([&] { bitXor(); }, { { "|", OR } });
+        }
+        void bitXor() {
+            binary([&] { bitAnd(); }, { { "^", XOR } });
+        }
+        void bitAnd() {
+            binary([&] { equality(); }, { { "&", AND } });
+        }
+        void equality() {
+            binary([&] { relational(); }, { { "==", EQ }, { "!=", NE } });
+        }
+        void relational() {
+            binary([&] { shift(); }, { { "<=", LE }, { ">=", GE }, { "<", LT }, { ">", GT } });
+        }
+        void shift() {
+            binary([&] { additive(); }, { { "<<", SHL }, { ">>", SHR } });
+        }
+        void additive() {
+            binary([&] { multiplicative(); }, { { "+", ADD }, { "-", SUB } });
+        }
+        void multiplicative() {
+            binary([&] { unary(); }, { { "*", MUL }, { "/", DIV }, { "%", MOD } });
+        }
+
+        void unary() {
+            if (accept("-")) {
+                unary();
+                emit(NEG);
+            } else if (accept("~")) {
+                unary();
+                emit(NOT);
+            } else if (accept("!")) {
+                unary();
+                emit(LNOT);
+            } else {
+                primary();
+            }
+        }
+
+        void primary() {
+            skipSpace();
+            if (accept("(")) {
+                expression();
+                expect(")");
+                return;
+            }
+            if (at < text.size() && isdigit(static_cast<unsigned char>(text[at]))) {
+                char *end;
+                unsigned long value = strtoul(text.c_str() + at, &end, 0);
+                if (value > 0xFFFFFFFFul)
+                    fail("number too large");
+                at = end - text.c_str();
+                emit(PUSH, static_cast<int32_t>(value));
+                return;
+            }
+            size_t start = at;
+            while (at < text.size() && (isalnum(static_cast<unsigned char>(text[at])) || text[at] == '_'))
+                at++;
+            std::string name = text.substr(start, at - start);
+            if (name.empty()) {
+                fail("expected a value");
+            } else if (name == "pc") {
+                emit(PC);
+            } else if (name == "byte" || name == "word") {
+                expect("[");
+                expression();
+                expect("]");
+                emit(name == "byte" ? BYTE : WORD);
+            } else if (name == "s16") {
+                expect("(");
+                expression();
+                expect(")");
+                emit(S16);
+            } else {
+                for (size_t r = 0; r < Z16Disasm::regNames.size(); r++) {
+                    if (name == Z16Disasm::regNames[r]) {
+                        emit(REG, static_cast<int32_t>(r));
+                        return;
+                    }
+                }
+                at = start;
+                fail(("unknown name '" + name + "'").c_str());
+            }
+        }
+    };
+};
+
+class Z16Watchpoints {
+public:
+    static const size_t PAGE_SIZE = 256;
+    static const size_t PAGE_COUNT = 65536 / PAGE_SIZE;
+
+    struct Range {
+        uint16_t addr;
+        uint32_t length;               // 1 to 65536 bytes; may wrap past 0xFFFF.
+        Z16Condition condition;
+    };
+
+    // Set by store() when a watched byte is about to be written; the loop
+    // then calls confirm() once the instruction has completed.
+    bool pending = false;
+
+    // The stop that confirm() last reported.
+    uint16_t hitAddr = 0;              // The first watched byte written.
+    size_t hitRange = 0;               // Index into ranges().
+
+    void add(uint16_t addr, uint32_t length, Z16Condition condition = Z16Condition()) {
+        if (length == 0 || length > 65536)
+            throw std::runtime_error("Watchpoint length must be 1 to 65536 bytes");
+        watched.push_back({ addr, length, std::move(condition) });
+        protect(watched.back(), 1);
+    }
+
+    // Remove the watchpoint(s) on exactly [addr, addr + length).
+    void remove(uint16_t addr, uint32_t length) {
+        for (size_t i = watched.size(); i-- > 0;) {
+            if (watched[i].addr == addr && watched[i].length == length) {
+                protect(watched[i], -1);
+                watched.erase(watched.begin() + i);
+            }
+        }
+    }
+
+    void clear() {
+        watched.clear();
+        pages.fill(0);
+        pending = false;
+    }
+
+    bool empty() const { return watched.empty(); }
+    const std::vector<Range> &ranges() const { return watched; }
+
+    // A store of 'bytes' bytes at 'addr' is about to happen. Stores to
+    // unprotected pages return after one table lookup.
+    void store(uint16_t addr, unsigned bytes) {
+        if (pages[addr / PAGE_SIZE] | pages[static_cast<uint16_t>(addr + bytes - 1) / PAGE_SIZE])
+            match(addr, bytes);
+    }
+
+    // After the instruction that made a pending store: true if a range it
+    // wrote has no condition or one that now holds (hitAddr, hitRange say
+    // which). Clears 'pending'.
+    bool confirm(const uint16_t *regs, uint16_t pc, const uint8_t *memory) {
+        pending = false;
+        for (size_t i = 0; i < watched.size(); i++) {
+            const Range &w = watched[i];
+            for (unsigned b = 0; b < storeBytes; b++) {
+                uint16_t a = storeAddr + b;
+                if (static_cast<uint16_t>(a - w.addr) < w.length) {
+                    if (w.condition.holds(regs, pc, memory)) {
+                        hitAddr = a;
+                        hitRange = i;
+                        return true;
+                    }
+                    break;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    std::vector<Range> watched;
+    std::array<int, PAGE_COUNT> pages{};    // Watched ranges touching each page.
+    uint16_t storeAddr = 0;                 // The pending store.
+    unsigned storeBytes = 0;
+
+    void protect(const Range &w, int delta) {
+        size_t first = w.addr / PAGE_SIZE;
+        size_t count = (w.addr % PAGE_SIZE + w.length + PAGE_SIZE - 1) / PAGE_SIZE;
+        for (size_t p = 0; p < count && p < PAGE_COUNT; p++)
+            pages[(first + p) % PAGE_COUNT] += delta;
+    }
+
+    void match(uint16_t addr, unsigned bytes) {
+        for (const Range &w : watched) {
+            for (unsigned b = 0; b < bytes; b++) {
+                if (static_cast<uint16_t>(addr + b - w.addr) < w.length) {
+                    pending = true;
+                    storeAddr = addr;
+                    storeBytes = bytes;
+                    return;
+                }
+            }
+        }
+    }
+};
+
+// Parse "ADDR[+LENGTH][:CONDITION]" (a watchpoint, LENGTH defaulting to 1)
+// or, with 'length' null, "ADDR[:CONDITION]" (a breakpoint). False if the
+// address part is malformed; a bad condition throws.
+inline bool parseStopPoint(const std::string &text, uint16_t &addr, uint32_t *length, Z16Condition &condition) {
+    size_t colon = text.find(':');
+    std::string where = text.substr(0, colon);
+    char *end;
+    unsigned long a = strtoul(where.c_str(), &end, 0);
+    if (where.empty() || end == where.c_str() || a > 0xFFFF)
+        return false;
+    if (length) {
+        *length = 1;
+        if (*end == '+') {
+            const char *start = end + 1;
+            unsigned long n = strtoul(start, &end, 0);
+            if (end == start || n == 0 || n > 65536)
+                return false;
+            *length = static_cast<uint32_t>(n);
+        }
+    }
+    if (*end)
+        return false;
+    addr = static_cast<uint16_t>(a);
+    condition = colon == std::string::npos ? Z16Condition() : Z16Condition(text.substr(colon + 1));
+    return true;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Work-stealing thread pool.
+// Every worker owns a task deque. submit() deals tasks out round-robin; a
+// worker takes work from the back of its own deque and, when that is empty,
+// steals from the front of the others', so a worker that drew short tasks
+// helps out the ones that drew long tasks instead of going idle.
+//
+// Tasks receive the index of the worker running them (0 .. size() - 1), which
+// callers use to give each worker its own reusable state.
+// ---------------------------------------------------------------------------
+class Z16ThreadPool {
+public:
+    typedef std::function<void(size_t worker)> Task;
+
+    explicit Z16ThreadPool(size_t threads = 0) {
+        if (!threads)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i < threads; i++)
+            queues.push_back(std::make_unique<Queue>());
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~Z16ThreadPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            stopping = true;
+        }
+        idleCv.notify_all();
+        for (std::thread &t : workers)
+            t.join();
+    }
+
+    Z16ThreadPool(const Z16ThreadPool &) = delete;
+    Z16ThreadPool &operator=(const Z16ThreadPool &) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    void submit(Task task) {
+        Queue &q = *queues[nextQueue++ % queues.size()];
+        pending++;
+        {
+            // Counted before it is pushed, so 'queued' never drops below zero.
+            std::lock_guard<std::mutex> lock(idleMutex);
+            queued++;
+        }
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        idleCv.notify_one();
+    }
+
+    // Block until every submitted task has finished.
+    void wait() {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        doneCv.wait(lock, [this] { return pending == 0; });
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> nextQueue{0};
+    std::atomic<size_t> pending{0};    // Submitted and not yet finished.
+    std::atomic<size_t> queued{0};     // Sitting in some deque.
+    std::mutex idleMutex;
+    std::condition_variable idleCv;
+    bool stopping = false;
+    std::mutex doneMutex;
+    std::condition_variable doneCv;
+
+    bool take(size_t self, Task &task) {
+        {
+            Queue &own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); k++) {
+            Queue &victim = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        Task task;
+        for (;;) {
+            if (take(self, task)) {
+                queued--;
+                task(self);
+                task = nullptr;
+                if (--pending == 0) {
+                    std::lock_guard<std::mutex> lock(doneMutex);
+                    doneCv.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idleCv.wait(lock, [this] { return queued > 0 || stopping; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+};
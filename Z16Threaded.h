@@ -0,0 +1,227 @@
+#pragma once
+
+#include "Z16Simulator.h"
+
+// ---------------------------------------------------------------------------
+// Threaded dispatch engine.
+// Runs the same loop as Z16Simulator::runExecution, but instead of returning
+// to a central switch after every instruction each handler jumps straight to
+// the handler of the next instruction. The jump goes through a table indexed
+// by the predecoded op id, so every handler ends in its own indirect branch,
+// which the host branch predictor handles far better than one shared switch.
+//
+// GCC and Clang use labels-as-values ("computed goto"); other compilers fall
+// back to a switch inside a loop with the same handler bodies (this can also
+// be forced with -DZ16_COMPUTED_GOTO=0).
+// ---------------------------------------------------------------------------
+#ifndef Z16_COMPUTED_GOTO
+#if defined(__GNUC__) || defined(__clang__)
+#define Z16_COMPUTED_GOTO 1
+#else
+#define Z16_COMPUTED_GOTO 0
+#endif
+#endif
+
+template <bool Trace>
+bool runThreaded(Z16Simulator &sim, Z16TraceWriter &trace, Z16Watchdog &watchdog) {
+    // Hot state is kept in locals; sim.pc is written back whenever code outside
+    // this function may observe it (instructions that can trap, ecalls, exit).
+    array<uint16_t, 8> &regs = sim.regs;
+    const DecodedOp *cache = sim.decodeCache.data();
+    const size_t programSize = sim.programSize;
+    uint16_t pc = sim.pc;
+    uint64_t executed = 0;
+    DecodedOp d;
+
+#if Z16_COMPUTED_GOTO
+    // Must list a label for every Z16Op, in enum order.
+    static void *const handlers[OP_COUNT] = {
+        &&L_OP_UNDECODED,
+        &&L_OP_ADD, &&L_OP_SUB, &&L_OP_SLT, &&L_OP_SLTU, &&L_OP_SLL, &&L_OP_SRL, &&L_OP_SRA,
+        &&L_OP_OR, &&L_OP_AND, &&L_OP_XOR, &&L_OP_MV, &&L_OP_JR, &&L_OP_JALR,
+        &&L_OP_ADDI, &&L_OP_SLTI, &&L_OP_SLTUI, &&L_OP_SLLI, &&L_OP_SRLI, &&L_OP_SRAI,
+        &&L_OP_ORI, &&L_OP_ANDI, &&L_OP_XORI, &&L_OP_LI,
+        &&L_OP_BEQ, &&L_OP_BNE, &&L_OP_BZ, &&L_OP_BNZ, &&L_OP_BLT, &&L_OP_BGE, &&L_OP_BLTU, &&L_OP_BGEU,
+        &&L_OP_SB, &&L_OP_SW, &&L_OP_LB, &&L_OP_LW, &&L_OP_LBU,
+        &&L_OP_J, &&L_OP_JAL, &&L_OP_LUI, &&L_OP_AUIPC,
+        &&L_OP_ECALL,
+        &&L_OP_MEM_NOP, &&L_OP_BAD_R, &&L_OP_BAD_SHIFT, &&L_OP_BAD_SYS,
+        &&L_OP_BREAKPOINT,
+    };
+#define TARGET(name) L_##name:
+#define JUMP_TO_HANDLER() goto *handlers[d.op]
+#else
+#define TARGET(name) case name:
+#define JUMP_TO_HANDLER() goto dispatch_switch
+#endif
+
+    // Per-instruction loop overhead shared by every handler: the same end
+    // check, trace line and fetch that runExecution performs.
+#define DISPATCH()                                                              \
+    do {                                                                        \
+        if (pc >= programSize) {                                                \
+            sim.pc = pc;                                                        \
+            return true;                                                        \
+        }                                                                       \
+        executed++;                                                             \
+        d = cache[pc >> 1];                                                     \
+        if ((pc & 1) || d.op == OP_UNDECODED)                                   \
+            d = sim.fetchDecoded(pc);                                           \
+        if (Trace && trace.sample())                                            \
+            trace.line(sim, pc, d.inst);                                        \
+        JUMP_TO_HANDLER();                                                      \
+    } while (0)
+
+    // Watchdog check point. As in runExecution these are backward control
+    // transfers (WATCH, after a transfer from 'from'), trap entry and the
+    // return from a trap handler.
+#define CHECK_POINT()                                                           \
+    do {                                                                        \
+        if (executed >= watchdog.nextCheck) {                                   \
+            sim.pc = pc;                                                        \
+            if (!watchdog.check(sim, pc, executed)) {                           \
+                trace.stopped(watchdog.reason(), pc);                           \
+                return false;                                                   \
+            }                                                                   \
+        }                                                                       \
+    } while (0)
+#define WATCH(from)                                                             \
+    do {                                                                        \
+        if (pc <= (from))                                                       \
+            CHECK_POINT();                                                      \
+    } while (0)
+
+#define RD regs[d.rd]
+#define RS regs[d.rs]
+#define SYNC_PC() (sim.pc = pc)
+#define NEXT() do { pc += 2; DISPATCH(); } while (0)
+#define BRANCH_IF(cond)                                                         \
+    do {                                                                        \
+        if (cond) {                                                             \
+            uint16_t from = pc;                                                 \
+            pc += d.imm;                                                        \
+            WATCH(from);                                                        \
+        } else {                                                                \
+            pc += 2;                                                            \
+        }                                                                       \
+        DISPATCH();                                                             \
+    } while (0)
+#define JUMP_TO(target)                                                         \
+    do {                                                                        \
+        uint16_t from = pc;                                                     \
+        pc = (target);                                                          \
+        WATCH(from);                                                            \
+        DISPATCH();                                                             \
+    } while (0)
+
+    DISPATCH();
+
+#if !Z16_COMPUTED_GOTO
+dispatch_switch:
+    switch (d.op) {
+#endif
+
+    TARGET(OP_UNDECODED) NEXT();  // Unreachable: fetchDecoded never returns it.
+
+    TARGET(OP_ADD)   RD = RD + RS; NEXT();
+    TARGET(OP_SUB)   RD = RD - RS; NEXT();
+    TARGET(OP_SLT)   RD = (int16_t)RD < (int16_t)RS ? 1 : 0; NEXT();
+    TARGET(OP_SLTU)  RD = RD < RS ? 1 : 0; NEXT();
+    TARGET(OP_SLL)   RD = RD << (RS & 0xF); NEXT();
+    TARGET(OP_SRL)   RD = RD >> (RS & 0xF); NEXT();
+    TARGET(OP_SRA)   RD = static_cast<uint16_t>(static_cast<int16_t>(RD) >> (RS & 0xF)); NEXT();
+    TARGET(OP_OR)    RD = RD | RS; NEXT();
+    TARGET(OP_AND)   RD = RD & RS; NEXT();
+    TARGET(OP_XOR)   RD = RD ^ RS; NEXT();
+    TARGET(OP_MV)    RD = RS; NEXT();
+    TARGET(OP_JR)    JUMP_TO(RD);
+    TARGET(OP_JALR)  RD = pc + 2; JUMP_TO(RS);
+
+    TARGET(OP_ADDI)  RD = RD + d.imm; NEXT();
+    TARGET(OP_SLTI)  RD = ((int16_t)RD < d.imm) ? 1 : 0; NEXT();
+    TARGET(OP_SLTUI) RD = (RD < (uint16_t)d.imm) ? 1 : 0; NEXT();
+    TARGET(OP_SLLI)  RD = RD << d.imm; NEXT();
+    TARGET(OP_SRLI)  RD = RD >> d.imm; NEXT();
+    TARGET(OP_SRAI)  RD = static_cast<uint16_t>(static_cast<int16_t>(RD) >> d.imm); NEXT();
+    TARGET(OP_ORI)   RD = RD | d.imm; NEXT();
+    TARGET(OP_ANDI)  RD = RD & d.imm; NEXT();
+    TARGET(OP_XORI)  RD = RD ^ d.imm; NEXT();
+    TARGET(OP_LI)    RD = d.imm; NEXT();
+
+    TARGET(OP_BEQ)   BRANCH_IF(RD == RS);
+    TARGET(OP_BNE)   BRANCH_IF(RD != RS);
+    TARGET(OP_BZ)    BRANCH_IF(RD == 0);
+    TARGET(OP_BNZ)   BRANCH_IF(RD != 0);
+    TARGET(OP_BLT)   BRANCH_IF((int16_t)RD < (int16_t)RS);
+    TARGET(OP_BGE)   BRANCH_IF((int16_t)RD >= (int16_t)RS);
+    TARGET(OP_BLTU)  BRANCH_IF(RD < RS);
+    TARGET(OP_BGEU)  BRANCH_IF(RD >= RS);
+
+    TARGET(OP_SB)    sim.writeByte(RD + d.imm, RS & 0xFF); NEXT();
+    TARGET(OP_SW)    SYNC_PC(); if (!sim.storeWord<0>(RD + d.imm, RS, nullptr)) goto trapped; NEXT();
+    TARGET(OP_LB)    RD = static_cast<int8_t>(sim.readByte(RS + d.imm)); NEXT();
+    TARGET(OP_LW)    SYNC_PC(); if (!sim.loadWord<0>(RS + d.imm, RD, nullptr)) goto trapped; NEXT();
+    TARGET(OP_LBU)   RD = sim.readByte(RS + d.imm); NEXT();
+
+    TARGET(OP_J)     JUMP_TO(pc + d.imm);
+    TARGET(OP_JAL)   RD = pc + 2; JUMP_TO(pc + d.imm);
+    TARGET(OP_LUI)   RD = (uint16_t)d.imm; NEXT();
+    TARGET(OP_AUIPC) RD = pc + (uint16_t)d.imm; NEXT();
+
+    TARGET(OP_ECALL)
+        SYNC_PC();
+        if (!sim.systemCall(d.imm))
+            return true;
+        if (sim.pc != pc) {                 // ecall 18 returned from a trap.
+            pc = sim.pc;
+            CHECK_POINT();
+            DISPATCH();
+        }
+        NEXT();
+
+    TARGET(OP_MEM_NOP) NEXT();
+    TARGET(OP_BAD_R)
+    TARGET(OP_BAD_SHIFT)
+    TARGET(OP_BAD_SYS)
+        SYNC_PC();
+        if (!sim.illegalOp(d))
+            goto trapped;
+        NEXT();
+
+    // A breakpoint either stops (a Breakpoint trap) or, when its condition
+    // does not hold, runs the instruction under it, which may go anywhere.
+    TARGET(OP_BREAKPOINT)
+        SYNC_PC();
+        if (!sim.breakpointAt()) {
+            if (sim.trap)
+                goto trapped;
+            return true;
+        }
+        JUMP_TO(sim.pc);
+
+#if !Z16_COMPUTED_GOTO
+    }
+    return true;  // Unreachable: every handler dispatches or returns.
+#endif
+
+trapped:
+    // The instruction trapped and had no effect: run the guest's handler, or
+    // end the run with the trap left in sim.trap.
+    if (!sim.enterTrap())
+        return true;
+    pc = sim.pc;
+    CHECK_POINT();
+    DISPATCH();
+
+#undef TARGET
+#undef JUMP_TO_HANDLER
+#undef DISPATCH
+#undef RD
+#undef RS
+#undef SYNC_PC
+#undef NEXT
+#undef BRANCH_IF
+#undef JUMP_TO
+#undef WATCH
+#undef CHECK_POINT
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include "Z16BinaryTrace.h"
+#include "Z16Disasm.h"
+#include "Z16Watchdog.h"
+
+// ---------------------------------------------------------------------------
+// Execution trace output.
+// Formats the "0x0000: 0000  mnemonic" lines of the execution trace into a
+// preallocated buffer with hand-rolled hex conversion and hands the buffer to
+// the stream in large blocks, instead of one flushed iostream line per
+// instruction.
+//
+//   TraceMode::None     no trace lines (engines use their untraced instantiation)
+//   TraceMode::Sampled  one line every 'sampleInterval' executed instructions
+//   TraceMode::Full     every executed instruction
+//
+// With a Z16BinaryTraceWriter attached the selected instructions are recorded
+// in the binary format instead and no text is formatted at all.
+// ---------------------------------------------------------------------------
+enum class TraceMode { None, Sampled, Full };
+
+class Z16TraceWriter {
+public:
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+    explicit Z16TraceWriter(std::ostream &out, TraceMode mode = TraceMode::Full, size_t sampleInterval = 1)
+        : out(out), traceMode(mode), buffer(BUFFER_SIZE), used(0),
+          interval(mode == TraceMode::Sampled && sampleInterval ? sampleInterval : 1), countdown(1) {}
+
+    ~Z16TraceWriter() { flush(); }
+
+    Z16TraceWriter(const Z16TraceWriter &) = delete;
+    Z16TraceWriter &operator=(const Z16TraceWriter &) = delete;
+
+    TraceMode mode() const { return traceMode; }
+    bool enabled() const { return traceMode != TraceMode::None; }
+
+    // Send trace records to 'writer' instead of the text stream.
+    void attachBinary(Z16BinaryTraceWriter *writer) { binary = writer; }
+
+    // Called once per executed instruction; true if this one should be traced.
+    bool sample() {
+        if (traceMode == TraceMode::None || --countdown)
+            return false;
+        countdown = interval;
+        return true;
+    }
+
+    // Trace the instruction 'inst' at 'pc' of the simulator, which is about
+    // to execute.
+    template <class Simulator>
+    void line(Simulator &, uint16_t pc, uint16_t inst) {
+        if (binary) {
+            binary->record(pc, inst);
+            return;
+        }
+        // Formatted straight into the buffer, without going through a string.
+        size_t needed = 14 + Z16Disasm::MAX_TEXT + 1;
+        if (used + needed > buffer.size())
+            flush();
+        char *p = buffer.data() + used;
+        p = linePrefix(p, pc, inst);
+        p = Z16Disasm::formatInstruction(p, pc, inst);
+        *p++ = '\n';
+        used = p - buffer.data();
+    }
+
+    // Append one trace line for the instruction 'inst' at 'pc'.
+    void line(uint16_t pc, uint16_t inst, const std::string &text) {
+        size_t needed = 14 + text.size() + 1;   // "0x0000: 0000  " + text + '\n'
+        if (used + needed > buffer.size()) {
+            flush();
+            if (needed > buffer.size())
+                buffer.resize(needed);
+        }
+        char *p = buffer.data() + used;
+        p = linePrefix(p, pc, inst);
+        memcpy(p, text.data(), text.size());
+        p += text.size();
+        *p++ = '\n';
+        used = p - buffer.data();
+    }
+
+    // Write out everything buffered so far.
+    void flush() {
+        if (used) {
+            out.write(buffer.data(), used);
+            used = 0;
+        }
+    }
+
+    // The underlying stream, for messages that must follow the buffered lines.
+    std::ostream &message() {
+        flush();
+        return out;
+    }
+
+    // Report that the watchdog stopped the run with 'pc' next to execute.
+    void stopped(StopReason reason, uint16_t pc) {
+        if (binary)
+            binary->stopped(reason, pc);
+        message() << "\n" << stopMessage(reason) << " at PC = 0x" << std::setw(4) << std::setfill('0')
+                  << std::hex << pc << ". Exiting simulation.\n";
+    }
+
+private:
+    std::ostream &out;
+    TraceMode traceMode;
+    std::vector<char> buffer;
+    size_t used;
+    size_t interval;
+    size_t countdown;
+    Z16BinaryTraceWriter *binary = nullptr;
+
+    // "0xPPPP: IIII  "
+    static char *linePrefix(char *p, uint16_t pc, uint16_t inst) {
+        *p++ = '0';
+        *p++ = 'x';
+        p = Z16Disasm::putHex4(p, pc);
+        *p++ = ':';
+        *p++ = ' ';
+        p = Z16Disasm::putHex4(p, inst);
+        *p++ = ' ';
+        *p++ = ' ';
+        return p;
+    }
+};
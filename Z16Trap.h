@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// ---------------------------------------------------------------------------
+// Traps and interrupts.
+// A load or store that cannot complete, or an instruction the decoder does
+// not know, does not throw: it records a Z16Trap in the simulator
+// (Z16Simulator::trap) and the instruction returns false with no effect and
+// pc left pointing at it. The engine then offers the trap to the guest
+// (Z16Simulator::enterTrap): if the guest has installed a trap vector the
+// handler runs, otherwise the run ends the way ecall 3 ends it and callers
+// find the cause in 'trap'. Traps are only looked at on that exit path, so
+// instructions that do not trap pay nothing for them.
+//
+// Addresses are 16-bit and wrap: every byte address is valid, and the only
+// access that can run off the end of memory is a word at 0xFFFF. What happens
+// to a word at an odd address is set by the misaligned-access policy:
+//
+//   allow  one unaligned access (a native load or store on little-endian
+//          hosts); a word at 0xFFFF would cross the end of memory and raises
+//          a load/store fault. This is the original behaviour and the default.
+//   split  two byte accesses, low byte first; a word at 0xFFFF wraps around
+//          to 0x0000 for its high byte.
+//   trap   every misaligned word access raises a misaligned load/store trap.
+//
+// Guest view. The trap registers below are read with ecall 16 (a0 = register
+// number a1) and written with ecall 17 (register number a1 = a0); ecall 18
+// returns from a handler. Taking a trap or interrupt sets
+//
+//   CAUSE   the Z16TrapCause value, or INTERRUPT | line for an interrupt
+//   EPC     the instruction to resume at: the faulting one for a trap, the
+//           next one to run for an interrupt
+//   TVAL    the address accessed, or the instruction word if it was illegal
+//   STATUS  PIE = IE, IE = 0, IN_TRAP = 1
+//
+// and jumps to VECTOR. ecall 18 restores IE from PIE, clears IN_TRAP and
+// jumps to EPC. A trap taken while IN_TRAP is set (a fault in a handler) is
+// a double fault and ends the run. VECTOR = 0, the reset value, means no
+// handler: memory traps end the run and unknown instructions are reported
+// and skipped, as they always were.
+//
+// A debugger breakpoint (Z16Simulator::setBreakpoint) stops the run through
+// the same path with cause Breakpoint, and a watchpoint (Z16Stops.h) with
+// cause Watchpoint. Neither is offered to the guest. A watchpoint stops
+// after the store it catches: 'pc' is the store and 'addr' the watched byte
+// it wrote, while the simulator's pc has moved on.
+//
+// Interrupt lines come from memory-mapped devices (Z16Devices.h): device n,
+// in mapping order, drives line n, and PENDING holds the lines as last
+// sampled. An interrupt is taken when IE is set and a line is both pending
+// and set in ENABLE. Lines are sampled at backward control transfers and trap
+// returns (where a loop's blocks meet, and where the watchdog is consulted),
+// and only with IE set, so a run that never enables interrupts does not poll
+// at all.
+// ---------------------------------------------------------------------------
+enum class Z16Misaligned : uint8_t { Allow, Split, Trap };
+
+// Debugger stops come last (Z16Simulator::enterTrap relies on it).
+enum class Z16TrapCause : uint8_t {
+    None, LoadFault, StoreFault, MisalignedLoad, MisalignedStore, IllegalInstruction, Breakpoint, Watchpoint
+};
+
+struct Z16Trap {
+    Z16TrapCause cause = Z16TrapCause::None;
+    uint16_t pc = 0;        // The faulting instruction.
+    uint16_t addr = 0;      // The address it accessed (the instruction word if illegal).
+
+    explicit operator bool() const { return cause != Z16TrapCause::None; }
+};
+
+// Guest trap registers (ecall 16 / 17).
+enum Z16TrapReg : uint8_t {
+    TRAP_CAUSE, TRAP_EPC, TRAP_TVAL, TRAP_VECTOR, TRAP_STATUS, TRAP_ENABLE, TRAP_PENDING, TRAP_REG_COUNT
+};
+
+// TRAP_STATUS bits.
+const uint16_t TRAP_STATUS_IE = 1;         // Interrupts enabled.
+const uint16_t TRAP_STATUS_PIE = 2;        // IE before the current trap.
+const uint16_t TRAP_STATUS_IN_TRAP = 4;    // A handler is running.
+
+// TRAP_CAUSE of an interrupt: this bit plus the line number.
+const uint16_t TRAP_CAUSE_INTERRUPT = 0x8000;
+
+inline const char *trapMessage(Z16TrapCause cause) {
+    switch (cause) {
+        case Z16TrapCause::LoadFault:          return "Memory read error: address out of bounds";
+        case Z16TrapCause::StoreFault:         return "Memory write error: address out of bounds";
+        case Z16TrapCause::MisalignedLoad:     return "Misaligned load";
+        case Z16TrapCause::MisalignedStore:    return "Misaligned store";
+        case Z16TrapCause::IllegalInstruction: return "Illegal instruction";
+        case Z16TrapCause::Breakpoint:         return "Breakpoint";
+        case Z16TrapCause::Watchpoint:         return "Watchpoint";
+        default:                               return "No trap";
+    }
+}
+
+// Parse a policy name (allow, split, trap); false if unknown.
+inline bool parseMisaligned(const std::string &name, Z16Misaligned &policy) {
+    static const char *const names[] = { "allow", "split", "trap" };
+    for (int i = 0; i < 3; i++) {
+        if (name == names[i]) {
+            policy = static_cast<Z16Misaligned>(i);
+            return true;
+        }
+    }
+    return false;
+}
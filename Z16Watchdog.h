@@ -0,0 +1,196 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// ---------------------------------------------------------------------------
+// Run budgets and livelock detection.
+// Engines count executed instructions and compare the count against
+// 'nextCheck' only at backward control transfers (or block boundaries) and
+// on entering and returning from trap handlers, which every non-terminating
+// run must keep reaching. The slow path, check(), runs
+// when that count is due and decides whether to stop:
+//
+//   - instruction budget: the run has executed at least maxInstructions;
+//   - wall-clock budget:  more than maxSeconds have passed (the clock is read
+//                         every CLOCK_INTERVAL instructions);
+//   - livelock:           the machine is back in a state it was in before.
+//
+// The machine is deterministic, so returning to an earlier (pc, regs, memory)
+// state means it will repeat forever; a loop that still makes progress never
+// matches. Livelock detection works in windows: at the start of a window the
+// state is saved, and every check point inside the window compares the
+// current state against it. Memory is compared through a hash kept per
+// 256-byte page, so only pages dirtied since the previous comparison are
+// rehashed. Windows (and the gaps between them) double in length, which keeps
+// the cost a small, fixed fraction of the run while still catching loops with
+// long periods.
+//
+// Budgets are checked at check points, so a run may execute up to one block
+// (or one straight-line stretch) past its instruction budget.
+// ---------------------------------------------------------------------------
+enum class StopReason { None, Livelock, InstructionBudget, TimeBudget };
+
+// Text of the message written to the trace when a run is stopped.
+inline const char *stopMessage(StopReason reason) {
+    switch (reason) {
+        case StopReason::Livelock:          return "Infinite loop detected";
+        case StopReason::InstructionBudget: return "Instruction budget exhausted";
+        case StopReason::TimeBudget:        return "Time budget exhausted";
+        default:                            return "Stopped";
+    }
+}
+
+struct Z16Budget {
+    uint64_t maxInstructions = 0;   // 0 = unlimited
+    double maxSeconds = 0;          // 0 = unlimited
+    bool detectLivelock = true;
+};
+
+class Z16Watchdog {
+public:
+    static const size_t PAGE_SIZE = 256;
+    static const size_t PAGE_COUNT = 65536 / PAGE_SIZE;
+    static const uint64_t CLOCK_INTERVAL = 1 << 20;   // Instructions between clock reads.
+    static const uint64_t FIRST_GAP = 1 << 16;        // Instructions before the first window.
+    static constexpr uint64_t MAX_GAP = 1 << 26;
+    static const uint64_t FIRST_WINDOW = 1 << 10;     // Check points in the first window.
+    static constexpr uint64_t MAX_WINDOW = 1 << 16;
+
+    // Bit of the simulator's dirtyPages owned by the livelock detector.
+    static const uint8_t DIRTY_BIT = 1;
+
+    // Engines call check() once their executed-instruction count reaches this.
+    uint64_t nextCheck;
+
+    // The executed-instruction count passed to the last check(), i.e. where
+    // a stopped run stopped (Z16CoSim.h).
+    uint64_t lastCheck = 0;
+
+    explicit Z16Watchdog(const Z16Budget &budget = Z16Budget())
+        : budget(budget), startTime(std::chrono::steady_clock::now()) {
+        nextClock = budget.maxSeconds > 0 ? CLOCK_INTERVAL : UINT64_MAX;
+        nextWindow = budget.detectLivelock ? FIRST_GAP : UINT64_MAX;
+        schedule(0);
+    }
+
+    const Z16Budget &limits() const { return budget; }
+
+    // Why check() last returned false.
+    StopReason reason() const { return stopReason; }
+
+    // Slow path at a check point with 'pc' next to execute and 'executed'
+    // instructions run so far. Returns false if the run must stop.
+    template <class Simulator>
+    bool check(Simulator &sim, uint16_t pc, uint64_t executed) {
+        lastCheck = executed;
+        if (budget.maxInstructions && executed >= budget.maxInstructions)
+            return stop(StopReason::InstructionBudget);
+        if (executed >= nextClock) {
+            nextClock = executed + CLOCK_INTERVAL;
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+            if (elapsed.count() >= budget.maxSeconds)
+                return stop(StopReason::TimeBudget);
+        }
+        if (inWindow) {
+            updateMemoryHash(sim);
+            if (pc == savedPc && memHash == savedMemHash &&
+                memcmp(sim.regs.data(), savedRegs.data(), sizeof(savedRegs)) == 0)
+                return stop(StopReason::Livelock);
+            if (++windowChecks == windowLength) {
+                inWindow = false;
+                windowLength = std::min(windowLength * 2, MAX_WINDOW);
+                gap = std::min(gap * 2, MAX_GAP);
+                nextWindow = executed + gap;
+            }
+        } else if (executed >= nextWindow) {
+            if (!memHashed)
+                hashAllMemory(sim);
+            updateMemoryHash(sim);
+            savedPc = pc;
+            memcpy(savedRegs.data(), sim.regs.data(), sizeof(savedRegs));
+            savedMemHash = memHash;
+            windowChecks = 0;
+            inWindow = true;
+        }
+        schedule(executed);
+        return true;
+    }
+
+private:
+    Z16Budget budget;
+    std::chrono::steady_clock::time_point startTime;
+    StopReason stopReason = StopReason::None;
+    uint64_t nextClock;
+
+    // Livelock detection.
+    uint64_t nextWindow;
+    uint64_t gap = FIRST_GAP;
+    uint64_t windowLength = FIRST_WINDOW;
+    uint64_t windowChecks = 0;
+    bool inWindow = false;
+    uint16_t savedPc = 0;
+    std::array<uint16_t, 8> savedRegs{};
+    uint64_t savedMemHash = 0;
+    bool memHashed = false;
+    std::array<uint64_t, PAGE_COUNT> pageHash{};
+    uint64_t memHash = 0;            // XOR of the page hashes.
+
+    bool stop(StopReason reason) {
+        stopReason = reason;
+        return false;
+    }
+
+    void schedule(uint64_t executed) {
+        uint64_t next = inWindow ? executed : std::min(nextClock, nextWindow);
+        if (budget.maxInstructions)
+            next = std::min(next, budget.maxInstructions);
+        nextCheck = next;
+    }
+
+    static uint64_t hashPage(const uint8_t *page, size_t index) {
+        uint64_t h = 0x9E3779B97F4A7C15ull * (index + 1);
+        for (size_t i = 0; i < PAGE_SIZE; i += 8) {
+            uint64_t w;
+            memcpy(&w, page + i, 8);
+            h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+            h ^= h >> 31;
+        }
+        return h;
+    }
+
+    template <class Simulator>
+    void hashAllMemory(Simulator &sim) {
+        memHash = 0;
+        for (size_t p = 0; p < PAGE_COUNT; p++) {
+            pageHash[p] = hashPage(sim.memory.data() + p * PAGE_SIZE, p);
+            memHash ^= pageHash[p];
+            sim.dirtyPages[p] &= ~DIRTY_BIT;
+        }
+        memHashed = true;
+    }
+
+    // Rehash the pages written since the last call.
+    template <class Simulator>
+    void updateMemoryHash(Simulator &sim) {
+        static_assert(sizeof(sim.dirtyPages) == PAGE_COUNT, "one dirty flag per page");
+        uint8_t *dirty = sim.dirtyPages.data();
+        for (size_t group = 0; group < PAGE_COUNT; group += 8) {
+            uint64_t flags;
+            memcpy(&flags, dirty + group, 8);
+            if (!(flags & (0x0101010101010101ull * DIRTY_BIT)))
+                continue;
+            for (size_t p = group; p < group + 8; p++) {
+                if (dirty[p] & DIRTY_BIT) {
+                    dirty[p] &= ~DIRTY_BIT;
+                    memHash ^= pageHash[p];
+                    pageHash[p] = hashPage(sim.memory.data() + p * PAGE_SIZE, p);
+                    memHash ^= pageHash[p];
+                }
+            }
+        }
+    }
+};
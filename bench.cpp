@@ -0,0 +1,174 @@
+#include <chrono>
+#include "Z16Simulator.h"
+#include "Z16Threaded.h"
+#include "Z16BlockEngine.h"
+#include "Z16Harts.h"
+
+// ---------------------------------------------------------------------
+// z16bench: measures simulated instructions per second (MIPS) of the
+// execution paths on a synthetic load/store/branch heavy loop. The timings
+// are only reported: a wall-clock ratio is too noisy to fail a build on.
+// With --check it fails (exit status 1) if any path ends the loop in a
+// different state (registers, pc, the stored word) from the reference, or
+// a hart lane retires a different number of instructions; ctest runs it
+// that way.
+// ---------------------------------------------------------------------
+
+// Instruction encoders used to build the benchmark program.
+static uint16_t encI(uint8_t funct3, uint8_t rd, int imm7) {
+    return ((imm7 & 0x7F) << 9) | (rd << 6) | (funct3 << 3) | 0x1;
+}
+static uint16_t encR(uint8_t funct4, uint8_t funct3, uint8_t rd, uint8_t rs2) {
+    return (funct4 << 12) | (rs2 << 9) | (rd << 6) | (funct3 << 3) | 0x0;
+}
+static uint16_t encB(uint8_t funct3, uint8_t rs1, uint8_t rs2, int offset) {
+    return ((offset & 0xF) << 12) | (rs2 << 9) | (rs1 << 6) | (funct3 << 3) | 0x2;
+}
+static uint16_t encMem(uint8_t opcode, uint8_t funct3, uint8_t r8_6, uint8_t r11_9, int offset) {
+    return ((offset & 0xF) << 12) | (r11_9 << 9) | (r8_6 << 6) | (funct3 << 3) | opcode;
+}
+static uint16_t encLui(uint8_t rd, uint16_t imm9) {
+    return ((imm9 >> 3) << 9) | (rd << 6) | ((imm9 & 0x7) << 3) | 0x6;
+}
+
+// Register indices (t0, ra, sp, s0, s1, t1, a0, a1).
+enum { T0, RA, SP, S0, S1, T1, A0, A1 };
+
+// Nested counting loop; the program ends by running off its last instruction.
+static void loadProgram(Z16Simulator &sim) {
+    const uint16_t prog[] = {
+        encLui(S0, 4),                      // 0x00 lui  s0, 4        (data at 0x200)
+        encI(0b111, A1, 60),                // 0x02 li   a1, 60
+        encI(0b111, A0, 0),                 // 0x04 li   a0, 0
+        encLui(T1, 0x1FF),                  // 0x06 lui  t1, 511      (outer)
+        encR(0b0000, 0b000, A0, T1),        // 0x08 add  a0, t1       (inner)
+        encMem(0x3, 0b001, S0, A0, 0),      // 0x0a sw   a0, 0(s0)
+        encMem(0x4, 0b001, T0, S0, 0),      // 0x0c lw   t0, 0(s0)
+        encI(0b000, T1, -1),                // 0x0e addi t1, -1
+        encB(0b011, T1, 0, -4),             // 0x10 bnz  t1, 0x0008
+        encI(0b000, A1, -1),                // 0x12 addi a1, -1
+        encB(0b011, A1, 0, -7),             // 0x14 bnz  a1, 0x0006
+    };
+    for (size_t i = 0; i < sizeof(prog) / sizeof(prog[0]); i++)
+        sim.writeWord(i * 2, prog[i]);
+    sim.programSize = sizeof(prog);
+}
+
+static void resetState(Z16Simulator &sim) {
+    sim.pc = 0;
+    sim.regs.fill(0);
+    sim.regs[2] = MEM_SIZE - 2;
+}
+
+// Run the program once through the reference path to count its instructions.
+static uint64_t countInstructions(Z16Simulator &sim) {
+    uint64_t executed = 0;
+    resetState(sim);
+    do {
+        executed++;
+    } while (sim.executeInstruction(sim.readWord(sim.pc)));
+    return executed;
+}
+
+// Time 'run' (one complete program execution per repetition) and print the MIPS.
+template <typename Run>
+static double runBench(const char *name, Z16Simulator &sim, int reps, uint64_t perRun, Run run) {
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < reps; r++) {
+        resetState(sim);
+        run();
+    }
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    uint64_t executed = perRun * reps;
+    double mips = executed / secs / 1e6;
+    cout << left << setw(12) << name << dec << executed << " instructions in "
+         << fixed << setprecision(3) << secs << " s  = " << setprecision(1) << mips << " MIPS" << endl;
+    return mips;
+}
+
+// What --check compares: the machine state a path leaves at the end.
+struct Outcome {
+    array<uint16_t, 8> regs;
+    uint16_t pc;
+    uint16_t stored;        // The word the loop stores at 0x200.
+
+    bool operator==(const Outcome &) const = default;
+};
+
+static Outcome outcome(Z16Simulator &sim) {
+    return { sim.regs, sim.pc, sim.readWord(0x200) };
+}
+
+int main(int argc, char **argv) {
+    int reps = 3;
+    bool check = false;
+    for (int i = 1; i < argc; i++) {
+        if (string(argv[i]) == "--check")
+            check = true;
+        else
+            reps = atoi(argv[i]);
+    }
+
+    Z16Simulator sim;
+    loadProgram(sim);
+    sim.predecodeImage();
+    uint64_t perRun = countInstructions(sim);
+    const Outcome expected = outcome(sim);
+    size_t failures = 0;
+    auto agree = [&](const char *name) {
+        if (check && !(outcome(sim) == expected)) {
+            cout << "check: " << name << " ends in a different state from the reference" << endl;
+            failures++;
+        }
+    };
+
+    double ref = runBench("reference", sim, reps, perRun, [&] {
+        while (sim.executeInstruction(sim.readWord(sim.pc))) {}
+    });
+    double decoded = runBench("decoded", sim, reps, perRun, [&] {
+        while (sim.executeDecoded(sim.fetchDecoded(sim.pc))) {}
+    });
+    agree("decoded");
+    Z16TraceWriter untraced(cout, TraceMode::None);
+    Z16Budget unlimited;
+    unlimited.detectLivelock = false;
+    Z16Watchdog watchdog(unlimited);
+    double threaded = runBench("threaded", sim, reps, perRun, [&] {
+        runThreaded<false>(sim, untraced, watchdog);
+    });
+    agree("threaded");
+    Z16BlockEngine blockEngine(sim);
+    double block = runBench("block", sim, reps, perRun, [&] {
+        blockEngine.run<false>(untraced, watchdog);
+    });
+    agree("block");
+    Z16BlockEngine jitEngine(sim);
+    jitEngine.jitThreshold = 32;
+    double jit = runBench("jit", sim, reps, perRun, [&] {
+        jitEngine.run<false>(untraced, watchdog);
+    });
+    agree("jit");
+    // Lock-step engine: 16 copies of the program, counted in lane instructions.
+    static Z16Harts<16> harts;
+    double lanes = runBench("harts x16", sim, reps, perRun * 16, [&] {
+        harts.reset();
+        harts.loadProgram(sim.memory.data(), sim.programSize);
+        harts.run();
+    });
+    cout << "speedup over reference: decoded " << setprecision(2) << decoded / ref
+         << "x, threaded " << threaded / ref << "x, block " << block / ref
+         << "x, jit " << jit / ref << "x, harts x16 " << lanes / ref << "x" << endl;
+    if (check) {
+        for (size_t l = 0; l < 16; l++) {
+            bool same = harts.executed[l] == perRun;
+            for (size_t r = 0; r < 8; r++)
+                same = same && harts.regs[r][l] == expected.regs[r];
+            if (!same) {
+                cout << "check: hart lane " << l << " ends in a different state from the reference" << endl;
+                failures++;
+            }
+        }
+        cout << "check: " << failures << " paths differ from the reference" << endl;
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -1,776 +1,441 @@
-#include <iostream>      
-#include <fstream>       
-#include <sstream>       // For stringstream (used in disassembly)
-#include <cstdint>       // For fixed-width integer types (uint16_t, uint8_t)
-#include <cstring>       
-#include <array>         
-#include <stdexcept>     
-#include <cstdlib>       
-#include <iomanip>       
-using namespace std;
-
-// Define total memory size as 64KB.
-static const size_t MEM_SIZE = 65536;
-
-class Z16Simulator {
-public:
-    // 64KB memory (overridden within the class)
-    static const size_t MEM_SIZE = 65536;
-    
-    // Array of 8 registers (16-bit each). The registers are indexed 0 to 7.
-    array<uint16_t, 8> regs;
-    
-    // Program counter (16-bit) holds the current address in memory.
-    uint16_t pc;
-    
-    // Memory array representing the entire 64KB.
-    array<uint8_t, MEM_SIZE> memory;
-    
-    // Total number of bytes loaded into memory (program size).
-    size_t programSize;
-    
-    // Register ABI names for display (used for disassembly and debugging).
-    const array<string, 8> regNames = { "t0", "ra", "sp", "s0", "s1", "t1", "a0", "a1" };
+#include "Z16Simulator.h"
+#include "Z16Threaded.h"
+#include "Z16BlockEngine.h"
+#include "Z16Batch.h"
+#include "Z16Cfg.h"
+#include "Z16Reverse.h"
+#include "Z16Gdb.h"
+#include "Z16CoSim.h"
+#include "Z16Harts.h"
+#include "Z16Assembler.h"
+#include <memory>
+
+static void printUsage() {
+    cerr << "Usage: rvsim [--engine=switch|threaded|block|jit] [--jit-threshold=N]\n"
+            "             [--trace=none|sampled|full] [--trace-interval=N] [--trace-format=text|binary]\n"
+            "             [--quiet] [--max-instructions=N] [--max-seconds=S] [--no-loop-detect]\n"
+            "             [--disasm=linear|cfg] [--jobs=N]\n"
+            "             [--timing=not-taken|btfn|bimodal|gshare] [--predictor-bits=N]\n"
+            "             [--mispredict-penalty=N] [--no-forwarding]\n"
+            "             [--icache=SIZE:WAYS:LINE[:lru|fifo|random]] [--dcache=SIZE:WAYS:LINE[:lru|fifo|random[:wb|wt]]]\n"
+            "             [--device=console@ADDR|timer@ADDR|disk:FILE@ADDR]... [--misaligned=allow|split|trap]\n"
+            "             [--record[=INTERVAL]] [--time-travel=FILE|-] [--gdb=SOCKET|-]\n"
+            "             [--break=ADDR[:COND]]... [--watch=ADDR[+LEN][:COND]]... [--cosim[=instruction]]\n"
+            "             [--save-snapshot=FILE] [--profile=FILE] <machine_code_or_snapshot_file_name>\n"
+            "       rvsim --batch=<manifest_or_directory> [--results=FILE] [--jobs=N]\n"
+            "             [--engine=...] [--jit-threshold=N] [--max-instructions=N] [--max-seconds=S]\n"
+            "             [--no-loop-detect] [--misaligned=allow|split|trap]\n"
+            "       rvsim --harts=<manifest_or_directory>@ADDR [--results=FILE] [--max-instructions=N]\n"
+            "             [--max-seconds=S] <machine_code_file_name>\n"
+            "       rvsim --check" << endl;
+}
 
-    // Constructor initializes registers, program counter, and memory.
-    // Note: sp (reg index 2) is initialized to point near the end of memory.
-    Z16Simulator() : pc(0), programSize(0) {
-        regs.fill(0);            // Set all registers to 0.
-        regs[2] = MEM_SIZE - 2;  // Initialize sp register to top of memory (minus 2).
-        memory.fill(0);          // Clear all memory bytes.
-    }
+// ---------------------------------------------------------------------------
+// --check (run by ctest): built-in programs that exercise the trap path, run
+// on every engine.
+// ---------------------------------------------------------------------------
+
+// Handlers that return (ecall 18) to an instruction that faults again. No
+// branch or jump closes the loop, so only the watchdog check points at trap
+// entry and return can stop it. In the first the trap goes back to the
+// handler and the return forward; in the second the other way round.
+static const char *const REFAULT_PROGRAMS[] = {
+    "        li a0, 8\n"            // 0x00
+    "        li a1, 3\n"            // 0x02
+    "        ecall 17\n"            // 0x04  VECTOR = 0x08
+    "        j 0x000c\n"            // 0x06
+    "        ecall 18\n"            // 0x08  handler
+    "        ecall 3\n"             // 0x0a
+    "        .word 0xf000\n",       // 0x0c  illegal
+    "        li a0, 16\n"           // 0x00
+    "        li a1, 3\n"            // 0x02
+    "        ecall 17\n"            // 0x04  VECTOR = 0x10
+    "        .word 0xf000\n"        // 0x06  illegal
+    "        ecall 3\n"             // 0x08
+    "        .org 0x10\n"
+    "        ecall 18\n",           // 0x10  handler
+};
 
+// ecall 16 / 17 / 18, which were unassigned (printed "ecall N" and did
+// nothing) before the trap registers: install a handler, read a register
+// back, try to write read-only PENDING, take an illegal instruction, read
+// CAUSE, TVAL, STATUS and EPC in the handler and return past the fault.
+// ecall 19 is still unassigned.
+static const char *const TRAP_REGISTER_PROGRAM =
+    "        li a0, 48\n"           // 0x00
+    "        li a1, 3\n"            // 0x02
+    "        ecall 17\n"            // 0x04  VECTOR = 0x30
+    "        li a0, 0\n"            // 0x06
+    "        ecall 16\n"            // 0x08  a0 = VECTOR
+    "        mv s0, a0\n"           // 0x0a
+    "        li a0, 5\n"            // 0x0c
+    "        li a1, 6\n"            // 0x0e
+    "        ecall 17\n"            // 0x10  PENDING is read-only
+    "        ecall 16\n"            // 0x12  a0 = PENDING
+    "        mv s1, a0\n"           // 0x14
+    "        .word 0xf000\n"        // 0x16  illegal
+    "        li a1, 4\n"            // 0x18  the handler returns here
+    "        ecall 16\n"            // 0x1a  a0 = STATUS
+    "        mv ra, a0\n"           // 0x1c
+    "        ecall 19\n"            // 0x1e
+    "        ecall 3\n"             // 0x20
+    "        .org 0x30\n"
+    "        li a1, 0\n"            // 0x30  handler
+    "        ecall 16\n"            //       a0 = CAUSE
+    "        mv t0, a0\n"
+    "        li a1, 2\n"
+    "        ecall 16\n"            //       a0 = TVAL
+    "        mv sp, a0\n"
+    "        li a1, 4\n"
+    "        ecall 16\n"            //       a0 = STATUS
+    "        mv t1, a0\n"
+    "        li a1, 1\n"
+    "        ecall 16\n"            //       a0 = EPC
+    "        addi a0, 2\n"
+    "        ecall 17\n"            //       EPC += 2
+    "        ecall 18\n";
+
+// Registers at the end: t0 = CAUSE, ra = STATUS after the return, sp = TVAL,
+// s0 = VECTOR, s1 = PENDING, t1 = STATUS in the handler.
+static const array<uint16_t, 8> TRAP_REGISTER_RESULT = {
+    static_cast<uint16_t>(Z16TrapCause::IllegalInstruction), 0, 0xf000, 0x30, 0, TRAP_STATUS_IN_TRAP, 0, 4
+};
 
-    // Read a byte from memory at the given address.
-    uint8_t readByte(uint16_t addr) {
-        if (addr >= MEM_SIZE)
-            throw runtime_error("Memory read error: address out of bounds");
-        return memory[addr];
+// Run 'sim' from its pc on 'engine', untraced; false if 'watchdog' stopped it.
+static bool runEngine(const string &engine, Z16Simulator &sim, Z16Watchdog &watchdog) {
+    ostream silent(nullptr);
+    Z16TraceWriter trace(silent, TraceMode::None);
+    if (engine == "threaded")
+        return runThreaded<false>(sim, trace, watchdog);
+    if (engine == "block" || engine == "jit") {
+        Z16BlockEngine blocks(sim);
+        if (engine == "jit")
+            blocks.jitThreshold = 32;
+        return blocks.run<false>(trace, watchdog);
     }
+    return sim.runExecution<false>(trace, watchdog);
+}
 
-void showmem(ostream &out) {
-    out << "\nUsed Memory Listing (only non-zero cells):\n";
-    bool foundAny = false;
-    // Go through the entire memory.
-    for (size_t addr = 0; addr < MEM_SIZE; ++addr) {
-        // Only output memory locations that have a nonzero value.
-        if (memory[addr] != 0) {
-            out << "Addr 0x" << setw(4) << setfill('0') << hex << addr
-                << " : 0x" << setw(2) << setfill('0') << hex << (int)memory[addr] << "\n";
-            foundAny = true;
+static size_t refaultCheck(const string &engine) {
+    size_t failures = 0;
+    for (size_t p = 0; p < size(REFAULT_PROGRAMS); p++) {
+        for (StopReason expected : { StopReason::InstructionBudget, StopReason::TimeBudget, StopReason::Livelock }) {
+            Z16Budget budget;
+            budget.detectLivelock = expected == StopReason::Livelock;
+            if (expected == StopReason::InstructionBudget)
+                budget.maxInstructions = 1000;
+            if (expected == StopReason::TimeBudget)
+                budget.maxSeconds = 0.1;
+            Z16Simulator sim;
+            ostringstream console;
+            sim.console = &console;
+            Z16Assembler().assemble(REFAULT_PROGRAMS[p], sim);
+            Z16Watchdog watchdog(budget);
+            if (runEngine(engine, sim, watchdog) || watchdog.reason() != expected) {
+                cerr << engine << ": refault program " << p << " was not stopped by \"" << stopMessage(expected)
+                     << "\"" << endl;
+                failures++;
+            }
         }
     }
-    // In case no memory cells were used.
-    if (!foundAny) {
-        out << "No used memory addresses found.\n";
-    }
+    return failures;
 }
 
+static size_t trapRegisterCheck(const string &engine) {
+    Z16Budget budget;
+    budget.maxInstructions = 10000;
+    Z16Simulator sim;
+    ostringstream console;
+    sim.console = &console;
+    Z16Assembler().assemble(TRAP_REGISTER_PROGRAM, sim);
+    Z16Watchdog watchdog(budget);
+    bool finished = runEngine(engine, sim, watchdog);
+    if (finished && !sim.trap && sim.regs == TRAP_REGISTER_RESULT && sim.trapRegs[TRAP_EPC] == 0x18 &&
+        console.str() == "ecall 19\necall 3\necall terminate simulation\n")
+        return 0;
+    cerr << engine << ": trap register program ended " << (finished ? "" : "by the watchdog ") << "with";
+    for (size_t r = 0; r < sim.regs.size(); r++)
+        cerr << " " << sim.regNames[r] << "=0x" << hex << sim.regs[r];
+    cerr << " EPC=0x" << sim.trapRegs[TRAP_EPC] << dec << ", output:\n" << console.str();
+    return 1;
+}
 
-    // Read a 16-bit word from memory (using little-endian order).
-    uint16_t readWord(uint16_t addr) {
-        if (addr + 1 >= MEM_SIZE)
-            throw runtime_error("Memory read error: address out of bounds");
-        // Combine two bytes: low byte at addr, high byte at addr+1.
-        return memory[addr] | (memory[addr + 1] << 8);
-    }
-
-    // Write a byte to memory at the given address.
-    void writeByte(uint16_t addr, uint8_t value) {
-        if (addr >= MEM_SIZE)
-            throw runtime_error("Memory write error: address out of bounds");
-        memory[addr] = value;
-    }
+static bool engineCheck() {
+    size_t failures = 0;
+    for (const char *engine : { "switch", "threaded", "block", "jit" })
+        failures += refaultCheck(engine) + trapRegisterCheck(engine);
+    cout << "check: " << failures << " failures" << endl;
+    return failures == 0;
+}
 
-    // Write a 16-bit word to memory in little-endian order.
-    void writeWord(uint16_t addr, uint16_t value) {
-        if (addr + 1 >= MEM_SIZE)
-            throw runtime_error("Memory write error: address out of bounds");
-        memory[addr] = value & 0xFF;             // Lower 8 bits.
-        memory[addr + 1] = (value >> 8) & 0xFF;    // Upper 8 bits.
+//
+// ---------------------
+// Main Entry Point
+// ---------------------
+//
+int main(int argc, char **argv) {
+    if (argc == 2 && string(argv[1]) == "--check") {
+        try {
+            return engineCheck() ? EXIT_SUCCESS : EXIT_FAILURE;
+        } catch (const exception &ex) {
+            cerr << ex.what() << endl;
+            return EXIT_FAILURE;
+        }
     }
-
-
-    // -----------------------------------------------------------------------
-    // Disassemble a 16-bit instruction into a human-readable assembly string.
-    // 'addr' is the current address (used for branch targets).
-    // -----------------------------------------------------------------------
-    string disassemble(uint16_t addr, uint16_t inst) {
-        // Extract the opcode from the lowest 3 bits.
-        uint8_t opcode = inst & 0x7;
-        stringstream ss;
-
-        // Decode based on opcode.
-        switch(opcode) {
-            case 0x0: { // R-type instructions.
-                // Extract function and register fields.
-                uint8_t funct4 = (inst >> 12) & 0xF;
-                uint8_t rs2 = (inst >> 9) & 0x7;
-                uint8_t rd_rs1 = (inst >> 6) & 0x7;
-                uint8_t funct3 = (inst >> 3) & 0x7;
-                // Determine the specific instruction based on funct4 and funct3.
-                if (funct4 == 0b0000 && funct3 == 0b000)
-                    ss << "add " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0001 && funct3 == 0b000)
-                    ss << "sub " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0000 && funct3 == 0b001)
-                    ss << "slt " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0000 && funct3 == 0b010)
-                    ss << "sltu " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0010 && funct3 == 0b011)
-                    ss << "sll " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0100 && funct3 == 0b011)
-                    ss << "srl " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b1000 && funct3 == 0b011)
-                    ss << "sra " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0001 && funct3 == 0b100)
-                    ss << "or " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0000 && funct3 == 0b101)
-                    ss << "and " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0000 && funct3 == 0b110)
-                    ss << "xor " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0000 && funct3 == 0b111)
-                    ss << "mv " << regNames[rd_rs1] << ", " << regNames[rs2];
-                else if (funct4 == 0b0100 && funct3 == 0b000)
-                    ss << "jr " << regNames[rd_rs1];
-                else if (funct4 == 0b1000 && funct3 == 0b000)
-                    ss << "jalr " << regNames[rs2];
-                else
-                    ss << "Unknown R-type instruction";
-                break;
+    // Parse options; the single non-option argument is the machine code file name.
+    string machineFilename;
+    string engine = "switch";
+    size_t jitThreshold = 32;
+    string traceOption = "full";
+    size_t traceInterval = 1000;
+    string traceFormat = "text";
+    Z16Budget budget;
+    string batchPath;
+    string resultsFilename = "batch_results.txt";
+    size_t jobs = 0;
+    string snapshotFilename;
+    string disasmMode = "linear";
+    string profileFilename;
+    bool timing = false;
+    Z16PipelineConfig pipelineConfig;
+    bool icache = false, dcache = false;
+    Z16CacheConfig icacheConfig, dcacheConfig;
+    vector<string> deviceSpecs;
+    Z16Misaligned misaligned = Z16Misaligned::Allow;
+    bool record = false;
+    uint64_t recordInterval = 1 << 16;
+    string timeTravelFilename;
+    string gdbPath;
+    vector<string> breakSpecs, watchSpecs;
+    string cosimMode;
+    string hartsInputs;
+    uint16_t hartsAddress = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--engine=", 0) == 0) {
+            engine = arg.substr(9);
+        } else if (arg.rfind("--jit-threshold=", 0) == 0) {
+            jitThreshold = strtoul(arg.c_str() + 16, nullptr, 10);
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            traceOption = arg.substr(8);
+        } else if (arg.rfind("--trace-interval=", 0) == 0) {
+            traceInterval = strtoul(arg.c_str() + 17, nullptr, 10);
+        } else if (arg.rfind("--trace-format=", 0) == 0) {
+            traceFormat = arg.substr(15);
+        } else if (arg == "--quiet") {
+            traceOption = "none";
+        } else if (arg.rfind("--max-instructions=", 0) == 0) {
+            budget.maxInstructions = strtoull(arg.c_str() + 19, nullptr, 10);
+        } else if (arg.rfind("--max-seconds=", 0) == 0) {
+            budget.maxSeconds = strtod(arg.c_str() + 14, nullptr);
+        } else if (arg == "--no-loop-detect") {
+            budget.detectLivelock = false;
+        } else if (arg.rfind("--batch=", 0) == 0) {
+            batchPath = arg.substr(8);
+        } else if (arg.rfind("--harts=", 0) == 0) {
+            // Input images and the address each is written at: INPUTS@ADDR.
+            size_t at = arg.rfind('@');
+            char *end = nullptr;
+            unsigned long address = at == string::npos || at < 9 ? 0x10000 : strtoul(arg.c_str() + at + 1, &end, 0);
+            if (address > 0xFFFF || at + 1 >= arg.size() || *end) {
+                printUsage();
+                return EXIT_FAILURE;
             }
-            case 0x1: { // I-type instructions.
-                uint8_t imm7 = (inst >> 9) & 0x7F;   // 7-bit immediate field.
-                uint8_t imm3 = (inst >> 13) & 0x7;     // Additional bits for shift instructions.
-                uint8_t rd_rs1 = (inst >> 6) & 0x7;      // Destination/source register.
-                uint8_t funct3 = (inst >> 3) & 0x7;      // Function code.
-                // Sign-extend the immediate field if needed.
-                int16_t simm = (imm7 & 0x40) ? (imm7 | 0xFF80) : imm7;
-                if (funct3 == 0b000)
-                    ss << "addi " << regNames[rd_rs1] << ", " << simm;
-                else if (funct3 == 0b001)
-                    ss << "slti " << regNames[rd_rs1] << ", " << simm;
-                else if (funct3 == 0b010)
-                    ss << "sltui " << regNames[rd_rs1] << ", " << imm7;
-                else if (funct3 == 0b011 && imm3 == 0b001)
-                    ss << "slli " << regNames[rd_rs1] << ", " << (imm7 & 0xF);
-                else if (funct3 == 0b011 && imm3 == 0b010)
-                    ss << "srli " << regNames[rd_rs1] << ", " << (imm7 & 0xF);
-                else if (funct3 == 0b011 && imm3 == 0b100)
-                    ss << "srai " << regNames[rd_rs1] << ", " << (imm7 & 0xF);
-                else if (funct3 == 0b100)
-                    ss << "ori " << regNames[rd_rs1] << ", " << simm;
-                else if (funct3 == 0b101)
-                    ss << "andi " << regNames[rd_rs1] << ", " << simm;
-                else if (funct3 == 0b110)
-                    ss << "xori " << regNames[rd_rs1] << ", " << simm;
-                else if (funct3 == 0b111)
-                    ss << "li " << regNames[rd_rs1] << ", " << simm;
-                else
-                    ss << "Unknown I-type instruction";
-                break;
+            hartsInputs = arg.substr(8, at - 8);
+            hartsAddress = static_cast<uint16_t>(address);
+        } else if (arg.rfind("--results=", 0) == 0) {
+            resultsFilename = arg.substr(10);
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            jobs = strtoul(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.rfind("--disasm=", 0) == 0) {
+            disasmMode = arg.substr(9);
+        } else if (arg.rfind("--save-snapshot=", 0) == 0) {
+            snapshotFilename = arg.substr(16);
+        } else if (arg.rfind("--profile=", 0) == 0) {
+            profileFilename = arg.substr(10);
+        } else if (arg.rfind("--timing=", 0) == 0) {
+            timing = true;
+            if (!parsePredictor(arg.substr(9), pipelineConfig.predictor)) {
+                printUsage();
+                return EXIT_FAILURE;
             }
-            case 0x2: { // B-type (branch) instructions.
-                // Extract a 4-bit offset and sign-extend it to 8 bits.
-                int8_t raw_offset = (inst >> 12) & 0xF;
-                if (raw_offset & 0x8)
-                    raw_offset |= 0xF0;
-                // Extract registers used in branch.
-                uint8_t rs2 = (inst >> 9) & 0x7;
-                uint8_t rs1 = (inst >> 6) & 0x7;
-                uint8_t funct3 = (inst >> 3) & 0x7;
-                // Calculate branch target address.
-                uint16_t target = addr + 2 + (raw_offset * 2);
-                switch(funct3) {
-                    case 0b000: // BEQ
-                        ss << "beq " << regNames[rs1] << ", " << regNames[rs2]
-                           << ", 0x" << setw(4) << setfill('0') << hex << target;
-                        break;
-                    case 0b001: // BNE
-                        ss << "bne " << regNames[rs1] << ", " << regNames[rs2]
-                           << ", 0x" << setw(4) << setfill('0') << hex << target;
-                        break;
-                    case 0b010: // BZ (branch if register rs1 is zero)
-                        target -= 2;
-                        ss << "bz " << regNames[rs1] << ", 0x"
-                           << setw(4) << setfill('0') << hex << target;
-                        break;
-                    case 0b011: // BNZ (branch if register rs1 is nonzero)
-                        target -= 2;
-                        ss << "bnz " << regNames[rs1] << ", 0x"
-                           << setw(4) << setfill('0') << hex << target;
-                        break;
-                    case 0b100: // BLT (branch if less than, signed)
-                        ss << "blt " << regNames[rs1] << ", " << regNames[rs2]
-                           << ", 0x" << setw(4) << setfill('0') << hex << target;
-                        break;
-                    case 0b101: // BGE (branch if greater than or equal, signed)
-                        ss << "bge " << regNames[rs1] << ", " << regNames[rs2]
-                           << ", 0x" << setw(4) << setfill('0') << hex << target;
-                        break;
-                    case 0b110: // BLTU (branch if less than, unsigned)
-                        ss << "bltu " << regNames[rs1] << ", " << regNames[rs2]
-                           << ", 0x" << setw(4) << setfill('0') << hex << target;
-                        break;
-                    case 0b111: // BGEU (branch if greater than or equal, unsigned)
-                        ss << "bgeu " << regNames[rs1] << ", " << regNames[rs2]
-                           << ", 0x" << setw(4) << setfill('0') << hex << target;
-                        break;
-                    default:
-                        ss << "Unimplemented B-type instruction";
-                        break;
-                }
-                break;
+        } else if (arg.rfind("--predictor-bits=", 0) == 0) {
+            pipelineConfig.tableBits = strtoul(arg.c_str() + 17, nullptr, 10);
+        } else if (arg.rfind("--mispredict-penalty=", 0) == 0) {
+            pipelineConfig.mispredictPenalty = strtoul(arg.c_str() + 21, nullptr, 10);
+        } else if (arg == "--no-forwarding") {
+            pipelineConfig.forwarding = false;
+        } else if (arg.rfind("--icache=", 0) == 0 || arg.rfind("--dcache=", 0) == 0) {
+            bool instruction = arg[2] == 'i';
+            (instruction ? icache : dcache) = true;
+            if (!parseCacheConfig(arg.substr(9), instruction ? icacheConfig : dcacheConfig)) {
+                printUsage();
+                return EXIT_FAILURE;
             }
-            case 0x3: { // S-type (store) instructions.
-                // Extract 4-bit offset.
-                int8_t offset = (inst >> 12) & 0xF;
-                // For store instructions, the register fields are swapped:
-                // Base register comes from bits [8:6] and value register from bits [11:9].
-                uint8_t rs1 = (inst >> 6) & 0x7;  // Base register (address)
-                uint8_t rs2 = (inst >> 9) & 0x7;  // Source register (value)
-                uint8_t funct3 = (inst >> 3) & 0x7;
-                // Format output as store instruction with offset addressing.
-                if (funct3 == 0b000)
-                    ss << "sb " << regNames[rs2] << ", " << static_cast<int>(offset)
-                       << "(" << regNames[rs1] << ")";
-                else if (funct3 == 0b001)
-                    ss << "sw " << regNames[rs2] << ", " << static_cast<int>(offset)
-                       << "(" << regNames[rs1] << ")";
-                else
-                    ss << "Unknown S-type instruction";
-                break;
+        } else if (arg.rfind("--device=", 0) == 0) {
+            deviceSpecs.push_back(arg.substr(9));
+        } else if (arg.rfind("--misaligned=", 0) == 0) {
+            if (!parseMisaligned(arg.substr(13), misaligned)) {
+                printUsage();
+                return EXIT_FAILURE;
             }
-            case 0x4: { // L-type (load) instructions.
-                int8_t offset = (inst >> 12) & 0xF;
-                uint8_t rs2 = (inst >> 9) & 0x7;   // Base register for address.
-                uint8_t rd = (inst >> 6) & 0x7;      // Destination register.
-                uint8_t funct3 = (inst >> 3) & 0x7;
-                if (funct3 == 0b000)
-                    ss << "lb " << regNames[rd] << ", " << static_cast<int>(offset)
-                       << "(" << regNames[rs2] << ")";
-                else if (funct3 == 0b001)
-                    ss << "lw " << regNames[rd] << ", " << static_cast<int>(offset)
-                       << "(" << regNames[rs2] << ")";
-                else if (funct3 == 0b100)
-                    ss << "lbu " << regNames[rd] << ", " << static_cast<int>(offset)
-                       << "(" << regNames[rs2] << ")";
-                else
-                    ss << "Unknown L-type instruction";
-                break;
-            }
-            case 0x5: { // J-type (jump) instructions.
-                // f: flag bit (determines type: jump vs. jal)
-                uint8_t f    = (inst >> 15) & 0x1; 
-                // imm6: bits 14:9, imm3: bits 5:3
-                uint8_t imm6 = (inst >> 9)  & 0x3F;
-                uint8_t rd   = (inst >> 6)  & 0x7;  // For JAL, this is the destination register.
-                uint8_t imm3 = (inst >> 3)  & 0x7;
-                // Combine immediate parts into a 9-bit immediate.
-                int16_t rawImm = (imm6 << 3) | imm3;
-                // Sign-extend if necessary (if bit 8 is set).
-                if (rawImm & (1 << 8)) {
-                    rawImm |= 0xFE00; // Set upper bits.
-                }
-                // Calculate final target address (PC-relative, multiplied by 2).
-                uint16_t target = addr + (rawImm * 2);
-                if (f == 0) {
-                    ss << "j 0x" << hex << setw(4) << setfill('0') << target;
-                } else {
-                    ss << "jal " << regNames[rd]
-                       << ", 0x" << hex << setw(4) << setfill('0') << target;
-                }
-                break;
-            }
-            case 0x6: { // U-type (lui/auipc) instructions.
-                // Extract flag and immediate fields.
-                uint8_t f         = (inst >> 15) & 0x1;      // f bit to differentiate between LUI and AUIPC.
-                uint8_t imm_upper = (inst >> 9)  & 0x3F;      // Upper 6 bits of immediate.
-                uint8_t rd        = (inst >> 6)  & 0x7;       // Destination register.
-                uint8_t imm_lower = (inst >> 3)  & 0x7;       // Lower 3 bits of immediate.
-                // Recombine into a 9-bit immediate value.
-                uint16_t imm_val = (imm_upper << 3) | imm_lower;
-                if (f == 0) {
-                    ss << "lui " << regNames[rd] << ", " << imm_val;
-                } else {
-                    ss << "auipc " << regNames[rd] << ", " << imm_val;
-                }
-                break;
-            }
-            case 0x7: { // SYS-type instructions.
-                // Extract service number from bits 6 to 15.
-                uint16_t service = (inst >> 6) & 0x3FF;
-                uint8_t funct3 = (inst >> 3) & 0x7;
-                if (funct3 == 0b000)
-                    ss << "ecall " << service;
-                else
-                    ss << "Unknown SYS-type instruction";
-                break;
-            }
-            default:
-                ss << "Unknown instruction with opcode 0x" << hex << static_cast<int>(opcode);
-                break;
+        } else if (arg == "--record" || arg.rfind("--record=", 0) == 0) {
+            record = true;
+            if (arg.size() > 8)
+                recordInterval = strtoull(arg.c_str() + 9, nullptr, 10);
+        } else if (arg.rfind("--time-travel=", 0) == 0) {
+            record = true;
+            timeTravelFilename = arg.substr(14);
+        } else if (arg.rfind("--gdb=", 0) == 0 && arg.size() > 6) {
+            gdbPath = arg.substr(6);
+        } else if (arg.rfind("--break=", 0) == 0) {
+            breakSpecs.push_back(arg.substr(8));
+        } else if (arg.rfind("--watch=", 0) == 0) {
+            watchSpecs.push_back(arg.substr(8));
+        } else if (arg == "--cosim") {
+            cosimMode = "boundary";
+        } else if (arg == "--cosim=instruction") {
+            cosimMode = "instruction";
+        } else if (arg.rfind("--", 0) != 0 && machineFilename.empty()) {
+            machineFilename = arg;
+        } else {
+            printUsage();
+            return EXIT_FAILURE;
         }
-        return ss.str();
     }
-
-    // -----------------------------------------------------
-    // Execution Loop: Simulate running the loaded program.
-    // -----------------------------------------------------
-    bool runExecution(ostream &out) {
-        size_t cycleCount = 0;
-        const size_t MAX_CYCLES = 10000;
-        while (pc < programSize) {
-            if (cycleCount++ > MAX_CYCLES) {
-                out << "\nInfinite loop detected at PC = 0x" << setw(4) << setfill('0')
-                    << hex << pc << ". Exiting simulation.\n";
-                return false;
-            }    
-            uint16_t inst = readWord(pc);
-            out << "0x" << setw(4) << setfill('0') << hex << pc << ": "
-                << setw(4) << inst << "  " << disassemble(pc, inst) << endl;
-            // Execute the instruction. If execution should terminate, break.
-            if (!executeInstruction(inst))
-                break;
-        }
-        return true;
+    if (machineFilename.empty() == batchPath.empty() || (engine != "switch" && engine != "threaded" &&
+                                    engine != "block" && engine != "jit") ||
+        (traceOption != "none" && traceOption != "sampled" && traceOption != "full") ||
+        (traceFormat != "text" && traceFormat != "binary") ||
+        (disasmMode != "linear" && disasmMode != "cfg") ||
+        traceInterval == 0 || recordInterval == 0 ||
+        (engine != "switch" && (!profileFilename.empty() || timing || icache || dcache || !deviceSpecs.empty() ||
+                                !watchSpecs.empty())) ||
+        (record && (!batchPath.empty() || !profileFilename.empty() || timing || icache || dcache || !deviceSpecs.empty())) ||
+        (!gdbPath.empty() && (!batchPath.empty() || record || !profileFilename.empty() || timing || icache || dcache ||
+                              !deviceSpecs.empty())) ||
+        ((!breakSpecs.empty() || !watchSpecs.empty()) && (!batchPath.empty() || record || !gdbPath.empty())) ||
+        (!cosimMode.empty() && (!batchPath.empty() || record || !gdbPath.empty() || !profileFilename.empty() || timing ||
+                                icache || dcache || !deviceSpecs.empty() || !breakSpecs.empty() || !watchSpecs.empty())) ||
+        (!hartsInputs.empty() && (!batchPath.empty() || engine != "switch" || misaligned != Z16Misaligned::Allow ||
+                                  record || !gdbPath.empty() || !profileFilename.empty() || timing || icache || dcache ||
+                                  !deviceSpecs.empty() || !breakSpecs.empty() || !watchSpecs.empty() ||
+                                  !cosimMode.empty() || !snapshotFilename.empty()))) {
+        printUsage();
+        return EXIT_FAILURE;
     }
 
-    // ----------------------------------------------
-    // Print Final Register State to the Output Stream.
-    // ----------------------------------------------
-    void printFinalState(ostream &out) {
-        out << "\nFinal register state:" << endl;
-        for (size_t i = 0; i < regs.size(); i++) {
-            out << regNames[i] << " = " << "0x" << setw(4) << setfill('0')
-                << hex << regs[i] << endl;
+    // Under a debugger the run is not traced. With --gdb=- the protocol owns
+    // standard output, so everything else written there goes to standard error.
+    int gdbOut = -1;
+    if (!gdbPath.empty()) {
+#if Z16_GDB_AVAILABLE
+        traceOption = "none";
+        if (gdbPath == "-") {
+            gdbOut = dup(STDOUT_FILENO);
+            dup2(STDERR_FILENO, STDOUT_FILENO);
         }
+#else
+        cerr << "--gdb is not supported on this platform" << endl;
+        return EXIT_FAILURE;
+#endif
     }
 
-    // -----------------------------------------------------
-    // Execute a Single Instruction.
-    // Returns false if simulation should terminate.
-    // -----------------------------------------------------
-    bool executeInstruction(uint16_t inst) {
-        // Extract opcode (lowest 3 bits).
-        uint8_t opcode = inst & 0x7;
-        bool pcUpdated = false;
-
-        // Special-case: If instruction is a specific jump (J-type) instruction with value 0x818D.
-        if (1){
-            // Switch based on opcode.
-            switch(opcode) {
-                case 0x0: { // R-type instructions.
-                    uint8_t funct4 = (inst >> 12) & 0xF;
-                    uint8_t rs2 = (inst >> 9) & 0x7;
-                    uint8_t rd_rs1 = (inst >> 6) & 0x7;
-                    uint8_t funct3 = (inst >> 3) & 0x7;
-                    if (funct4 == 0b0000 && funct3 == 0b000)
-                        regs[rd_rs1] = regs[rd_rs1] + regs[rs2];
-                    else if (funct4 == 0b0001 && funct3 == 0b000)
-                        regs[rd_rs1] = regs[rd_rs1] - regs[rs2];
-                    else if (funct4 == 0b0000 && funct3 == 0b001)
-                        regs[rd_rs1] = (int16_t)regs[rd_rs1] < (int16_t)regs[rs2] ? 1 : 0;
-                    else if (funct4 == 0b0000 && funct3 == 0b010)
-                        regs[rd_rs1] = regs[rd_rs1] < regs[rs2] ? 1 : 0;
-                    else if (funct4 == 0b0010 && funct3 == 0b011)
-                        regs[rd_rs1] = regs[rd_rs1] << (regs[rs2] & 0xF);
-                    else if (funct4 == 0b0100 && funct3 == 0b011)
-                        regs[rd_rs1] = regs[rd_rs1] >> (regs[rs2] & 0xF);
-                    else if (funct4 == 0b1000 && funct3 == 0b011)
-                        regs[rd_rs1] = static_cast<uint16_t>(static_cast<int16_t>(regs[rd_rs1]) >> (regs[rs2] & 0xF));
-                    else if (funct4 == 0b0001 && funct3 == 0b100)
-                        regs[rd_rs1] = regs[rd_rs1] | regs[rs2];
-                    else if (funct4 == 0b0000 && funct3 == 0b101)
-                        regs[rd_rs1] = regs[rd_rs1] & regs[rs2];
-                    else if (funct4 == 0b0000 && funct3 == 0b110)
-                        regs[rd_rs1] = regs[rd_rs1] ^ regs[rs2];
-                    else if (funct4 == 0b0000 && funct3 == 0b111)
-                        regs[rd_rs1] = regs[rs2];
-                    else if (funct4 == 0b0100 && funct3 == 0b000) {
-                        // JR: Jump register.
-                        pc = regs[rd_rs1];
-                        pcUpdated = true;
-                    } else if (funct4 == 0b1000 && funct3 == 0b000) {
-                        // JALR: Save return address and jump.
-                        regs[rd_rs1] = pc + 2;
-                        pc = regs[rs2];
-                        pcUpdated = true;
-                    } else {
-                        cout << "Unknown R-type instruction at PC = 0x" << hex << pc << endl;
-                    }
-                    break;
-                }
-                case 0x1: { // I-type instructions.
-                    // Extract fields for I-type instruction.
-                    uint8_t imm7    = (inst >> 9) & 0x7F;   // Immediate (bits 15:9)
-                    uint8_t rd_rs1  = (inst >> 6) & 0x7;      // Register operand
-                    uint8_t funct3  = (inst >> 3) & 0x7;      // Function code
-                    uint8_t imm3    = (inst >> 13) & 0x7;     // For shift instructions (overlap)
-                    // Sign-extend immediate for non-shift operations.
-                    int16_t simm = (imm7 & 0x40) ? (imm7 | 0xFF80) : imm7;
-
-                    switch (funct3) {
-                        case 0b000: {
-                            // ADDI: Add immediate.
-                            regs[rd_rs1] = regs[rd_rs1] + simm;
-                            break;
-                        }
-                        case 0b001: {
-                            // SLTI: Set if less than (signed).
-                            regs[rd_rs1] = ((int16_t) regs[rd_rs1] < simm) ? 1 : 0;
-                            break;
-                        }
-                        case 0b010: {
-                            // SLTUI: Set if less than (unsigned).
-                            regs[rd_rs1] = ((uint16_t) regs[rd_rs1] < (uint16_t) simm) ? 1 : 0;
-                            break;
-                        }
-                        case 0b011: {
-                            // Shift instructions: SLLI, SRLI, SRAI.
-                            uint8_t shamt = imm7 & 0xF;  // Shift amount is in lower 4 bits.
-                            switch (imm3) {
-                                case 0b001: // SLLI: Shift left logical.
-                                    regs[rd_rs1] = regs[rd_rs1] << shamt;
-                                    break;
-                                case 0b010: // SRLI: Shift right logical.
-                                    regs[rd_rs1] = regs[rd_rs1] >> shamt;
-                                    break;
-                                case 0b100: // SRAI: Shift right arithmetic.
-                                    regs[rd_rs1] = static_cast<uint16_t>(
-                                        static_cast<int16_t>(regs[rd_rs1]) >> shamt
-                                    );
-                                    break;
-                                default:
-                                    cout << "Unimplemented I-type shift instruction at PC = 0x"
-                                         << hex << pc << endl;
-                                    break;
-                            }
-                            break;
-                        }
-                        case 0b100: {
-                            // ORI: Bitwise OR with immediate.
-                            regs[rd_rs1] = regs[rd_rs1] | simm;
-                            break;
-                        }
-                        case 0b101: {
-                            // ANDI: Bitwise AND with immediate.
-                            regs[rd_rs1] = regs[rd_rs1] & simm;
-                            break;
-                        }
-                        case 0b110: {
-                            // XORI: Bitwise XOR with immediate.
-                            regs[rd_rs1] = regs[rd_rs1] ^ simm;
-                            break;
-                        }
-                        case 0b111: {
-                            // LI: Load immediate.
-                            regs[rd_rs1] = simm;
-                            break;
-                        }
-                        default:
-                            cout << "Unimplemented I-type instruction at PC = 0x"
-                                 << hex << pc << endl;
-                            break;
-                    }
-                    break;
-                }
-                case 0x2: { // B-type (branch) instructions.
-                    int8_t raw_offset = (inst >> 12) & 0xF;
-                    if (raw_offset & 0x8)
-                        raw_offset |= 0xF0;  // Sign extend offset.
-                    uint8_t rs2 = (inst >> 9) & 0x7;
-                    uint8_t rs1 = (inst >> 6) & 0x7;
-                    uint8_t funct3 = (inst >> 3) & 0x7;
-                    uint16_t target = pc + (raw_offset * 2);
-                    switch(funct3) {
-                        case 0b000: // BEQ
-                            if (regs[rs1] == regs[rs2]) {
-                                pc = target + 2;
-                                return true;
-                            }
-                            break;
-                        case 0b001: // BNE
-                            if (regs[rs1] != regs[rs2]) {
-                                pc = target + 2;
-                                return true;
-                            }
-                            break;
-                        case 0b010: // BZ (branch if register rs1 equals 0)
-                            if (regs[rs1] == 0) {
-                                pc = target;
-                                return true;
-                            }
-                            break;
-                        case 0b011: // BNZ (branch if register rs1 is nonzero)
-                            if (regs[rs1] != 0) {
-                                pc = target;
-                                return true;
-                            }
-                            break;
-                        case 0b100: // BLT (branch if less than, signed)
-                            if ((int16_t)regs[rs1] < (int16_t)regs[rs2]) {
-                                pc = target + 2;
-                                return true;
-                            }
-                            break;
-                        case 0b101: // BGE (branch if greater than or equal, signed)
-                            if ((int16_t)regs[rs1] >= (int16_t)regs[rs2]) {
-                                pc = target + 2;
-                                return true;
-                            }
-                            break;
-                        case 0b110: // BLTU (branch if less than, unsigned)
-                            if (regs[rs1] < regs[rs2]) {
-                                pc = target + 2;
-                                return true;
-                            }
-                            break;
-                        case 0b111: // BGEU (branch if greater than or equal, unsigned)
-                            if (regs[rs1] >= regs[rs2]) {
-                                pc = target + 2;
-                                return true;
-                            }
-                            break;
-                        default:
-                            cout << "Unimplemented B-type instruction at PC = 0x" << hex << pc << endl;
-                            break;
-                    }
-                    break;
-                }
-                case 0x3: { // S-type (store) instructions.
-                    int8_t offset = (inst >> 12) & 0xF;
-                    uint8_t rs1 = (inst >> 6) & 0x7;   // Base register for store.
-                    uint8_t rs2 = (inst >> 9) & 0x7;   // Register holding value to store.
-                    uint8_t funct3 = (inst >> 3) & 0x7;
-                    uint16_t addr = regs[rs1] + offset;
-                    if (funct3 == 0b000)
-                        writeByte(addr, regs[rs2] & 0xFF);
-                    else if (funct3 == 0b001)
-                        writeWord(addr, regs[rs2]);
-                    break;
-                }
-                case 0x4: { // L-type (load) instructions.
-                    int8_t offset = (inst >> 12) & 0xF;
-                    uint8_t rs2 = (inst >> 9) & 0x7;   // Base register.
-                    uint8_t rd = (inst >> 6) & 0x7;      // Destination register.
-                    uint8_t funct3 = (inst >> 3) & 0x7;
-                    uint16_t addr = regs[rs2] + offset;
-                    if (funct3 == 0b000)
-                        regs[rd] = static_cast<int8_t>(readByte(addr));
-                    else if (funct3 == 0b001)
-                        regs[rd] = readWord(addr);
-                    else if (funct3 == 0b100)
-                        regs[rd] = readByte(addr);
-                    break;
-                }
-                case 0x5: { // J-type (jump) instructions.
-                    uint8_t f = (inst >> 15) & 0x1;  // Flag to differentiate jump types.
-                    uint8_t imm6 = (inst >> 9) & 0x3F;
-                    uint8_t rd = (inst >> 6) & 0x7;
-                    uint8_t imm3 = (inst >> 3) & 0x7;
-                    // Combine immediate fields into 9-bit immediate.
-                    int16_t rawImm = imm3 | (imm6 << 3);
-                    // Sign-extend the immediate.
-                    if (rawImm & (1 << 8))
-                        rawImm |= 0xFE00;
-                    uint16_t target = pc + (rawImm * 2);
-                    if (f == 0b0) {
-                        pc = target;
-                        pcUpdated = true;
-                    }
-                    else if (f == 0b1) {
-                        regs[rd] = pc + 2;  // Save return address in register.
-                        pc = target;
-                        pcUpdated = true;
-                    }
-                    break;
-                }
-                case 0x6: { // U-type (lui/auipc) instructions.
-                    uint8_t f         = (inst >> 15) & 0x1;
-                    uint8_t imm_upper = (inst >> 9)  & 0x3F;
-                    uint8_t rd        = (inst >> 6)  & 0x7;
-                    uint8_t imm_lower = (inst >> 3)  & 0x7;
-                    uint16_t imm_val  = (imm_upper << 3) | imm_lower;
-                    if (f == 0) {
-                        // LUI: Load upper immediate (shift left by 7 bits).
-                        regs[rd] = imm_val << 7;
-                    } else {
-                        // AUIPC: Add upper immediate to PC.
-                        regs[rd] = pc + (imm_val << 7);
-                    }
-                    break;
-                }
-                case 0x7: { // SYS-type instructions.
-                    uint16_t service = (inst >> 6) & 0x3FF;
-                    uint8_t funct3 = (inst >> 3) & 0x7;
-                    if (funct3 == 0b000) {
-                        if (service == 1) {
-                            // ecall service 1: Print integer (assumes a0 is at index 6).
-                            cout << "Print integer: " << dec << static_cast<int16_t>(regs[6]) << endl;
-                        } else if (service == 3) {
-                            // ecall service 3: Terminate simulation.
-                            cout << "ecall 3" << endl;
-                            cout << "ecall terminate simulation" << endl;
-                            return false;
-                        } else if (service == 5) {
-                            // ecall service 5: Print null-terminated string.
-                            // Assumes address of string in register a0.
-                            uint16_t addr = regs[6];
-                            string output;
-                            while (true) {
-                                char c = static_cast<char>(readByte(addr));
-                                if (c == '\0') break;
-                                output.push_back(c);
-                                addr++;
-                            }
-                            cout << "Print string: " << output << endl;
-                        } else {
-                            cout << "ecall " << service << endl;
-                        }
-                    } else {
-                        cout << "Unknown SYS-type instruction" << endl;
-                    }
-                    break;
-                }
-                default:
-                    cout << "Unknown instruction opcode 0x" << hex << static_cast<int>(opcode)
-                         << " at PC = 0x" << pc << endl;
-                    break;
+    // A co-simulated run is not traced: the .dis file gets its report instead.
+    if (!cosimMode.empty())
+        traceOption = "none";
+
+    if (!batchPath.empty()) {
+        try {
+            Z16BatchOptions options;
+            options.engine = engine;
+            options.jitThreshold = jitThreshold;
+            options.budget = budget;
+            options.jobs = jobs;
+            options.misaligned = misaligned;
+            vector<string> files = Z16Batch::collectInputs(batchPath);
+            ofstream results(resultsFilename);
+            if (!results) {
+                cerr << "Error opening results file: " << resultsFilename << endl;
+                return EXIT_FAILURE;
             }
+            Z16Batch batch(options);
+            Z16BatchSummary summary = batch.run(files, results);
+            cout << "Ran " << summary.programs << " programs in " << summary.seconds << " s: "
+                 << summary.finished << " finished, " << summary.stopped << " stopped, "
+                 << summary.failed << " failed" << endl;
+            cout << "Results written to " << resultsFilename << endl;
+        } catch (const exception &ex) {
+            cerr << ex.what() << endl;
+            return EXIT_FAILURE;
         }
-        // If the instruction did not change the PC explicitly, increment by 2 (instruction size).
-        if (!pcUpdated)
-            pc += 2;
-        // Terminate simulation if PC is beyond program size.
-        if (pc >= programSize)
-            return false;
-        return true;
-    }
-
-    // ---------------------------------------------------
-    // Print final register state to standard output.
-    // ---------------------------------------------------
-    // (This function is used in non-redirected mode.)
-    void printFinalState() {
-        cout << "\nFinal register state:" << endl;
-        for (size_t i = 0; i < regs.size(); i++) {
-            cout << regNames[i] << " = " << "0x" << setw(4) << setfill('0') << hex << regs[i] << endl;
-        }
+        return EXIT_SUCCESS;
     }
 
-    // ------------------------------------------------------------------------
-    // Linear Disassembly: Walk through memory and output disassembly.
-    // Writes output to the provided output stream.
-    // ------------------------------------------------------------------------
-    void runFullDisassembly(ostream &out) {
-        uint16_t addr = 0;
-        while (addr < programSize) {
-            // --- Step 1: Detect an ASCII string ---
-            const int MIN_STR_LEN = 4;      // Minimum length for string detection.
-            const int MAX_PROBE = 256;        // Limit to avoid scanning too far.
-            int probe = addr;
-            string candidate;
-            bool nullFound = false;
-            while (probe < programSize && (probe - addr) < MAX_PROBE) {
-                uint8_t b = readByte(probe);
-                if (b == 0) {  // Null terminator found.
-                    nullFound = true;
-                    break;
-                }
-                // Only allow printable characters and whitespace.
-                if (!isprint(b) && !isspace(b))
-                    break;
-                candidate.push_back(static_cast<char>(b));
-                probe++;
-            }
-            if (nullFound && candidate.length() >= MIN_STR_LEN) {
-                out << "0x" << setw(4) << setfill('0') << hex << addr
-                    << ": .asciiz \"" << candidate << "\"" << endl;
-                // Skip over the entire string and the null terminator.
-                addr = probe + 1;
-                continue;
-            }
-
-            // --- Step 2: Group contiguous zero words ---
-            if (addr + 1 < programSize) {
-                uint16_t word = readWord(addr);
-                if (word == 0) {
-                    int zeroCount = 0;
-                    uint16_t startAddr = addr;
-                    while (addr + 1 < programSize && readWord(addr) == 0) {
-                        zeroCount++;
-                        addr += 2;
-                    }
-                    const int THRESHOLD = 4; // If 4 or more consecutive zero words, group them.
-                    if (zeroCount >= THRESHOLD) {
-                        out << "0x" << setw(4) << setfill('0') << hex << startAddr
-                            << ": .space " << (zeroCount * 2) << " bytes" << endl;
-                        continue;
-                    } else {
-                        // For small gaps, output each zero word individually.
-                        for (int i = 0; i < zeroCount; i++) {
-                            out << "0x" << setw(4) << setfill('0') << hex << (startAddr + i * 2)
-                                << ": .word 0x0000" << endl;
-                        }
-                        continue;
-                    }
-                }
+    // One program over many inputs on the lock-step engine (Z16Harts.h).
+    if (!hartsInputs.empty()) {
+        try {
+            vector<string> files = Z16Batch::collectInputs(hartsInputs);
+            ofstream results(resultsFilename);
+            if (!results) {
+                cerr << "Error opening results file: " << resultsFilename << endl;
+                return EXIT_FAILURE;
             }
-
-            // --- Step 3: Attempt to disassemble an instruction ---
-            if (addr + 1 < programSize) {
-                uint16_t word = readWord(addr);
-                string instStr = disassemble(addr, word);
-                // If disassembly returns "Unknown", assume it's data.
-                if (instStr.find("Unknown") != string::npos) {
-                    out << "0x" << setw(4) << setfill('0') << hex << addr
-                        << ": .word 0x" << setw(4) << word << endl;
-                    addr += 2;
-                    continue;
-                } else {
-                    out << "0x" << setw(4) << setfill('0') << hex << addr << ": "
-                        << setw(4) << word << "  " << instStr << endl;
-                    addr += 2;
-                    continue;
-                }
-            }
-
-            // --- Step 4: Handle any leftover single byte ---
-            uint8_t b = readByte(addr);
-            out << "0x" << setw(4) << setfill('0') << hex << addr
-                << ": .byte 0x" << setw(2) << (int)b << endl;
-            addr++;
+            auto harts = make_unique<Z16HartsBatch<>>(machineFilename, hartsAddress, budget);
+            Z16BatchSummary summary = harts->run(files, results);
+            cout << "Ran " << machineFilename << " on " << summary.programs << " inputs in " << summary.seconds
+                 << " s: " << summary.finished << " finished, " << summary.stopped << " stopped, "
+                 << summary.failed << " failed" << endl;
+            cout << "Results written to " << resultsFilename << endl;
+        } catch (const exception &ex) {
+            cerr << ex.what() << endl;
+            return EXIT_FAILURE;
         }
+        return EXIT_SUCCESS;
     }
-};
-
-//
-// ---------------------
-// Main Entry Point
-// ---------------------
-//
-int main(int argc, char **argv) {
-    // Check for correct command-line usage.
-    if (argc != 2) {
-        cerr << "Usage: rvsim <machine_code_file_name>" << endl;
-        return EXIT_FAILURE;
-    }
-
-    // Retrieve the machine code file name from command-line argument.
-    string machineFilename = argv[1];
 
     try {
         Z16Simulator sim;
-
-        // Load the binary machine code into memory.
+        sim.misaligned = misaligned;
+
+        // Memory-mapped devices (Z16Devices.h).
+        Z16Bus bus;
+        for (const string &spec : deviceSpecs) {
+            if (!mapDevice(spec, bus, *sim.console, &cin)) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+        }
+        // Device state is outside the (pc, registers, memory) state the
+        // livelock detector compares: a loop polling the timer is not stuck.
+        if (!bus.empty())
+            budget.detectLivelock = false;
+
+        // Load the program (a raw binary or a segmented image, Z16Loader.h)
+        // into memory, or resume from a snapshot (written by --save-snapshot).
+        bool resumed = false;
+        uint16_t entry = 0;
         {
             ifstream fin(machineFilename, ios::binary);
             if (!fin)
                 throw runtime_error("Error opening binary file: " + machineFilename);
-            fin.read(reinterpret_cast<char*>(sim.memory.data()), MEM_SIZE);
-            sim.programSize = fin.gcount();
-            cout << "Loaded " << sim.programSize << " bytes into memory from " << machineFilename << endl;
+            if (Z16Snapshot::isSnapshot(fin)) {
+                sim.restore(Z16Snapshot::load(fin));
+                resumed = true;
+                cout << "Restored snapshot from " << machineFilename << " (program size " << sim.programSize
+                     << " bytes, PC = 0x" << hex << sim.pc << dec << ")" << endl;
+                sim.predecodeImage();
+            } else {
+                fin.close();
+                Z16Image image(machineFilename);
+                image.load(sim);
+                entry = image.entry;
+                if (image.segmented)
+                    cout << "Loaded " << image.segments.size() << " segments (program size " << sim.programSize
+                         << " bytes, entry 0x" << hex << entry << dec << ") into memory from " << machineFilename << endl;
+                else
+                    cout << "Loaded " << sim.programSize << " bytes into memory from " << machineFilename << endl;
+            }
         }
 
         // Build output file name by appending ".dis" to the input file name.
@@ -781,26 +446,248 @@ int main(int argc, char **argv) {
             return EXIT_FAILURE;
         }
 
-        // Write full disassembly to the output file.
-        out << "Full disassembly of binary:\n";
-        sim.runFullDisassembly(out);
+        // Write full disassembly to the output file: a linear sweep, or the
+        // labelled control-flow listing (Z16Cfg.h).
+        if (disasmMode == "cfg") {
+            out << "Control-flow disassembly of binary:\n";
+            string listing;
+            Z16Cfg(sim.memory.data(), sim.programSize, entry).write(listing, jobs);
+            out << listing << hex << setfill('0');
+        } else {
+            out << "Full disassembly of binary:\n";
+            sim.runFullDisassembly(out);
+        }
+
+        // Reset PC and registers for simulation execution: the program starts
+        // at its entry point (a snapshot resumes with its own state).
+        if (!resumed) {
+            sim.pc = entry;
+            sim.regs.fill(0);
+            sim.regs[2] = MEM_SIZE - 2;
+        }
+
+        // Stop conditions (Z16Stops.h): breakpoints live in the decode cache,
+        // watchpoints are a plug-in of the predecoded interpreter.
+        Z16Watchpoints watchpoints;
+        for (const string &spec : breakSpecs) {
+            uint16_t addr;
+            Z16Condition condition;
+            if (!parseStopPoint(spec, addr, nullptr, condition)) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+            sim.setBreakpoint(addr, std::move(condition));
+        }
+        for (const string &spec : watchSpecs) {
+            uint16_t addr;
+            uint32_t length;
+            Z16Condition condition;
+            if (!parseStopPoint(spec, addr, &length, condition)) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+            watchpoints.add(addr, length, std::move(condition));
+        }
 
-        // Reset PC and registers for simulation execution.
-        sim.pc = 0;
-        sim.regs.fill(0);
-        sim.regs[2] = MEM_SIZE - 2;
+        // Write execution simulation trace. With --trace=none the engines run
+        // their untraced instantiation (and --engine=jit can use the native tier).
+        TraceMode traceMode = traceOption == "none"    ? TraceMode::None
+                            : traceOption == "sampled" ? TraceMode::Sampled
+                                                       : TraceMode::Full;
+        bool binaryTrace = traceMode != TraceMode::None && traceFormat == "binary";
+        string traceFilename = machineFilename + ".z16t";
+        if (binaryTrace)
+            out << "\nExecution simulation trace: binary, written to " << traceFilename << "\n";
+        else if (traceMode == TraceMode::Sampled)
+            out << "\nExecution simulation trace (every " << dec << traceInterval << " instructions):\n";
+        else if (traceMode == TraceMode::Full)
+            out << "\nExecution simulation trace:\n";
+        // Optional observers of the run: profiler, timing model and caches.
+        unique_ptr<Z16Profiler> profiler;
+        if (!profileFilename.empty())
+            profiler = make_unique<Z16Profiler>();
+        unique_ptr<Z16Pipeline> pipeline;
+        if (timing)
+            pipeline = make_unique<Z16Pipeline>(pipelineConfig);
+        unique_ptr<Z16Cache> instructionCache, dataCache;
+        if (icache)
+            instructionCache = make_unique<Z16Cache>(icacheConfig);
+        if (dcache)
+            dataCache = make_unique<Z16Cache>(dcacheConfig);
+        Z16Plugins plugins;
+        plugins.profiler = profiler.get();
+        plugins.pipeline = pipeline.get();
+        plugins.icache = instructionCache.get();
+        plugins.dcache = dataCache.get();
+        plugins.bus = &bus;
+        plugins.watch = &watchpoints;
+        bool diverged = false;
+        unique_ptr<Z16TimeTravel> recorder;
+        if (record)
+            recorder = make_unique<Z16TimeTravel>(sim, recordInterval);
+        {
+            // Binary records go to their own file; z16trace turns them back into text.
+            ofstream traceFile;
+            unique_ptr<Z16BinaryTraceWriter> binary;
+            if (binaryTrace) {
+                traceFile.open(traceFilename, ios::binary);
+                if (!traceFile)
+                    throw runtime_error("Error opening trace file: " + traceFilename);
+                binary = make_unique<Z16BinaryTraceWriter>(traceFile, sim.regs.data(), sim.memory.data());
+            }
+            Z16TraceWriter trace(out, traceMode, traceInterval);
+            trace.attachBinary(binary.get());
+            Z16Watchdog watchdog(budget);
+            bool traced = trace.enabled();
+            if (!gdbPath.empty()) {
+#if Z16_GDB_AVAILABLE
+                Z16GdbServer server(sim, engine, jitThreshold);
+                if (gdbOut >= 0) {
+                    server.serve(STDIN_FILENO, gdbOut);
+                } else {
+                    cout << "Waiting for a debugger on " << gdbPath << endl;
+                    server.serveSocket(gdbPath);
+                }
+#endif
+            } else if (!cosimMode.empty()) {
+                // 'sim' runs the reference interpreter, the engine a copy of it (Z16CoSim.h).
+                Z16CoSimOptions options;
+                options.engine = engine;
+                options.jitThreshold = jitThreshold;
+                options.everyInstruction = cosimMode == "instruction";
+                options.budget = budget;
+                Z16CoSimResult result = Z16CoSim(sim, options).run();
+                if (result.diverged) {
+                    out << "\n" << result.report;
+                    cerr << result.report;
+                    diverged = true;
+                } else {
+                    if (result.stop != StopReason::None)
+                        trace.stopped(result.stop, sim.pc);
+                    out << "\nCo-simulation: the reference interpreter and the " << engine << " engine agree over "
+                        << dec << result.instructions << " instructions (" << result.comparisons << " comparisons)\n";
+                    cout << "Co-simulation: no divergence in " << result.instructions << " instructions" << endl;
+                }
+            } else if (recorder) {
+                // Recording runs on the predecoded interpreter, without observers (checked above).
+                traced ? recorder->run<true>(trace, watchdog) : recorder->run<false>(trace, watchdog);
+            } else if (plugins.present()) {
+                // The profiler, timing model, caches, devices and watchpoints are plug-ins of the
+                // predecoded interpreter; the usage check rejects them with another engine.
+                if (profiler)
+                    profiler->start(sim.pc);
+                traced ? sim.runExecution<true>(trace, watchdog, plugins) : sim.runExecution<false>(trace, watchdog, plugins);
+            } else if (engine == "threaded") {
+                traced ? runThreaded<true>(sim, trace, watchdog) : runThreaded<false>(sim, trace, watchdog);
+            } else if (engine == "block" || engine == "jit") {
+                // The native tier only runs untraced blocks; while tracing,
+                // --engine=jit executes like --engine=block.
+                Z16BlockEngine blocks(sim);
+                if (engine == "jit")
+                    blocks.jitThreshold = jitThreshold;
+                traced ? blocks.run<true>(trace, watchdog) : blocks.run<false>(trace, watchdog);
+            } else {
+                traced ? sim.runExecution<true>(trace, watchdog) : sim.runExecution<false>(trace, watchdog);
+            }
+            bus.flush();
+        }
 
-        // Write execution simulation trace.
-        out << "\nExecution simulation trace:\n";
-        sim.runExecution(out);
+        // A breakpoint or watchpoint whose condition held stopped the run; a
+        // trap the guest did not handle ended it (Z16Trap.h).
+        bool stopped = sim.trap.cause == Z16TrapCause::Breakpoint || sim.trap.cause == Z16TrapCause::Watchpoint;
+        if (stopped) {
+            ostringstream where;
+            where << hex << setfill('0') << "Stopped at " << (sim.trap.cause == Z16TrapCause::Breakpoint ? "breakpoint" : "watchpoint")
+                  << ": PC = 0x" << setw(4) << sim.trap.pc;
+            string condition;
+            if (sim.trap.cause == Z16TrapCause::Breakpoint) {
+                auto b = sim.findBreakpoint(sim.trap.pc);
+                if (b != sim.breakpoints.end())
+                    condition = b->condition.text();
+            } else {
+                where << " wrote 0x" << setw(4) << sim.trap.addr;
+                condition = watchpoints.ranges()[watchpoints.hitRange].condition.text();
+            }
+            if (!condition.empty())
+                where << " (" << condition << ")";
+            out << "\n" << where.str() << "\n";
+            cout << where.str() << endl;
+        } else if (sim.trap) {
+            bool illegal = sim.trap.cause == Z16TrapCause::IllegalInstruction;
+            out << "\n" << trapMessage(sim.trap.cause) << " at PC = 0x" << setw(4) << sim.trap.pc
+                << (illegal ? " (instruction 0x" : " (address 0x") << setw(4) << sim.trap.addr << ")\n";
+            cerr << trapMessage(sim.trap.cause) << " at PC = 0x" << hex << setfill('0') << setw(4) << sim.trap.pc
+                 << dec << setfill(' ') << endl;
+        }
 
         // Write final register state.
         sim.printFinalState(out);
         sim.showmem(out);
 
+        if (pipeline) {
+            string report;
+            pipeline->write(report);
+            out << "\n" << report;
+            cout << "Timing model: " << pipeline->cycles() << " cycles, CPI " << fixed << setprecision(3)
+                 << pipeline->cpi() << defaultfloat << endl;
+        }
+        if (instructionCache || dataCache) {
+            string report;
+            if (instructionCache)
+                instructionCache->writeReport("I-cache", report);
+            if (dataCache)
+                dataCache->writeReport("D-cache", report);
+            out << "\nCache simulation:\n" << report;
+            cout << "Cache hit rates:" << fixed << setprecision(2);
+            if (instructionCache)
+                cout << " I-cache " << instructionCache->hitRate() << "%";
+            if (dataCache)
+                cout << " D-cache " << dataCache->hitRate() << "%";
+            cout << defaultfloat << endl;
+        }
+
         out.close();
         cout << "Disassembly and simulation trace written to " << outputFilename << endl;
 
+        if (profiler) {
+            // Report: summary and annotated listing; call stacks for flame graphs.
+            string report, stacks;
+            profiler->finish(sim.memory.data());
+            profiler->writeSummary(sim.memory.data(), report);
+            report += "\nAnnotated disassembly (executions, share of total):\n";
+            profiler->writeListing(sim.memory.data(), sim.programSize, report);
+            profiler->writeFoldedStacks(stacks);
+            ofstream profileFile(profileFilename), stackFile(profileFilename + ".folded");
+            if (!profileFile || !stackFile)
+                throw runtime_error("Error opening profile file: " + profileFilename);
+            profileFile << report;
+            stackFile << stacks;
+            cout << "Profile written to " << profileFilename << " (call stacks in " << profileFilename << ".folded)" << endl;
+        }
+
+        if (!snapshotFilename.empty()) {
+            ofstream snapshotFile(snapshotFilename, ios::binary);
+            if (!snapshotFile)
+                throw runtime_error("Error opening snapshot file: " + snapshotFilename);
+            sim.snapshot().save(snapshotFile);
+            cout << "Final machine state written to " << snapshotFilename << endl;
+        }
+        bool trapped = sim.trap && !stopped;
+        if (recorder) {
+            cout << "Recorded " << recorder->end() << " steps (" << recorder->checkpointCount() << " checkpoints, every "
+                 << recorder->checkpointInterval() << " steps)" << endl;
+            if (timeTravelFilename == "-") {
+                runTimeTravelCommands(*recorder, sim, cin, cout);
+            } else if (!timeTravelFilename.empty()) {
+                ifstream commands(timeTravelFilename);
+                if (!commands)
+                    throw runtime_error("Error opening time-travel command file: " + timeTravelFilename);
+                runTimeTravelCommands(*recorder, sim, commands, cout);
+            }
+        }
+        if (trapped || diverged)
+            return EXIT_FAILURE;
+
     } catch (const exception &ex) {
         cerr << ex.what() << endl;
         return EXIT_FAILURE;
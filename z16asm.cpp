@@ -0,0 +1,170 @@
+#include "Z16Simulator.h"
+#include "Z16Assembler.h"
+#include "Z16Loader.h"
+#include "Z16Cfg.h"
+
+// ---------------------------------------------------------------------------
+// z16asm: assembles a Z16 source file (or a .dis listing written by rvsim)
+// into a binary that rvsim can load: a raw image loaded at address 0, or
+// with --segmented a segmented image (Z16Loader.h) holding one segment per
+// contiguous run of code/data and entered at the label _start if defined.
+// ---------------------------------------------------------------------------
+
+static void printUsage() {
+    cerr << "Usage: z16asm [--segmented] <source_file> [-o <binary_file>]\n"
+            "       z16asm --check" << endl;
+}
+
+// ---------------------------------------------------------------------------
+// --check (run by ctest): disassemble -> assemble round trips. Every defined
+// instruction word, listed at the start, middle and end of memory, must
+// assemble back to a word that lists the same way (bits the text does not
+// show may differ), and the linear and control-flow listings of generated
+// images must assemble back to the same bytes. sltui is left out of the
+// first part: its immediate is listed as a raw character, which only the
+// listing form (that also carries the word) can reproduce.
+// ---------------------------------------------------------------------------
+static bool roundTripCheck() {
+    Z16Assembler assembler;
+    vector<uint8_t> memory(Z16Assembler::MEM_SIZE);
+    size_t failures = 0, words = 0, listings = 0;
+    auto failed = [&](const string &what) {
+        if (failures++ < 10)
+            cerr << "round trip: " << what << endl;
+    };
+    auto hex4 = [](uint16_t v) {
+        char text[4];
+        return string(text, Z16Disasm::putHex4(text, v));
+    };
+    auto listed = [](uint16_t addr, uint16_t word) {
+        char text[64];
+        return string(text, Z16Disasm::formatInstruction(text, addr, word));
+    };
+
+    for (uint16_t addr : { 0x0000, 0x0100, 0xFFF0 }) {
+        for (uint32_t word = 0; word <= 0xFFFF; word++) {
+            if (!Z16Disasm::table[word].valid() || Z16Disasm::table[word].layout == LAYOUT_IMM_CHAR)
+                continue;
+            string text = listed(addr, static_cast<uint16_t>(word));
+            stringstream source;
+            source << ".org 0x" << hex << addr << "\n" << text << "\n";
+            words++;
+            try {
+                assembler.assemble(source.str(), memory.data());
+                uint16_t back = static_cast<uint16_t>(memory[addr] | memory[addr + 1] << 8);
+                if (listed(addr, back) != text)
+                    failed(text + " at 0x" + hex4(addr) + " assembled to " + listed(addr, back));
+            } catch (const exception &ex) {
+                failed(text + " at 0x" + hex4(addr) + ": " + ex.what());
+            }
+        }
+    }
+
+    // Images mixing random words, zero runs and text, in 64-byte stretches.
+    uint64_t seed = 1;
+    for (size_t i = 0; i < 64; i++) {
+        size_t size = 1 + i * 997 % 4000;
+        vector<uint8_t> image(Z16Assembler::MEM_SIZE);
+        for (size_t k = 0; k < size; k++) {
+            seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+            uint8_t b = static_cast<uint8_t>(seed >> 56);
+            size_t kind = (k / 64 + i) % 3;
+            image[k] = kind == 0 ? b : kind == 1 ? 0 : static_cast<uint8_t>(" ~\"\\\r\nab"[b % 8]);
+        }
+        for (bool cfg : { false, true }) {
+            string listing;
+            if (cfg)
+                Z16Cfg(image.data(), size).write(listing);
+            else
+                Z16Disasm::sweep(image.data(), 0, size, listing);
+            listings++;
+            try {
+                fill(memory.begin(), memory.end(), 0);
+                size_t n = assembler.assemble(listing, memory.data());
+                if (n != size || memcmp(memory.data(), image.data(), size) != 0)
+                    failed(string(cfg ? "control-flow" : "linear") + " listing of image " + to_string(i) +
+                           " does not reassemble to the same bytes");
+            } catch (const exception &ex) {
+                failed(string(cfg ? "control-flow" : "linear") + " listing of image " + to_string(i) + ": " + ex.what());
+            }
+        }
+    }
+
+    cout << "check: " << words << " instruction words and " << listings << " listings, "
+         << failures << " round-trip failures" << endl;
+    return failures == 0;
+}
+
+int main(int argc, char **argv) {
+    string sourceFilename, binaryFilename;
+    bool segmented = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            binaryFilename = argv[++i];
+        } else if (arg == "--segmented") {
+            segmented = true;
+        } else if (arg == "--check" && argc == 2) {
+            return roundTripCheck() ? EXIT_SUCCESS : EXIT_FAILURE;
+        } else if (arg.rfind("-", 0) != 0 && sourceFilename.empty()) {
+            sourceFilename = arg;
+        } else {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (sourceFilename.empty()) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    // Default output: the source name with its extension replaced by ".bin".
+    if (binaryFilename.empty()) {
+        size_t dot = sourceFilename.find_last_of('.');
+        size_t slash = sourceFilename.find_last_of('/');
+        if (dot != string::npos && (slash == string::npos || dot > slash))
+            binaryFilename = sourceFilename.substr(0, dot);
+        else
+            binaryFilename = sourceFilename;
+        binaryFilename += ".bin";
+    }
+
+    ifstream in(sourceFilename);
+    if (!in) {
+        cerr << "Error opening source file: " << sourceFilename << endl;
+        return EXIT_FAILURE;
+    }
+    stringstream source;
+    source << in.rdbuf();
+
+    try {
+        string text = source.str();
+        Z16Assembler assembler;
+        vector<uint8_t> image = assembler.assemble(text);
+        ofstream out(binaryFilename, ios::binary);
+        if (!out)
+            throw runtime_error("Error opening output file: " + binaryFilename);
+        if (segmented) {
+            vector<Z16Segment> segments;
+            for (const Z16Assembler::Extent &e : assembler.extents()) {
+                Z16Segment s;
+                s.address = static_cast<uint16_t>(e.begin);
+                s.fileSize = s.memSize = static_cast<uint32_t>(e.end - e.begin);
+                s.flags = (e.code ? Z16Segment::CODE : 0) | (e.data ? Z16Segment::DATA : 0);
+                s.bytes = image.data() + e.begin;
+                segments.push_back(s);
+            }
+            uint16_t entry = 0;
+            assembler.address("_start", entry);
+            Z16Image::write(out, segments, entry);
+            cout << "Assembled " << segments.size() << " segments (entry 0x" << hex << entry << dec << ") into "
+                 << binaryFilename << endl;
+        } else {
+            out.write(reinterpret_cast<const char*>(image.data()), image.size());
+            cout << "Assembled " << image.size() << " bytes into " << binaryFilename << endl;
+        }
+    } catch (const exception &ex) {
+        cerr << sourceFilename << ": " << ex.what() << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
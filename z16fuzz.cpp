@@ -0,0 +1,257 @@
+#include <filesystem>
+#include "Z16Fuzz.h"
+
+// ---------------------------------------------------------------------------
+// z16fuzz: coverage-guided fuzzing of Z16 programs (Z16Fuzz.h). Seeds are
+// program binaries, given as files or directories; new-coverage inputs are
+// written to the corpus directory, crashing and diverging ones (with the
+// co-simulation report) to the crashes directory, each named by a hash of
+// its contents. Without --runs or --seconds it runs until interrupted.
+// With --check (run by ctest) it checks that differential mode finds a fault
+// planted in each engine.
+//
+// Built with -DZ16_LIBFUZZER (and -fsanitize=fuzzer), this file instead
+// provides the libFuzzer entry points, with the decode-table-aware mutator
+// as the custom mutator; a divergence, with Z16_FUZZ_DIFFERENTIAL set to an
+// engine name, aborts.
+// ---------------------------------------------------------------------------
+
+namespace fs = std::filesystem;
+
+static string hashName(const vector<uint8_t> &data) {
+    uint64_t h = 0xcbf29ce484222325ull;   // FNV-1a
+    for (uint8_t b : data)
+        h = (h ^ b) * 0x100000001b3ull;
+    stringstream ss;
+    ss << hex << setw(16) << setfill('0') << h;
+    return ss.str();
+}
+
+static bool readFile(const fs::path &path, vector<uint8_t> &data) {
+    ifstream in(path, ios::binary);
+    if (!in)
+        return false;
+    data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return true;
+}
+
+static void writeFile(const fs::path &path, const vector<uint8_t> &data) {
+    ofstream out(path, ios::binary);
+    out.write(reinterpret_cast<const char *>(data.data()), data.size());
+}
+
+#ifdef Z16_LIBFUZZER
+
+static Z16Fuzzer &fuzzer() {
+    static Z16Fuzzer instance([] {
+        Z16FuzzOptions options;
+        options.maxLength = Z16Simulator::MEM_SIZE;
+        if (const char *engine = getenv("Z16_FUZZ_DIFFERENTIAL"))
+            options.differential = engine;
+        return options;
+    }());
+    return instance;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    Z16FuzzResult result = fuzzer().execute(data, size);
+    if (result.diverged) {
+        cerr << result.report;
+        abort();
+    }
+    return 0;
+}
+
+extern "C" size_t LLVMFuzzerCustomMutator(uint8_t *data, size_t size, size_t maxSize, unsigned int seed) {
+    static uint64_t mixed = 0;
+    vector<uint8_t> input(data, data + size);
+    mixed = mixed * 6364136223846793005ull + seed;
+    size_t count = 1 + mixed % Z16Fuzzer::MAX_STACK;
+    for (size_t i = 0; i < count; i++)
+        fuzzer().mutate(input);
+    size = min(input.size(), maxSize);
+    memcpy(data, input.data(), size);
+    return size;
+}
+
+#else
+
+static void printUsage() {
+    cerr << "Usage: z16fuzz [--runs=N] [--seconds=S] [--max-len=BYTES] [--max-instructions=N] [--seed=N]\n"
+            "               [--misaligned=allow|split|trap] [--differential=switch|threaded|block|jit]\n"
+            "               [--max-corpus=N] [--corpus=DIR] [--crashes=DIR] [seed_file_or_dir]...\n"
+            "       z16fuzz --check" << endl;
+}
+
+static void printStatus(const Z16Fuzzer &fuzzer, double seconds) {
+    const Z16FuzzStats &stats = fuzzer.statistics();
+    cerr << "#" << stats.executions << "  " << static_cast<uint64_t>(stats.executions / max(seconds, 1e-9))
+         << " execs/s  corpus " << fuzzer.corpus().size() << "  edges " << stats.edges
+         << "  crashes " << stats.crashes;
+    if (!fuzzer.settings().differential.empty())
+        cerr << "  divergences " << stats.divergences;
+    cerr << endl;
+}
+
+// ---------------------------------------------------------------------------
+// --check: the engine under test gets a conditional breakpoint on every
+// address an input can occupy, so it stops, and the reference does not, at
+// the first instruction reached with a0 == CHECK_A0. Nothing tells the
+// fuzzer where; it must build a program that gets there (300 takes more
+// than one li) within CHECK_SEARCH executions, report it as a divergence,
+// and the input must diverge again when run alone. Beforehand, CHECK_CLEAN
+// executions without the fault must report none.
+// ---------------------------------------------------------------------------
+static const uint64_t CHECK_CLEAN = 20000;
+static const uint64_t CHECK_SEARCH = 200000;
+static const char *const CHECK_A0 = "a0 == 300";
+
+static bool differentialCheck() {
+    bool ok = true;
+    for (const char *engine : { "switch", "threaded", "block", "jit" }) {
+        Z16FuzzOptions options;
+        options.differential = engine;
+        Z16Fuzzer fuzzer(options);
+        while (fuzzer.statistics().executions < CHECK_CLEAN)
+            fuzzer.step();
+        uint64_t clean = fuzzer.statistics().divergences;
+
+        Z16Simulator &faulty = *fuzzer.engineUnderTest();
+        for (size_t addr = 0; addr < options.maxLength; addr += 2)
+            faulty.setBreakpoint(static_cast<uint16_t>(addr), Z16Condition(CHECK_A0));
+        uint64_t start = fuzzer.statistics().executions;
+        bool found = false;
+        while (!found && fuzzer.statistics().executions - start < CHECK_SEARCH)
+            found = fuzzer.step().divergence;
+        vector<uint8_t> input = fuzzer.lastInput();
+        bool again = found && fuzzer.execute(input.data(), input.size()).diverged;
+
+        cout << "check: " << engine << ": " << clean << " divergences in " << CHECK_CLEAN << " clean executions; ";
+        if (found)
+            cout << "fault found after " << fuzzer.statistics().executions - start << " executions"
+                 << (again ? "" : ", but its input does not diverge again") << endl;
+        else
+            cout << "fault not found in " << CHECK_SEARCH << " executions" << endl;
+        ok = ok && clean == 0 && found && again;
+    }
+    return ok;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2 && string(argv[1]) == "--check")
+        return differentialCheck() ? EXIT_SUCCESS : EXIT_FAILURE;
+    Z16FuzzOptions options;
+    uint64_t runs = 0;
+    double seconds = 0;
+    string corpusDir, crashesDir;
+    vector<string> seeds;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--runs=", 0) == 0) {
+            runs = strtoull(arg.c_str() + 7, nullptr, 0);
+        } else if (arg.rfind("--seconds=", 0) == 0) {
+            seconds = strtod(arg.c_str() + 10, nullptr);
+        } else if (arg.rfind("--max-len=", 0) == 0) {
+            options.maxLength = strtoull(arg.c_str() + 10, nullptr, 0);
+        } else if (arg.rfind("--max-instructions=", 0) == 0) {
+            options.maxInstructions = strtoull(arg.c_str() + 19, nullptr, 0);
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.seed = strtoull(arg.c_str() + 7, nullptr, 0);
+        } else if (arg.rfind("--misaligned=", 0) == 0) {
+            if (!parseMisaligned(arg.substr(13), options.misaligned)) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+        } else if (arg.rfind("--differential=", 0) == 0) {
+            options.differential = arg.substr(15);
+            if (options.differential != "switch" && options.differential != "threaded" &&
+                options.differential != "block" && options.differential != "jit") {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+        } else if (arg.rfind("--max-corpus=", 0) == 0) {
+            options.maxCorpus = strtoull(arg.c_str() + 13, nullptr, 0);
+        } else if (arg.rfind("--corpus=", 0) == 0) {
+            corpusDir = arg.substr(9);
+        } else if (arg.rfind("--crashes=", 0) == 0) {
+            crashesDir = arg.substr(10);
+        } else if (arg.rfind("--", 0) != 0) {
+            seeds.push_back(arg);
+        } else {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (options.maxInstructions == 0 || options.maxLength == 0 || options.maxCorpus == 0) {
+        cerr << "--max-instructions, --max-len and --max-corpus must be positive" << endl;
+        return EXIT_FAILURE;
+    }
+
+    error_code ec;
+    for (const string &dir : { corpusDir, crashesDir }) {
+        if (!dir.empty() && !fs::create_directories(dir, ec) && ec) {
+            cerr << "Cannot create directory " << dir << ": " << ec.message() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    Z16Fuzzer fuzzer(options);
+    // The corpus directory doubles as a seed directory, so a run resumes
+    // where the last one stopped.
+    if (!corpusDir.empty())
+        seeds.push_back(corpusDir);
+    vector<uint8_t> data;
+    for (const string &seed : seeds) {
+        vector<fs::path> files;
+        if (fs::is_directory(seed, ec)) {
+            for (const auto &entry : fs::directory_iterator(seed, ec))
+                if (entry.is_regular_file())
+                    files.push_back(entry.path());
+            sort(files.begin(), files.end());
+        } else {
+            files.push_back(seed);
+        }
+        for (const fs::path &file : files) {
+            if (!readFile(file, data)) {
+                cerr << "Cannot open seed " << file.string() << endl;
+                return EXIT_FAILURE;
+            }
+            fuzzer.addSeed(data, false);
+        }
+    }
+
+    auto startTime = chrono::steady_clock::now();
+    double lastStatus = 0, elapsed = 0;
+    while (!runs || fuzzer.statistics().executions < runs) {
+        Z16Fuzzer::Event event = fuzzer.step();
+        if (event.newCoverage && !corpusDir.empty())
+            writeFile(fs::path(corpusDir) / hashName(fuzzer.lastInput()), fuzzer.lastInput());
+        if ((event.crash || event.divergence) && !crashesDir.empty()) {
+            string name = hashName(fuzzer.lastInput());
+            if (event.divergence) {
+                writeFile(fs::path(crashesDir) / ("diverge-" + name), fuzzer.lastInput());
+                ofstream(fs::path(crashesDir) / ("diverge-" + name + ".txt")) << fuzzer.lastResult().report;
+            }
+            if (event.crash) {
+                const Z16Trap &trap = fuzzer.lastResult().trap;
+                writeFile(fs::path(crashesDir) / ("trap-" + name), fuzzer.lastInput());
+                ofstream(fs::path(crashesDir) / ("trap-" + name + ".txt"))
+                    << trapMessage(trap.cause) << " at PC = 0x" << hex << trap.pc << endl;
+            }
+        }
+        if ((fuzzer.statistics().executions & 0xFFF) == 0) {
+            elapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+            if (elapsed - lastStatus >= 1) {
+                printStatus(fuzzer, elapsed);
+                lastStatus = elapsed;
+            }
+            if (seconds > 0 && elapsed >= seconds)
+                break;
+        }
+    }
+    elapsed = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+    printStatus(fuzzer, elapsed);
+    return fuzzer.statistics().divergences ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#endif
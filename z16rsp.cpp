@@ -0,0 +1,293 @@
+#include <thread>
+#include "Z16Assembler.h"
+#include "Z16Gdb.h"
+
+// ---------------------------------------------------------------------------
+// z16rsp: a scripted GDB remote protocol client for the stub in Z16Gdb.h.
+// Each line of a script is a packet to send and, after a tab, the reply it
+// must get ("*" accepts any, a trailing "*" any ending). With --check (run
+// by ctest) it plays its built-in script against a Z16GdbServer in this
+// process, on every engine, over a socket pair, a pair of pipes and a Unix
+// socket; it also checks that the socket server will not replace a file
+// that is not a socket. Given a socket path and a script file, it plays
+// the script against "rvsim --gdb=SOCKET" instead.
+// ---------------------------------------------------------------------------
+
+#if Z16_GDB_AVAILABLE
+
+static void printUsage() {
+    cerr << "Usage: z16rsp <socket_path> <script_file>\n"
+            "       z16rsp --check" << endl;
+}
+
+// The debuggee of --check: a loop that stores and reloads its counter.
+static const char *const CHECK_PROGRAM =
+    "        li t0, 0\n"            // 0x00
+    "        li a0, 5\n"            // 0x02
+    "loop:   addi t0, 1\n"          // 0x04
+    "        lui s0, 2\n"           // 0x06  s0 = 0x100
+    "        sw t0, 0(s0)\n"        // 0x08
+    "        lw t1, 0(s0)\n"        // 0x0a
+    "        blt t0, a0, loop\n"    // 0x0c
+    "        ecall 3\n";            // 0x0e
+
+// Packet <tab> expected reply. Registers are t0 ra sp s0 s1 t1 a0 a1 pc.
+static const char *const CHECK_SCRIPT =
+    "qSupported:swbreak+\tPacketSize=*\n"
+    "?\tS05\n"
+    "Z0,c,2\tOK\n"
+    "c\tT05swbreak:;\n"
+    "p8\t0c00\n"
+    "p0\t0100\n"
+    "m100,2\t0100\n"
+    "QStartNoAckMode\tOK\n"
+    "M100,2:3412\tOK\n"
+    "m100,2\t3412\n"
+    "z0,c,2\tOK\n"
+    "s\tT05\n"
+    "p8\t0400\n"
+    "Z2,100,2\tOK\n"
+    "c\tT05watch:100;\n"
+    "p8\t0a00\n"
+    "z2,100,2\tOK\n"
+    "Z3,100,2\tOK\n"
+    "c\tT05rwatch:100;\n"
+    "p0\t0200\n"
+    "z3,100,2\tOK\n"
+    "P0=1000\tOK\n"
+    "g\t1000*\n"
+    "c\tW00\n";
+
+class RspClient {
+public:
+    RspClient(int in, int out) : in(in), out(out) {}
+
+    // Send 'packet' and return the reply, acknowledging it unless the
+    // session has switched acknowledgements off; "" if the connection closed.
+    string exchange(const string &packet) {
+        sendPacket(packet);
+        int c;
+        while ((c = getByte()) != '$')
+            if (c < 0)
+                return "";
+        string reply;
+        while ((c = getByte()) != '#')
+            if (c < 0)
+                return "";
+            else
+                reply += static_cast<char>(c);
+        getByte();
+        getByte();
+        if (ack)
+            send("+");
+        if (packet == "QStartNoAckMode" && reply == "OK")
+            ack = false;
+        return reply;
+    }
+
+    // Send 'packet', which gets no reply (k).
+    void sendPacket(const string &packet) {
+        uint8_t sum = 0;
+        for (char c : packet)
+            sum += static_cast<uint8_t>(c);
+        char tail[4];
+        snprintf(tail, sizeof tail, "#%02x", sum);
+        send("$" + packet + tail);
+    }
+
+private:
+    int in, out;
+    bool ack = true;
+
+    int getByte() {
+        uint8_t c;
+        return read(in, &c, 1) == 1 ? c : -1;
+    }
+
+    void send(const string &bytes) {
+        size_t done = 0;
+        while (done < bytes.size()) {
+            ssize_t n = write(out, bytes.data() + done, bytes.size() - done);
+            if (n <= 0)
+                return;
+            done += n;
+        }
+    }
+};
+
+static bool matches(const string &reply, const string &expected) {
+    if (!expected.empty() && expected.back() == '*')
+        return reply.compare(0, expected.size() - 1, expected, 0, expected.size() - 1) == 0;
+    return reply == expected;
+}
+
+// Play 'script' over 'client'; returns the number of replies that differ.
+static size_t play(RspClient &client, const string &script, const string &name) {
+    size_t failures = 0;
+    stringstream lines(script);
+    string line;
+    while (getline(lines, line)) {
+        size_t tab = line.find('\t');
+        if (line.empty() || tab == string::npos)
+            continue;
+        string packet = line.substr(0, tab), expected = line.substr(tab + 1);
+        string reply = client.exchange(packet);
+        if (!matches(reply, expected) && failures++ < 10)
+            cerr << name << ": " << packet << " -> " << reply << ", expected " << expected << endl;
+    }
+    client.sendPacket("k");
+    return failures;
+}
+
+// ---------------------------------------------------------------------------
+// --check.
+// ---------------------------------------------------------------------------
+static size_t checkSession(const string &engine, const string &transport) {
+    auto sim = make_unique<Z16Simulator>();
+    Z16Assembler().assemble(CHECK_PROGRAM, *sim);
+    Z16GdbServer server(*sim, engine);
+    string name = engine + " over " + transport;
+    int toServer[2], toClient[2];
+    if (transport == "socketpair") {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, toServer) < 0)
+            throw runtime_error("socketpair failed");
+        toClient[0] = toServer[0];
+        toClient[1] = toServer[0];
+        thread stub([&] { server.serve(toServer[1], toServer[1]); });
+        RspClient client(toClient[0], toClient[1]);
+        size_t failures = play(client, CHECK_SCRIPT, name);
+        stub.join();
+        close(toServer[0]);
+        close(toServer[1]);
+        return failures;
+    }
+    if (transport == "pipes") {
+        if (pipe(toServer) < 0 || pipe(toClient) < 0)
+            throw runtime_error("pipe failed");
+        thread stub([&] { server.serve(toServer[0], toClient[1]); });
+        RspClient client(toClient[0], toServer[1]);
+        size_t failures = play(client, CHECK_SCRIPT, name);
+        stub.join();
+        for (int fd : { toServer[0], toServer[1], toClient[0], toClient[1] })
+            close(fd);
+        return failures;
+    }
+    // Unix socket: a stale socket left at the path is replaced.
+    string path = "/tmp/z16rsp-" + to_string(getpid()) + ".sock";
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    int stale = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (stale < 0 || bind(stale, reinterpret_cast<sockaddr *>(&address), sizeof address) < 0)
+        throw runtime_error("Cannot create " + path);
+    close(stale);
+    string error;
+    thread stub([&] {
+        try {
+            server.serveSocket(path);
+        } catch (const exception &ex) {
+            error = ex.what();
+        }
+    });
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    for (int tries = 0; connect(connection, reinterpret_cast<sockaddr *>(&address), sizeof address) < 0; tries++) {
+        if (tries == 1000) {
+            cerr << name << ": cannot connect to " << path << endl;
+            close(connection);
+            return 1;
+        }
+        this_thread::sleep_for(chrono::milliseconds(5));
+    }
+    RspClient client(connection, connection);
+    size_t failures = play(client, CHECK_SCRIPT, name);
+    stub.join();
+    close(connection);
+    if (!error.empty()) {
+        cerr << name << ": " << error << endl;
+        failures++;
+    }
+    return failures;
+}
+
+// serveSocket must refuse a path that holds a regular file, and leave it.
+static size_t checkNotSocket() {
+    string path = "/tmp/z16rsp-" + to_string(getpid()) + ".file";
+    ofstream(path) << "keep\n";
+    auto sim = make_unique<Z16Simulator>();
+    Z16GdbServer server(*sim);
+    bool refused = false;
+    try {
+        server.serveSocket(path);
+    } catch (const exception &) {
+        refused = true;
+    }
+    string kept;
+    getline(ifstream(path), kept);
+    unlink(path.c_str());
+    if (refused && kept == "keep")
+        return 0;
+    cerr << "socket over a regular file: " << (refused ? "file changed" : "not refused") << endl;
+    return 1;
+}
+
+static bool protocolCheck() {
+    size_t sessions = 0, failures = 0;
+    for (const char *engine : { "switch", "threaded", "block", "jit" }) {
+        for (const char *transport : { "socketpair", "pipes", "socket" }) {
+            failures += checkSession(engine, transport);
+            sessions++;
+        }
+    }
+    failures += checkNotSocket();
+    cout << "check: " << sessions << " scripted sessions, " << failures << " failures" << endl;
+    return failures == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc == 2 && string(argv[1]) == "--check") {
+        try {
+            return protocolCheck() ? EXIT_SUCCESS : EXIT_FAILURE;
+        } catch (const exception &ex) {
+            cerr << ex.what() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc != 3) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+    string path = argv[1];
+    ifstream in(argv[2]);
+    if (!in) {
+        cerr << "Error opening script file: " << argv[2] << endl;
+        return EXIT_FAILURE;
+    }
+    stringstream script;
+    script << in.rdbuf();
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof address.sun_path) {
+        cerr << "Socket path too long: " << path << endl;
+        return EXIT_FAILURE;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0 || connect(connection, reinterpret_cast<sockaddr *>(&address), sizeof address) < 0) {
+        cerr << "Cannot connect to " << path << endl;
+        return EXIT_FAILURE;
+    }
+    RspClient client(connection, connection);
+    size_t failures = play(client, script.str(), path);
+    close(connection);
+    cout << failures << " unexpected replies" << endl;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else
+
+int main() {
+    cerr << "z16rsp needs Unix sockets" << endl;
+    return EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#include "Z16Simulator.h"
+#include "Z16BinaryTrace.h"
+
+// ---------------------------------------------------------------------------
+// z16trace: expands a binary execution trace (rvsim --trace-format=binary)
+// into the text lines of the execution simulation trace, optionally limited
+// to a PC range and to some instruction classes.
+// ---------------------------------------------------------------------------
+
+static void printUsage() {
+    cerr << "Usage: z16trace [--pc=LO-HI] [--class=r,i,b,s,l,j,u,sys] [--deltas] <trace_file>" << endl;
+}
+
+// Instruction class letters, indexed by the 3-bit opcode field.
+static const char *const classNames[8] = { "r", "i", "b", "s", "l", "j", "u", "sys" };
+
+// Parse a comma-separated class list into an opcode mask; 0 on an unknown name.
+static uint8_t parseClasses(const string &list) {
+    uint8_t mask = 0;
+    stringstream ss(list);
+    string name;
+    while (getline(ss, name, ',')) {
+        int i = 0;
+        while (i < 8 && name != classNames[i])
+            i++;
+        if (i == 8)
+            return 0;
+        mask |= 1 << i;
+    }
+    return mask;
+}
+
+int main(int argc, char **argv) {
+    string traceFilename;
+    uint16_t pcLow = 0, pcHigh = 0xFFFF;
+    uint8_t classMask = 0xFF;
+    bool deltas = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--pc=", 0) == 0) {
+            char *end;
+            pcLow = strtoul(arg.c_str() + 5, &end, 0);
+            if (*end != '-') {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+            pcHigh = strtoul(end + 1, nullptr, 0);
+        } else if (arg.rfind("--class=", 0) == 0) {
+            classMask = parseClasses(arg.substr(8));
+            if (!classMask) {
+                printUsage();
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--deltas") {
+            deltas = true;
+        } else if (arg.rfind("--", 0) != 0 && traceFilename.empty()) {
+            traceFilename = arg;
+        } else {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (traceFilename.empty()) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    ifstream in(traceFilename, ios::binary);
+    if (!in) {
+        cerr << "Error opening trace file: " << traceFilename << endl;
+        return EXIT_FAILURE;
+    }
+    Z16BinaryTraceReader reader(in);
+    if (!reader.open()) {
+        cerr << traceFilename << " is not a Z16 binary trace" << endl;
+        return EXIT_FAILURE;
+    }
+
+    // Only used for disassemble() and the register names.
+    Z16Simulator sim;
+    Z16TraceWriter text(cout);
+    Z16TraceRecord rec;
+    bool ended = false;
+    while (!ended && reader.next(rec)) {
+        switch (rec.kind) {
+            case Z16TraceRecord::INSTRUCTION:
+                if (rec.pc < pcLow || rec.pc > pcHigh || !(classMask & (1 << (rec.inst & 0x7))))
+                    break;
+                text.line(sim, rec.pc, rec.inst);
+                if (deltas && (rec.regMask || rec.memSize)) {
+                    ostream &os = text.message();
+                    os << "        ";
+                    for (int r = 0; r < 8; r++)
+                        if (rec.regMask & (1 << r))
+                            os << " " << sim.regNames[r] << "=0x" << setw(4) << setfill('0') << hex << rec.regs[r];
+                    if (rec.memSize)
+                        os << " [0x" << setw(4) << setfill('0') << hex << rec.memAddr << "]=0x"
+                           << setw(rec.memSize * 2) << rec.memValue;
+                    os << "\n";
+                }
+                break;
+            case Z16TraceRecord::END_STOPPED:
+                text.stopped(rec.reason, rec.pc);
+                ended = true;
+                break;
+            case Z16TraceRecord::END_NORMAL:
+                ended = true;
+                break;
+        }
+    }
+    text.flush();
+    if (!ended) {
+        cerr << traceFilename << ": trace is truncated" << endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}